@@ -0,0 +1,535 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ANIMATION_SSE 1
+#endif
+
+#include <glm/glm.hpp>
+
+#include "thread_pool.hpp"
+
+// Skeletal animation: a node hierarchy with bones, keyframed clips, and the
+// per-frame work of sampling clips into a local pose, cross-fading two poses
+// and turning the result into a palette of skinning matrices.
+//
+// Translations, rotations (x, y, z, w quaternions) and scales are all kept
+// as vec4, so every key and pose element is one 16-byte SIMD lane. Nothing
+// in here touches GL, so it all runs headless.
+
+// Compact skinned vertices store 8-bit bone IDs.
+const unsigned int MAX_SKELETON_BONES = 256;
+
+enum animation_math { ANIMATION_MATH_SCALAR, ANIMATION_MATH_SIMD };
+
+struct Skeleton_Node {
+  std::string name;
+  // Always lower than the node's own index; -1 for the root.
+  int parent = -1;
+  // Index into Skeleton::bone_nodes / bone_offsets, or -1.
+  int bone = -1;
+  // Rest pose, relative to the parent.
+  glm::mat4 local = glm::mat4(1.0f);
+};
+
+// One local pose: a translation, rotation and scale per skeleton node.
+struct Pose {
+  std::vector<glm::vec4> translations;
+  std::vector<glm::vec4> rotations;
+  std::vector<glm::vec4> scales;
+
+  void resize(std::size_t node_count) {
+    translations.resize(node_count);
+    rotations.resize(node_count);
+    scales.resize(node_count);
+  }
+};
+
+inline glm::vec4 quat_from_matrix(const glm::mat4& m) {
+  // r(row, column)
+  auto r = [&](int row, int column) { return m[column][row]; };
+  float trace = r(0, 0) + r(1, 1) + r(2, 2);
+
+  if (trace > 0.0f) {
+    float s = std::sqrt(trace + 1.0f) * 2.0f;
+    return glm::vec4((r(2, 1) - r(1, 2)) / s, (r(0, 2) - r(2, 0)) / s,
+                     (r(1, 0) - r(0, 1)) / s, 0.25f * s);
+  }
+
+  if (r(0, 0) > r(1, 1) && r(0, 0) > r(2, 2)) {
+    float s = std::sqrt(1.0f + r(0, 0) - r(1, 1) - r(2, 2)) * 2.0f;
+    return glm::vec4(0.25f * s, (r(0, 1) + r(1, 0)) / s,
+                     (r(0, 2) + r(2, 0)) / s, (r(2, 1) - r(1, 2)) / s);
+  }
+
+  if (r(1, 1) > r(2, 2)) {
+    float s = std::sqrt(1.0f + r(1, 1) - r(0, 0) - r(2, 2)) * 2.0f;
+    return glm::vec4((r(0, 1) + r(1, 0)) / s, 0.25f * s,
+                     (r(1, 2) + r(2, 1)) / s, (r(0, 2) - r(2, 0)) / s);
+  }
+
+  float s = std::sqrt(1.0f + r(2, 2) - r(0, 0) - r(1, 1)) * 2.0f;
+  return glm::vec4((r(0, 2) + r(2, 0)) / s, (r(1, 2) + r(2, 1)) / s,
+                   0.25f * s, (r(1, 0) - r(0, 1)) / s);
+}
+
+// Splits a transform without shear into translation, rotation and scale.
+inline void decompose_transform(const glm::mat4& m, glm::vec4& translation,
+                                glm::vec4& rotation, glm::vec4& scale) {
+  translation = glm::vec4(m[3][0], m[3][1], m[3][2], 0.0f);
+  scale = glm::vec4(glm::length(glm::vec3(m[0])), glm::length(glm::vec3(m[1])),
+                    glm::length(glm::vec3(m[2])), 0.0f);
+
+  glm::mat4 unscaled(1.0f);
+
+  for (int i = 0; i < 3; i++) {
+    unscaled[i] = scale[i] > 0.0f ? m[i] / scale[i] : glm::vec4(0.0f);
+  }
+
+  rotation = quat_from_matrix(unscaled);
+}
+
+inline glm::mat4 compose_transform(const glm::vec4& t, const glm::vec4& q,
+                                   const glm::vec4& s) {
+  float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+  float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+  float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+  glm::mat4 m;
+  m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz),
+                   2.0f * (xz - wy), 0.0f) * s.x;
+  m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz),
+                   2.0f * (yz + wx), 0.0f) * s.y;
+  m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx),
+                   1.0f - 2.0f * (xx + yy), 0.0f) * s.z;
+  m[3] = glm::vec4(t.x, t.y, t.z, 1.0f);
+
+  return m;
+}
+
+struct Skeleton {
+  // Parents before children.
+  std::vector<Skeleton_Node> nodes;
+  std::unordered_map<std::string, int> node_index;
+
+  // Per bone: the node it follows and its offset (inverse bind) matrix,
+  // which takes mesh space into the bone's space.
+  std::vector<int> bone_nodes;
+  std::vector<glm::mat4> bone_offsets;
+
+  // Inverse of the root's rest transform.
+  glm::mat4 global_inverse = glm::mat4(1.0f);
+
+  // The nodes' rest transforms, for nodes no clip channel animates.
+  Pose rest_pose;
+
+  std::size_t bone_count() const { return bone_offsets.size(); }
+
+  int add_node(const std::string& name, int parent, const glm::mat4& local) {
+    int index = static_cast<int>(nodes.size());
+    Skeleton_Node node;
+    node.name = name;
+    node.parent = parent;
+    node.local = local;
+    nodes.push_back(node);
+    node_index.emplace(name, index);
+
+    rest_pose.resize(nodes.size());
+    decompose_transform(local, rest_pose.translations[index],
+                        rest_pose.rotations[index], rest_pose.scales[index]);
+
+    return index;
+  }
+
+  int find_node(const std::string& name) const {
+    auto it = node_index.find(name);
+    return it == node_index.end() ? -1 : it->second;
+  }
+
+  // The bone following node `name`, added on first use. -1 if there is no
+  // such node or the skeleton is full.
+  int add_bone(const std::string& name, const glm::mat4& offset) {
+    int node = find_node(name);
+
+    if (node < 0) {
+      return -1;
+    }
+
+    if (nodes[node].bone >= 0) {
+      return nodes[node].bone;
+    }
+
+    if (bone_offsets.size() >= MAX_SKELETON_BONES) {
+      return -1;
+    }
+
+    nodes[node].bone = static_cast<int>(bone_offsets.size());
+    bone_nodes.push_back(node);
+    bone_offsets.push_back(offset);
+
+    return nodes[node].bone;
+  }
+
+  int find_bone(const std::string& name) const {
+    int node = find_node(name);
+    return node < 0 ? -1 : nodes[node].bone;
+  }
+};
+
+// Keys of one node, in seconds and ascending. A track with a single key
+// holds that value; an empty track leaves the rest pose in place.
+struct Animation_Channel {
+  int node = -1;
+  std::vector<float> translation_times;
+  std::vector<glm::vec4> translations;
+  std::vector<float> rotation_times;
+  std::vector<glm::vec4> rotations;
+  std::vector<float> scale_times;
+  std::vector<glm::vec4> scales;
+};
+
+struct Animation_Clip {
+  std::string name;
+  float duration = 0.0f;
+  std::vector<Animation_Channel> channels;
+};
+
+// The key at or before `time` and the fraction of the way to the next one.
+inline std::size_t find_key(const std::vector<float>& times, float time,
+                            float& fraction) {
+  fraction = 0.0f;
+
+  if (times.size() < 2 || time <= times.front()) {
+    return 0;
+  }
+
+  if (time >= times.back()) {
+    return times.size() - 1;
+  }
+
+  std::size_t next =
+      std::upper_bound(times.begin(), times.end(), time) - times.begin();
+  std::size_t key = next - 1;
+  fraction = (time - times[key]) / (times[next] - times[key]);
+
+  return key;
+}
+
+inline void lerp_scalar(const float* a, const float* b, float t, float* out) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = a[i] + (b[i] - a[i]) * t;
+  }
+}
+
+// Normalized lerp along the shorter arc. Close enough to slerp for
+// neighbouring keys and for blend weights, and much cheaper.
+inline void nlerp_scalar(const float* a, const float* b, float t, float* out) {
+  float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+  float sign = dot < 0.0f ? -1.0f : 1.0f;
+  float length = 0.0f;
+
+  for (int i = 0; i < 4; i++) {
+    out[i] = a[i] + (b[i] * sign - a[i]) * t;
+    length += out[i] * out[i];
+  }
+
+  length = std::sqrt(length);
+
+  for (int i = 0; i < 4; i++) {
+    out[i] /= length;
+  }
+}
+
+// out = a * b, all column-major.
+inline void multiply_scalar(const glm::mat4& a, const glm::mat4& b,
+                            glm::mat4& out) {
+  glm::mat4 result;
+
+  for (int column = 0; column < 4; column++) {
+    result[column] = a[0] * b[column][0] + a[1] * b[column][1] +
+                     a[2] * b[column][2] + a[3] * b[column][3];
+  }
+
+  out = result;
+}
+
+#ifdef ANIMATION_SSE
+inline void lerp_sse(const float* a, const float* b, float t, float* out) {
+  __m128 va = _mm_loadu_ps(a);
+  __m128 vb = _mm_loadu_ps(b);
+  _mm_storeu_ps(out,
+                _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), _mm_set1_ps(t))));
+}
+
+// All four lanes hold the dot product of a and b.
+inline __m128 dot4_sse(__m128 a, __m128 b) {
+  __m128 products = _mm_mul_ps(a, b);
+  __m128 swapped = _mm_shuffle_ps(products, products, _MM_SHUFFLE(2, 3, 0, 1));
+  __m128 sums = _mm_add_ps(products, swapped);
+  return _mm_add_ps(sums, _mm_shuffle_ps(sums, sums, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+inline void nlerp_sse(const float* a, const float* b, float t, float* out) {
+  __m128 va = _mm_loadu_ps(a);
+  __m128 vb = _mm_loadu_ps(b);
+  // Flip b onto a's hemisphere by xoring in the sign of the dot product.
+  __m128 sign = _mm_and_ps(dot4_sse(va, vb), _mm_set1_ps(-0.0f));
+  vb = _mm_xor_ps(vb, sign);
+
+  __m128 q = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), _mm_set1_ps(t)));
+  _mm_storeu_ps(out, _mm_div_ps(q, _mm_sqrt_ps(dot4_sse(q, q))));
+}
+
+inline void multiply_sse(const glm::mat4& a, const glm::mat4& b,
+                         glm::mat4& out) {
+  const float* pa = &a[0][0];
+  const float* pb = &b[0][0];
+  __m128 a0 = _mm_loadu_ps(pa);
+  __m128 a1 = _mm_loadu_ps(pa + 4);
+  __m128 a2 = _mm_loadu_ps(pa + 8);
+  __m128 a3 = _mm_loadu_ps(pa + 12);
+  __m128 columns[4];
+
+  for (int column = 0; column < 4; column++) {
+    __m128 c = _mm_loadu_ps(pb + column * 4);
+    __m128 x = _mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 y = _mm_shuffle_ps(c, c, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(c, c, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 w = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128 r = _mm_mul_ps(a0, x);
+    r = _mm_add_ps(r, _mm_mul_ps(a1, y));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, z));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, w));
+    columns[column] = r;
+  }
+
+  // Stored last, so `out` may alias `a` or `b`.
+  float* po = &out[0][0];
+
+  for (int column = 0; column < 4; column++) {
+    _mm_storeu_ps(po + column * 4, columns[column]);
+  }
+}
+#endif
+
+inline void animation_lerp(const glm::vec4& a, const glm::vec4& b, float t,
+                           glm::vec4& out, animation_math math) {
+#ifdef ANIMATION_SSE
+  if (math == ANIMATION_MATH_SIMD) {
+    lerp_sse(&a.x, &b.x, t, &out.x);
+    return;
+  }
+#endif
+  lerp_scalar(&a.x, &b.x, t, &out.x);
+}
+
+inline void animation_nlerp(const glm::vec4& a, const glm::vec4& b, float t,
+                            glm::vec4& out, animation_math math) {
+#ifdef ANIMATION_SSE
+  if (math == ANIMATION_MATH_SIMD) {
+    nlerp_sse(&a.x, &b.x, t, &out.x);
+    return;
+  }
+#endif
+  nlerp_scalar(&a.x, &b.x, t, &out.x);
+}
+
+inline void animation_multiply(const glm::mat4& a, const glm::mat4& b,
+                               glm::mat4& out, animation_math math) {
+#ifdef ANIMATION_SSE
+  if (math == ANIMATION_MATH_SIMD) {
+    multiply_sse(a, b, out);
+    return;
+  }
+#endif
+  multiply_scalar(a, b, out);
+}
+
+inline void sample_track(const std::vector<float>& times,
+                         const std::vector<glm::vec4>& keys, float time,
+                         bool rotation, glm::vec4& out, animation_math math) {
+  if (keys.empty()) {
+    return;
+  }
+
+  float fraction;
+  std::size_t key = find_key(times, time, fraction);
+  std::size_t next = std::min(key + 1, keys.size() - 1);
+
+  if (rotation) {
+    animation_nlerp(keys[key], keys[next], fraction, out, math);
+  } else {
+    animation_lerp(keys[key], keys[next], fraction, out, math);
+  }
+}
+
+// The clip's local pose at `time` seconds (clamped to the clip).
+inline void sample_clip(const Skeleton& skeleton, const Animation_Clip& clip,
+                        float time, Pose& pose,
+                        animation_math math = ANIMATION_MATH_SIMD) {
+  pose = skeleton.rest_pose;
+
+  for (const Animation_Channel& channel : clip.channels) {
+    if (channel.node < 0) {
+      continue;
+    }
+
+    sample_track(channel.translation_times, channel.translations, time, false,
+                 pose.translations[channel.node], math);
+    sample_track(channel.rotation_times, channel.rotations, time, true,
+                 pose.rotations[channel.node], math);
+    sample_track(channel.scale_times, channel.scales, time, false,
+                 pose.scales[channel.node], math);
+  }
+}
+
+// out = a blended towards b by `weight`; `out` may be `a`.
+inline void blend_poses(const Pose& a, const Pose& b, float weight, Pose& out,
+                        animation_math math = ANIMATION_MATH_SIMD) {
+  std::size_t count = a.translations.size();
+  out.resize(count);
+
+  for (std::size_t i = 0; i < count; i++) {
+    animation_lerp(a.translations[i], b.translations[i], weight,
+                   out.translations[i], math);
+    animation_nlerp(a.rotations[i], b.rotations[i], weight, out.rotations[i],
+                    math);
+    animation_lerp(a.scales[i], b.scales[i], weight, out.scales[i], math);
+  }
+}
+
+// Writes one skinning matrix per bone to `palette`: mesh space to posed
+// model space. `globals` is scratch space.
+inline void compute_bone_palette(const Skeleton& skeleton, const Pose& pose,
+                                 std::vector<glm::mat4>& globals,
+                                 glm::mat4* palette,
+                                 animation_math math = ANIMATION_MATH_SIMD) {
+  globals.resize(skeleton.nodes.size());
+
+  for (std::size_t i = 0; i < skeleton.nodes.size(); i++) {
+    glm::mat4 local = compose_transform(pose.translations[i],
+                                        pose.rotations[i], pose.scales[i]);
+    int parent = skeleton.nodes[i].parent;
+
+    // The root's parent is the inverse of its own rest transform.
+    animation_multiply(parent < 0 ? skeleton.global_inverse : globals[parent],
+                       local, globals[i], math);
+  }
+
+  for (std::size_t bone = 0; bone < skeleton.bone_count(); bone++) {
+    animation_multiply(globals[skeleton.bone_nodes[bone]],
+                       skeleton.bone_offsets[bone], palette[bone], math);
+  }
+}
+
+// Playback state of one animated instance: a clip, optionally cross-faded
+// into a second one.
+struct Animation_State {
+  int clip = 0;
+  float time = 0.0f;
+  // -1 for none; blend_weight 0 shows only `clip`, 1 only `blend_clip`.
+  int blend_clip = -1;
+  float blend_time = 0.0f;
+  float blend_weight = 0.0f;
+  float speed = 1.0f;
+  bool loop = true;
+};
+
+// Per-thread working memory for animate().
+struct Animation_Scratch {
+  Pose pose;
+  Pose blend_pose;
+  std::vector<glm::mat4> globals;
+};
+
+inline float wrap_animation_time(float time, float duration, bool loop) {
+  if (duration <= 0.0f) {
+    return 0.0f;
+  }
+
+  if (!loop) {
+    return std::clamp(time, 0.0f, duration);
+  }
+
+  time = std::fmod(time, duration);
+  return time < 0.0f ? time + duration : time;
+}
+
+inline void advance_animation(Animation_State& state,
+                              const std::vector<Animation_Clip>& clips,
+                              float delta_seconds) {
+  auto duration = [&](int clip) {
+    return clip >= 0 && clip < (int)clips.size() ? clips[clip].duration
+                                                 : 0.0f;
+  };
+
+  state.time = wrap_animation_time(state.time + delta_seconds * state.speed,
+                                   duration(state.clip), state.loop);
+  state.blend_time =
+      wrap_animation_time(state.blend_time + delta_seconds * state.speed,
+                          duration(state.blend_clip), state.loop);
+}
+
+// Samples, blends and skins one instance into `palette` (bone_count()
+// matrices). An out-of-range clip leaves the instance in its rest pose.
+inline void animate(const Skeleton& skeleton,
+                    const std::vector<Animation_Clip>& clips,
+                    const Animation_State& state, Animation_Scratch& scratch,
+                    glm::mat4* palette,
+                    animation_math math = ANIMATION_MATH_SIMD) {
+  auto valid = [&](int clip) { return clip >= 0 && clip < (int)clips.size(); };
+
+  if (valid(state.clip)) {
+    sample_clip(skeleton, clips[state.clip], state.time, scratch.pose, math);
+  } else {
+    scratch.pose = skeleton.rest_pose;
+  }
+
+  if (valid(state.blend_clip) && state.blend_weight > 0.0f) {
+    sample_clip(skeleton, clips[state.blend_clip], state.blend_time,
+                scratch.blend_pose, math);
+    blend_poses(scratch.pose, scratch.blend_pose, state.blend_weight,
+                scratch.pose, math);
+  }
+
+  compute_bone_palette(skeleton, scratch.pose, scratch.globals, palette, math);
+}
+
+// Advances every instance by `delta_seconds` and writes their palettes back
+// to back into `palettes` (instance i starts at i * bone_count()), ready to
+// upload to a Bone_Palette_Buffer in one go. Instances are independent, so
+// with `parallel` they are spread over the shared thread pool.
+inline void animate_instances(const Skeleton& skeleton,
+                              const std::vector<Animation_Clip>& clips,
+                              std::vector<Animation_State>& states,
+                              float delta_seconds,
+                              std::vector<glm::mat4>& palettes,
+                              animation_math math = ANIMATION_MATH_SIMD,
+                              bool parallel = true) {
+  std::size_t bones = skeleton.bone_count();
+  palettes.resize(states.size() * bones);
+
+  auto run = [&](std::size_t begin, std::size_t end) {
+    Animation_Scratch scratch;
+
+    for (std::size_t i = begin; i < end; i++) {
+      advance_animation(states[i], clips, delta_seconds);
+      animate(skeleton, clips, states[i], scratch, palettes.data() + i * bones,
+              math);
+    }
+  };
+
+  if (parallel) {
+    Thread_Pool::shared().parallel_for(states.size(), 16, run);
+  } else {
+    run(0, states.size());
+  }
+}
@@ -0,0 +1,2077 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stb_image.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "animation.hpp"
+#include "cube_mesh.hpp"
+#include "deferred.hpp"
+#include "frustum_cull.hpp"
+#include "instancing.hpp"
+#include "light_clusters.hpp"
+#include "model.hpp"
+#include "occlusion_cull.hpp"
+#include "render_queue.hpp"
+#include "skinning.hpp"
+#include "uniform_block.hpp"
+
+// Usage: ./bin/benchmark [name] [args...]
+//
+// Runs the named benchmark (or every benchmark when no name is given) from the
+// project root so the data/ paths resolve. Benchmarks that need a GL context
+// get a hidden window; the others run headless.
+
+typedef void (*benchmark_fn)(int argc, char** argv);
+
+struct Benchmark {
+  const char* name;
+  bool needs_gl;
+  benchmark_fn run;
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void benchmark_model_cache(int argc, char** argv) {
+  std::string path = argc > 0 ? argv[0] : "data/backpack/backpack.obj";
+  const int iterations = 3;
+
+  double cold_best = 1e30, warm_best = 1e30;
+  double cold_total = 0.0, warm_total = 0.0;
+
+  for (int i = 0; i < iterations; i++) {
+    std::remove(Model::cache_path(path).c_str());
+
+    // Each model is destroyed and its textures evicted before the next load
+    // so the texture cache does not flatter the warm run.
+    auto start = std::chrono::steady_clock::now();
+    double cold_ms, warm_ms;
+
+    {
+      Model cold(path);
+      cold_ms = elapsed_ms(start);
+    }
+
+    Texture_Cache::shared().evict_unused();
+    start = std::chrono::steady_clock::now();
+
+    {
+      Model warm(path);
+      warm_ms = elapsed_ms(start);
+
+      if (!warm.loaded_from_cache) {
+        std::cerr << "model_cache: warm load did not hit the cache\n";
+      }
+    }
+
+    Texture_Cache::shared().evict_unused();
+
+    cold_best = std::min(cold_best, cold_ms);
+    warm_best = std::min(warm_best, warm_ms);
+    cold_total += cold_ms;
+    warm_total += warm_ms;
+  }
+
+  std::printf("model_cache: %s\n", path.c_str());
+  std::printf("  cold (assimp + bake): best %8.2f ms  avg %8.2f ms\n",
+              cold_best, cold_total / iterations);
+  std::printf("  warm (mapped cache):  best %8.2f ms  avg %8.2f ms\n",
+              warm_best, warm_total / iterations);
+  std::printf("  speedup: %.1fx\n", cold_best / warm_best);
+
+  // GEOMETRY_RESIDENCY_KEEP must keep the same geometry either way: the
+  // warm load decodes it back out of the cache.
+  std::remove(Model::cache_path(path).c_str());
+  Model cold(path);
+  Model warm(path);
+  bool match = warm.loaded_from_cache &&
+               cold.meshes.size() == warm.meshes.size();
+  float max_position_error = 0.0f;
+  std::size_t kept_vertices = 0;
+
+  for (std::size_t i = 0; match && i < cold.meshes.size(); i++) {
+    const Mesh& a = cold.meshes[i];
+    const Mesh& b = warm.meshes[i];
+    match = !a.vertices.empty() && a.vertices.size() == b.vertices.size() &&
+            a.indices == b.indices;
+
+    for (std::size_t j = 0; match && j < a.vertices.size(); j++) {
+      max_position_error =
+          std::max(max_position_error, glm::length(a.vertices[j].position -
+                                                   b.vertices[j].position));
+    }
+
+    kept_vertices += a.vertices.size();
+  }
+
+  std::printf("  kept geometry, cold vs warm: %s (%zu vertices, max "
+              "position error %g)\n",
+              match ? "match" : "MISMATCH", kept_vertices,
+              max_position_error);
+}
+
+std::vector<std::string> list_images(const std::string& directory) {
+  std::vector<std::string> paths;
+
+  for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+    std::string extension = entry.path().extension().string();
+
+    if (extension == ".jpg" || extension == ".png") {
+      paths.push_back(entry.path().string());
+    }
+  }
+
+  return paths;
+}
+
+void benchmark_texture_decode(int argc, char** argv) {
+  std::string directory = argc > 0 ? argv[0] : "data/backpack";
+  std::vector<std::string> paths = list_images(directory);
+
+  // A discarded read of every image first, so both passes find them in
+  // the OS file cache and the serial one does not warm it for the other.
+  std::vector<unsigned char> warm_up;
+
+  for (const std::string& path : paths) {
+    read_file_bytes(path, warm_up);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (const std::string& path : paths) {
+    unsigned int texture_ID;
+    glGenTextures(1, &texture_ID);
+
+    int width, height, n_components;
+    unsigned char* data =
+        stbi_load(path.c_str(), &width, &height, &n_components, 0);
+
+    if (data) {
+      upload_texture_image(texture_ID, data, width, height, n_components);
+    }
+
+    stbi_image_free(data);
+    glDeleteTextures(1, &texture_ID);
+  }
+
+  glFinish();
+  double serial_ms = elapsed_ms(start);
+
+  start = std::chrono::steady_clock::now();
+  Texture_Loader loader;
+
+  for (const std::string& path : paths) {
+    loader.request(path);
+  }
+
+  loader.finish();
+  glFinish();
+  double parallel_ms = elapsed_ms(start);
+
+  for (const Texture_Load_Timing& timing : loader.timings) {
+    glDeleteTextures(1, &timing.texture_ID);
+  }
+
+  std::printf("texture_decode: %zu images in %s\n", paths.size(),
+              directory.c_str());
+  std::printf("  serial stbi_load:    %8.2f ms\n", serial_ms);
+  std::printf("  Texture_Loader (%2u): %8.2f ms\n",
+              Thread_Pool::shared().size(), parallel_ms);
+  print_texture_load_report(loader.timings);
+}
+
+// Compares loading every image in a directory the runtime way (decode,
+// upload, glGenerateMipmap) with baking it once and then loading the bake:
+// mapped, no decode, mips and block compression precomputed. Doubles as the
+// offline bake step: the bakes are left next to the images.
+void benchmark_texture_bake(int argc, char** argv) {
+  std::string directory = argc > 0 ? argv[0] : "data/backpack";
+  std::vector<std::string> paths = list_images(directory);
+
+  Texture_Bake_Options options;
+  options.enabled = true;
+  query_texture_compression(options);
+
+  double runtime_ms = 0.0, bake_ms = 0.0, baked_ms = 0.0;
+  std::size_t runtime_bytes = 0, baked_bytes = 0;
+  const char* format_names[] = {"RGBA8", "BC1", "BC3", "BC5"};
+
+  std::printf("texture_bake: %zu images in %s (S3TC %s)\n", paths.size(),
+              directory.c_str(), options.s3tc ? "supported" : "unsupported");
+
+  for (const std::string& path : paths) {
+    std::vector<unsigned char> bytes;
+
+    if (!read_file_bytes(path, bytes)) {
+      continue;
+    }
+
+    texture_kind kind = path.find("normal") != std::string::npos
+                            ? TEXTURE_KIND_NORMAL
+                            : TEXTURE_KIND_COLOR;
+    uint32_t flags = texture_bake_flags(false, kind, options);
+    uint64_t source_hash = fnv1a_64(bytes.data(), bytes.size());
+
+    unsigned int texture_ID;
+    glGenTextures(1, &texture_ID);
+    auto start = std::chrono::steady_clock::now();
+
+    int width, height, n_components;
+    unsigned char* data =
+        stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()),
+                              &width, &height, &n_components, 0);
+
+    if (!data) {
+      glDeleteTextures(1, &texture_ID);
+      continue;
+    }
+
+    upload_texture_image(texture_ID, data, width, height, n_components);
+    glFinish();
+    runtime_ms += elapsed_ms(start);
+    runtime_bytes += static_cast<std::size_t>(width) * height * n_components *
+                     4 / 3;
+    stbi_image_free(data);
+    glDeleteTextures(1, &texture_ID);
+
+    start = std::chrono::steady_clock::now();
+    data = stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()),
+                                 &width, &height, &n_components, 4);
+    texture_bake_format format =
+        choose_texture_bake_format(data, width, height, flags, options);
+    write_texture_bake(texture_bake_path(path, flags),
+                       bake_texture(data, width, height, source_hash, flags,
+                                    format));
+    stbi_image_free(data);
+    double bake_one_ms = elapsed_ms(start);
+    bake_ms += bake_one_ms;
+
+    // What a later run pays: hash the source, map the bake, upload.
+    glGenTextures(1, &texture_ID);
+    start = std::chrono::steady_clock::now();
+    Texture_Bake bake;
+    uint64_t current_hash = fnv1a_64(bytes.data(), bytes.size());
+
+    if (bake.open(texture_bake_path(path, flags), current_hash, flags)) {
+      begin_texture_bake_upload(texture_ID, bake);
+
+      for (int level = bake.level_count() - 1; level >= 0; level--) {
+        upload_texture_bake_level(texture_ID, bake, level);
+      }
+
+      glFinish();
+      baked_ms += elapsed_ms(start);
+      baked_bytes += bake.texture_bytes();
+
+      std::printf("  %-40s %5dx%-5d %-5s %2d levels, baked in %8.2f ms\n",
+                  path.c_str(), width, height, format_names[format],
+                  bake.level_count(), bake_one_ms);
+    }
+
+    glDeleteTextures(1, &texture_ID);
+  }
+
+  std::printf("  runtime (decode + glGenerateMipmap): %8.2f ms, %8zu KiB\n",
+              runtime_ms, runtime_bytes / 1024);
+  std::printf("  baked (mapped, per-level upload):    %8.2f ms, %8zu KiB\n",
+              baked_ms, baked_bytes / 1024);
+  std::printf("  one-off bake: %.2f ms; load %.1fx faster, %.1fx less VRAM\n",
+              bake_ms, runtime_ms / std::max(baked_ms, 1e-3),
+              static_cast<double>(runtime_bytes) /
+                  std::max<std::size_t>(baked_bytes, 1));
+}
+
+void benchmark_mipmap(int argc, char** argv) {
+  const int size = argc > 0 ? std::atoi(argv[0]) : 2048;
+  const int iterations = 3;
+
+  // Smooth gradients with a fine checker on top, so both the filtering and
+  // the sRGB curve matter.
+  std::vector<unsigned char> rgba(static_cast<std::size_t>(size) * size * 4);
+
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      unsigned char* texel =
+          &rgba[(static_cast<std::size_t>(y) * size + x) * 4];
+      int checker = ((x ^ y) & 1) * 64;
+      texel[0] = static_cast<unsigned char>(x * 191 / size + checker);
+      texel[1] = static_cast<unsigned char>(y * 191 / size + checker);
+      texel[2] = static_cast<unsigned char>((x + y) * 95 / size + checker);
+      texel[3] = static_cast<unsigned char>(255 - checker);
+    }
+  }
+
+  std::printf("mipmap: %dx%d sRGB RGBA8, %u threads\n", size, size,
+              Thread_Pool::shared().size());
+  std::printf("  %-8s %12s %12s %12s %12s %9s\n", "filter", "scalar ms",
+              "SIMD ms", "SIMD pool ms", "Mtexels/s", "max diff");
+
+  const char* filter_names[] = {"box", "kaiser"};
+  std::vector<Mip_Level> scalar_levels, simd_levels;
+
+  for (mip_filter filter : {MIP_FILTER_BOX, MIP_FILTER_KAISER}) {
+    auto best_ms = [&](mip_math math, bool parallel,
+                       std::vector<Mip_Level>& levels) {
+      Mip_Options options;
+      options.filter = filter;
+      options.srgb = true;
+      options.math = math;
+      options.parallel = parallel;
+      double best = 1e30;
+
+      for (int i = 0; i < iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        generate_mip_chain(rgba.data(), size, size, options, levels);
+        best = std::min(best, elapsed_ms(start));
+      }
+
+      return best;
+    };
+
+    double scalar_ms = best_ms(MIP_MATH_SCALAR, false, scalar_levels);
+    double simd_ms = best_ms(MIP_MATH_SIMD, false, simd_levels);
+    double pool_ms = best_ms(MIP_MATH_SIMD, true, simd_levels);
+    int max_difference = 0;
+
+    for (std::size_t i = 0; i < scalar_levels.size(); i++) {
+      for (std::size_t j = 0; j < scalar_levels[i].rgba.size(); j++) {
+        max_difference =
+            std::max(max_difference, std::abs(scalar_levels[i].rgba[j] -
+                                              simd_levels[i].rgba[j]));
+      }
+    }
+
+    // Base-level texels consumed per second, the fastest path.
+    double texels = size * static_cast<double>(size);
+    std::printf("  %-8s %12.2f %12.2f %12.2f %12.1f %9d\n",
+                filter_names[filter], scalar_ms, simd_ms, pool_ms,
+                texels / (std::min(simd_ms, pool_ms) * 1e3), max_difference);
+  }
+
+  // A black and white checker must average to mid grey in linear light,
+  // which is 188 in sRGB; averaging the sRGB bytes gives a darker 128.
+  unsigned char checker[16];
+
+  for (int i = 0; i < 4; i++) {
+    unsigned char value = (i == 0 || i == 3) ? 255 : 0;
+    std::memset(checker + i * 4, value, 3);
+    checker[i * 4 + 3] = 255;
+  }
+
+  Mip_Options options;
+  generate_mip_chain(checker, 2, 2, options, simd_levels);
+  int gamma_space = simd_levels[0].rgba[0];
+  options.srgb = true;
+  generate_mip_chain(checker, 2, 2, options, simd_levels);
+  std::printf("  2x2 checker averages to %d in linear light, %d in gamma "
+              "space\n",
+              simd_levels[0].rgba[0], gamma_space);
+}
+
+void benchmark_vertex_format(int argc, char** argv) {
+  std::string path = argc > 0 ? argv[0] : "data/backpack/backpack.obj";
+
+  Model_Options float_options;
+  float_options.use_mesh_cache = false;
+
+  Model_Options compact_options = float_options;
+  compact_options.compact_vertices = true;
+
+  std::size_t vertices = 0, float_bytes = 0, compact_bytes = 0;
+  Quantization_Error error;
+
+  {
+    Model float_model(path, false, float_options);
+    Model compact_model(path, false, compact_options);
+
+    for (std::size_t i = 0; i < float_model.meshes.size(); i++) {
+      std::size_t count = float_model.meshes[i].vertices.size();
+      vertices += count;
+      float_bytes += count * vertex_size(float_model.meshes[i].format);
+      compact_bytes += count * vertex_size(compact_model.meshes[i].format);
+    }
+
+    error = compact_model.quantization_error;
+  }
+
+  Texture_Cache::shared().evict_unused();
+
+  std::printf("vertex_format: %s, %zu vertices\n", path.c_str(), vertices);
+  std::printf("  float:   %8zu KiB (%zu B/vertex)\n", float_bytes / 1024,
+              vertex_size(VERTEX_FORMAT_FLOAT));
+  std::printf("  compact: %8zu KiB (%.1f B/vertex, %.1fx smaller)\n",
+              compact_bytes / 1024,
+              (double)compact_bytes / std::max<std::size_t>(vertices, 1),
+              (double)float_bytes / std::max<std::size_t>(compact_bytes, 1));
+  std::printf("  position error: max %g mean %g (model units)\n",
+              error.max_position_error, error.mean_position_error);
+  std::printf("  normal / tangent / bitangent max error: %.3f / %.3f / "
+              "%.3f deg\n",
+              error.max_normal_error, error.max_tangent_error,
+              error.max_bitangent_error);
+  std::printf("  tex coord max error: %g\n", error.max_tex_coord_error);
+}
+
+void print_optimize_report(const char* name,
+                           const Mesh_Optimize_Report& report) {
+  std::printf("  %-24s ACMR %.3f -> %.3f  ATVR %.3f -> %.3f  (%zu tris, "
+              "%.2f ms)\n",
+              name, report.before.acmr(), report.after.acmr(),
+              report.before.atvr(), report.after.atvr(),
+              report.after.triangles, report.milliseconds);
+}
+
+// Headless: runs the optimizer on a shuffled grid and, when a path is given,
+// on every triangle mesh assimp imports from it.
+void benchmark_index_optimizer(int argc, char** argv) {
+  const unsigned int grid = 256;
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned int> indices;
+
+  for (unsigned int y = 0; y <= grid; y++) {
+    for (unsigned int x = 0; x <= grid; x++) {
+      positions.push_back(glm::vec3(x, y, 0.0f));
+    }
+  }
+
+  std::vector<unsigned int> quads(grid * grid);
+  std::iota(quads.begin(), quads.end(), 0u);
+  std::shuffle(quads.begin(), quads.end(), std::mt19937(1234));
+
+  for (unsigned int quad : quads) {
+    unsigned int i = quad / grid * (grid + 1) + quad % grid;
+    unsigned int triangle[6] = {i, i + 1, i + grid + 2, i, i + grid + 2,
+                                i + grid + 1};
+    indices.insert(indices.end(), triangle, triangle + 6);
+  }
+
+  struct Grid_Vertex {
+    glm::vec3 position;
+  };
+
+  std::vector<Grid_Vertex> vertices(positions.size());
+
+  for (std::size_t i = 0; i < positions.size(); i++) {
+    vertices[i].position = positions[i];
+  }
+
+  std::printf("index_optimizer: FIFO cache of %u vertices\n",
+              VERTEX_CACHE_SIZE);
+  print_optimize_report("shuffled 256x256 grid",
+                        optimize_mesh(vertices, indices, true, true, true));
+
+  if (argc == 0) {
+    return;
+  }
+
+  Assimp::Importer importer;
+  const aiScene* scene = importer.ReadFile(argv[0], MODEL_IMPORT_FLAGS);
+
+  if (!scene) {
+    std::cerr << "ERROR::ASSIMP\n" << importer.GetErrorString() << "\n";
+    return;
+  }
+
+  Mesh_Optimize_Report total;
+
+  for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+    const aiMesh* mesh = scene->mMeshes[m];
+
+    if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) {
+      continue;
+    }
+
+    std::vector<Grid_Vertex> mesh_vertices(mesh->mNumVertices);
+    std::vector<unsigned int> mesh_indices;
+
+    for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
+      mesh_vertices[i].position =
+          glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y,
+                    mesh->mVertices[i].z);
+    }
+
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+      mesh_indices.insert(mesh_indices.end(), mesh->mFaces[i].mIndices,
+                          mesh->mFaces[i].mIndices + 3);
+    }
+
+    total.merge(
+        optimize_mesh(mesh_vertices, mesh_indices, true, true, true));
+  }
+
+  print_optimize_report(argv[0], total);
+}
+
+// A welded, cache-optimized UV sphere of radius 1.
+void make_sphere(unsigned int rings, unsigned int segments,
+                 std::vector<Vertex>& vertices,
+                 std::vector<unsigned int>& indices) {
+  for (unsigned int r = 0; r <= rings; r++) {
+    float phi = glm::radians(180.0f * r / rings);
+
+    for (unsigned int s = 0; s <= segments; s++) {
+      float theta = glm::radians(360.0f * s / segments);
+      Vertex vertex = {};
+      vertex.position = glm::vec3(std::sin(phi) * std::cos(theta),
+                                  std::cos(phi),
+                                  std::sin(phi) * std::sin(theta));
+      vertex.normal = vertex.position;
+      vertex.tex_coords = glm::vec2((float)s / segments, (float)r / rings);
+      vertices.push_back(vertex);
+    }
+  }
+
+  for (unsigned int r = 0; r < rings; r++) {
+    for (unsigned int s = 0; s < segments; s++) {
+      unsigned int i = r * (segments + 1) + s;
+      unsigned int quad[6] = {i, i + 1, i + segments + 1,
+                              i + 1, i + segments + 2, i + segments + 1};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+
+  weld_vertices(vertices, indices);
+  optimize_mesh(vertices, indices, true, false, true);
+}
+
+// Headless: a dense UV sphere split into meshlets, viewed from a few cameras.
+// Reports how many meshlets the frustum and normal cone tests reject per view
+// and what the culling costs.
+void benchmark_meshlets(int argc, char** argv) {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  make_sphere(512, 1024, vertices, indices);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Meshlet> meshlets = build_meshlets(indices, vertices.size());
+  compute_meshlet_bounds(meshlets, indices, &vertices[0].position.x,
+                         sizeof(Vertex));
+  double build_ms = elapsed_ms(start);
+
+  std::printf("meshlets: sphere with %zu triangles -> %zu meshlets "
+              "(%.1f tris, built in %.2f ms)\n",
+              indices.size() / 3, meshlets.size(),
+              (double)indices.size() / 3 / meshlets.size(), build_ms);
+
+  struct View {
+    const char* name;
+    glm::vec3 eye;
+    glm::vec3 target;
+  };
+
+  const View views[] = {
+      {"outside, whole sphere", glm::vec3(0.0f, 0.0f, 4.0f), glm::vec3(0.0f)},
+      {"close up", glm::vec3(0.0f, 0.0f, 1.3f), glm::vec3(0.0f)},
+      {"looking away", glm::vec3(0.0f, 0.0f, 4.0f),
+       glm::vec3(0.0f, 0.0f, 8.0f)},
+      {"beside, looking past", glm::vec3(1.2f, 0.0f, 0.0f),
+       glm::vec3(1.2f, 0.0f, -1.0f)},
+  };
+
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+  std::vector<unsigned int> visible;
+
+  for (const View& view : views) {
+    glm::mat4 view_matrix =
+        glm::lookAt(view.eye, view.target, glm::vec3(0.0f, 1.0f, 0.0f));
+    Meshlet_Cull_View cull_view(projection, view_matrix, glm::mat4(1.0f));
+    Meshlet_Cull_Stats stats;
+    const int iterations = 100;
+
+    start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++) {
+      visible.clear();
+      stats = Meshlet_Cull_Stats();
+      cull_meshlets(meshlets, cull_view, visible, stats);
+    }
+
+    double cull_us = elapsed_ms(start) * 1000.0 / iterations;
+
+    std::printf("  %-22s %5.1f%% culled (frustum %zu, backface %zu), "
+                "%5.1f%% of triangles, %.1f us\n",
+                view.name, stats.fraction_culled() * 100.0f,
+                stats.frustum_culled, stats.backface_culled,
+                100.0 * stats.triangles_culled /
+                    std::max<std::size_t>(stats.triangles, 1),
+                cull_us);
+  }
+}
+
+// Headless: builds a LOD chain for a sphere (UV seam included) and shows
+// which level select_lods' screen-space error rule picks with distance.
+void benchmark_lod_chain(int argc, char** argv) {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  make_sphere(256, 512, vertices, indices);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Mesh_LOD> lods =
+      generate_lod_chain(indices, &vertices[0].position.x, sizeof(Vertex),
+                         vertices.size(), 6, 0.5f, 0.05f);
+  double build_ms = elapsed_ms(start);
+
+  std::printf("lod_chain: %zu levels in %.2f ms\n", lods.size(), build_ms);
+
+  for (std::size_t i = 0; i < lods.size(); i++) {
+    std::printf("  LOD %zu: %7u tris, error %.5f\n", i,
+                lods[i].index_count / 3, lods[i].error);
+  }
+
+  // 1 pixel threshold, 45 degree field of view, 600 pixel viewport.
+  float pixels_per_unit = 600.0f / (2.0f * std::tan(glm::radians(22.5f)));
+
+  for (float distance : {2.0f, 5.0f, 10.0f, 25.0f, 50.0f, 100.0f}) {
+    std::size_t level = 0;
+
+    while (level + 1 < lods.size() &&
+           lods[level + 1].error * pixels_per_unit / (distance - 1.0f) <=
+               1.0f) {
+      level++;
+    }
+
+    std::printf("  distance %5.1f -> LOD %zu\n", distance, level);
+  }
+}
+
+// Headless: interleaves synthetic attribute streams (the layout of an aiMesh)
+// into Vertex with the old per-vertex push_back loop, the branch-free scalar
+// path and the SIMD path, then converts several meshes at once on the pool.
+void benchmark_vertex_convert(int argc, char** argv) {
+  const std::size_t count = argc > 0 ? std::strtoul(argv[0], nullptr, 10)
+                                     : 2000000;
+  const int iterations = 5;
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+  std::vector<float> streams_data[5];
+
+  for (std::vector<float>& stream : streams_data) {
+    stream.resize(count * 3);
+
+    for (float& v : stream) {
+      v = value(rng);
+    }
+  }
+
+  Vertex_Streams streams;
+  streams.count = count;
+  streams.position = streams_data[0].data();
+  streams.normal = streams_data[1].data();
+  streams.tex_coords = streams_data[2].data();
+  streams.tangent = streams_data[3].data();
+  streams.bitangent = streams_data[4].data();
+
+  // What process_mesh used to do.
+  auto push_back_loop = [&](std::vector<Vertex>& vertices) {
+    for (std::size_t i = 0; i < count; i++) {
+      Vertex vertex = {};
+      vertex.position = glm::vec3(streams.position[i * 3],
+                                  streams.position[i * 3 + 1],
+                                  streams.position[i * 3 + 2]);
+
+      if (streams.normal) {
+        vertex.normal = glm::vec3(streams.normal[i * 3],
+                                  streams.normal[i * 3 + 1],
+                                  streams.normal[i * 3 + 2]);
+      }
+
+      if (streams.tex_coords) {
+        vertex.tex_coords = glm::vec2(streams.tex_coords[i * 3],
+                                      streams.tex_coords[i * 3 + 1]);
+        vertex.tangent = glm::vec3(streams.tangent[i * 3],
+                                   streams.tangent[i * 3 + 1],
+                                   streams.tangent[i * 3 + 2]);
+        vertex.bitangent = glm::vec3(streams.bitangent[i * 3],
+                                     streams.bitangent[i * 3 + 1],
+                                     streams.bitangent[i * 3 + 2]);
+      }
+
+      vertices.push_back(vertex);
+    }
+  };
+
+  // Fresh vectors include the allocation and first-touch page faults an
+  // import pays; the warm buffer isolates the conversion itself.
+  auto best_ms = [&](auto convert) {
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++) {
+      std::vector<Vertex> vertices;
+      auto start = std::chrono::steady_clock::now();
+      convert(vertices);
+      best = std::min(best, elapsed_ms(start));
+    }
+
+    return best;
+  };
+
+  std::vector<Vertex> warm(count);
+
+  auto best_warm_ms = [&](auto convert) {
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++) {
+      auto start = std::chrono::steady_clock::now();
+      convert(streams, warm.data(), std::size_t(0), count);
+      best = std::min(best, elapsed_ms(start));
+    }
+
+    return best;
+  };
+
+  auto report = [&](const char* name, double ms, std::size_t vertices) {
+    std::printf("  %-32s %8.2f ms  %8.1f Mvertices/s\n", name, ms,
+                vertices / (ms * 1e3));
+  };
+
+  std::printf("vertex_convert: %zu vertices, %zu bytes each\n", count,
+              sizeof(Vertex));
+
+  report("push_back loop", best_ms(push_back_loop), count);
+  report("resize + SIMD", best_ms([&](std::vector<Vertex>& vertices) {
+           convert_vertices(streams, vertices);
+         }),
+         count);
+  report("scalar, warm buffer", best_warm_ms(convert_vertices_scalar), count);
+  report("SIMD, warm buffer",
+         best_warm_ms([](const Vertex_Streams& streams, Vertex* out,
+                         std::size_t begin, std::size_t end) {
+           convert_vertices(streams, out, begin, end);
+         }),
+         count);
+
+  std::vector<Vertex> expected, simd;
+  push_back_loop(expected);
+  convert_vertices(streams, simd);
+  bool match = std::memcmp(expected.data(), simd.data(),
+                           count * sizeof(Vertex)) == 0;
+  std::printf("  SIMD output %s the push_back loop\n",
+              match ? "matches" : "DIFFERS FROM");
+
+  // Independent meshes, as Model imports them.
+  const std::size_t mesh_count = 16;
+  std::vector<std::vector<Vertex>> meshes(mesh_count);
+  Thread_Pool& pool = Thread_Pool::shared();
+  double parallel_ms = 1e30;
+
+  for (int i = 0; i < iterations; i++) {
+    for (std::vector<Vertex>& mesh : meshes) {
+      std::vector<Vertex>().swap(mesh);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pool.parallel_for(mesh_count, 1, [&](std::size_t begin, std::size_t end) {
+      for (std::size_t m = begin; m < end; m++) {
+        convert_vertices(streams, meshes[m]);
+      }
+    });
+    parallel_ms = std::min(parallel_ms, elapsed_ms(start));
+  }
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "SIMD, %zu meshes, %u threads",
+                mesh_count, pool.size());
+  report(name, parallel_ms, count * mesh_count);
+}
+
+// A branching skeleton of `bone_count` bones, each node a bone, and two
+// looping 2 s clips keyed at 30 Hz on every node.
+void make_animated_skeleton(int bone_count, Skeleton& skeleton,
+                            std::vector<Animation_Clip>& clips) {
+  for (int i = 0; i < bone_count; i++) {
+    glm::mat4 local(1.0f);
+    local[3] = glm::vec4(0.0f, 0.25f, 0.0f, 1.0f);
+
+    std::string name = "bone " + std::to_string(i);
+    skeleton.add_node(name, i > 0 ? (i - 1) / 2 : -1, local);
+    skeleton.add_bone(name, glm::mat4(1.0f));
+  }
+
+  for (int c = 0; c < 2; c++) {
+    Animation_Clip clip;
+    clip.name = c == 0 ? "walk" : "run";
+    clip.duration = 2.0f;
+
+    for (int i = 0; i < bone_count; i++) {
+      Animation_Channel channel;
+      channel.node = i;
+
+      for (int k = 0; k <= 60; k++) {
+        float time = k / 30.0f;
+        float angle = std::sin(time * (3.0f + c) + i) * 0.5f;
+        glm::vec3 axis = glm::normalize(glm::vec3(1.0f, i % 3, c + 1.0f));
+        glm::vec3 v = axis * std::sin(angle * 0.5f);
+
+        channel.translation_times.push_back(time);
+        channel.translations.push_back(
+            glm::vec4(0.0f, 0.25f + 0.05f * std::sin(time + i), 0.0f, 0.0f));
+        channel.rotation_times.push_back(time);
+        channel.rotations.push_back(
+            glm::vec4(v.x, v.y, v.z, std::cos(angle * 0.5f)));
+      }
+
+      clip.channels.push_back(std::move(channel));
+    }
+
+    clips.push_back(std::move(clip));
+  }
+}
+
+// Headless: samples, cross-fades and builds bone palettes for a growing
+// number of animated instances (scalar vs SIMD, one thread vs the pool),
+// then skins a mesh on the CPU. Argument: the largest instance count.
+void benchmark_animation(int argc, char** argv) {
+  const std::size_t max_instances =
+      argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 10000;
+  const int bone_count = 64;
+  const int iterations = 5;
+  const float delta_seconds = 1.0f / 60.0f;
+
+  Skeleton skeleton;
+  std::vector<Animation_Clip> clips;
+  make_animated_skeleton(bone_count, skeleton, clips);
+
+  std::printf("animation: %d bones, %zu clips, %u threads\n", bone_count,
+              clips.size(), Thread_Pool::shared().size());
+  std::printf("  %10s %14s %14s %14s\n", "instances", "scalar ms",
+              "SIMD ms", "SIMD pool ms");
+
+  std::vector<glm::mat4> palettes;
+
+  for (std::size_t count = 1; count <= max_instances; count *= 10) {
+    std::vector<Animation_State> states(count);
+
+    for (std::size_t i = 0; i < count; i++) {
+      states[i].clip = i % 2;
+      states[i].time = (i % 97) / 97.0f * 2.0f;
+      states[i].blend_clip = 1 - i % 2;
+      states[i].blend_weight = (i % 5) / 4.0f;
+    }
+
+    auto best_ms = [&](animation_math math, bool parallel) {
+      double best = 1e30;
+
+      for (int i = 0; i < iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        animate_instances(skeleton, clips, states, delta_seconds, palettes,
+                          math, parallel);
+        best = std::min(best, elapsed_ms(start));
+      }
+
+      return best;
+    };
+
+    double scalar_ms = best_ms(ANIMATION_MATH_SCALAR, false);
+    double simd_ms = best_ms(ANIMATION_MATH_SIMD, false);
+    double pool_ms = best_ms(ANIMATION_MATH_SIMD, true);
+    std::printf("  %10zu %14.3f %14.3f %14.3f\n", count, scalar_ms, simd_ms,
+                pool_ms);
+  }
+
+  // Both paths from the same states must agree to rounding.
+  std::vector<Animation_State> states(64);
+  std::vector<glm::mat4> scalar_palettes, simd_palettes;
+
+  for (std::size_t i = 0; i < states.size(); i++) {
+    states[i].time = i / 32.0f;
+    states[i].blend_clip = 1;
+    states[i].blend_weight = 0.3f;
+  }
+
+  std::vector<Animation_State> simd_states = states;
+  animate_instances(skeleton, clips, states, delta_seconds, scalar_palettes,
+                    ANIMATION_MATH_SCALAR, false);
+  animate_instances(skeleton, clips, simd_states, delta_seconds,
+                    simd_palettes, ANIMATION_MATH_SIMD, false);
+
+  float max_difference = 0.0f;
+
+  for (std::size_t i = 0; i < scalar_palettes.size(); i++) {
+    for (int column = 0; column < 4; column++) {
+      for (int row = 0; row < 4; row++) {
+        max_difference = std::max(
+            max_difference, std::abs(scalar_palettes[i][column][row] -
+                                     simd_palettes[i][column][row]));
+      }
+    }
+  }
+
+  std::printf("  SIMD palettes differ from scalar by at most %g\n",
+              max_difference);
+
+  // CPU skinning: a dense sphere weighted to four bones per vertex.
+  std::vector<Vertex> bind;
+  std::vector<unsigned int> indices;
+  make_sphere(512, 1024, bind, indices);
+
+  for (std::size_t i = 0; i < bind.size(); i++) {
+    for (int k = 0; k < MAX_BONE_INFLUENCE; k++) {
+      bind[i].m_bone_IDs[k] = (i / 64 + k * 17) % bone_count;
+      bind[i].m_weights[k] = 0.25f;
+    }
+  }
+
+  const glm::mat4* palette = simd_palettes.data();
+  std::vector<Vertex> skinned;
+
+  auto skin_ms = [&](animation_math math, bool parallel) {
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++) {
+      auto start = std::chrono::steady_clock::now();
+      skin_mesh(bind, palette, skinned, math, parallel);
+      best = std::min(best, elapsed_ms(start));
+    }
+
+    return best;
+  };
+
+  auto report = [&](const char* name, double ms) {
+    std::printf("  %-24s %8.2f ms  %8.1f Mvertices/s\n", name, ms,
+                bind.size() / (ms * 1e3));
+  };
+
+  std::printf("  CPU skinning, %zu vertices:\n", bind.size());
+  report("scalar", skin_ms(ANIMATION_MATH_SCALAR, false));
+  report("SIMD", skin_ms(ANIMATION_MATH_SIMD, false));
+  report("SIMD, thread pool", skin_ms(ANIMATION_MATH_SIMD, true));
+}
+
+// Culls random boxes scattered around a camera, with each implementation.
+void benchmark_frustum_cull(int argc, char** argv) {
+  const std::size_t count =
+      argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 1000000;
+  const int iterations = 10;
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+  std::uniform_real_distribution<float> size(0.1f, 2.0f);
+  Cull_Bounds bounds;
+  bounds.reserve(count);
+
+  for (std::size_t i = 0; i < count; i++) {
+    glm::vec3 center(position(rng), position(rng), position(rng));
+    glm::vec3 extent(size(rng), size(rng), size(rng));
+    bounds.push_back(center - extent, center + extent);
+  }
+
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.3f, 0.1f, -1.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+  Frustum frustum(projection, view);
+
+  std::printf("frustum_cull: %zu boxes, %u threads\n", count,
+              Thread_Pool::shared().size());
+
+  std::vector<unsigned char> reference, visible;
+  Frustum_Cull_Stats stats;
+  cull_bounds(frustum, bounds, reference, stats, CULL_MATH_SCALAR, false);
+
+  auto run = [&](const char* name, cull_math math, bool parallel) {
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++) {
+      Frustum_Cull_Stats frame;
+      auto start = std::chrono::steady_clock::now();
+      cull_bounds(frustum, bounds, visible, frame, math, parallel);
+      best = std::min(best, elapsed_ms(start));
+    }
+
+    std::printf("  %-18s %8.3f ms  %8.1f Mboxes/s  %s\n", name, best,
+                count / (best * 1e3),
+                visible == reference ? "matches scalar" : "MISMATCH");
+  };
+
+  run("scalar", CULL_MATH_SCALAR, false);
+  run("SIMD", CULL_MATH_SIMD, false);
+  run("SIMD, thread pool", CULL_MATH_SIMD, true);
+
+  std::printf("  %zu tested, %zu culled (%.1f%%)\n", stats.tested,
+              stats.culled, stats.fraction_culled() * 100.0f);
+}
+
+// Appends a closed box with outward-facing, counter-clockwise triangles.
+void append_box(const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+                std::vector<glm::vec3>& positions,
+                std::vector<unsigned int>& indices) {
+  unsigned int first = static_cast<unsigned int>(positions.size());
+  glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+
+  for (int corner = 0; corner < 8; corner++) {
+    positions.push_back(glm::vec3(corner & 1 ? bounds_max.x : bounds_min.x,
+                                  corner & 2 ? bounds_max.y : bounds_min.y,
+                                  corner & 4 ? bounds_max.z : bounds_min.z));
+  }
+
+  const unsigned int faces[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4},
+                                    {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}};
+
+  for (const auto& face : faces) {
+    for (unsigned int t = 0; t < 2; t++) {
+      unsigned int a = first + face[0], b = first + face[1 + t],
+                   c = first + face[2 + t];
+      glm::vec3 normal = glm::cross(positions[b] - positions[a],
+                                    positions[c] - positions[a]);
+
+      if (glm::dot(normal, positions[a] - center) < 0.0f) {
+        std::swap(b, c);
+      }
+
+      indices.insert(indices.end(), {a, b, c});
+    }
+  }
+}
+
+// An interior: a wall with a doorway between the camera and a field of
+// small boxes, some in front of the wall and most behind it.
+void benchmark_occlusion_cull(int argc, char** argv) {
+  const std::size_t count =
+      argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 100000;
+  const int iterations = 10;
+  const float wall_z = -20.0f;
+
+  std::vector<glm::vec3> wall_positions;
+  std::vector<unsigned int> wall_indices;
+  append_box(glm::vec3(-60.0f, -1.0f, wall_z - 1.0f),
+             glm::vec3(-3.0f, 20.0f, wall_z), wall_positions, wall_indices);
+  append_box(glm::vec3(3.0f, -1.0f, wall_z - 1.0f),
+             glm::vec3(60.0f, 20.0f, wall_z), wall_positions, wall_indices);
+  append_box(glm::vec3(-3.0f, 4.0f, wall_z - 1.0f),
+             glm::vec3(3.0f, 20.0f, wall_z), wall_positions, wall_indices);
+
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> x(-40.0f, 40.0f), y(0.0f, 3.0f);
+  std::uniform_real_distribution<float> z(-80.0f, -2.0f);
+  Cull_Bounds bounds;
+  bounds.reserve(count);
+
+  for (std::size_t i = 0; i < count; i++) {
+    glm::vec3 center(x(rng), y(rng), z(rng));
+    bounds.push_back(center - glm::vec3(0.25f), center + glm::vec3(0.25f));
+  }
+
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+  glm::mat4 view =
+      glm::lookAt(glm::vec3(0.0f, 1.5f, 0.0f), glm::vec3(0.0f, 1.5f, -1.0f),
+                  glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 clip = projection * view;
+  Frustum frustum(clip);
+
+  Frustum_Cull_Stats frustum_stats;
+  std::vector<unsigned char> in_frustum, visible;
+  cull_bounds(frustum, bounds, in_frustum, frustum_stats);
+
+  std::printf("occlusion_cull: %zu boxes, %zu in the frustum, %u threads\n",
+              count, frustum_stats.visible(), Thread_Pool::shared().size());
+  std::printf("  %-18s %9s %9s %9s %10s\n", "", "setup ms", "raster ms",
+              "test ms", "occluded");
+
+  Occlusion_Buffer buffer;
+  std::vector<unsigned char> reference;
+
+  auto run = [&](const char* name, cull_math math, bool parallel) {
+    Occlusion_Cull_Stats best;
+    best.setup_ms = best.raster_ms = best.test_ms = 1e30;
+    buffer.math = math;
+
+    for (int i = 0; i < iterations; i++) {
+      buffer.clear();
+      buffer.add_occluder(wall_positions.data(), wall_positions.size(),
+                          sizeof(glm::vec3), wall_indices.data(),
+                          wall_indices.size(), clip);
+      buffer.rasterize(parallel);
+      visible = in_frustum;
+      buffer.test_bounds(bounds, clip, visible, parallel);
+
+      best.setup_ms = std::min(best.setup_ms, buffer.stats.setup_ms);
+      best.raster_ms = std::min(best.raster_ms, buffer.stats.raster_ms);
+      best.test_ms = std::min(best.test_ms, buffer.stats.test_ms);
+    }
+
+    if (reference.empty()) {
+      reference = visible;
+    }
+
+    std::printf("  %-18s %9.3f %9.3f %9.3f %9.1f%%  %s\n", name,
+                best.setup_ms, best.raster_ms, best.test_ms,
+                buffer.stats.fraction_occluded() * 100.0f,
+                visible == reference ? "matches scalar" : "MISMATCH");
+  };
+
+  run("scalar", CULL_MATH_SCALAR, false);
+  run("SIMD", CULL_MATH_SIMD, false);
+  run("SIMD, thread pool", CULL_MATH_SIMD, true);
+
+  // Nothing in front of the wall may be hidden; everything entirely behind
+  // it and clear of the doorway's view should be.
+  std::size_t wrongly_hidden = 0, behind = 0, behind_hidden = 0;
+
+  for (std::size_t i = 0; i < count; i++) {
+    if (!in_frustum[i]) {
+      continue;
+    }
+
+    float near_z = bounds.center_z[i] + bounds.extent_z[i];
+    float half_width = bounds.extent_x[i];
+    // The doorway, seen from the camera, widens with distance.
+    float doorway = 3.0f * bounds.center_z[i] / wall_z + half_width;
+
+    if (near_z > wall_z && !visible[i]) {
+      wrongly_hidden++;
+    } else if (near_z < wall_z - 1.0f &&
+               std::abs(bounds.center_x[i]) > doorway) {
+      behind++;
+      behind_hidden += !visible[i];
+    }
+  }
+
+  std::printf("  %zu occluder triangles (%zu rejected), %zu in front of the "
+              "wall hidden (must be 0), %zu of %zu behind it hidden\n",
+              buffer.stats.triangles, buffer.stats.triangles_rejected,
+              wrongly_hidden, behind_hidden, behind);
+}
+
+// Sets the model shader's five integer uniforms `rounds` times: by string
+// through glGetUniformLocation (as Shader used to), by run-time hashed
+// name, by "name"_uniform and by Uniform_Handle.
+void benchmark_uniforms(int argc, char** argv) {
+  const int rounds = argc > 0 ? std::atoi(argv[0]) : 100000;
+
+  Shader shader("src/shader/model_loading.vs", "src/shader/model_loading.fs");
+  shader.use();
+
+  const char* fields[5] = {"instanced", "skinned", "bone_offset",
+                           "bone_palette", "texture_diffuse1"};
+  std::vector<std::string> names;
+  std::vector<Uniform_Handle> handles;
+
+  for (const char* field : fields) {
+    names.push_back(field);
+    handles.push_back(shader.uniform(names.back()));
+  }
+
+  double ms[4];
+
+  for (int method = 0; method < 4; method++) {
+    glFinish();
+    auto start = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < rounds; round++) {
+      int value = round & 1;
+
+      for (std::size_t i = 0; i < names.size(); i++) {
+        if (method == 0) {
+          std::string name = names[i];
+          glUniform1i(glGetUniformLocation(shader.ID, name.c_str()), value);
+        } else if (method == 1) {
+          shader.set_uniform_int(names[i], value);
+        } else if (method == 3) {
+          shader.set_uniform_int(handles[i], value);
+        }
+      }
+
+      // The hashes fold to constants, as they do in the demos.
+      if (method == 2) {
+        shader.set_uniform_int("instanced"_uniform, value);
+        shader.set_uniform_int("skinned"_uniform, value);
+        shader.set_uniform_int("bone_offset"_uniform, value);
+        shader.set_uniform_int("bone_palette"_uniform, value);
+        shader.set_uniform_int("texture_diffuse1"_uniform, value);
+      }
+    }
+
+    glFinish();
+    ms[method] = elapsed_ms(start);
+  }
+
+  shader.delete_program();
+
+  double calls = (double)rounds * names.size();
+  std::printf("uniforms: %zu active, %d rounds of %zu\n",
+              shader.active_uniforms().size(), rounds, names.size());
+  std::printf("  glGetUniformLocation: %7.1f ns/call\n",
+              ms[0] * 1e6 / calls);
+  std::printf("  hashed at run time:   %7.1f ns/call\n",
+              ms[1] * 1e6 / calls);
+  std::printf("  \"name\"_uniform:       %7.1f ns/call\n",
+              ms[2] * 1e6 / calls);
+  std::printf("  Uniform_Handle:       %7.1f ns/call\n",
+              ms[3] * 1e6 / calls);
+}
+
+// Headless: prints the std140 layouts checked in uniform_block.hpp, then
+// replays `frames` frames of the lighting demo into its two blocks, the
+// camera orbiting for the first half and still for the second, and counts
+// the bytes upload() would send against the per-program uniforms it
+// replaced (projection and view for both programs, view_pos and the spot
+// light's position and direction).
+void benchmark_uniform_blocks(int argc, char** argv) {
+  const int frames = argc > 0 ? std::atoi(argv[0]) : 1000;
+
+  std::printf("uniform_blocks: Camera %zu bytes, Lights %zu bytes\n",
+              sizeof(Camera_Block), sizeof(Lights_Block));
+  std::printf("  Lights: dir_light at %zu, spot_light at %zu, cluster_grid "
+              "at %zu, cluster_mapping at %zu\n",
+              offsetof(Lights_Block, dir_light),
+              offsetof(Lights_Block, spot_light),
+              offsetof(Lights_Block, cluster_grid),
+              offsetof(Lights_Block, cluster_mapping));
+
+  Uniform_Block<Camera_Block> camera_block(UNIFORM_BLOCK_CAMERA);
+  Uniform_Block<Lights_Block> lights_block(UNIFORM_BLOCK_LIGHTS);
+
+  Std140_Dir_Light dir_light{};
+  dir_light.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+  dir_light.diffuse = glm::vec3(0.4f);
+  lights_block.set(&Lights_Block::dir_light, dir_light);
+
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+  Std140_Spot_Light spot_light{};
+  spot_light.diffuse = glm::vec3(1.0f);
+  spot_light.cut_off = std::cos(glm::radians(12.5f));
+  std::size_t bytes[2] = {}, ranges[2] = {};
+  std::size_t offset, size;
+
+  for (int frame = 0; frame < frames; frame++) {
+    bool moving = frame < frames / 2;
+    float angle = 0.01f * std::min(frame, frames / 2 - 1);
+    glm::vec3 position(std::sin(angle) * 5.0f, 1.0f, std::cos(angle) * 5.0f);
+
+    camera_block.set(&Camera_Block::projection, projection);
+    camera_block.set(&Camera_Block::view,
+                     glm::lookAt(position, glm::vec3(0.0f),
+                                 glm::vec3(0.0f, 1.0f, 0.0f)));
+    camera_block.set(&Camera_Block::view_pos, position);
+
+    spot_light.position = position;
+    spot_light.direction = glm::normalize(-position);
+    lights_block.set(&Lights_Block::spot_light, spot_light);
+
+    // The first frame sends both blocks whole, as the first upload() does.
+    if (frame == 0) {
+      camera_block.take_dirty_range(offset, size);
+      lights_block.take_dirty_range(offset, size);
+      continue;
+    }
+
+    if (camera_block.take_dirty_range(offset, size)) {
+      bytes[moving] += size;
+      ranges[moving]++;
+    }
+
+    if (lights_block.take_dirty_range(offset, size)) {
+      bytes[moving] += size;
+      ranges[moving]++;
+    }
+  }
+
+  std::size_t per_program = 4 * sizeof(glm::mat4) + 3 * sizeof(glm::vec3);
+  int counted[2] = {frames - frames / 2, frames / 2 - 1};
+  const char* cameras[2] = {"still", "moving"};
+  std::printf("  per-program uniforms:   %5zu bytes in 7 calls per frame\n",
+              per_program);
+
+  for (int moving = 1; moving >= 0; moving--) {
+    int count = std::max(counted[moving], 1);
+    std::printf("  blocks, %-6s camera: %7.1f bytes in %.2f uploads per "
+                "frame\n",
+                cameras[moving], (double)bytes[moving] / count,
+                (double)ranges[moving] / count);
+  }
+}
+
+// Headless: bins `count` random point and spot lights (a quarter spots)
+// into the froxel grid with scalar and SIMD tests, on one thread and on
+// the pool, checks all three build the same lists, and checks at random
+// points in the frustum that every light reaching a point is in the list
+// of the froxel the shader would look the point up in.
+void benchmark_light_clusters(int argc, char** argv) {
+  const std::size_t count =
+      argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 4096;
+  const int iterations = 20;
+
+  std::mt19937 random(3);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<Cluster_Light> lights(count);
+
+  for (std::size_t i = 0; i < count; i++) {
+    lights[i].position =
+        glm::vec3(unit(random) * 60.0f - 30.0f, unit(random) * 40.0f - 20.0f,
+                  -unit(random) * 90.0f);
+    lights[i].range = 1.0f + unit(random) * 4.0f;
+
+    if (i % 4 == 0) {
+      lights[i].direction = glm::normalize(glm::vec3(
+          unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f));
+      lights[i].cos_inner = 0.9f;
+      lights[i].cos_outer = 0.8f;
+    }
+  }
+
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+  glm::mat4 view = glm::mat4(1.0f);
+  Light_Clusters clusters;
+  clusters.set_projection(projection);
+
+  const char* names[3] = {"scalar", "SIMD", "SIMD, threads"};
+  std::vector<std::uint32_t> ranges[3], indices[3];
+  double ms[3];
+
+  for (int method = 0; method < 3; method++) {
+    cull_math math = method == 0 ? CULL_MATH_SCALAR : CULL_MATH_SIMD;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++) {
+      clusters.bin(lights, view, math, method == 2);
+    }
+
+    ms[method] = elapsed_ms(start) / iterations;
+    ranges[method] = clusters.cluster_ranges();
+    indices[method] = clusters.light_indices();
+  }
+
+  bool identical = ranges[0] == ranges[1] && ranges[0] == ranges[2] &&
+                   indices[0] == indices[1] && indices[0] == indices[2];
+
+  const int samples = 10000;
+  std::size_t missed = 0;
+  glm::mat4 inverse = glm::inverse(projection);
+
+  for (int sample = 0; sample < samples; sample++) {
+    float ndc_x = unit(random) * 2.0f - 1.0f;
+    float ndc_y = unit(random) * 2.0f - 1.0f;
+    float depth = 0.1f + unit(random) * 99.9f;
+    glm::vec4 ray = inverse * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+    glm::vec3 point = glm::vec3(ray) / ray.w;
+    point *= depth / -point.z;
+
+    int tile_x = std::min((int)((ndc_x + 1.0f) * 0.5f * CLUSTER_TILES_X),
+                          CLUSTER_TILES_X - 1);
+    int tile_y = std::min((int)((ndc_y + 1.0f) * 0.5f * CLUSTER_TILES_Y),
+                          CLUSTER_TILES_Y - 1);
+    int cluster =
+        (clusters.slice(depth) * CLUSTER_TILES_Y + tile_y) * CLUSTER_TILES_X +
+        tile_x;
+    const std::vector<std::uint32_t>& cluster_ranges =
+        clusters.cluster_ranges();
+    const std::uint32_t* list =
+        clusters.light_indices().data() + cluster_ranges[cluster * 2];
+    const std::uint32_t* list_end = list + cluster_ranges[cluster * 2 + 1];
+
+    for (std::size_t i = 0; i < count; i++) {
+      glm::vec4 bounds = cluster_light_bounds(lights[i]);
+      glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(bounds), 1.0f));
+      glm::vec3 to_point = point - center;
+
+      if (glm::dot(to_point, to_point) <= bounds.w * bounds.w &&
+          std::find(list, list_end, (std::uint32_t)i) == list_end) {
+        missed++;
+      }
+    }
+  }
+
+  const Light_Cluster_Stats& stats = clusters.stats;
+  std::printf("light_clusters: %zu lights, %dx%dx%d clusters\n", count,
+              CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+
+  for (int method = 0; method < 3; method++) {
+    std::printf("  %-14s %8.3f ms (%.1fx)\n", names[method], ms[method],
+                ms[0] / std::max(ms[method], 1e-6));
+  }
+
+  std::printf("  lists identical: %s\n", identical ? "yes" : "NO");
+  std::printf("  %zu lights in range, %zu list entries, %zu/%d clusters "
+              "lit, at most %zu per cluster\n",
+              stats.binned, stats.references, stats.occupied_clusters,
+              CLUSTER_COUNT, stats.max_per_cluster);
+  std::printf("  lights reaching one of %d sample points but missing from "
+              "its cluster: %zu (must be 0)\n",
+              samples, missed);
+}
+
+// Headless: sorts the keys of `count` random draws (16 programs, 512
+// materials, 64 VAOs, a quarter transparent) with radix_sort and with
+// std::stable_sort, and counts the program, material and VAO changes
+// between consecutive draws before and after sorting.
+void benchmark_render_queue(int argc, char** argv) {
+  const std::size_t count =
+      argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 100000;
+  const int iterations = 20;
+
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> depth(0.1f, 100.0f);
+  std::vector<Sort_Entry> submitted(count);
+  std::vector<float> depths(count);
+  // Program, material and VAO of each draw.
+  std::vector<std::array<std::uint32_t, 3>> states(count);
+
+  for (std::size_t i = 0; i < count; i++) {
+    render_pass pass = random() % 4 ? RENDER_PASS_OPAQUE
+                                    : RENDER_PASS_TRANSPARENT;
+    states[i] = {static_cast<std::uint32_t>(random() % 16),
+                 static_cast<std::uint32_t>(random() % 512),
+                 static_cast<std::uint32_t>(random() % 64)};
+    depths[i] = depth(random);
+    submitted[i].key = make_sort_key(pass, states[i][0], states[i][1],
+                                     states[i][2], depths[i]);
+    submitted[i].index = static_cast<std::uint32_t>(i);
+  }
+
+  std::vector<Sort_Entry> radix, scratch, reference;
+  double radix_ms = 0.0, std_ms = 0.0;
+
+  for (int iteration = 0; iteration < iterations; iteration++) {
+    radix = submitted;
+    auto start = std::chrono::steady_clock::now();
+    radix_sort(radix, scratch);
+    radix_ms += elapsed_ms(start);
+
+    reference = submitted;
+    start = std::chrono::steady_clock::now();
+    std::stable_sort(reference.begin(), reference.end(),
+                     [](const Sort_Entry& a, const Sort_Entry& b) {
+                       return a.key < b.key;
+                     });
+    std_ms += elapsed_ms(start);
+  }
+
+  bool same = true;
+  std::size_t out_of_order = 0;
+
+  for (std::size_t i = 0; i < count; i++) {
+    same = same && radix[i].index == reference[i].index;
+
+    // Within a state group opaque depth must rise; across transparent
+    // draws it must fall (up to the key's depth precision).
+    if (i > 0) {
+      std::uint64_t previous = radix[i - 1].key, key = radix[i].key;
+      std::uint64_t a = quantize_sort_depth(depths[radix[i - 1].index]);
+      std::uint64_t b = quantize_sort_depth(depths[radix[i].index]);
+      bool transparent = (key >> 62) == RENDER_PASS_TRANSPARENT;
+
+      if (transparent && (previous >> 62) == RENDER_PASS_TRANSPARENT) {
+        out_of_order += b > a;
+      } else if (!transparent && previous >> 24 == key >> 24) {
+        out_of_order += b < a;
+      }
+    }
+  }
+
+  auto state_changes = [&](const std::vector<Sort_Entry>& order) {
+    std::array<std::size_t, 3> changes = {};
+    std::array<std::uint32_t, 3> current = {~0u, ~0u, ~0u};
+
+    for (const Sort_Entry& entry : order) {
+      const std::array<std::uint32_t, 3>& state = states[entry.index];
+
+      for (int k = 0; k < 3; k++) {
+        changes[k] += state[k] != current[k];
+      }
+
+      current = state;
+    }
+
+    return changes;
+  };
+
+  std::array<std::size_t, 3> before = state_changes(submitted);
+  std::array<std::size_t, 3> after = state_changes(radix);
+
+  std::printf("render_queue: %zu draws\n", count);
+  std::printf("  radix sort:       %8.2f ms\n", radix_ms / iterations);
+  std::printf("  std::stable_sort: %8.2f ms (%.1fx)\n", std_ms / iterations,
+              std_ms / std::max(radix_ms, 1e-6));
+  std::printf("  same order: %s, %zu depth inversions (must be 0)\n",
+              same ? "yes" : "NO", out_of_order);
+  std::printf("  changes     %10s %10s\n", "submitted", "sorted");
+  const char* names[3] = {"program", "material", "VAO"};
+
+  for (int k = 0; k < 3; k++) {
+    std::printf("  %-11s %10zu %10zu\n", names[k], before[k], after[k]);
+  }
+}
+
+// Draws `count` cubes into the hidden window once with a uniform update and
+// draw call per cube and once as a single instanced draw, then measures
+// Instance_Buffer uploads after changing every, 1% and none of the cubes,
+// and after the camera turns by a degree with the visible cubes packed the
+// way the demos do it.
+void benchmark_instancing(int argc, char** argv) {
+  const std::size_t count =
+      argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 100000;
+
+  Shader shader("src/shader/model_loading.vs", "src/shader/model_loading.fs");
+  Mesh cube = make_cube_mesh();
+  std::vector<glm::mat4> models(count);
+  std::size_t side =
+      static_cast<std::size_t>(std::ceil(std::cbrt((double)count)));
+
+  for (std::size_t i = 0; i < count; i++) {
+    glm::vec3 cell(i % side, i / side % side, i / (side * side));
+    models[i] = glm::translate(glm::mat4(1.0f), cell * 2.0f);
+  }
+
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(-10.0f), glm::vec3(side),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+
+  Uniform_Block<Camera_Block> camera_block(UNIFORM_BLOCK_CAMERA);
+  camera_block.set(&Camera_Block::projection, projection);
+  camera_block.set(&Camera_Block::view, view);
+  camera_block.upload();
+
+  shader.use();
+  glBindVertexArray(cube.VAO);
+  glFinish();
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (const glm::mat4& model : models) {
+    shader.set_uniform_mat4("model", model);
+    cube.draw_elements();
+  }
+
+  glFinish();
+  double per_draw_ms = elapsed_ms(start);
+
+  Instance_Buffer instances;
+  double upload_ms[3];
+  std::size_t upload_bytes[3];
+
+  for (int pass = 0; pass < 3; pass++) {
+    start = std::chrono::steady_clock::now();
+    instances.resize(count);
+
+    // The second pass turns the first 1% of the cubes, the third sets the
+    // same matrices again.
+    for (std::size_t i = 0; i < count; i++) {
+      glm::mat4 model = models[i];
+
+      if (pass > 0 && i < count / 100) {
+        model = glm::rotate(model, 0.5f, glm::vec3(0.0f, 1.0f, 0.0f));
+      }
+
+      instances.set(i, model);
+    }
+
+    upload_bytes[pass] = instances.upload();
+    glFinish();
+    upload_ms[pass] = elapsed_ms(start);
+  }
+
+  // Culled packing: fill the buffer for one view, then turn the camera.
+  Cull_Bounds bounds;
+  bounds.reserve(count);
+
+  for (const glm::mat4& model : models) {
+    bounds.push_back(glm::vec3(-0.5f), glm::vec3(0.5f), model);
+  }
+
+  Instance_Buffer packed;
+  std::vector<unsigned char> visible;
+  std::size_t packed_bytes = 0, packed_visible = 0;
+
+  for (int turn = 0; turn < 2; turn++) {
+    glm::mat4 turned = glm::rotate(glm::mat4(1.0f), glm::radians(1.0f * turn),
+                                   glm::vec3(0.0f, 1.0f, 0.0f)) *
+                       view;
+    Frustum_Cull_Stats stats;
+    cull_bounds(Frustum(projection, turned), bounds, visible, stats);
+    packed.pack(models, visible);
+    packed_bytes = packed.upload();
+    packed_visible = stats.visible();
+  }
+
+  packed.reset();
+
+  instances.attach(cube.vertex_array_id());
+  glBindVertexArray(cube.VAO);
+  start = std::chrono::steady_clock::now();
+  shader.set_uniform_bool("instanced", true);
+  cube.draw_elements_instanced(instances.size());
+  glFinish();
+  double instanced_ms = elapsed_ms(start);
+
+  shader.set_uniform_bool("instanced", false);
+  glBindVertexArray(0);
+  shader.delete_program();
+
+  std::printf("instancing: %zu cubes\n", count);
+  std::printf("  draw per cube:   %8.2f ms\n", per_draw_ms);
+  std::printf("  instanced draw:  %8.2f ms (%.1fx)\n", instanced_ms,
+              per_draw_ms / std::max(instanced_ms, 1e-3));
+
+  const char* passes[3] = {"all changed", "1% changed", "none changed"};
+
+  for (int pass = 0; pass < 3; pass++) {
+    std::printf("  upload, %-12s %8.2f ms, %8.1f KiB\n", passes[pass],
+                upload_ms[pass], upload_bytes[pass] / 1024.0);
+  }
+
+  // Dense packing shifts the slots behind each cube that enters or leaves
+  // the view, so this is most of the visible set rather than the change.
+  std::printf("  upload, culled and packed, camera turned 1 degree: "
+              "%.1f of %.1f KiB (%zu visible)\n",
+              packed_bytes / 1024.0,
+              packed_visible * sizeof(Instance_Transform) / 1024.0,
+              packed_visible);
+}
+
+// Headless: the precision of the G-buffer packing. Round trips random unit
+// normals through octahedral RG16 and, for comparison, 8-bit xyz, and
+// rebuilds world positions from 24-bit depth with the lighting demo's
+// projection, reporting the worst errors.
+void benchmark_g_buffer(int argc, char** argv) {
+  const int samples = argc > 0 ? std::atoi(argv[0]) : 1000000;
+
+  std::mt19937 random(5);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  double octahedral_error = 0.0, xyz8_error = 0.0;
+  // In double: acos of a float dot product is off by ~0.02 degrees alone.
+  auto angle = [](const glm::vec3& a, const glm::vec3& b) {
+    double dot = (double)a.x * b.x + (double)a.y * b.y + (double)a.z * b.z;
+    double length = std::sqrt(((double)a.x * a.x + (double)a.y * a.y +
+                               (double)a.z * a.z) *
+                              ((double)b.x * b.x + (double)b.y * b.y +
+                               (double)b.z * b.z));
+    return std::acos(std::clamp(dot / length, -1.0, 1.0));
+  };
+
+  for (int i = 0; i < samples; i++) {
+    glm::vec3 n = glm::normalize(
+        glm::vec3(normal(random), normal(random), normal(random)));
+    glm::vec3 octahedral =
+        octahedral_decode(quantize_rg16(octahedral_encode(n)));
+    glm::vec3 xyz8;
+
+    for (int axis = 0; axis < 3; axis++) {
+      xyz8[axis] = std::round((n[axis] * 0.5f + 0.5f) * 255.0f) / 255.0f;
+    }
+
+    xyz8 = glm::normalize(xyz8 * 2.0f - 1.0f);
+
+    octahedral_error = std::max(octahedral_error, angle(n, octahedral));
+    xyz8_error = std::max(xyz8_error, angle(n, xyz8));
+  }
+
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 6.0f), glm::vec3(0.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 view_projection = projection * view;
+  glm::mat4 inverse_projection = glm::inverse(projection);
+  glm::mat4 inverse_view = glm::inverse(view);
+  glm::mat4 inverse_view_projection = glm::inverse(view_projection);
+  const float ranges[3] = {10.0f, 50.0f, 100.0f};
+  double position_error[3] = {0.0, 0.0, 0.0};
+
+  for (int i = 0; i < samples; i++) {
+    glm::vec2 ndc(unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f);
+    float distance = 0.1f + unit(random) * 99.9f;
+    glm::vec4 ray = inverse_projection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    glm::vec3 view_point = glm::vec3(ray) / ray.w;
+    view_point *= distance / -view_point.z;
+    glm::vec3 point = glm::vec3(inverse_view * glm::vec4(view_point, 1.0f));
+
+    glm::vec4 clip = view_projection * glm::vec4(point, 1.0f);
+    float depth = (clip.z / clip.w) * 0.5f + 0.5f;
+    depth = std::round(depth * 16777215.0f) / 16777215.0f;
+    glm::vec2 uv(clip.x / clip.w * 0.5f + 0.5f, clip.y / clip.w * 0.5f + 0.5f);
+    glm::vec3 rebuilt =
+        reconstruct_position(inverse_view_projection, uv, depth);
+    int range = distance <= ranges[0] ? 0 : distance <= ranges[1] ? 1 : 2;
+
+    position_error[range] = std::max(position_error[range],
+                                     (double)glm::length(rebuilt - point));
+  }
+
+  // Position and normal in RGBA16F, albedo and specular in RGBA8, depth.
+  const std::size_t naive_bytes = 8 + 8 + 4 + 4 + 4;
+
+  std::printf("g_buffer: %d samples\n", samples);
+  std::printf("  %zu bytes per pixel (%zu with a stored position), "
+              "%.1f MiB at 1920x1080\n",
+              G_BUFFER_BYTES_PER_PIXEL, naive_bytes,
+              1920.0 * 1080.0 * G_BUFFER_BYTES_PER_PIXEL / (1024 * 1024));
+  std::printf("  worst normal error: octahedral RG16 %.4f deg, "
+              "xyz RGB8 %.4f deg\n",
+              glm::degrees(octahedral_error), glm::degrees(xyz8_error));
+
+  for (int range = 0; range < 3; range++) {
+    std::printf("  worst position error from 24-bit depth up to %3.0f: "
+                "%.5f\n",
+                ranges[range], position_error[range]);
+  }
+}
+
+// The lighting demo's stress scene at 1280x720, offscreen: `cubes` textured
+// cubes in a block ahead of the camera, drawn far to near so most
+// fragments are overdrawn, lit by `lights` clustered point and spot lights
+// as well as the directional and camera spot lights. Times frames of the
+// forward and deferred paths (to glFinish) and compares their images.
+void benchmark_shading(int argc, char** argv) {
+  const std::size_t cube_count =
+      argc > 0 ? std::strtoul(argv[0], nullptr, 10) : 20000;
+  const std::size_t light_count =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1024;
+  const int frames = 20;
+  const int width = 1280, height = 720;
+
+  Shader forward_shader("src/shader/lighting_object.vs",
+                        "src/shader/lighting_object.fs");
+  Deferred_Renderer deferred;
+  Mesh cube = make_cube_mesh();
+
+  Texture_Cache& texture_cache = Texture_Cache::shared();
+  unsigned int diffuse_map = texture_cache.acquire("data/container2.png");
+  unsigned int specular_map =
+      texture_cache.acquire("data/container2_specular.png");
+  texture_cache.finish();
+
+  forward_shader.use();
+  forward_shader.set_uniform_int("material.diffuse"_uniform, 0);
+  forward_shader.set_uniform_int("material.specular"_uniform, 1);
+  forward_shader.set_uniform_float("material.shininess"_uniform, 32.0f);
+  deferred.geometry_shader.use();
+  deferred.geometry_shader.set_uniform_int("material.diffuse"_uniform, 0);
+  deferred.geometry_shader.set_uniform_int("material.specular"_uniform, 1);
+  deferred.lighting_shader.use();
+  deferred.lighting_shader.set_uniform_float("shininess"_uniform, 32.0f);
+
+  std::size_t side =
+      static_cast<std::size_t>(std::ceil(std::cbrt((double)cube_count)));
+  float extent = side * 1.5f;
+  Instance_Buffer instances;
+  instances.resize(cube_count);
+
+  // Index 0 is the far corner of the block.
+  for (std::size_t i = 0; i < cube_count; i++) {
+    glm::vec3 cell(i % side, i / side % side, i / (side * side));
+    glm::vec3 position = glm::vec3(cell.x * 1.5f - extent * 0.5f,
+                                   cell.y * 1.5f - extent * 0.5f,
+                                   -4.0f - extent + cell.z * 1.5f);
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    instances.set(i, glm::rotate(model, (float)i, glm::vec3(1.0f, 0.3f, 0.5f)));
+  }
+
+  instances.upload();
+  instances.attach(cube.vertex_array_id());
+
+  std::mt19937 random(6);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<Cluster_Light> lights(light_count);
+
+  for (std::size_t i = 0; i < light_count; i++) {
+    lights[i].position = glm::vec3((unit(random) - 0.5f) * extent,
+                                   (unit(random) - 0.5f) * extent,
+                                   -4.0f - unit(random) * extent);
+    lights[i].range = 2.0f + unit(random) * 2.0f;
+    lights[i].color =
+        glm::vec3(unit(random), unit(random), unit(random)) * 2.0f;
+
+    if (i % 4 == 0) {
+      lights[i].direction = glm::vec3(0.0f, -1.0f, 0.0f);
+      lights[i].cos_inner = glm::cos(glm::radians(20.0f));
+      lights[i].cos_outer = glm::cos(glm::radians(30.0f));
+    }
+  }
+
+  glm::mat4 projection = glm::perspective(
+      glm::radians(45.0f), (float)width / (float)height, 0.1f, 100.0f);
+  glm::mat4 view = glm::mat4(1.0f);
+  Light_Clusters clusters;
+  clusters.set_projection(projection);
+  clusters.bin(lights, view);
+  Light_Cluster_Buffers cluster_buffers;
+  cluster_buffers.upload(lights, clusters);
+
+  Uniform_Block<Camera_Block> camera_block(UNIFORM_BLOCK_CAMERA);
+  camera_block.set(&Camera_Block::projection, projection);
+  camera_block.set(&Camera_Block::view, view);
+  camera_block.set(&Camera_Block::view_pos, glm::vec3(0.0f));
+  camera_block.upload();
+
+  Uniform_Block<Lights_Block> lights_block(UNIFORM_BLOCK_LIGHTS);
+  Std140_Dir_Light dir_light{};
+  dir_light.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+  dir_light.ambient = glm::vec3(0.05f);
+  dir_light.diffuse = glm::vec3(0.4f);
+  dir_light.specular = glm::vec3(0.5f);
+  Std140_Spot_Light spot_light{};
+  spot_light.direction = glm::vec3(0.0f, 0.0f, -1.0f);
+  spot_light.diffuse = glm::vec3(1.0f);
+  spot_light.specular = glm::vec3(1.0f);
+  spot_light.constant = 1.0f;
+  spot_light.linear = 0.09f;
+  spot_light.quadratic = 0.032f;
+  spot_light.cut_off = glm::cos(glm::radians(12.5f));
+  spot_light.outer_cut_off = glm::cos(glm::radians(15.0f));
+  glm::vec2 depth_mapping = clusters.depth_mapping();
+  lights_block.set(&Lights_Block::dir_light, dir_light);
+  lights_block.set(&Lights_Block::spot_light, spot_light);
+  lights_block.set(&Lights_Block::cluster_grid,
+                   glm::ivec4{CLUSTER_TILES_X, CLUSTER_TILES_Y,
+                              CLUSTER_SLICES, 0});
+  lights_block.set(&Lights_Block::cluster_mapping,
+                   glm::vec4(depth_mapping.x, depth_mapping.y,
+                             (float)CLUSTER_TILES_X / width,
+                             (float)CLUSTER_TILES_Y / height));
+  lights_block.upload();
+
+  forward_shader.use();
+  cluster_buffers.bind(forward_shader);
+  deferred.lighting_shader.use();
+  cluster_buffers.bind(deferred.lighting_shader);
+
+  // One colour and depth target per path; the depth format matches the
+  // G-buffer's so the deferred path can copy its depth across.
+  Gl_Framebuffer targets[2];
+  Gl_Texture target_colors[2], target_depths[2];
+
+  for (int path = 0; path < 2; path++) {
+    targets[path] = Gl_Framebuffer::create("shading benchmark target");
+    target_colors[path] = Gl_Texture::create("shading benchmark colour");
+    target_depths[path] = Gl_Texture::create("shading benchmark depth");
+
+    glBindTexture(GL_TEXTURE_2D, target_colors[path].get());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, target_depths[path].get());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0,
+                 GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, targets[path].get());
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           target_colors[path].get(), 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                           GL_TEXTURE_2D, target_depths[path].get(), 0);
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, diffuse_map);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, specular_map);
+  glActiveTexture(GL_TEXTURE0);
+  glEnable(GL_DEPTH_TEST);
+  glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+
+  auto draw_frame = [&](render_path path) {
+    GLuint target = targets[path].get();
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    if (path == RENDER_PATH_DEFERRED) {
+      deferred.begin_geometry(width, height);
+      deferred.geometry_shader.use();
+    } else {
+      forward_shader.use();
+    }
+
+    glBindVertexArray(cube.VAO);
+    cube.draw_elements_instanced(instances.size());
+    glBindVertexArray(0);
+
+    if (path == RENDER_PATH_DEFERRED) {
+      deferred.light(target, projection, view);
+    }
+  };
+
+  double frame_ms[2];
+  std::vector<unsigned char> pixels[2];
+
+  for (int path = 0; path < 2; path++) {
+    draw_frame((render_path)path);
+    glFinish();
+    auto start = std::chrono::steady_clock::now();
+
+    for (int frame = 0; frame < frames; frame++) {
+      draw_frame((render_path)path);
+    }
+
+    glFinish();
+    frame_ms[path] = elapsed_ms(start) / frames;
+
+    pixels[path].resize((std::size_t)width * height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, targets[path].get());
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                 pixels[path].data());
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  double difference = 0.0;
+  std::size_t differing = 0;
+
+  for (std::size_t i = 0; i < pixels[0].size(); i += 4) {
+    int worst = 0;
+
+    for (int channel = 0; channel < 3; channel++) {
+      int d = std::abs(pixels[0][i + channel] - pixels[1][i + channel]);
+      difference += d;
+      worst = std::max(worst, d);
+    }
+
+    differing += worst > 8;
+  }
+
+  difference /= (double)width * height * 3;
+  std::size_t g_buffer_bytes = deferred.g_buffer.bytes();
+
+  for (int path = 0; path < 2; path++) {
+    targets[path].reset();
+    target_colors[path].reset();
+    target_depths[path].reset();
+  }
+
+  deferred.reset();
+  forward_shader.delete_program();
+  instances.reset();
+  cluster_buffers.reset();
+  camera_block.reset();
+  lights_block.reset();
+  texture_cache.release(diffuse_map);
+  texture_cache.release(specular_map);
+
+  std::printf("shading: %zu cubes, %zu lights, %dx%d\n", cube_count,
+              light_count, width, height);
+  std::printf("  %zu lights in range, at most %zu per cluster\n",
+              clusters.stats.binned, clusters.stats.max_per_cluster);
+
+  for (int path = 0; path < 2; path++) {
+    std::printf("  %-9s %8.2f ms per frame (%.2fx)\n",
+                render_path_name((render_path)path), frame_ms[path],
+                frame_ms[0] / std::max(frame_ms[path], 1e-3));
+  }
+
+  std::printf("  G-buffer %.1f MiB\n", g_buffer_bytes / (1024.0 * 1024.0));
+  std::printf("  images differ by %.2f/255 on average, %zu pixels by more "
+              "than 8\n",
+              difference, differing);
+}
+
+const Benchmark BENCHMARKS[] = {
+    {"model_cache", true, benchmark_model_cache},
+    {"texture_decode", true, benchmark_texture_decode},
+    {"texture_bake", true, benchmark_texture_bake},
+    {"mipmap", false, benchmark_mipmap},
+    {"vertex_format", true, benchmark_vertex_format},
+    {"index_optimizer", false, benchmark_index_optimizer},
+    {"meshlets", false, benchmark_meshlets},
+    {"lod_chain", false, benchmark_lod_chain},
+    {"vertex_convert", false, benchmark_vertex_convert},
+    {"animation", false, benchmark_animation},
+    {"frustum_cull", false, benchmark_frustum_cull},
+    {"occlusion_cull", false, benchmark_occlusion_cull},
+    {"instancing", true, benchmark_instancing},
+    {"render_queue", false, benchmark_render_queue},
+    {"uniforms", true, benchmark_uniforms},
+    {"uniform_blocks", false, benchmark_uniform_blocks},
+    {"light_clusters", false, benchmark_light_clusters},
+    {"g_buffer", false, benchmark_g_buffer},
+    {"shading", true, benchmark_shading},
+};
+
+GLFWwindow* create_hidden_context() {
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+  GLFWwindow* window = glfwCreateWindow(64, 64, "Benchmark", NULL, NULL);
+
+  if (!window) {
+    std::cout << "Failed to create GLFW window\n";
+    glfwTerminate();
+
+    return nullptr;
+  }
+
+  glfwMakeContextCurrent(window);
+
+  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+    std::cout << "Failed to initialise GLAD\n";
+    glfwTerminate();
+
+    return nullptr;
+  }
+
+  stbi_set_flip_vertically_on_load(true);
+
+  return window;
+}
+
+int main(int argc, char** argv) {
+  const char* name = argc > 1 ? argv[1] : nullptr;
+  GLFWwindow* window = nullptr;
+  bool found = false;
+
+  for (const Benchmark& benchmark : BENCHMARKS) {
+    if (name && std::strcmp(name, benchmark.name) != 0) {
+      continue;
+    }
+
+    found = true;
+
+    if (benchmark.needs_gl && !window) {
+      window = create_hidden_context();
+
+      if (!window) {
+        return -1;
+      }
+    }
+
+    // Only a single named benchmark receives the trailing arguments.
+    benchmark.run(name ? argc - 2 : 0, name ? argv + 2 : nullptr);
+
+    // There is no frame loop here to retire released objects.
+    if (window) {
+      Gl_Resources::shared().flush();
+    }
+  }
+
+  if (!found) {
+    std::cerr << "Unknown benchmark: " << name << "\n";
+    return -1;
+  }
+
+  if (window) {
+    Texture_Cache::shared().evict_unused();
+    Texture_Cache::shared().clear_placeholders();
+    Gl_Resources::shared().flush();
+    Gl_Resources::shared().print_leak_report();
+    glfwTerminate();
+  }
+
+  return 0;
+}
@@ -1,5 +1,9 @@
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -10,7 +14,13 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "camera.hpp"
+#include "cube_mesh.hpp"
+#include "frustum_cull.hpp"
+#include "gl_resource.hpp"
+#include "instancing.hpp"
 #include "shader.hpp"
+#include "texture_cache.hpp"
+#include "uniform_block.hpp"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double x_pos, double y_pos);
@@ -20,6 +30,10 @@ void process_input(GLFWwindow* window);
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
+// 10 draws the usual scene; raise it (e.g. to 100000) to stress the
+// instanced path with a field of cubes behind it.
+const std::size_t CUBE_COUNT = 10;
+
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 bool first_mouse = true;
 float last_x = SCR_WIDTH / 2.0f;
@@ -62,50 +76,6 @@ int main() {
 
   Shader shader("src/shader/container.vs", "src/shader/container.fs");
 
-  float vertices[] = {
-    -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-     0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
-     0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-     0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-
-    -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-     0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-
-    -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-
-     0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-     0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-     0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-
-    -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
-     0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-     0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-
-    -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-     0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
-  };
-
   glm::vec3 cube_positions[] = {
     glm::vec3( 0.0f,  0.0f,  0.0f),
     glm::vec3( 2.0f,  5.0f, -15.0f),
@@ -119,75 +89,57 @@ int main() {
     glm::vec3(-1.3f,  1.0f, -1.5f)
   };
 
-  unsigned int VBO, VAO;
-  glGenVertexArrays(1, &VAO);
-  glGenBuffers(1, &VBO);
-
-  glBindVertexArray(VAO);
-
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-  glEnableVertexAttribArray(0);
-
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
-                        (void*)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
-
-  unsigned int texture1, texture2;
-  glGenTextures(1, &texture1);
-  glBindTexture(GL_TEXTURE_2D, texture1);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                  GL_LINEAR_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  std::unique_ptr<Mesh> cube_mesh =
+      std::make_unique<Mesh>(make_cube_mesh());
 
   // Texture
   stbi_set_flip_vertically_on_load(true);
 
-  int width, height, n_channels;
-  unsigned char* data =
-      stbi_load("data/container.jpg", &width, &height, &n_channels, 0);
-
-  if (data) {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-  } else {
-    std::cerr << "Failed to load texture\n";
-  }
+  Texture_Cache& texture_cache = Texture_Cache::shared();
+  unsigned int texture1 = texture_cache.acquire("data/container.jpg");
+  unsigned int texture2 = texture_cache.acquire("data/awesomeface.png");
+  texture_cache.finish();
 
-  stbi_image_free(data);
-
-  glGenTextures(1, &texture2);
-  glBindTexture(GL_TEXTURE_2D, texture2);
+  shader.use();
+  shader.set_uniform_int("texture1", 0);
+  shader.set_uniform_int("texture2", 1);
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  // Past the ten scene cubes, the rest of CUBE_COUNT fill a grid further
+  // down -z. Only the first `spinning_cubes` move from frame to frame.
+  std::size_t side =
+      static_cast<std::size_t>(std::ceil(std::cbrt((double)CUBE_COUNT)));
+  std::size_t spinning_cubes =
+      std::min(CUBE_COUNT, std::max<std::size_t>(10, CUBE_COUNT / 100));
+  std::vector<glm::vec3> cube_field(cube_positions, cube_positions + 10);
+
+  for (std::size_t i = 10; i < CUBE_COUNT; i++) {
+    float x = (float)(i % side) - side * 0.5f;
+    float y = (float)(i / side % side) - side * 0.5f;
+    float z = (float)(i / (side * side));
+    cube_field.push_back(glm::vec3(x, y, -z) * 3.0f - glm::vec3(0, 0, 20));
+  }
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                  GL_LINEAR_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  auto cube_model = [&](std::size_t i, float time) {
+    float angle = 20.0f * (i % 10 + 1) * time;
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), cube_field[i]);
+    return glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+  };
 
-  data = stbi_load("data/awesomeface.png", &width, &height, &n_channels, 0);
+  // World-space boxes of the cubes, frustum culled every frame; only the
+  // spinning ones are refreshed.
+  Cull_Bounds cube_bounds;
+  std::vector<unsigned char> cube_visible;
+  std::vector<glm::mat4> cube_models(CUBE_COUNT);
+  cube_bounds.reserve(CUBE_COUNT);
 
-  if (data) {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-  } else {
-    std::cerr << "Failed to load texture\n";
+  for (std::size_t i = 0; i < CUBE_COUNT; i++) {
+    cube_models[i] = cube_model(i, 0.0f);
+    cube_bounds.push_back(glm::vec3(-0.5f), glm::vec3(0.5f), cube_models[i]);
   }
 
-  stbi_image_free(data);
-
-  shader.use();
-  shader.set_uniform_int("texture1", 0);
-  shader.set_uniform_int("texture2", 1);
+  Instance_Buffer instances;
+  Uniform_Block<Camera_Block> camera_block(UNIFORM_BLOCK_CAMERA);
+  float last_title_time = 0.0f;
 
   while (!glfwWindowShouldClose(window)) {
     float current_frame_time = static_cast<float>(glfwGetTime());
@@ -208,39 +160,61 @@ int main() {
     shader.use();
 
     glm::mat4 view = camera.get_view_matrix();
-    shader.set_uniform_mat4("view", view);
-
     glm::mat4 projection =
         glm::perspective(glm::radians(camera.zoom),
                          (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    shader.set_uniform_mat4("projection", projection);
-
-    glBindVertexArray(VAO);
-
-    for (unsigned int i = 0; i < 10; i++) {
-      glm::mat4 model = glm::mat4(1.0f);
-      model = glm::translate(model, cube_positions[i]);
-
-      float angle = 20.0f * (i + 1) * glfwGetTime();
-      model =
-          glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-
-      shader.set_uniform_mat4("model", model);
+    camera_block.set(&Camera_Block::projection, projection);
+    camera_block.set(&Camera_Block::view, view);
+    camera_block.set(&Camera_Block::view_pos, camera.position);
+    camera_block.upload();
+
+    for (std::size_t i = 0; i < spinning_cubes; i++) {
+      cube_models[i] = cube_model(i, current_frame_time);
+      cube_bounds.set(i, glm::vec3(-0.5f), glm::vec3(0.5f), cube_models[i]);
+    }
 
-      glDrawArrays(GL_TRIANGLES, 0, 36);
+    Frustum_Cull_Stats cull_stats;
+    cull_bounds(Frustum(projection, view), cube_bounds, cube_visible,
+                cull_stats);
+
+    // Turning the camera changes the visible set and shifts the packed
+    // slots, so most of the buffer goes up again; see Instance_Buffer::pack.
+    instances.pack(cube_models, cube_visible);
+    instances.upload();
+    instances.attach(cube_mesh->vertex_array_id());
+    glBindVertexArray(cube_mesh->VAO);
+    cube_mesh->draw_elements_instanced(instances.size());
+
+    if (current_frame_time - last_title_time > 0.5f) {
+      char title[128];
+      std::snprintf(title, sizeof(title),
+                    "Awesome container - %zu/%zu cubes culled, %.1f KiB "
+                    "of instances uploaded",
+                    cull_stats.culled, cull_stats.tested,
+                    instances.uploaded_bytes / 1024.0f);
+      glfwSetWindowTitle(window, title);
+      last_title_time = current_frame_time;
     }
 
     // glDrawArrays(GL_TRIANGLES, 0, 36);
     // glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
+    Gl_Resources::shared().end_frame();
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
 
-  glDeleteVertexArrays(1, &VAO);
-  glDeleteBuffers(1, &VBO);
+  instances.reset();
+  camera_block.reset();
+  cube_mesh.reset();
+  texture_cache.release(texture1);
+  texture_cache.release(texture2);
+  texture_cache.evict_unused();
   shader.delete_program();
 
+  Gl_Resources::shared().flush();
+  Gl_Resources::shared().print_leak_report();
+
   glfwTerminate();
 
   return 0;
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+
+// A unit cube centred on the origin: 24 vertices (4 per face, so normals
+// and texture coordinates stay per face) and 36 indices, counter-clockwise
+// seen from outside. The demos draw it instanced.
+inline Mesh make_cube_mesh() {
+  // Normal, then the face's u and v axes; cross(u, v) == normal.
+  const glm::vec3 faces[6][3] = {
+      {{1, 0, 0}, {0, 0, -1}, {0, 1, 0}},  {{-1, 0, 0}, {0, 0, 1}, {0, 1, 0}},
+      {{0, 1, 0}, {1, 0, 0}, {0, 0, -1}},  {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}},
+      {{0, 0, 1}, {1, 0, 0}, {0, 1, 0}},   {{0, 0, -1}, {-1, 0, 0}, {0, 1, 0}}};
+  const glm::vec2 corners[4] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+
+  for (const glm::vec3* face : faces) {
+    unsigned int first = static_cast<unsigned int>(vertices.size());
+
+    for (const glm::vec2& corner : corners) {
+      Vertex vertex{};
+      vertex.position = 0.5f * (face[0] + (corner.x * 2.0f - 1.0f) * face[1] +
+                                (corner.y * 2.0f - 1.0f) * face[2]);
+      vertex.normal = face[0];
+      vertex.tex_coords = corner;
+      vertex.tangent = face[1];
+      vertex.bitangent = face[2];
+      vertices.push_back(vertex);
+    }
+
+    for (unsigned int index : {0u, 1u, 2u, 2u, 3u, 0u}) {
+      indices.push_back(first + index);
+    }
+  }
+
+  return Mesh(std::move(vertices), std::move(indices), {});
+}
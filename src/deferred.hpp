@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_resource.hpp"
+#include "shader.hpp"
+
+// Deferred shading. The geometry pass writes each visible surface once into
+// a compact G-buffer:
+//
+//   albedo_specular  RGBA8             diffuse colour, specular intensity
+//   normal           RG16              octahedral world-space normal
+//   depth            DEPTH24_STENCIL8  world position is rebuilt from it
+//
+// 12 bytes a pixel. The lighting pass then shades every covered pixel once
+// with a full-screen triangle, reading the material a single time and
+// looping over the light list of its froxel from light_clusters.hpp, so the
+// screen tiles the forward path bins lights into double as the deferred
+// light tiles. Overdraw in the geometry pass costs only the G-buffer write.
+//
+// The specular map is reduced to one intensity and every surface shares
+// one shininess; the forward path keeps both per material.
+
+enum render_path { RENDER_PATH_FORWARD, RENDER_PATH_DEFERRED };
+
+inline const char* render_path_name(render_path path) {
+  return path == RENDER_PATH_FORWARD ? "forward" : "deferred";
+}
+
+// Units the lighting pass reads the G-buffer from, clear of the material
+// maps and of the cluster and bone palette textures.
+const int G_BUFFER_ALBEDO_SPECULAR_TEXTURE_UNIT = 9;
+const int G_BUFFER_NORMAL_TEXTURE_UNIT = 10;
+const int G_BUFFER_DEPTH_TEXTURE_UNIT = 11;
+
+const std::size_t G_BUFFER_BYTES_PER_PIXEL = 4 + 4 + 4;
+
+// C++ mirrors of the shaders' normal packing and position reconstruction,
+// for checking their precision headless.
+
+// Folds the unit sphere onto the [-1, 1] square: the upper hemisphere onto
+// the inner diamond, the lower onto the corners.
+inline glm::vec2 octahedral_encode(glm::vec3 n) {
+  n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+
+  if (n.z >= 0.0f) {
+    return glm::vec2(n.x, n.y);
+  }
+
+  return glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                   (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+inline glm::vec3 octahedral_decode(glm::vec2 e) {
+  glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+  float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+
+  return glm::normalize(n);
+}
+
+// Rounds an encoded normal to what the RG16 target keeps.
+inline glm::vec2 quantize_rg16(glm::vec2 e) {
+  auto round = [](float x) {
+    return std::floor((x * 0.5f + 0.5f) * 65535.0f + 0.5f) / 65535.0f * 2.0f -
+           1.0f;
+  };
+
+  return glm::vec2(round(e.x), round(e.y));
+}
+
+// The world position at window coordinates `uv` in [0, 1] with depth
+// buffer value `depth`.
+inline glm::vec3 reconstruct_position(const glm::mat4& inverse_view_projection,
+                                      glm::vec2 uv, float depth) {
+  glm::vec4 clip(uv.x * 2.0f - 1.0f, uv.y * 2.0f - 1.0f, depth * 2.0f - 1.0f,
+                 1.0f);
+  glm::vec4 world = inverse_view_projection * clip;
+
+  return glm::vec3(world) / world.w;
+}
+
+class G_Buffer {
+ public:
+  int width = 0;
+  int height = 0;
+
+  // (Re)allocates the attachments when the size changes; false if the
+  // framebuffer is not complete.
+  bool resize(int new_width, int new_height) {
+    if (framebuffer && new_width == width && new_height == height) {
+      return true;
+    }
+
+    width = new_width;
+    height = new_height;
+
+    if (!framebuffer) {
+      framebuffer = Gl_Framebuffer::create("g-buffer");
+      albedo_specular = Gl_Texture::create("g-buffer albedo and specular");
+      normal = Gl_Texture::create("g-buffer normal");
+      depth = Gl_Texture::create("g-buffer depth");
+    }
+
+    allocate(albedo_specular.get(), GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    allocate(normal.get(), GL_RG16, GL_RG, GL_UNSIGNED_SHORT);
+    allocate(depth.get(), GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL,
+             GL_UNSIGNED_INT_24_8);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.get());
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           albedo_specular.get(), 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                           normal.get(), 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                           GL_TEXTURE_2D, depth.get(), 0);
+
+    const GLenum draw_buffers[2] = {GL_COLOR_ATTACHMENT0,
+                                    GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, draw_buffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+      std::cerr << "ERROR::G_BUFFER::INCOMPLETE\nstatus 0x" << std::hex
+                << status << std::dec << "\n";
+      return false;
+    }
+
+    return true;
+  }
+
+  GLuint get() const { return framebuffer.get(); }
+
+  std::size_t bytes() const {
+    return (std::size_t)width * height * G_BUFFER_BYTES_PER_PIXEL;
+  }
+
+  void bind_textures() const {
+    glActiveTexture(GL_TEXTURE0 + G_BUFFER_ALBEDO_SPECULAR_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, albedo_specular.get());
+    glActiveTexture(GL_TEXTURE0 + G_BUFFER_NORMAL_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, normal.get());
+    glActiveTexture(GL_TEXTURE0 + G_BUFFER_DEPTH_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, depth.get());
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // Deletes the GL objects, for before Gl_Resources::flush().
+  void reset() {
+    framebuffer.reset();
+    albedo_specular.reset();
+    normal.reset();
+    depth.reset();
+    width = height = 0;
+  }
+
+ private:
+  Gl_Framebuffer framebuffer;
+  Gl_Texture albedo_specular, normal, depth;
+
+  // Read with texelFetch only, so one level and no filtering.
+  void allocate(GLuint texture, GLint internal_format, GLenum format,
+                GLenum type) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format,
+                 type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+};
+
+// The two passes around a G_Buffer. Draw the geometry pass with
+// geometry_shader, whose "material.diffuse" and "material.specular"
+// samplers and the lighting shader's "shininess" are the caller's to set,
+// as are the cluster textures (Light_Cluster_Buffers::bind()) and the
+// Camera and Lights blocks the lighting pass reads.
+class Deferred_Renderer {
+ public:
+  G_Buffer g_buffer;
+  Shader geometry_shader;
+  Shader lighting_shader;
+
+  Deferred_Renderer()
+      : geometry_shader("src/shader/lighting_object.vs",
+                        "src/shader/gbuffer.fs"),
+        lighting_shader("src/shader/deferred_lighting.vs",
+                        "src/shader/deferred_lighting.fs"),
+        empty_vertex_array(
+            Gl_Vertex_Array::create("deferred full-screen triangle")) {
+    lighting_shader.use();
+    lighting_shader.set_uniform_int("g_albedo_specular"_uniform,
+                                    G_BUFFER_ALBEDO_SPECULAR_TEXTURE_UNIT);
+    lighting_shader.set_uniform_int("g_normal"_uniform,
+                                    G_BUFFER_NORMAL_TEXTURE_UNIT);
+    lighting_shader.set_uniform_int("g_depth"_uniform,
+                                    G_BUFFER_DEPTH_TEXTURE_UNIT);
+  }
+
+  // Binds the G-buffer, sized to `width` by `height`, and clears it.
+  void begin_geometry(int width, int height) {
+    g_buffer.resize(width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, g_buffer.get());
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  }
+
+  // Shades the covered pixels into `target` (0 for the window), whose
+  // colour the caller has cleared, then copies the G-buffer depth there so
+  // forward passes can draw on top. Leaves `target` bound.
+  void light(GLuint target, const glm::mat4& projection,
+             const glm::mat4& view) {
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glDisable(GL_DEPTH_TEST);
+
+    lighting_shader.use();
+    lighting_shader.set_uniform_mat4("inverse_view_projection"_uniform,
+                                     glm::inverse(projection * view));
+    g_buffer.bind_textures();
+    glBindVertexArray(empty_vertex_array.get());
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_buffer.get());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+    glBlitFramebuffer(0, 0, g_buffer.width, g_buffer.height, 0, 0,
+                      g_buffer.width, g_buffer.height, GL_DEPTH_BUFFER_BIT,
+                      GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glEnable(GL_DEPTH_TEST);
+  }
+
+  // Deletes the GL objects, for before Gl_Resources::flush().
+  void reset() {
+    g_buffer.reset();
+    empty_vertex_array.reset();
+    geometry_shader.delete_program();
+    lighting_shader.delete_program();
+  }
+
+ private:
+  Gl_Vertex_Array empty_vertex_array;
+};
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRUSTUM_CULL_SSE 1
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#define FRUSTUM_CULL_AVX 1
+#endif
+
+#include <glm/glm.hpp>
+
+#include "thread_pool.hpp"
+
+// Frustum culling of axis-aligned boxes in batches. The boxes are kept as
+// structure-of-arrays centres and half extents, so one SIMD register holds
+// the same coordinate of 4 (SSE2) or 8 (AVX2) boxes and each plane test is
+// a handful of multiply-adds for all of them:
+//
+//   outside if  dot(n, center) + w + dot(abs(n), extent) < 0
+//
+// A box is only culled when it is entirely behind one plane, so boxes near
+// a frustum corner may be kept; that is conservative, never wrong.
+//
+// Nothing in here touches GL, so culling can run headless.
+
+enum cull_math { CULL_MATH_SCALAR, CULL_MATH_SIMD };
+
+// Writes the six planes (left, right, bottom, top, near, far) of the clip
+// volume of `m`, normalized and facing inwards. For m = projection * view
+// they are in world space; with a model matrix on the right, in that
+// model's space.
+inline void extract_frustum_planes(const glm::mat4& m, glm::vec4* planes) {
+  glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+  for (int i = 0; i < 3; i++) {
+    glm::vec4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+    planes[i * 2 + 0] = w + row;
+    planes[i * 2 + 1] = w - row;
+  }
+
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+struct Frustum {
+  glm::vec4 planes[6];
+
+  explicit Frustum(const glm::mat4& clip) {
+    extract_frustum_planes(clip, planes);
+  }
+
+  Frustum(const glm::mat4& projection, const glm::mat4& view)
+      : Frustum(projection * view) {}
+
+  bool intersects_sphere(const glm::vec3& center, float radius) const {
+    for (const glm::vec4& plane : planes) {
+      if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+};
+
+// Boxes in structure-of-arrays form: centre and half extent per axis.
+struct Cull_Bounds {
+  std::vector<float> center_x, center_y, center_z;
+  std::vector<float> extent_x, extent_y, extent_z;
+
+  std::size_t size() const { return center_x.size(); }
+
+  void clear() {
+    for (std::vector<float>* lane : lanes()) {
+      lane->clear();
+    }
+  }
+
+  void reserve(std::size_t count) {
+    for (std::vector<float>* lane : lanes()) {
+      lane->reserve(count);
+    }
+  }
+
+  void push_back(const glm::vec3& bounds_min, const glm::vec3& bounds_max) {
+    glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+    glm::vec3 extent = (bounds_max - bounds_min) * 0.5f;
+
+    center_x.push_back(center.x);
+    center_y.push_back(center.y);
+    center_z.push_back(center.z);
+    extent_x.push_back(extent.x);
+    extent_y.push_back(extent.y);
+    extent_z.push_back(extent.z);
+  }
+
+  // The box around `bounds_min`/`bounds_max` transformed by `model`.
+  void push_back(const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+                 const glm::mat4& model) {
+    push_back(glm::vec3(0.0f), glm::vec3(0.0f));
+    set(size() - 1, bounds_min, bounds_max, model);
+  }
+
+  // Replaces box `i`, for sets where only a few boxes move each frame.
+  void set(std::size_t i, const glm::vec3& bounds_min,
+           const glm::vec3& bounds_max, const glm::mat4& model) {
+    glm::vec3 center =
+        glm::vec3(model * glm::vec4((bounds_min + bounds_max) * 0.5f, 1.0f));
+    glm::vec3 extent = (bounds_max - bounds_min) * 0.5f;
+    glm::mat3 axes = glm::mat3(model);
+    glm::vec3 world_extent = glm::abs(axes[0]) * extent.x +
+                             glm::abs(axes[1]) * extent.y +
+                             glm::abs(axes[2]) * extent.z;
+
+    center_x[i] = center.x;
+    center_y[i] = center.y;
+    center_z[i] = center.z;
+    extent_x[i] = world_extent.x;
+    extent_y[i] = world_extent.y;
+    extent_z[i] = world_extent.z;
+  }
+
+ private:
+  std::vector<std::vector<float>*> lanes() {
+    return {&center_x, &center_y, &center_z, &extent_x, &extent_y, &extent_z};
+  }
+};
+
+// Per-frame counters; reset them at the start of a frame and merge the
+// results of every cull_bounds() call into them.
+struct Frustum_Cull_Stats {
+  std::size_t tested = 0;
+  std::size_t culled = 0;
+
+  std::size_t visible() const { return tested - culled; }
+
+  float fraction_culled() const {
+    return tested ? (float)culled / (float)tested : 0.0f;
+  }
+
+  void merge(const Frustum_Cull_Stats& other) {
+    tested += other.tested;
+    culled += other.culled;
+  }
+};
+
+// visible[i] = 0 for boxes [begin, end) behind a plane, 1 otherwise;
+// returns how many were culled.
+inline std::size_t cull_bounds_scalar(const Frustum& frustum,
+                                      const Cull_Bounds& bounds,
+                                      std::size_t begin, std::size_t end,
+                                      unsigned char* visible) {
+  std::size_t culled = 0;
+
+  for (std::size_t i = begin; i < end; i++) {
+    bool outside = false;
+
+    for (const glm::vec4& plane : frustum.planes) {
+      float distance = plane.x * bounds.center_x[i] +
+                       plane.y * bounds.center_y[i] +
+                       plane.z * bounds.center_z[i] + plane.w;
+      float radius = std::abs(plane.x) * bounds.extent_x[i] +
+                     std::abs(plane.y) * bounds.extent_y[i] +
+                     std::abs(plane.z) * bounds.extent_z[i];
+      outside = outside || distance + radius < 0.0f;
+    }
+
+    visible[i] = !outside;
+    culled += outside;
+  }
+
+  return culled;
+}
+
+#ifdef FRUSTUM_CULL_SSE
+inline std::size_t cull_bounds_simd(const Frustum& frustum,
+                                    const Cull_Bounds& bounds,
+                                    std::size_t begin, std::size_t end,
+                                    unsigned char* visible) {
+  std::size_t culled = 0;
+  std::size_t i = begin;
+  const float* cx = bounds.center_x.data();
+  const float* cy = bounds.center_y.data();
+  const float* cz = bounds.center_z.data();
+  const float* ex = bounds.extent_x.data();
+  const float* ey = bounds.extent_y.data();
+  const float* ez = bounds.extent_z.data();
+#ifdef FRUSTUM_CULL_AVX
+  __m256 planes8[6][7];
+
+  for (int p = 0; p < 6; p++) {
+    const glm::vec4& plane = frustum.planes[p];
+    float values[7] = {plane.x,           plane.y,           plane.z,
+                       plane.w,           std::abs(plane.x), std::abs(plane.y),
+                       std::abs(plane.z)};
+
+    for (int k = 0; k < 7; k++) {
+      planes8[p][k] = _mm256_set1_ps(values[k]);
+    }
+  }
+
+  for (; i + 8 <= end; i += 8) {
+    __m256 x = _mm256_loadu_ps(cx + i), y = _mm256_loadu_ps(cy + i);
+    __m256 z = _mm256_loadu_ps(cz + i);
+    __m256 rx = _mm256_loadu_ps(ex + i), ry = _mm256_loadu_ps(ey + i);
+    __m256 rz = _mm256_loadu_ps(ez + i);
+    __m256 outside = _mm256_setzero_ps();
+
+    for (int p = 0; p < 6; p++) {
+      const __m256* n = planes8[p];
+      __m256 d = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(n[0], x), _mm256_mul_ps(n[1], y)),
+          _mm256_add_ps(_mm256_mul_ps(n[2], z), n[3]));
+      __m256 r = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(n[4], rx), _mm256_mul_ps(n[5], ry)),
+          _mm256_mul_ps(n[6], rz));
+      outside = _mm256_or_ps(
+          outside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(),
+                                 _CMP_LT_OQ));
+    }
+
+    int bits = _mm256_movemask_ps(outside);
+
+    for (int k = 0; k < 8; k++) {
+      visible[i + k] = !((bits >> k) & 1);
+      culled += (bits >> k) & 1;
+    }
+  }
+#endif
+  __m128 planes4[6][7];
+
+  for (int p = 0; p < 6; p++) {
+    const glm::vec4& plane = frustum.planes[p];
+    float values[7] = {plane.x,           plane.y,           plane.z,
+                       plane.w,           std::abs(plane.x), std::abs(plane.y),
+                       std::abs(plane.z)};
+
+    for (int k = 0; k < 7; k++) {
+      planes4[p][k] = _mm_set1_ps(values[k]);
+    }
+  }
+
+  for (; i + 4 <= end; i += 4) {
+    __m128 x = _mm_loadu_ps(cx + i), y = _mm_loadu_ps(cy + i);
+    __m128 z = _mm_loadu_ps(cz + i);
+    __m128 rx = _mm_loadu_ps(ex + i), ry = _mm_loadu_ps(ey + i);
+    __m128 rz = _mm_loadu_ps(ez + i);
+    __m128 outside = _mm_setzero_ps();
+
+    for (int p = 0; p < 6; p++) {
+      const __m128* n = planes4[p];
+      __m128 d = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(n[0], x), _mm_mul_ps(n[1], y)),
+          _mm_add_ps(_mm_mul_ps(n[2], z), n[3]));
+      __m128 r = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(n[4], rx), _mm_mul_ps(n[5], ry)),
+          _mm_mul_ps(n[6], rz));
+      outside = _mm_or_ps(outside,
+                          _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+    }
+
+    int bits = _mm_movemask_ps(outside);
+
+    for (int k = 0; k < 4; k++) {
+      visible[i + k] = !((bits >> k) & 1);
+      culled += (bits >> k) & 1;
+    }
+  }
+
+  return culled + cull_bounds_scalar(frustum, bounds, i, end, visible);
+}
+#endif
+
+// Boxes per thread pool job; small sets are culled on the calling thread.
+const std::size_t CULL_BATCH = 16384;
+
+// Fills `visible` with one byte per box (1 = keep) and adds the counts to
+// `stats`. With `parallel`, batches of boxes are culled on the shared
+// thread pool; not from inside a pool job.
+inline void cull_bounds(const Frustum& frustum, const Cull_Bounds& bounds,
+                        std::vector<unsigned char>& visible,
+                        Frustum_Cull_Stats& stats,
+                        cull_math math = CULL_MATH_SIMD,
+                        bool parallel = true) {
+  std::size_t count = bounds.size();
+  std::atomic<std::size_t> culled(0);
+  visible.resize(count);
+
+  auto run = [&](std::size_t begin, std::size_t end) {
+    std::size_t batch_culled;
+#ifdef FRUSTUM_CULL_SSE
+    if (math == CULL_MATH_SIMD) {
+      batch_culled =
+          cull_bounds_simd(frustum, bounds, begin, end, visible.data());
+    } else
+#endif
+    {
+      batch_culled =
+          cull_bounds_scalar(frustum, bounds, begin, end, visible.data());
+    }
+
+    culled += batch_culled;
+  };
+
+  if (parallel && count > CULL_BATCH) {
+    Thread_Pool::shared().parallel_for(count, CULL_BATCH, run);
+  } else {
+    run(0, count);
+  }
+
+  stats.tested += count;
+  stats.culled += culled;
+}
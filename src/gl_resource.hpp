@@ -0,0 +1,405 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glad/glad.h>
+
+enum gl_object_type {
+  GL_OBJECT_BUFFER,
+  GL_OBJECT_VERTEX_ARRAY,
+  GL_OBJECT_TEXTURE,
+  GL_OBJECT_PROGRAM,
+  GL_OBJECT_FRAMEBUFFER,
+  GL_OBJECT_QUERY,
+  GL_OBJECT_TYPE_COUNT
+};
+
+inline const char* gl_object_type_name(gl_object_type type) {
+  switch (type) {
+    case GL_OBJECT_BUFFER:
+      return "buffer";
+    case GL_OBJECT_VERTEX_ARRAY:
+      return "vertex array";
+    case GL_OBJECT_TEXTURE:
+      return "texture";
+    case GL_OBJECT_PROGRAM:
+      return "program";
+    case GL_OBJECT_FRAMEBUFFER:
+      return "framebuffer";
+    case GL_OBJECT_QUERY:
+      return "query";
+    default:
+      return "unknown";
+  }
+}
+
+// Registry slot plus the generation the slot had when the object was
+// tracked. Releasing the object bumps the slot's generation, so any copy of
+// the ID that outlives the object is detected instead of silently naming
+// whatever GL object reuses the slot (or the GL name) later. Generation 0 is
+// the null ID.
+struct Gl_Object_ID {
+  uint32_t slot = 0;
+  uint32_t generation = 0;
+
+  explicit operator bool() const { return generation != 0; }
+};
+
+struct Gl_Resource_Stats {
+  std::size_t created[GL_OBJECT_TYPE_COUNT] = {};
+  std::size_t deleted[GL_OBJECT_TYPE_COUNT] = {};
+  std::size_t live[GL_OBJECT_TYPE_COUNT] = {};
+  // Released but not yet deleted: the GPU may still be using them.
+  std::size_t retiring = 0;
+  std::size_t stale_accesses = 0;
+};
+
+// Process-wide table of the GL objects owned through Gl_Handle. Releasing an
+// object does not delete it: the deletion joins the current frame's batch,
+// end_frame() puts a fence behind that frame's commands, and the batch is
+// deleted once the fence has signalled, i.e. after every frame that could
+// still have drawn with the objects has completed on the GPU.
+//
+// All methods must be called on the GL thread.
+class Gl_Resources {
+ public:
+  // Never destroyed, so handles held by other statics (the texture cache)
+  // may still release into it during exit.
+  static Gl_Resources& shared() {
+    static Gl_Resources* resources = new Gl_Resources;
+    return *resources;
+  }
+
+  Gl_Resources(const Gl_Resources&) = delete;
+  Gl_Resources& operator=(const Gl_Resources&) = delete;
+
+  // Takes ownership of the existing object `name`. `label` shows up in the
+  // leak report.
+  Gl_Object_ID track(gl_object_type type, GLuint name, std::string label) {
+    uint32_t slot_index;
+
+    if (!free_slots.empty()) {
+      slot_index = free_slots.back();
+      free_slots.pop_back();
+    } else {
+      slot_index = static_cast<uint32_t>(slots.size());
+      slots.emplace_back();
+    }
+
+    Slot& slot = slots[slot_index];
+    slot.name = name;
+    slot.type = type;
+    slot.live = true;
+    slot.label = std::move(label);
+
+    stats.created[type]++;
+    stats.live[type]++;
+
+    return {slot_index, slot.generation};
+  }
+
+  // Generates a new object of `type` and tracks it.
+  Gl_Object_ID create(gl_object_type type, std::string label) {
+    GLuint name = 0;
+
+    switch (type) {
+      case GL_OBJECT_BUFFER:
+        glGenBuffers(1, &name);
+        break;
+      case GL_OBJECT_VERTEX_ARRAY:
+        glGenVertexArrays(1, &name);
+        break;
+      case GL_OBJECT_TEXTURE:
+        glGenTextures(1, &name);
+        break;
+      case GL_OBJECT_PROGRAM:
+        name = glCreateProgram();
+        break;
+      case GL_OBJECT_FRAMEBUFFER:
+        glGenFramebuffers(1, &name);
+        break;
+      case GL_OBJECT_QUERY:
+        glGenQueries(1, &name);
+        break;
+      default:
+        break;
+    }
+
+    return track(type, name, std::move(label));
+  }
+
+  bool alive(Gl_Object_ID id) const {
+    return id && id.slot < slots.size() && slots[id.slot].live &&
+           slots[id.slot].generation == id.generation;
+  }
+
+  // The GL name behind `id`; 0 (and an error) if the object is gone.
+  GLuint name(Gl_Object_ID id) {
+    if (!alive(id)) {
+      if (id) {
+        report_stale("NAME", id);
+      }
+
+      return 0;
+    }
+
+    return slots[id.slot].name;
+  }
+
+  // Invalidates `id` and queues the object's deletion behind the current
+  // frame.
+  void release(Gl_Object_ID id) {
+    if (!alive(id)) {
+      report_stale("RELEASE", id);
+      return;
+    }
+
+    Slot& slot = slots[id.slot];
+    pending.push_back({slot.type, slot.name});
+
+    slot.live = false;
+    slot.label.clear();
+    // Skip 0 on wrap-around; it is the null generation.
+    slot.generation = slot.generation + 1 ? slot.generation + 1 : 1;
+    free_slots.push_back(id.slot);
+
+    stats.live[slot.type]--;
+  }
+
+  // Call once per frame after its last draw (before swapping buffers).
+  // Fences the frame's releases and deletes every earlier batch whose fence
+  // has signalled. Never blocks.
+  void end_frame() {
+    if (!pending.empty()) {
+      Batch batch;
+      batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      batch.objects.swap(pending);
+      batches.push_back(std::move(batch));
+    }
+
+    while (!batches.empty() && signalled(batches.front().fence, 0)) {
+      retire(batches.front());
+      batches.pop_front();
+    }
+  }
+
+  // Waits for the GPU and deletes everything released so far. For shutdown
+  // and for tools without a frame loop.
+  void flush() {
+    end_frame();
+
+    // Deleting early would still be valid GL (the driver keeps the objects
+    // alive while in use), so a fence that times out or fails is not fatal.
+    for (Batch& batch : batches) {
+      signalled(batch.fence, 1000000000);
+      retire(batch);
+    }
+
+    batches.clear();
+
+    if (!pending.empty()) {
+      glFinish();
+
+      Batch batch;
+      batch.objects.swap(pending);
+      retire(batch);
+    }
+  }
+
+  Gl_Resource_Stats get_stats() const {
+    Gl_Resource_Stats result = stats;
+    result.retiring = pending.size();
+
+    for (const Batch& batch : batches) {
+      result.retiring += batch.objects.size();
+    }
+
+    return result;
+  }
+
+  void print_stats(std::ostream& out = std::cout) const {
+    Gl_Resource_Stats current = get_stats();
+
+    out << "gl resources:";
+
+    for (int type = 0; type < GL_OBJECT_TYPE_COUNT; type++) {
+      out << (type ? ", " : " ") << current.live[type] << " "
+          << gl_object_type_name(static_cast<gl_object_type>(type))
+          << " (" << current.created[type] << " created, "
+          << current.deleted[type] << " deleted)";
+    }
+
+    out << ", " << current.retiring << " retiring, "
+        << current.stale_accesses << " stale accesses\n";
+  }
+
+  // Lists every object still owned by a handle. Call it at shutdown, after
+  // everything that should have released its objects has been destroyed.
+  // Returns the number of leaked objects.
+  std::size_t print_leak_report(std::ostream& out = std::cerr) const {
+    std::size_t leaked = 0;
+
+    for (const Slot& slot : slots) {
+      leaked += slot.live;
+    }
+
+    if (leaked == 0) {
+      return 0;
+    }
+
+    out << "ERROR::GL_RESOURCES::LEAKED_OBJECTS\n" << leaked
+        << " objects still alive at shutdown:\n";
+
+    for (std::size_t i = 0; i < slots.size(); i++) {
+      const Slot& slot = slots[i];
+
+      if (slot.live) {
+        out << "  " << gl_object_type_name(slot.type) << " " << slot.name
+            << " (slot " << i << ", generation " << slot.generation << ") "
+            << (slot.label.empty() ? "<unlabelled>" : slot.label) << "\n";
+      }
+    }
+
+    return leaked;
+  }
+
+ private:
+  struct Slot {
+    GLuint name = 0;
+    gl_object_type type = GL_OBJECT_BUFFER;
+    uint32_t generation = 1;
+    bool live = false;
+    std::string label;
+  };
+
+  struct Batch {
+    GLsync fence = 0;
+    std::vector<std::pair<gl_object_type, GLuint>> objects;
+  };
+
+  std::vector<Slot> slots;
+  std::vector<uint32_t> free_slots;
+  std::vector<std::pair<gl_object_type, GLuint>> pending;
+  std::deque<Batch> batches;
+  Gl_Resource_Stats stats;
+
+  Gl_Resources() = default;
+
+  static bool signalled(GLsync fence, GLuint64 timeout_ns) {
+    if (!fence) {
+      return true;
+    }
+
+    GLenum status =
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+    return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+  }
+
+  void retire(Batch& batch) {
+    for (const auto& [type, name] : batch.objects) {
+      switch (type) {
+        case GL_OBJECT_BUFFER:
+          glDeleteBuffers(1, &name);
+          break;
+        case GL_OBJECT_VERTEX_ARRAY:
+          glDeleteVertexArrays(1, &name);
+          break;
+        case GL_OBJECT_TEXTURE:
+          glDeleteTextures(1, &name);
+          break;
+        case GL_OBJECT_PROGRAM:
+          glDeleteProgram(name);
+          break;
+        case GL_OBJECT_FRAMEBUFFER:
+          glDeleteFramebuffers(1, &name);
+          break;
+        case GL_OBJECT_QUERY:
+          glDeleteQueries(1, &name);
+          break;
+        default:
+          break;
+      }
+
+      stats.deleted[type]++;
+    }
+
+    if (batch.fence) {
+      glDeleteSync(batch.fence);
+    }
+
+    batch.objects.clear();
+    batch.fence = 0;
+  }
+
+  void report_stale(const char* what, Gl_Object_ID id) {
+    stats.stale_accesses++;
+    std::cerr << "ERROR::GL_RESOURCES::STALE_" << what << "\nslot "
+              << id.slot << ", generation " << id.generation << "\n";
+  }
+};
+
+// Move-only owner of one GL object. Destroying (or reset()ting) the handle
+// queues the object's deletion with Gl_Resources; get() checks the
+// generation, so using a handle after its object is gone reports an error
+// and yields 0 rather than another object's name.
+template <gl_object_type Type>
+class Gl_Handle {
+ public:
+  Gl_Handle() = default;
+
+  // Takes ownership of an existing object name.
+  Gl_Handle(GLuint name, std::string label)
+      : id(Gl_Resources::shared().track(Type, name, std::move(label))) {}
+
+  static Gl_Handle create(std::string label) {
+    Gl_Handle handle;
+    handle.id = Gl_Resources::shared().create(Type, std::move(label));
+    return handle;
+  }
+
+  Gl_Handle(const Gl_Handle&) = delete;
+  Gl_Handle& operator=(const Gl_Handle&) = delete;
+
+  Gl_Handle(Gl_Handle&& other) noexcept : id(other.id) { other.id = {}; }
+
+  Gl_Handle& operator=(Gl_Handle&& other) noexcept {
+    if (this != &other) {
+      reset();
+      id = other.id;
+      other.id = {};
+    }
+
+    return *this;
+  }
+
+  ~Gl_Handle() { reset(); }
+
+  void reset() {
+    if (id) {
+      Gl_Resources::shared().release(id);
+      id = {};
+    }
+  }
+
+  GLuint get() const { return Gl_Resources::shared().name(id); }
+
+  Gl_Object_ID object_id() const { return id; }
+
+  explicit operator bool() const { return static_cast<bool>(id); }
+
+ private:
+  Gl_Object_ID id;
+};
+
+typedef Gl_Handle<GL_OBJECT_BUFFER> Gl_Buffer;
+typedef Gl_Handle<GL_OBJECT_VERTEX_ARRAY> Gl_Vertex_Array;
+typedef Gl_Handle<GL_OBJECT_TEXTURE> Gl_Texture;
+typedef Gl_Handle<GL_OBJECT_PROGRAM> Gl_Program;
+typedef Gl_Handle<GL_OBJECT_FRAMEBUFFER> Gl_Framebuffer;
+typedef Gl_Handle<GL_OBJECT_QUERY> Gl_Query;
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glad/glad.h>
+
+#include "gl_resource.hpp"
+
+// GPU time of a span of commands, from GL_TIME_ELAPSED queries read back a
+// few frames later, so the CPU never waits for the GPU to catch up. Each
+// span carries a tag (e.g. which render path drew it) that comes back with
+// its result.
+class Gpu_Timer {
+ public:
+  // Spans in flight; begin() skips timing while all of them are.
+  static const int LATENCY = 4;
+
+  // Only one span may be open at a time, across all timers.
+  void begin(int tag = 0) {
+    open = pending < LATENCY;
+
+    if (!open) {
+      return;
+    }
+
+    Slot& slot = slots[(first + pending) % LATENCY];
+
+    if (!slot.query) {
+      slot.query = Gl_Query::create("gpu timer query");
+    }
+
+    slot.tag = tag;
+    glBeginQuery(GL_TIME_ELAPSED, slot.query.get());
+  }
+
+  void end() {
+    if (open) {
+      glEndQuery(GL_TIME_ELAPSED);
+      pending++;
+      open = false;
+    }
+  }
+
+  // Takes the oldest finished span, if there is one.
+  bool poll(int& tag, double& ms) {
+    if (pending == 0) {
+      return false;
+    }
+
+    Slot& slot = slots[first];
+    GLint available = 0;
+    glGetQueryObjectiv(slot.query.get(), GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+
+    if (!available) {
+      return false;
+    }
+
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(slot.query.get(), GL_QUERY_RESULT, &nanoseconds);
+    tag = slot.tag;
+    ms = nanoseconds / 1e6;
+    first = (first + 1) % LATENCY;
+    pending--;
+
+    return true;
+  }
+
+  // Deletes the queries, for before Gl_Resources::flush().
+  void reset() {
+    for (Slot& slot : slots) {
+      slot.query.reset();
+    }
+
+    first = pending = 0;
+    open = false;
+  }
+
+ private:
+  struct Slot {
+    Gl_Query query;
+    int tag = 0;
+  };
+
+  Slot slots[LATENCY];
+  int first = 0;
+  int pending = 0;
+  bool open = false;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+inline uint64_t fnv1a_64(const void* data, std::size_t size,
+                         uint64_t hash = 0xcbf29ce484222325ull) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+  for (std::size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+inline bool hash_file(const std::string& path, uint64_t& hash) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+
+  if (!file) {
+    return false;
+  }
+
+  std::vector<unsigned char> buffer(1 << 20);
+  hash = 0xcbf29ce484222325ull;
+
+  std::size_t read;
+  while ((read = std::fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+    hash = fnv1a_64(buffer.data(), read, hash);
+  }
+
+  std::fclose(file);
+
+  return true;
+}
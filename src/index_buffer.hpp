@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Index data is kept as 32-bit on the CPU and narrowed to the smallest GL
+// index type that can address the mesh's vertices when it is uploaded or
+// baked.
+
+inline GLenum choose_index_type(std::size_t vertex_count) {
+  return vertex_count <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+inline std::size_t index_size(GLenum index_type) {
+  return index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t)
+                                         : sizeof(uint32_t);
+}
+
+inline std::vector<unsigned char> encode_indices(
+    GLenum index_type, const std::vector<unsigned int>& indices) {
+  std::vector<unsigned char> bytes(indices.size() * index_size(index_type));
+
+  if (index_type == GL_UNSIGNED_INT) {
+    std::memcpy(bytes.data(), indices.data(), bytes.size());
+    return bytes;
+  }
+
+  uint16_t* narrow = reinterpret_cast<uint16_t*>(bytes.data());
+
+  for (std::size_t i = 0; i < indices.size(); i++) {
+    narrow[i] = static_cast<uint16_t>(indices[i]);
+  }
+
+  return bytes;
+}
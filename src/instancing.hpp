@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_resource.hpp"
+
+// Per-instance transforms for instanced draws. Each instance carries its
+// model matrix and the normal matrix precomputed on the CPU, as vertex
+// attributes advancing once per instance:
+//
+//   layout (location = 8) in mat4 i_model;          (locations 8-11)
+//   layout (location = 12) in mat3 i_normal_matrix; (locations 12-14)
+//
+// Clear of the mesh attributes (0-6) and within the 16 GL 3.3 guarantees.
+
+const unsigned int INSTANCE_MODEL_ATTRIBUTE = 8;
+const unsigned int INSTANCE_NORMAL_ATTRIBUTE = 12;
+
+struct Instance_Transform {
+  glm::mat4 model;
+  // Columns of transpose(inverse(mat3(model))), padded to 16 bytes.
+  glm::vec4 normal_matrix[3];
+};
+
+inline Instance_Transform make_instance_transform(const glm::mat4& model) {
+  Instance_Transform transform;
+  transform.model = model;
+  glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(model)));
+
+  for (int column = 0; column < 3; column++) {
+    transform.normal_matrix[column] = glm::vec4(normal[column], 0.0f);
+  }
+
+  return transform;
+}
+
+// A CPU copy of the transforms plus a GL buffer. Changed instances are
+// tracked in blocks of INSTANCE_BLOCK, and upload() only sends the runs of
+// changed blocks, so moving a few instances out of 100k costs a few KiB.
+const std::size_t INSTANCE_BLOCK = 256;
+
+class Instance_Buffer {
+ public:
+  // Bytes sent by the last upload().
+  std::size_t uploaded_bytes = 0;
+
+  Instance_Buffer() : buffer(Gl_Buffer::create("instance buffer")) {}
+
+  Instance_Buffer(const Instance_Buffer&) = delete;
+  Instance_Buffer& operator=(const Instance_Buffer&) = delete;
+
+  ~Instance_Buffer() { reset(); }
+
+  // Drops the instances and deletes the GL buffer, for before
+  // Gl_Resources::flush(); the buffer cannot be used afterwards.
+  void reset() {
+    uint64_t self = key(buffer.object_id());
+    std::erase_if(vertex_array_owners(), [&](const auto& entry) {
+      return entry.second == self;
+    });
+    buffer.reset();
+    transforms.clear();
+    dirty.clear();
+    capacity = 0;
+  }
+
+  std::size_t size() const { return transforms.size(); }
+
+  // New instances get the identity transform.
+  void resize(std::size_t count) {
+    std::size_t old_size = transforms.size();
+    transforms.resize(count, make_instance_transform(glm::mat4(1.0f)));
+    dirty.resize((count + INSTANCE_BLOCK - 1) / INSTANCE_BLOCK, 0);
+
+    if (count > old_size) {
+      mark_dirty(old_size, count);
+    }
+  }
+
+  void clear() { resize(0); }
+
+  std::size_t add(const glm::mat4& model) {
+    resize(transforms.size() + 1);
+    set(transforms.size() - 1, model);
+    return transforms.size() - 1;
+  }
+
+  // Does nothing (and uploads nothing) when the matrix is unchanged.
+  void set(std::size_t i, const glm::mat4& model) {
+    if (std::memcmp(&transforms[i].model, &model, sizeof(model)) == 0) {
+      return;
+    }
+
+    transforms[i] = make_instance_transform(model);
+    mark_dirty(i, i + 1);
+  }
+
+  const glm::mat4& model(std::size_t i) const { return transforms[i].model; }
+
+  // Keeps models[i] for each set visible[i], in order, in consecutive
+  // slots. The slots are dense because GL 3.3 has no base instance to draw
+  // runs of a sparse buffer from, so a model entering or leaving the view
+  // shifts every visible one after it, and all of those are uploaded
+  // again. Only when the visible set is unchanged are the uploads limited
+  // to the matrices that changed.
+  void pack(const std::vector<glm::mat4>& models,
+            const std::vector<unsigned char>& visible) {
+    std::size_t count = 0;
+
+    for (unsigned char keep : visible) {
+      count += keep;
+    }
+
+    resize(count);
+    std::size_t slot = 0;
+
+    for (std::size_t i = 0; i < models.size(); i++) {
+      if (visible[i]) {
+        set(slot++, models[i]);
+      }
+    }
+  }
+
+  // Sends the changed blocks to the GPU, or everything when the buffer has
+  // to grow. Returns the bytes sent.
+  std::size_t upload() {
+    uploaded_bytes = 0;
+    std::size_t count = transforms.size();
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.get());
+
+    // Never empty: attached attributes must always point at storage.
+    if (count > capacity || capacity == 0) {
+      capacity = std::max<std::size_t>({count, capacity * 2, 64});
+      glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Instance_Transform),
+                   NULL, GL_DYNAMIC_DRAW);
+      mark_dirty(0, count);
+    }
+
+    for (std::size_t block = 0; block < dirty.size();) {
+      if (!dirty[block]) {
+        block++;
+        continue;
+      }
+
+      std::size_t end_block = block;
+
+      while (end_block < dirty.size() && dirty[end_block]) {
+        dirty[end_block++] = 0;
+      }
+
+      std::size_t first = block * INSTANCE_BLOCK;
+      std::size_t last = std::min(count, end_block * INSTANCE_BLOCK);
+      std::size_t bytes = (last - first) * sizeof(Instance_Transform);
+      glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Instance_Transform),
+                      bytes, transforms.data() + first);
+      uploaded_bytes += bytes;
+      block = end_block;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return uploaded_bytes;
+  }
+
+  // Points the instance attributes of `vertex_array` (e.g.
+  // Mesh::vertex_array_id()) at this buffer. Call it before every instanced
+  // draw: it only touches the VAO when another buffer was attached to it
+  // last. Shaders that do not read them are unaffected. Returns true when
+  // it did, leaving no VAO bound.
+  bool attach(Gl_Object_ID vertex_array) {
+    Gl_Resources& resources = Gl_Resources::shared();
+    auto& owners = vertex_array_owners();
+    uint64_t self = key(buffer.object_id());
+    auto found = owners.find(key(vertex_array));
+
+    if (found != owners.end() && found->second == self) {
+      return false;
+    }
+
+    if (found == owners.end()) {
+      // A new VAO: forget the ones deleted since, whose GL names may since
+      // have been reused.
+      std::erase_if(owners, [&](const auto& entry) {
+        return !resources.alive({static_cast<uint32_t>(entry.first >> 32),
+                                 static_cast<uint32_t>(entry.first)});
+      });
+    }
+
+    unsigned int VAO = resources.name(vertex_array);
+
+    if (capacity == 0) {
+      upload();
+    }
+
+    GLsizei stride = sizeof(Instance_Transform);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.get());
+
+    for (unsigned int column = 0; column < 4; column++) {
+      unsigned int location = INSTANCE_MODEL_ATTRIBUTE + column;
+      glEnableVertexAttribArray(location);
+      glVertexAttribPointer(
+          location, 4, GL_FLOAT, GL_FALSE, stride,
+          (void*)(offsetof(Instance_Transform, model) +
+                  column * sizeof(glm::vec4)));
+      glVertexAttribDivisor(location, 1);
+    }
+
+    for (unsigned int column = 0; column < 3; column++) {
+      unsigned int location = INSTANCE_NORMAL_ATTRIBUTE + column;
+      glEnableVertexAttribArray(location);
+      glVertexAttribPointer(
+          location, 3, GL_FLOAT, GL_FALSE, stride,
+          (void*)(offsetof(Instance_Transform, normal_matrix) +
+                  column * sizeof(glm::vec4)));
+      glVertexAttribDivisor(location, 1);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    owners[key(vertex_array)] = self;
+    return true;
+  }
+
+ private:
+  Gl_Buffer buffer;
+  std::vector<Instance_Transform> transforms;
+  // One flag per INSTANCE_BLOCK instances.
+  std::vector<unsigned char> dirty;
+  std::size_t capacity = 0;
+
+  // VAO -> the instance buffer its instance attributes point at, both by
+  // Gl_Object_ID rather than GL name, so a VAO that reuses a deleted one's
+  // name never looks attached already.
+  static std::unordered_map<uint64_t, uint64_t>& vertex_array_owners() {
+    static std::unordered_map<uint64_t, uint64_t> owners;
+    return owners;
+  }
+
+  static uint64_t key(Gl_Object_ID id) {
+    return (uint64_t)id.slot << 32 | id.generation;
+  }
+
+  void mark_dirty(std::size_t begin, std::size_t end) {
+    for (std::size_t block = begin / INSTANCE_BLOCK;
+         block * INSTANCE_BLOCK < end; block++) {
+      dirty[block] = 1;
+    }
+  }
+};
@@ -0,0 +1,566 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LIGHT_CLUSTERS_SSE 1
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#define LIGHT_CLUSTERS_AVX 1
+#endif
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "frustum_cull.hpp"
+#include "gl_resource.hpp"
+#include "shader.hpp"
+#include "thread_pool.hpp"
+
+// Clustered forward lighting. The view frustum is split into a grid of
+// froxels: CLUSTER_TILES_X by CLUSTER_TILES_Y screen tiles, each cut into
+// CLUSTER_SLICES depth slices spaced exponentially between the near and far
+// planes, so froxels stay roughly cubic:
+//
+//   slice = log(depth) * scale + bias
+//
+// Every frame each light's bounding sphere is tested against the view-space
+// boxes of the froxels in the slices and screen tiles it spans, and the
+// lights touching each froxel are packed into one index list. The fragment
+// shader finds its froxel from gl_FragCoord and its view depth and loops
+// over just those lights. Binning runs a slice per thread pool job and
+// tests 4 (SSE2) or 8 (AVX2) boxes at once; none of it touches GL, so it
+// can run headless.
+
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 9;
+const int CLUSTER_SLICES = 24;
+const int CLUSTERS_PER_SLICE = CLUSTER_TILES_X * CLUSTER_TILES_Y;
+const int CLUSTER_COUNT = CLUSTERS_PER_SLICE * CLUSTER_SLICES;
+
+// A point or spot light, laid out as the three RGBA32F texels the shader
+// reads. Light falls off to nothing at `range`.
+struct Cluster_Light {
+  glm::vec3 position = glm::vec3(0.0f);
+  float range = 1.0f;
+  glm::vec3 color = glm::vec3(1.0f);
+  // Spot lights: cosines of the cone's inner and outer half angles around
+  // `direction`. Point lights keep the defaults, which light every
+  // direction fully.
+  float cos_inner = -1.0f;
+  glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+  float cos_outer = -2.0f;
+
+  bool spot() const { return cos_outer > -1.0f; }
+};
+
+static_assert(sizeof(Cluster_Light) == 3 * sizeof(glm::vec4));
+
+// The smallest sphere around the light's reach: its range for a point
+// light, the bounds of its cone for a spot light.
+inline glm::vec4 cluster_light_bounds(const Cluster_Light& light) {
+  if (!light.spot()) {
+    return glm::vec4(light.position, light.range);
+  }
+
+  float cos_angle = std::max(light.cos_outer, 0.0f);
+
+  // Wide cones are bounded by the circle at their base, narrow ones by the
+  // sphere through the apex and that circle.
+  if (cos_angle < 0.70710678f) {
+    float sin_angle = std::sqrt(1.0f - cos_angle * cos_angle);
+    glm::vec3 base = light.position + light.direction * light.range * cos_angle;
+    return glm::vec4(base, light.range * sin_angle);
+  }
+
+  float radius = light.range / (2.0f * cos_angle);
+  return glm::vec4(light.position + light.direction * radius, radius);
+}
+
+// View-space boxes of the froxels in structure-of-arrays form, slice by
+// slice.
+struct Cluster_Boxes {
+  std::vector<float> min_x, min_y, min_z;
+  std::vector<float> max_x, max_y, max_z;
+};
+
+// Appends `light` to the list of every box in [begin, end) the sphere
+// touches: the squared distance from its centre to the box is at most r^2.
+inline void bin_sphere_scalar(const Cluster_Boxes& boxes, std::size_t begin,
+                              std::size_t end, const glm::vec4& sphere,
+                              std::uint32_t light,
+                              std::vector<std::uint32_t>* lists) {
+  for (std::size_t i = begin; i < end; i++) {
+    float dx = std::max(std::max(boxes.min_x[i] - sphere.x,
+                                 sphere.x - boxes.max_x[i]), 0.0f);
+    float dy = std::max(std::max(boxes.min_y[i] - sphere.y,
+                                 sphere.y - boxes.max_y[i]), 0.0f);
+    float dz = std::max(std::max(boxes.min_z[i] - sphere.z,
+                                 sphere.z - boxes.max_z[i]), 0.0f);
+
+    if (dx * dx + dy * dy + dz * dz <= sphere.w * sphere.w) {
+      lists[i].push_back(light);
+    }
+  }
+}
+
+#ifdef LIGHT_CLUSTERS_SSE
+inline void bin_sphere_simd(const Cluster_Boxes& boxes, std::size_t begin,
+                            std::size_t end, const glm::vec4& sphere,
+                            std::uint32_t light,
+                            std::vector<std::uint32_t>* lists) {
+  std::size_t i = begin;
+  const float* min_x = boxes.min_x.data();
+  const float* min_y = boxes.min_y.data();
+  const float* min_z = boxes.min_z.data();
+  const float* max_x = boxes.max_x.data();
+  const float* max_y = boxes.max_y.data();
+  const float* max_z = boxes.max_z.data();
+#ifdef LIGHT_CLUSTERS_AVX
+  __m256 x8 = _mm256_set1_ps(sphere.x), y8 = _mm256_set1_ps(sphere.y);
+  __m256 z8 = _mm256_set1_ps(sphere.z);
+  __m256 r2_8 = _mm256_set1_ps(sphere.w * sphere.w);
+  __m256 zero8 = _mm256_setzero_ps();
+
+  for (; i + 8 <= end; i += 8) {
+    __m256 dx = _mm256_max_ps(
+        _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(min_x + i), x8),
+                      _mm256_sub_ps(x8, _mm256_loadu_ps(max_x + i))),
+        zero8);
+    __m256 dy = _mm256_max_ps(
+        _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(min_y + i), y8),
+                      _mm256_sub_ps(y8, _mm256_loadu_ps(max_y + i))),
+        zero8);
+    __m256 dz = _mm256_max_ps(
+        _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(min_z + i), z8),
+                      _mm256_sub_ps(z8, _mm256_loadu_ps(max_z + i))),
+        zero8);
+    __m256 distance2 = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+        _mm256_mul_ps(dz, dz));
+    int bits =
+        _mm256_movemask_ps(_mm256_cmp_ps(distance2, r2_8, _CMP_LE_OQ));
+
+    for (int k = 0; bits; k++, bits >>= 1) {
+      if (bits & 1) {
+        lists[i + k].push_back(light);
+      }
+    }
+  }
+#endif
+  __m128 x4 = _mm_set1_ps(sphere.x), y4 = _mm_set1_ps(sphere.y);
+  __m128 z4 = _mm_set1_ps(sphere.z);
+  __m128 r2_4 = _mm_set1_ps(sphere.w * sphere.w);
+  __m128 zero4 = _mm_setzero_ps();
+
+  for (; i + 4 <= end; i += 4) {
+    __m128 dx = _mm_max_ps(
+        _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(min_x + i), x4),
+                   _mm_sub_ps(x4, _mm_loadu_ps(max_x + i))),
+        zero4);
+    __m128 dy = _mm_max_ps(
+        _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(min_y + i), y4),
+                   _mm_sub_ps(y4, _mm_loadu_ps(max_y + i))),
+        zero4);
+    __m128 dz = _mm_max_ps(
+        _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(min_z + i), z4),
+                   _mm_sub_ps(z4, _mm_loadu_ps(max_z + i))),
+        zero4);
+    __m128 distance2 =
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                   _mm_mul_ps(dz, dz));
+    int bits = _mm_movemask_ps(_mm_cmple_ps(distance2, r2_4));
+
+    for (int k = 0; bits; k++, bits >>= 1) {
+      if (bits & 1) {
+        lists[i + k].push_back(light);
+      }
+    }
+  }
+
+  bin_sphere_scalar(boxes, i, end, sphere, light, lists);
+}
+#endif
+
+// Counts for one bin().
+struct Light_Cluster_Stats {
+  // Lights given, and of those the ones reaching into the frustum.
+  std::size_t lights = 0;
+  std::size_t binned = 0;
+  // Entries over all froxel lists.
+  std::size_t references = 0;
+  std::size_t occupied_clusters = 0;
+  std::size_t max_per_cluster = 0;
+  double bin_ms = 0.0;
+};
+
+class Light_Clusters {
+ public:
+  Light_Cluster_Stats stats;
+
+  // Rebuilds the froxel boxes when `projection` (a glm::perspective one)
+  // differs from the last.
+  void set_projection(const glm::mat4& projection) {
+    if (lists.size() == CLUSTER_COUNT &&
+        std::memcmp(&projection, &this->projection, sizeof(projection)) ==
+            0) {
+      return;
+    }
+
+    this->projection = projection;
+    near_plane = projection[3][2] / (projection[2][2] - 1.0f);
+    far_plane = projection[3][2] / (projection[2][2] + 1.0f);
+    float log_ratio = std::log(far_plane / near_plane);
+    depth_scale = CLUSTER_SLICES / log_ratio;
+    depth_bias = -CLUSTER_SLICES * std::log(near_plane) / log_ratio;
+    build_boxes();
+  }
+
+  // (scale, bias) of the slice mapping, for the shader.
+  glm::vec2 depth_mapping() const {
+    return glm::vec2(depth_scale, depth_bias);
+  }
+
+  // The slice holding view depth `depth` (positive in front of the camera),
+  // clamped to the grid.
+  int slice(float depth) const {
+    float value = std::log(std::max(depth, near_plane)) * depth_scale +
+                  depth_bias;
+    return std::clamp((int)value, 0, CLUSTER_SLICES - 1);
+  }
+
+  // Fills the froxel lists with the indices of `lights` that reach them.
+  // With `parallel`, slices are binned on the shared thread pool; not from
+  // inside a pool job. Call set_projection() first.
+  void bin(const std::vector<Cluster_Light>& lights, const glm::mat4& view,
+           cull_math math = CULL_MATH_SIMD, bool parallel = true) {
+    auto start = std::chrono::steady_clock::now();
+    stats = Light_Cluster_Stats();
+    stats.lights = lights.size();
+    spheres.clear();
+    spans.clear();
+    light_ids.clear();
+
+    for (std::size_t i = 0; i < lights.size(); i++) {
+      glm::vec4 bounds = cluster_light_bounds(lights[i]);
+      glm::vec4 center = view * glm::vec4(glm::vec3(bounds), 1.0f);
+      glm::vec4 sphere(glm::vec3(center), bounds.w);
+      float nearest = -center.z - bounds.w, farthest = -center.z + bounds.w;
+      Light_Span span;
+
+      if (farthest < near_plane || nearest > far_plane ||
+          !screen_tiles(sphere, span)) {
+        continue;
+      }
+
+      span.first_slice = slice(nearest);
+      span.last_slice = slice(farthest);
+      spheres.push_back(sphere);
+      spans.push_back(span);
+      light_ids.push_back(static_cast<std::uint32_t>(i));
+    }
+
+    stats.binned = light_ids.size();
+
+    auto run = [&](std::size_t begin, std::size_t end) {
+      for (std::size_t s = begin; s < end; s++) {
+        bin_slice((int)s, math);
+      }
+    };
+
+    if (parallel) {
+      Thread_Pool::shared().parallel_for(CLUSTER_SLICES, 1, run);
+    } else {
+      run(0, CLUSTER_SLICES);
+    }
+
+    pack();
+    stats.bin_ms = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  }
+
+  // Per froxel, the offset of its list in light_indices() and its length:
+  // the RG32UI texels the shader reads.
+  const std::vector<std::uint32_t>& cluster_ranges() const { return ranges; }
+
+  const std::vector<std::uint32_t>& light_indices() const { return indices; }
+
+  const Cluster_Boxes& cluster_boxes() const { return boxes; }
+
+ private:
+  glm::mat4 projection = glm::mat4(0.0f);
+  float near_plane = 0.1f, far_plane = 100.0f;
+  float depth_scale = 0.0f, depth_bias = 0.0f;
+  Cluster_Boxes boxes;
+  // The froxels a light's sphere may touch, inclusive.
+  struct Light_Span {
+    int first_slice, last_slice;
+    int first_x = 0, first_y = 0;
+    int last_x = CLUSTER_TILES_X - 1, last_y = CLUSTER_TILES_Y - 1;
+  };
+
+  // View-space bounding spheres of the lights in the depth range, their
+  // spans and their indices in the caller's vector.
+  std::vector<glm::vec4> spheres;
+  std::vector<Light_Span> spans;
+  std::vector<std::uint32_t> light_ids;
+  std::vector<std::vector<std::uint32_t>> lists;
+  std::vector<std::uint32_t> ranges, indices;
+
+  // Each tile's corner rays through the near plane, cut at the slice's
+  // depths; a froxel's box holds the 8 points.
+  void build_boxes() {
+    glm::mat4 inverse = glm::inverse(projection);
+    std::vector<float>* lanes[6] = {&boxes.min_x, &boxes.min_y, &boxes.min_z,
+                                    &boxes.max_x, &boxes.max_y, &boxes.max_z};
+
+    for (std::vector<float>* lane : lanes) {
+      lane->resize(CLUSTER_COUNT);
+    }
+
+    lists.resize(CLUSTER_COUNT);
+
+    for (int s = 0; s < CLUSTER_SLICES; s++) {
+      float depths[2] = {
+          near_plane * std::pow(far_plane / near_plane,
+                                (float)s / CLUSTER_SLICES),
+          near_plane * std::pow(far_plane / near_plane,
+                                (float)(s + 1) / CLUSTER_SLICES)};
+
+      for (int y = 0; y < CLUSTER_TILES_Y; y++) {
+        for (int x = 0; x < CLUSTER_TILES_X; x++) {
+          glm::vec3 low(INFINITY), high(-INFINITY);
+
+          for (int corner = 0; corner < 4; corner++) {
+            float ndc_x = -1.0f + 2.0f * (x + (corner & 1)) / CLUSTER_TILES_X;
+            float ndc_y = -1.0f + 2.0f * (y + (corner >> 1)) / CLUSTER_TILES_Y;
+            glm::vec4 point = inverse * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+            glm::vec3 ray = glm::vec3(point) / point.w;
+
+            for (float depth : depths) {
+              glm::vec3 p = ray * (depth / -ray.z);
+              low = glm::min(low, p);
+              high = glm::max(high, p);
+            }
+          }
+
+          std::size_t i = (s * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x;
+          boxes.min_x[i] = low.x;
+          boxes.min_y[i] = low.y;
+          boxes.min_z[i] = low.z;
+          boxes.max_x[i] = high.x;
+          boxes.max_y[i] = high.y;
+          boxes.max_z[i] = high.z;
+        }
+      }
+    }
+  }
+
+  // Narrows `span` to the tiles under the projection of the sphere's
+  // bounding box; false when that is off screen. A box reaching behind the
+  // near plane keeps every tile.
+  bool screen_tiles(const glm::vec4& sphere, Light_Span& span) const {
+    if (-sphere.z - sphere.w <= near_plane) {
+      return true;
+    }
+
+    glm::vec2 low(INFINITY), high(-INFINITY);
+
+    for (int corner = 0; corner < 8; corner++) {
+      glm::vec3 offset((corner & 1) ? sphere.w : -sphere.w,
+                       (corner & 2) ? sphere.w : -sphere.w,
+                       (corner & 4) ? sphere.w : -sphere.w);
+      glm::vec4 clip =
+          projection * glm::vec4(glm::vec3(sphere) + offset, 1.0f);
+      glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+      low = glm::vec2(std::min(low.x, ndc.x), std::min(low.y, ndc.y));
+      high = glm::vec2(std::max(high.x, ndc.x), std::max(high.y, ndc.y));
+    }
+
+    // In tiles, widened a little against rounding at tile edges.
+    float x0 = (low.x + 1.0f) * 0.5f * CLUSTER_TILES_X - 0.01f;
+    float x1 = (high.x + 1.0f) * 0.5f * CLUSTER_TILES_X + 0.01f;
+    float y0 = (low.y + 1.0f) * 0.5f * CLUSTER_TILES_Y - 0.01f;
+    float y1 = (high.y + 1.0f) * 0.5f * CLUSTER_TILES_Y + 0.01f;
+
+    if (x1 < 0.0f || y1 < 0.0f || x0 >= CLUSTER_TILES_X ||
+        y0 >= CLUSTER_TILES_Y) {
+      return false;
+    }
+
+    span.first_x = std::max((int)x0, 0);
+    span.first_y = std::max((int)y0, 0);
+    span.last_x = std::min((int)x1, CLUSTER_TILES_X - 1);
+    span.last_y = std::min((int)y1, CLUSTER_TILES_Y - 1);
+    return true;
+  }
+
+  // Lists stay in light order, so the result does not depend on threads.
+  void bin_slice(int s, cull_math math) {
+    std::size_t slice_begin = (std::size_t)s * CLUSTERS_PER_SLICE;
+
+    for (std::size_t i = 0; i < CLUSTERS_PER_SLICE; i++) {
+      lists[slice_begin + i].clear();
+    }
+
+    for (std::size_t i = 0; i < spheres.size(); i++) {
+      const Light_Span& span = spans[i];
+
+      if (s < span.first_slice || s > span.last_slice) {
+        continue;
+      }
+
+      for (int y = span.first_y; y <= span.last_y; y++) {
+        std::size_t row = slice_begin + (std::size_t)y * CLUSTER_TILES_X;
+        std::size_t begin = row + span.first_x, end = row + span.last_x + 1;
+#ifdef LIGHT_CLUSTERS_SSE
+        if (math == CULL_MATH_SIMD) {
+          bin_sphere_simd(boxes, begin, end, spheres[i], light_ids[i],
+                          lists.data());
+          continue;
+        }
+#endif
+        bin_sphere_scalar(boxes, begin, end, spheres[i], light_ids[i],
+                          lists.data());
+      }
+    }
+  }
+
+  void pack() {
+    ranges.resize(CLUSTER_COUNT * 2);
+    indices.clear();
+
+    for (int i = 0; i < CLUSTER_COUNT; i++) {
+      const std::vector<std::uint32_t>& list = lists[i];
+      ranges[i * 2] = static_cast<std::uint32_t>(indices.size());
+      ranges[i * 2 + 1] = static_cast<std::uint32_t>(list.size());
+      indices.insert(indices.end(), list.begin(), list.end());
+      stats.occupied_clusters += !list.empty();
+      stats.max_per_cluster = std::max(stats.max_per_cluster, list.size());
+    }
+
+    stats.references = indices.size();
+  }
+};
+
+// Texture units of the cluster buffer textures, clear of the material
+// units from 0 and of BONE_PALETTE_TEXTURE_UNIT.
+const unsigned int CLUSTER_LIGHTS_TEXTURE_UNIT = 12;
+const unsigned int CLUSTER_RANGES_TEXTURE_UNIT = 13;
+const unsigned int CLUSTER_INDICES_TEXTURE_UNIT = 14;
+
+// The lights and froxel lists in buffer textures, read with texelFetch by
+// lighting_object.fs:
+//
+//   cluster_lights         RGBA32F, 3 texels per Cluster_Light
+//   cluster_ranges         RG32UI, offset and count per froxel
+//   cluster_light_indices  R32UI
+//
+// GL 3.3 guarantees 65536 texels per buffer texture, i.e. 21845 lights and
+// 65536 list entries; desktop drivers allow far more.
+class Light_Cluster_Buffers {
+ public:
+  // Bytes sent by the last upload().
+  std::size_t uploaded_bytes = 0;
+
+  Light_Cluster_Buffers()
+      : lights("cluster lights", GL_RGBA32F),
+        ranges("cluster ranges", GL_RG32UI),
+        indices("cluster light indices", GL_R32UI) {}
+
+  // Replaces all three; the old storage is orphaned, so frames still in
+  // flight keep reading their own copy.
+  std::size_t upload(const std::vector<Cluster_Light>& cluster_lights,
+                     const Light_Clusters& clusters) {
+    uploaded_bytes =
+        lights.upload(cluster_lights.data(),
+                      cluster_lights.size() * sizeof(Cluster_Light)) +
+        ranges.upload(clusters.cluster_ranges().data(),
+                      clusters.cluster_ranges().size() *
+                          sizeof(std::uint32_t)) +
+        indices.upload(clusters.light_indices().data(),
+                       clusters.light_indices().size() *
+                           sizeof(std::uint32_t));
+    return uploaded_bytes;
+  }
+
+  // Binds the textures and points `shader`'s samplers at them; the shader
+  // must be in use.
+  void bind(Shader& shader) const {
+    lights.bind(CLUSTER_LIGHTS_TEXTURE_UNIT);
+    ranges.bind(CLUSTER_RANGES_TEXTURE_UNIT);
+    indices.bind(CLUSTER_INDICES_TEXTURE_UNIT);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.set_uniform_int("cluster_lights"_uniform,
+                           CLUSTER_LIGHTS_TEXTURE_UNIT);
+    shader.set_uniform_int("cluster_ranges"_uniform,
+                           CLUSTER_RANGES_TEXTURE_UNIT);
+    shader.set_uniform_int("cluster_light_indices"_uniform,
+                           CLUSTER_INDICES_TEXTURE_UNIT);
+  }
+
+  // Deletes the GL objects, for before Gl_Resources::flush().
+  void reset() {
+    lights.reset();
+    ranges.reset();
+    indices.reset();
+  }
+
+ private:
+  struct Texture_Buffer {
+    Gl_Buffer buffer;
+    Gl_Texture texture;
+    GLenum format;
+    std::size_t capacity = 0;
+    bool attached = false;
+
+    Texture_Buffer(const char* label, GLenum format)
+        : buffer(Gl_Buffer::create(std::string(label) + " buffer")),
+          texture(Gl_Texture::create(std::string(label) + " texture")),
+          format(format) {}
+
+    // Never empty: a buffer texture needs storage to be complete.
+    std::size_t upload(const void* data, std::size_t bytes) {
+      capacity = std::max({capacity, bytes, std::size_t(16)});
+
+      glBindBuffer(GL_TEXTURE_BUFFER, buffer.get());
+      glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+      glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+
+      if (!attached) {
+        glBindTexture(GL_TEXTURE_BUFFER, texture.get());
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer.get());
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        attached = true;
+      }
+
+      glBindBuffer(GL_TEXTURE_BUFFER, 0);
+      return bytes;
+    }
+
+    void bind(unsigned int unit) const {
+      glActiveTexture(GL_TEXTURE0 + unit);
+      glBindTexture(GL_TEXTURE_BUFFER, texture.get());
+    }
+
+    void reset() {
+      buffer.reset();
+      texture.reset();
+      capacity = 0;
+      attached = false;
+    }
+  };
+
+  Texture_Buffer lights, ranges, indices;
+};
@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -9,17 +16,35 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "camera.hpp"
+#include "cube_mesh.hpp"
+#include "deferred.hpp"
+#include "frustum_cull.hpp"
+#include "gl_resource.hpp"
+#include "gpu_timer.hpp"
+#include "instancing.hpp"
+#include "light_clusters.hpp"
+#include "render_queue.hpp"
 #include "shader.hpp"
+#include "texture_cache.hpp"
+#include "uniform_block.hpp"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double x_pos, double y_pos);
 void scroll_callback(GLFWwindow* window, double x_offset, double y_offset);
 void process_input(GLFWwindow* window);
-unsigned int load_texture(char const* path);
 
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
+// 10 draws the usual scene; raise it (e.g. to 100000) to stress the
+// instanced path with a field of cubes behind it.
+const std::size_t CUBE_COUNT = 10;
+
+// The first 4 are the scene's fixed point lights; the rest are small
+// coloured point and spot lights circling through it. Raise it (e.g. to
+// 4096) to stress the clustered lighting.
+const std::size_t LIGHT_COUNT = 256;
+
 Camera camera(glm::vec3(0.0f, 0.0f, 6.0f));
 bool first_mouse = true;
 float last_x = SCR_WIDTH / 2.0f;
@@ -28,6 +53,10 @@ float last_y = SCR_HEIGHT / 2.0f;
 float delta_time = 0.0f;
 float last_frame_time = 0.0f;
 
+// G switches between the two; the title compares their GPU frame times.
+render_path path = RENDER_PATH_FORWARD;
+bool path_key_down = false;
+
 glm::vec3 light_pos(1.2f, 1.0f, 2.0f);
 
 int main() {
@@ -65,50 +94,6 @@ int main() {
   Shader object_shader("src/shader/lighting_object.vs", "src/shader/lighting_object.fs");
   Shader light_source_shader("src/shader/lighting_source.vs", "src/shader/lighting_source.fs");
 
-  float vertices[] = {
-    -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
-     0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 0.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
-
-    -0.5f, -0.5f,  0.5f,  0.0f,  0.0f, 1.0f,   0.0f, 0.0f,
-     0.5f, -0.5f,  0.5f,  0.0f,  0.0f, 1.0f,   1.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  0.0f, 1.0f,   1.0f, 1.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  0.0f, 1.0f,   1.0f, 1.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f,  0.0f, 1.0f,   0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f,  0.0f, 1.0f,   0.0f, 0.0f,
-
-    -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-
-     0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-     0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-     0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-
-    -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-     0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f,
-     0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
-     0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 0.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-
-    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 1.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f
-  };
-
   glm::vec3 cube_positions[] = {
     glm::vec3( 0.0f,  0.0f,  0.0f),
     glm::vec3( 2.0f,  5.0f, -15.0f),
@@ -129,39 +114,138 @@ int main() {
     glm::vec3( 0.0f,  0.0f, -3.0f)
   };
 
-  unsigned int VBO, object_VAO;
-  glGenVertexArrays(1, &object_VAO);
-  glGenBuffers(1, &VBO);
-
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  std::unique_ptr<Mesh> cube_mesh =
+      std::make_unique<Mesh>(make_cube_mesh());
 
-  glBindVertexArray(object_VAO);
+  Texture_Cache& texture_cache = Texture_Cache::shared();
+  unsigned int diffuse_map = texture_cache.acquire("data/container2.png");
+  unsigned int specular_map =
+      texture_cache.acquire("data/container2_specular.png");
+  texture_cache.finish();
 
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-  glEnableVertexAttribArray(0);
+  object_shader.use();
+  object_shader.set_uniform_int("material.diffuse"_uniform, 0);
+  object_shader.set_uniform_int("material.specular"_uniform, 1);
+  object_shader.set_uniform_float("material.shininess"_uniform, 32.0f);
+
+  Deferred_Renderer deferred;
+  deferred.geometry_shader.use();
+  deferred.geometry_shader.set_uniform_int("material.diffuse"_uniform, 0);
+  deferred.geometry_shader.set_uniform_int("material.specular"_uniform, 1);
+  deferred.lighting_shader.use();
+  deferred.lighting_shader.set_uniform_float("shininess"_uniform, 32.0f);
+
+  // Only the spot light and the cluster mapping change; the rest of the
+  // block is sent once, on the first upload().
+  Uniform_Block<Camera_Block> camera_block(UNIFORM_BLOCK_CAMERA);
+  Uniform_Block<Lights_Block> lights_block(UNIFORM_BLOCK_LIGHTS);
+
+  Std140_Dir_Light dir_light{};
+  dir_light.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+  dir_light.ambient = glm::vec3(0.05f);
+  dir_light.diffuse = glm::vec3(0.4f);
+  dir_light.specular = glm::vec3(0.5f);
+  lights_block.set(&Lights_Block::dir_light, dir_light);
+
+  std::vector<Cluster_Light> lights(LIGHT_COUNT);
+
+  for (int i = 0; i < 4; i++) {
+    lights[i].position = point_light_positions[i];
+    lights[i].range = 15.0f;
+    lights[i].color = glm::vec3(3.0f);
+  }
 
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
+  // Every fourth moving light is a spot light pointing down and out.
+  struct Light_Orbit {
+    glm::vec3 center;
+    float radius, speed, phase;
+  };
 
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-  glEnableVertexAttribArray(2);
+  std::vector<Light_Orbit> orbits;
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  for (std::size_t i = 4; i < LIGHT_COUNT; i++) {
+    glm::vec3 center(unit(random) * 10.0f - 5.0f, unit(random) * 8.0f - 4.0f,
+                     unit(random) * -17.0f + 2.0f);
+    orbits.push_back({center, 0.5f + unit(random) * 2.0f,
+                      0.2f + unit(random), unit(random) * 6.2831853f});
+    lights[i].range = 2.0f + unit(random) * 2.0f;
+    lights[i].color =
+        glm::vec3(unit(random), unit(random), unit(random)) * 2.0f;
+
+    if (i % 4 == 0) {
+      lights[i].cos_inner = glm::cos(glm::radians(20.0f));
+      lights[i].cos_outer = glm::cos(glm::radians(30.0f));
+    }
+  }
 
-  unsigned int light_source_VAO;
-  glGenVertexArrays(1, &light_source_VAO);
-  glBindVertexArray(light_source_VAO);
+  Light_Clusters light_clusters;
+  Light_Cluster_Buffers cluster_buffers;
+  object_shader.use();
+  cluster_buffers.bind(object_shader);
+  deferred.lighting_shader.use();
+  cluster_buffers.bind(deferred.lighting_shader);
+  lights_block.set(&Lights_Block::cluster_grid,
+                   glm::ivec4{CLUSTER_TILES_X, CLUSTER_TILES_Y,
+                              CLUSTER_SLICES, 0});
+
+  Std140_Spot_Light spot_light{};
+  spot_light.ambient = glm::vec3(0.0f);
+  spot_light.diffuse = glm::vec3(1.0f);
+  spot_light.specular = glm::vec3(1.0f);
+  spot_light.constant = 1.0f;
+  spot_light.linear = 0.09f;
+  spot_light.quadratic = 0.032f;
+  spot_light.cut_off = glm::cos(glm::radians(12.5f));
+  spot_light.outer_cut_off = glm::cos(glm::radians(15.0f));
+
+  // Past the ten scene cubes, the rest of CUBE_COUNT fill a grid further
+  // down -z. Nothing moves, so the instance buffers only change when the
+  // set of visible cubes does.
+  std::size_t side =
+      static_cast<std::size_t>(std::ceil(std::cbrt((double)CUBE_COUNT)));
+  std::vector<glm::mat4> cube_models, light_models;
+  Cull_Bounds cube_bounds, light_bounds;
+  std::vector<unsigned char> cube_visible, light_visible;
+  cube_models.reserve(CUBE_COUNT);
+  cube_bounds.reserve(CUBE_COUNT);
+
+  for (std::size_t i = 0; i < CUBE_COUNT; i++) {
+    glm::vec3 position;
+
+    if (i < 10) {
+      position = cube_positions[i];
+    } else {
+      float x = (float)(i % side) - side * 0.5f;
+      float y = (float)(i / side % side) - side * 0.5f;
+      float z = (float)(i / (side * side));
+      position = glm::vec3(x, y, -z) * 3.0f - glm::vec3(0, 0, 20);
+    }
 
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    float angle = 20.0f * (i % 10);
+    model =
+        glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+    cube_models.push_back(model);
+    cube_bounds.push_back(glm::vec3(-0.5f), glm::vec3(0.5f), model);
+  }
 
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-  glEnableVertexAttribArray(0);
+  for (unsigned int i = 0; i < 4; i++) {
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), point_light_positions[i]);
+    model = glm::scale(model, glm::vec3(0.2f));
+    light_models.push_back(model);
+    light_bounds.push_back(glm::vec3(-0.5f), glm::vec3(0.5f), model);
+  }
 
-  unsigned int diffuse_map = load_texture("data/container2.png");
-  unsigned int specular_map = load_texture("data/container2_specular.png");
+  // Both draw the cube mesh; attach() repoints its VAO between them.
+  Instance_Buffer cube_instances, light_instances;
+  Render_Queue render_queue;
+  float last_title_time = 0.0f;
 
-  object_shader.use();
-  object_shader.set_uniform_int("material.diffuse", 0);
-  object_shader.set_uniform_int("material.specular", 1);
+  // Smoothed GPU time of each path's frames, 0 until it has been timed.
+  Gpu_Timer frame_timer;
+  double path_ms[2] = {0.0, 0.0};
 
   while (!glfwWindowShouldClose(window)) {
     float current_frame_time = static_cast<float>(glfwGetTime());
@@ -170,115 +254,132 @@ int main() {
 
     process_input(window);
 
+    frame_timer.begin(path);
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    object_shader.use();
-    object_shader.set_uniform_vec3("view_pos", camera.position);
-    object_shader.set_uniform_float("material.shininess", 32.0f);
-
-    // Directional Light
-    object_shader.set_uniform_vec3("dir_light.direction", -0.2f, -1.0f, -0.3f);
-    object_shader.set_uniform_vec3("dir_light.ambient", 0.05f, 0.05f, 0.05f);
-    object_shader.set_uniform_vec3("dir_light.diffuse", 0.4f, 0.4f, 0.4f);
-    object_shader.set_uniform_vec3("dir_light.specular", 0.5f, 0.5f, 0.5f);
-
-    // Point Lights
-    object_shader.set_uniform_vec3("point_lights[0].position", point_light_positions[0]);
-    object_shader.set_uniform_vec3("point_lights[0].ambient", 0.05f, 0.05f, 0.05f);
-    object_shader.set_uniform_vec3("point_lights[0].diffuse", 0.8f, 0.8f, 0.8f);
-    object_shader.set_uniform_vec3("point_lights[0].specular", 1.0f, 1.0f, 1.0f);
-    object_shader.set_uniform_float("point_lights[0].constant", 1.0f);
-    object_shader.set_uniform_float("point_lights[0].linear", 0.09f);
-    object_shader.set_uniform_float("point_lights[0].quadratic", 0.032f);
-
-    object_shader.set_uniform_vec3("point_lights[1].position", point_light_positions[1]);
-    object_shader.set_uniform_vec3("point_lights[1].ambient", 0.05f, 0.05f, 0.05f);
-    object_shader.set_uniform_vec3("point_lights[1].diffuse", 0.8f, 0.8f, 0.8f);
-    object_shader.set_uniform_vec3("point_lights[1].specular", 1.0f, 1.0f, 1.0f);
-    object_shader.set_uniform_float("point_lights[1].constant", 1.0f);
-    object_shader.set_uniform_float("point_lights[1].linear", 0.09f);
-    object_shader.set_uniform_float("point_lights[1].quadratic", 0.032f);
-
-    object_shader.set_uniform_vec3("point_lights[2].position", point_light_positions[2]);
-    object_shader.set_uniform_vec3("point_lights[2].ambient", 0.05f, 0.05f, 0.05f);
-    object_shader.set_uniform_vec3("point_lights[2].diffuse", 0.8f, 0.8f, 0.8f);
-    object_shader.set_uniform_vec3("point_lights[2].specular", 1.0f, 1.0f, 1.0f);
-    object_shader.set_uniform_float("point_lights[2].constant", 1.0f);
-    object_shader.set_uniform_float("point_lights[2].linear", 0.09f);
-    object_shader.set_uniform_float("point_lights[2].quadratic", 0.032f);
-
-    object_shader.set_uniform_vec3("point_lights[3].position", point_light_positions[3]);
-    object_shader.set_uniform_vec3("point_lights[3].ambient", 0.05f, 0.05f, 0.05f);
-    object_shader.set_uniform_vec3("point_lights[3].diffuse", 0.8f, 0.8f, 0.8f);
-    object_shader.set_uniform_vec3("point_lights[3].specular", 1.0f, 1.0f, 1.0f);
-    object_shader.set_uniform_float("point_lights[3].constant", 1.0f);
-    object_shader.set_uniform_float("point_lights[3].linear", 0.09f);
-    object_shader.set_uniform_float("point_lights[3].quadratic", 0.032f);
-
-    // Spot Light
-    object_shader.set_uniform_vec3("spot_light.position", camera.position);
-    object_shader.set_uniform_vec3("spot_light.direction", camera.front);
-    object_shader.set_uniform_vec3("spot_light.ambient", 0.0f, 0.0f, 0.0f);
-    object_shader.set_uniform_vec3("spot_light.diffuse", 1.0f, 1.0f, 1.0f);
-    object_shader.set_uniform_vec3("spot_light.specular", 1.0f, 1.0f, 1.0f);
-    object_shader.set_uniform_float("spot_light.constant", 1.0f);
-    object_shader.set_uniform_float("spot_light.linear", 0.09f);
-    object_shader.set_uniform_float("spot_light.quadratic", 0.032f);
-    object_shader.set_uniform_float("spot_light.cut_off", glm::cos(glm::radians(12.5f)));
-    object_shader.set_uniform_float("spot_light.outer_cut_off", glm::cos(glm::radians(15.0f)));
-
     glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
     glm::mat4 view = camera.get_view_matrix();
-    object_shader.set_uniform_mat4("projection", projection);
-    object_shader.set_uniform_mat4("view", view);
+    camera_block.set(&Camera_Block::projection, projection);
+    camera_block.set(&Camera_Block::view, view);
+    camera_block.set(&Camera_Block::view_pos, camera.position);
+
+    spot_light.position = camera.position;
+    spot_light.direction = camera.front;
+    lights_block.set(&Lights_Block::spot_light, spot_light);
+
+    for (std::size_t i = 4; i < LIGHT_COUNT; i++) {
+      const Light_Orbit& orbit = orbits[i - 4];
+      float angle = orbit.phase + orbit.speed * current_frame_time;
+      glm::vec3 offset(std::cos(angle), std::sin(angle * 0.7f) * 0.5f,
+                       std::sin(angle));
+      lights[i].position = orbit.center + offset * orbit.radius;
+      lights[i].direction =
+          glm::normalize(glm::vec3(offset.x, -2.0f, offset.z));
+    }
 
-    glm::mat4 model = glm::mat4(1.0f);
-    object_shader.set_uniform_mat4("model", model);
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+    light_clusters.set_projection(projection);
+    light_clusters.bin(lights, view);
+    glm::vec2 depth_mapping = light_clusters.depth_mapping();
+    lights_block.set(
+        &Lights_Block::cluster_mapping,
+        glm::vec4(depth_mapping.x, depth_mapping.y,
+                  (float)CLUSTER_TILES_X / std::max(framebuffer_width, 1),
+                  (float)CLUSTER_TILES_Y / std::max(framebuffer_height, 1)));
+    cluster_buffers.upload(lights, light_clusters);
+
+    std::size_t block_bytes = camera_block.upload() + lights_block.upload();
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, diffuse_map);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, specular_map);
 
-    glBindVertexArray(object_VAO);
-
-    for (unsigned int i = 0; i < 10; i++) {
-      glm::mat4 model = glm::mat4(1.0f);
-      model = glm::translate(model, cube_positions[i]);
-      float angle = 20.0f * i;
-      model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-      object_shader.set_uniform_mat4("model", model);
-
-      glDrawArrays(GL_TRIANGLES, 0, 36);
+    Frustum frustum(projection, view);
+    Frustum_Cull_Stats cull_stats;
+    cull_bounds(frustum, cube_bounds, cube_visible, cull_stats);
+    cull_bounds(frustum, light_bounds, light_visible, cull_stats);
+
+    cube_instances.pack(cube_models, cube_visible);
+    light_instances.pack(light_models, light_visible);
+    std::size_t uploaded_bytes =
+        cube_instances.upload() + light_instances.upload();
+
+    render_queue.clear();
+
+    Draw_Item item;
+    item.mesh = cube_mesh.get();
+    item.instances = &cube_instances;
+
+    if (path == RENDER_PATH_DEFERRED) {
+      deferred.begin_geometry(framebuffer_width, framebuffer_height);
+      item.shader = &deferred.geometry_shader;
+      render_queue.submit(item);
+      render_queue.execute();
+
+      deferred.light(0, projection, view);
+      render_queue.clear();
+    } else {
+      item.shader = &object_shader;
+      render_queue.submit(item);
     }
 
-    light_source_shader.use();
-    light_source_shader.set_uniform_mat4("projection", projection);
-    light_source_shader.set_uniform_mat4("view", view);
+    // The light markers are unlit, so both paths draw them forward.
+    item.shader = &light_source_shader;
+    item.instances = &light_instances;
+    render_queue.submit(item);
 
-    glBindVertexArray(light_source_VAO);
+    render_queue.execute();
+    frame_timer.end();
 
-    for (unsigned int i = 0; i < 4; i++) {
-      model = glm::mat4(1.0f);
-      model = glm::translate(model, point_light_positions[i]);
-      model = glm::scale(model, glm::vec3(0.2f));
+    int timed_path;
+    double frame_ms;
 
-      light_source_shader.set_uniform_mat4("model", model);
+    while (frame_timer.poll(timed_path, frame_ms)) {
+      double& average = path_ms[timed_path];
+      average = average > 0.0 ? average * 0.9 + frame_ms * 0.1 : frame_ms;
+    }
 
-      glDrawArrays(GL_TRIANGLES, 0, 36);
+    if (current_frame_time - last_title_time > 0.5f) {
+      char title[384];
+      std::snprintf(title, sizeof(title),
+                    "Lighting (%s, G switches) - GPU %.2f ms forward, "
+                    "%.2f ms deferred - %zu/%zu cubes culled, %.1f KiB of "
+                    "instances and %zu bytes of uniform blocks uploaded, %zu "
+                    "lights binned in %.2f ms (at most %zu per cluster)",
+                    render_path_name(path), path_ms[RENDER_PATH_FORWARD],
+                    path_ms[RENDER_PATH_DEFERRED], cull_stats.culled,
+                    cull_stats.tested, uploaded_bytes / 1024.0f, block_bytes,
+                    light_clusters.stats.binned, light_clusters.stats.bin_ms,
+                    light_clusters.stats.max_per_cluster);
+      glfwSetWindowTitle(window, title);
+      last_title_time = current_frame_time;
     }
-    
+
+    Gl_Resources::shared().end_frame();
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
 
-  glDeleteVertexArrays(1, &object_VAO);
-  glDeleteVertexArrays(1, &light_source_VAO);
-  glDeleteBuffers(1, &VBO);
+  cube_instances.reset();
+  light_instances.reset();
+  camera_block.reset();
+  lights_block.reset();
+  cluster_buffers.reset();
+  deferred.reset();
+  frame_timer.reset();
+  cube_mesh.reset();
+  texture_cache.release(diffuse_map);
+  texture_cache.release(specular_map);
+  texture_cache.evict_unused();
   object_shader.delete_program();
   light_source_shader.delete_program();
 
+  Gl_Resources::shared().flush();
+  Gl_Resources::shared().print_leak_report();
+
   glfwTerminate();
 
   return 0;
@@ -331,40 +432,13 @@ void process_input(GLFWwindow* window) {
   if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
     camera.process_keyboard(RIGHT, delta_time);
   }
-}
-
-unsigned int load_texture(char const* path) {
-  unsigned int texture_ID;
-  glGenTextures(1, &texture_ID);
-
-  int width, height, n_components;
-  unsigned char* data = stbi_load(path, &width, &height, &n_components, 0);
-
-  if (data) {
-    GLenum format;
-
-    if (n_components == 1) {
-      format = GL_RED;
-    } else if (n_components == 3) {
-      format = GL_RGB;
-    } else if (n_components == 4) {
-      format = GL_RGBA;
-    }
-
-    glBindTexture(GL_TEXTURE_2D, texture_ID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  bool path_key = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
 
-    stbi_image_free(data);
-  } else {
-    std::cerr << "Texture failed to load at path: " << path << "\n";
-    stbi_image_free(data);
+  if (path_key && !path_key_down) {
+    path = path == RENDER_PATH_FORWARD ? RENDER_PATH_DEFERRED
+                                       : RENDER_PATH_FORWARD;
   }
 
-  return texture_ID;
+  path_key_down = path_key;
 }
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <glad/glad.h>
@@ -8,20 +13,12 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "gl_resource.hpp"
+#include "mesh_arena.hpp"
+#include "mesh_simplify.hpp"
+#include "meshlet.hpp"
 #include "shader.hpp"
-
-const int MAX_BONE_INFLUENCE = 4;
-
-struct Vertex {
-  glm::vec3 position;
-  glm::vec3 normal;
-  glm::vec2 tex_coords;
-  glm::vec3 tangent;
-  glm::vec3 bitangent;
-
-  int m_bone_IDs[MAX_BONE_INFLUENCE];
-  int m_weights[MAX_BONE_INFLUENCE];
-};
+#include "vertex.hpp"
 
 struct Texture {
   unsigned int id;
@@ -29,6 +26,225 @@ struct Texture {
   std::string path;
 };
 
+// The sampler uniform for each of `textures`, bound to unit i in order:
+// "texture_diffuse1", "texture_diffuse2", "texture_specular1", ...
+inline std::vector<std::string> texture_sampler_names(
+    const std::vector<Texture>& textures) {
+  unsigned int diffuse_n = 1;
+  unsigned int specular_n = 1;
+  unsigned int normal_n = 1;
+  unsigned int height_n = 1;
+  std::vector<std::string> names;
+
+  for (const Texture& texture : textures) {
+    std::string number;
+    const std::string& name = texture.type;
+
+    if (name == "texture_diffuse") {
+      number = std::to_string(diffuse_n);
+      diffuse_n += 1;
+    } else if (name == "texture_specular") {
+      number = std::to_string(specular_n);
+      specular_n += 1;
+    } else if (name == "texture_normal") {
+      number = std::to_string(normal_n);
+      normal_n += 1;
+    } else if (name == "texture_height") {
+      number = std::to_string(height_n);
+      height_n += 1;
+    }
+
+    names.push_back(name + number);
+  }
+
+  return names;
+}
+
+// A mesh prepared for upload away from the GL thread. The GPU-ready data is
+// either owned by the import (`vertices` for the float format, or the
+// encoded_* buffers) or borrowed from a mapping that `owner` keeps alive.
+// Texture ids are left at 0; only type and path are known.
+struct Mesh_Import {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  std::vector<Texture> textures;
+  std::vector<Meshlet> meshlets;
+  std::vector<Mesh_LOD> lods;
+
+  vertex_format format = VERTEX_FORMAT_FLOAT;
+  GLenum index_type = GL_UNSIGNED_INT;
+  std::size_t vertex_count = 0;
+  std::size_t index_count = 0;
+  const void* vertex_data = nullptr;
+  const void* index_data = nullptr;
+  std::vector<unsigned char> encoded_vertices;
+  std::vector<unsigned char> encoded_indices;
+  std::shared_ptr<const void> owner;
+
+  glm::vec3 bounds_min = glm::vec3(0.0f);
+  glm::vec3 bounds_max = glm::vec3(0.0f);
+
+  // Has bone weights, see skinning.hpp.
+  bool skinned = false;
+
+  Mesh_Import() = default;
+
+  // vertex_data / index_data may point into this import's own buffers.
+  Mesh_Import(const Mesh_Import&) = delete;
+  Mesh_Import& operator=(const Mesh_Import&) = delete;
+
+  std::size_t vertex_bytes() const {
+    return vertex_count * vertex_size(format);
+  }
+
+  std::size_t index_bytes() const {
+    return index_count * index_size(index_type);
+  }
+};
+
+// What happens to a model's CPU-side geometry once it is on the GPU.
+enum geometry_residency {
+  // Keep the full vertices and indices.
+  GEOMETRY_RESIDENCY_KEEP,
+  // Free them; the mesh can still be drawn, culled and LOD-selected.
+  GEOMETRY_RESIDENCY_DROP,
+  // Keep only positions and level-0 triangles, in Mesh::collision.
+  GEOMETRY_RESIDENCY_COLLISION
+};
+
+// Positions (12 bytes instead of sizeof(Vertex)) and the full-detail
+// triangles, for picking and physics once the full vertices are gone.
+struct Collision_Mesh {
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned int> indices;
+
+  std::size_t bytes() const {
+    return positions.capacity() * sizeof(glm::vec3) +
+           indices.capacity() * sizeof(unsigned int);
+  }
+};
+
+// Vertex `i` of the import, decoded from its GPU data when the float
+// vertices are not around (e.g. meshes from the mesh cache).
+inline Vertex import_vertex(const Mesh_Import& import, std::size_t i) {
+  if (!import.vertices.empty()) {
+    return import.vertices[i];
+  }
+
+  const unsigned char* bytes = static_cast<const unsigned char*>(
+                                   import.vertex_data) +
+                               i * vertex_size(import.format);
+  Vertex vertex;
+
+  if (import.format == VERTEX_FORMAT_FLOAT) {
+    std::memcpy(&vertex, bytes, sizeof(vertex));
+    return vertex;
+  }
+
+  // Compact_Skinned_Vertex starts with a Compact_Vertex.
+  Compact_Vertex compact;
+  std::memcpy(&compact, bytes, sizeof(compact));
+  vertex = decode_compact_vertex(compact, import.bounds_min,
+                                 import.bounds_max);
+
+  if (import.format == VERTEX_FORMAT_COMPACT_SKINNED) {
+    Compact_Skinned_Vertex skinned;
+    std::memcpy(&skinned, bytes, sizeof(skinned));
+
+    for (int j = 0; j < MAX_BONE_INFLUENCE; j++) {
+      vertex.m_bone_IDs[j] = skinned.bone_IDs[j];
+      vertex.m_weights[j] = skinned.weights[j] / 255.0f;
+    }
+  }
+
+  return vertex;
+}
+
+// The first `count` indices of the import, widened from its GPU data when
+// needed.
+inline void import_indices(const Mesh_Import& import, std::size_t count,
+                           unsigned int* out) {
+  if (!import.indices.empty()) {
+    std::copy(import.indices.begin(), import.indices.begin() + count, out);
+  } else if (import.index_type == GL_UNSIGNED_SHORT) {
+    const uint16_t* narrow = static_cast<const uint16_t*>(import.index_data);
+    std::copy(narrow, narrow + count, out);
+  } else {
+    const uint32_t* wide = static_cast<const uint32_t*>(import.index_data);
+    std::copy(wide, wide + count, out);
+  }
+}
+
+// Reads the collision data back out of the import.
+inline Collision_Mesh build_collision_mesh(const Mesh_Import& import) {
+  Collision_Mesh collision;
+  std::size_t index_count =
+      import.lods.empty() ? import.index_count : import.lods[0].index_count;
+
+  collision.positions.resize(import.vertex_count);
+  collision.indices.resize(index_count);
+
+  for (std::size_t i = 0; i < import.vertex_count; i++) {
+    collision.positions[i] = import_vertex(import, i).position;
+  }
+
+  import_indices(import, index_count, collision.indices.data());
+
+  return collision;
+}
+
+// The full vertices and indices (every LOD level) for
+// GEOMETRY_RESIDENCY_KEEP. Imported meshes hand over their float originals;
+// cached ones are decoded, so compact vertices come back quantized.
+inline void keep_import_geometry(Mesh_Import& import,
+                                 std::vector<Vertex>& vertices,
+                                 std::vector<unsigned int>& indices) {
+  if (!import.vertices.empty()) {
+    vertices = std::move(import.vertices);
+  } else {
+    vertices.resize(import.vertex_count);
+
+    for (std::size_t i = 0; i < import.vertex_count; i++) {
+      vertices[i] = import_vertex(import, i);
+    }
+  }
+
+  if (!import.indices.empty()) {
+    indices = std::move(import.indices);
+  } else {
+    indices.resize(import.index_count);
+    import_indices(import, import.index_count, indices.data());
+  }
+}
+
+// CPU bytes are vector capacities; GPU bytes are this mesh's share of its
+// buffers (an arena's unused capacity is not attributed to any mesh).
+struct Mesh_Memory {
+  std::size_t cpu_vertex_bytes = 0;
+  std::size_t cpu_index_bytes = 0;
+  std::size_t cpu_collision_bytes = 0;
+  // Meshlets, LODs and texture bindings.
+  std::size_t cpu_other_bytes = 0;
+  std::size_t gpu_vertex_bytes = 0;
+  std::size_t gpu_index_bytes = 0;
+
+  std::size_t cpu_bytes() const {
+    return cpu_vertex_bytes + cpu_index_bytes + cpu_collision_bytes +
+           cpu_other_bytes;
+  }
+
+  std::size_t gpu_bytes() const { return gpu_vertex_bytes + gpu_index_bytes; }
+
+  void merge(const Mesh_Memory& other) {
+    cpu_vertex_bytes += other.cpu_vertex_bytes;
+    cpu_index_bytes += other.cpu_index_bytes;
+    cpu_collision_bytes += other.cpu_collision_bytes;
+    cpu_other_bytes += other.cpu_other_bytes;
+    gpu_vertex_bytes += other.gpu_vertex_bytes;
+    gpu_index_bytes += other.gpu_index_bytes;
+  }
+};
+
 class Mesh {
  public:
   std::vector<Vertex> vertices;
@@ -36,98 +252,303 @@ class Mesh {
   std::vector<Texture> textures;
 
   unsigned int VAO;
+  unsigned int index_count;
+  vertex_format format = VERTEX_FORMAT_FLOAT;
+  // GL_UNSIGNED_SHORT whenever the vertices fit, see choose_index_type().
+  GLenum index_type = GL_UNSIGNED_INT;
+
+  // Set when the geometry lives in a shared Mesh_Arena instead of this
+  // mesh's own buffers; VAO is then the arena's VAO.
+  Mesh_Arena* arena = nullptr;
+  Arena_Allocation allocation;
+
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+
+  // Bounding sphere around the box: its centre and half diagonal.
+  glm::vec3 bounds_center() const { return (bounds_min + bounds_max) * 0.5f; }
+
+  float bounds_radius() const {
+    return glm::length(bounds_max - bounds_min) * 0.5f;
+  }
+
+  // Optional; see build_meshlets(). Indexes level 0 of the index buffer.
+  std::vector<Meshlet> meshlets;
+
+  // Optional detail levels, all stored in this mesh's index buffer;
+  // draw_elements() draws lods[current_lod].
+  std::vector<Mesh_LOD> lods;
+  unsigned int current_lod = 0;
+
+  // Only filled in under GEOMETRY_RESIDENCY_COLLISION.
+  Collision_Mesh collision;
 
+  // Has bone weights, see skinning.hpp.
+  bool skinned = false;
+
+  // `format` is the GPU layout; `arena`, if given, must use the same one.
   Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
-       std::vector<Texture> textures) {
-    this->vertices = vertices;
-    this->indices = indices;
+       std::vector<Texture> textures, Mesh_Arena* arena = nullptr,
+       vertex_format format = VERTEX_FORMAT_FLOAT) {
+    this->vertices = std::move(vertices);
+    this->indices = std::move(indices);
+    this->textures = std::move(textures);
+    this->arena = arena;
+    this->format = format;
+    this->index_type = choose_index_type(this->vertices.size());
+    this->skinned = has_bone_weights(this->vertices);
+
+    compute_bounds();
+
+    std::vector<unsigned char> encoded_indices =
+        encode_indices(index_type, this->indices);
+
+    if (format == VERTEX_FORMAT_FLOAT) {
+      setup_mesh(this->vertices.data(), this->vertices.size(),
+                 encoded_indices.data(), this->indices.size());
+    } else {
+      std::vector<unsigned char> encoded =
+          encode_vertices(format, this->vertices, bounds_min, bounds_max);
+      setup_mesh(encoded.data(), this->vertices.size(),
+                 encoded_indices.data(), this->indices.size());
+    }
+  }
+
+  // Uploads straight from caller-owned memory (e.g. a mapped mesh cache)
+  // without keeping a CPU-side copy of the geometry. `vertex_data` is
+  // already encoded in `format` and `index_data` in `index_type`.
+  Mesh(const void* vertex_data, vertex_format format,
+       std::size_t vertex_count, const void* index_data, GLenum index_type,
+       std::size_t index_count, std::vector<Texture> textures,
+       glm::vec3 bounds_min, glm::vec3 bounds_max,
+       Mesh_Arena* arena = nullptr) {
     this->textures = textures;
+    this->arena = arena;
+    this->format = format;
+    this->index_type = index_type;
+    this->bounds_min = bounds_min;
+    this->bounds_max = bounds_max;
 
-    setup_mesh();
+    setup_mesh(vertex_data, vertex_count, index_data, index_count);
+  }
+
+  // Overwrites the GPU vertices with `vertex_data` (all of them, already in
+  // `format`), e.g. after CPU skinning.
+  void update_vertices(const void* vertex_data) {
+    if (arena) {
+      arena->update_vertices(allocation, vertex_data);
+      return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer.get());
+    glBufferSubData(GL_ARRAY_BUFFER, 0,
+                    allocation.vertex_count * vertex_size(format),
+                    vertex_data);
   }
 
   void draw(Shader& shader) {
-    unsigned int diffuse_n = 1;
-    unsigned int specular_n = 1;
-    unsigned int normal_n = 1;
-    unsigned int height_n = 1;
+    bind_textures(shader);
+    set_vertex_uniforms(shader);
 
-    for (unsigned int i = 0; i < textures.size(); i++) {
-      glActiveTexture(GL_TEXTURE0 + i);
+    glBindVertexArray(VAO);
+    draw_elements();
+    glBindVertexArray(0);
+
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // The VAO's registry ID, for keying state on it (see instancing.hpp);
+  // unlike VAO it never names another object once this one is deleted.
+  Gl_Object_ID vertex_array_id() const {
+    return arena ? arena->vertex_array_id() : vertex_array.object_id();
+  }
+
+  // Issues the draw call alone; the caller has bound this mesh's VAO (for
+  // arena meshes, the arena VAO shared by every mesh in it).
+  void draw_elements() const {
+    std::size_t first = 0;
+    std::size_t count = index_count;
+
+    if (!lods.empty()) {
+      first = lods[current_lod].first_index;
+      count = lods[current_lod].index_count;
+    }
+
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES, static_cast<GLsizei>(count), index_type,
+        (void*)((allocation.first_index + first) * index_size(index_type)),
+        static_cast<GLint>(allocation.base_vertex));
+  }
+
+  // Like draw_elements(), `instance_count` times; the instance attributes
+  // come from an Instance_Buffer attached to the VAO.
+  void draw_elements_instanced(std::size_t instance_count) const {
+    std::size_t first = 0;
+    std::size_t count = index_count;
+
+    if (!lods.empty()) {
+      first = lods[current_lod].first_index;
+      count = lods[current_lod].index_count;
+    }
+
+    glDrawElementsInstancedBaseVertex(
+        GL_TRIANGLES, static_cast<GLsizei>(count), index_type,
+        (void*)((allocation.first_index + first) * index_size(index_type)),
+        static_cast<GLsizei>(instance_count),
+        static_cast<GLint>(allocation.base_vertex));
+  }
+
+  // Draws only the listed meshlets (ascending), merging runs of adjacent
+  // ones into a single range of the multi-draw.
+  void draw_meshlets(const std::vector<unsigned int>& visible) const {
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    std::size_t size = index_size(index_type);
 
-      std::string number;
-      std::string name = textures[i].type;
-
-      if (name == "texture_diffuse") {
-        number = std::to_string(diffuse_n);
-        diffuse_n += 1;
-      } else if (name == "texture_specular") {
-        number = std::to_string(specular_n);
-        specular_n += 1;
-      } else if (name == "texture_normal") {
-        number = std::to_string(normal_n);
-        normal_n += 1;
-      } else if (name == "texture_height") {
-        number = std::to_string(height_n);
-        height_n += 1;
+    for (std::size_t i = 0; i < visible.size(); i++) {
+      const Meshlet& meshlet = meshlets[visible[i]];
+      bool adjacent = i > 0 && visible[i] == visible[i - 1] + 1;
+
+      if (adjacent) {
+        counts.back() += meshlet.triangle_count * 3;
+        continue;
       }
 
-      glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+      counts.push_back(meshlet.triangle_count * 3);
+      offsets.push_back((const void*)((allocation.first_index +
+                                       meshlet.first_triangle * 3) *
+                                      size));
+    }
+
+    if (counts.empty()) {
+      return;
+    }
+
+    std::vector<GLint> base_vertices(
+        counts.size(), static_cast<GLint>(allocation.base_vertex));
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), index_type,
+                                  offsets.data(),
+                                  static_cast<GLsizei>(counts.size()),
+                                  base_vertices.data());
+  }
+
+  std::size_t index_bytes() const {
+    return index_count * index_size(index_type);
+  }
+
+  Mesh_Memory memory() const {
+    Mesh_Memory memory;
+    memory.cpu_vertex_bytes = vertices.capacity() * sizeof(Vertex);
+    memory.cpu_index_bytes = indices.capacity() * sizeof(unsigned int);
+    memory.cpu_collision_bytes = collision.bytes();
+    memory.cpu_other_bytes = meshlets.capacity() * sizeof(Meshlet) +
+                             lods.capacity() * sizeof(Mesh_LOD) +
+                             textures.capacity() * sizeof(Texture);
+    memory.gpu_vertex_bytes = allocation.vertex_count * vertex_size(format);
+    memory.gpu_index_bytes = index_bytes();
+    return memory;
+  }
+
+  // Compact vertices store positions relative to the mesh bounds; the
+  // vertex shader needs them to decode.
+  void set_vertex_uniforms(Shader& shader) {
+    if (format == VERTEX_FORMAT_FLOAT) {
+      return;
+    }
+
+    shader.set_uniform_vec3("position_offset", bounds_min);
+    shader.set_uniform_vec3("position_scale",
+                            position_scale(bounds_min, bounds_max));
+  }
+
+  void bind_textures(Shader& shader) {
+    const std::vector<Uniform_Handle>& samplers = sampler_uniforms(shader);
+
+    for (unsigned int i = 0; i < textures.size(); i++) {
+      glActiveTexture(GL_TEXTURE0 + i);
+      shader.set_sampler(samplers[i], i);
       glBindTexture(GL_TEXTURE_2D, textures[i].id);
     }
+  }
 
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()),
-                   GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+  // The sampler uniform of each texture in `shader`, resolved by name the
+  // first time the mesh meets that program. Texture types never change, so
+  // the handles stay valid; only the texture ids behind them do.
+  const std::vector<Uniform_Handle>& sampler_uniforms(
+      const Shader& shader) const {
+    Gl_Object_ID program = shader.object_id();
+
+    if (program.slot != sampler_program.slot ||
+        program.generation != sampler_program.generation ||
+        sampler_handles.size() != textures.size()) {
+      sampler_program = program;
+      sampler_handles.clear();
+
+      for (const std::string& name : texture_sampler_names(textures)) {
+        sampler_handles.push_back(shader.uniform(name));
+      }
+    }
 
-    glActiveTexture(GL_TEXTURE0);
+    return sampler_handles;
   }
 
  private:
-  unsigned int VBO, EBO;
-
-  void setup_mesh() {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+  // Empty for arena meshes.
+  Gl_Vertex_Array vertex_array;
+  // Cached by sampler_uniforms().
+  mutable Gl_Object_ID sampler_program;
+  mutable std::vector<Uniform_Handle> sampler_handles;
+  Gl_Buffer vertex_buffer;
+  Gl_Buffer index_buffer;
+
+  void compute_bounds() {
+    bounds_min = glm::vec3(0.0f);
+    bounds_max = glm::vec3(0.0f);
+
+    if (vertices.empty()) {
+      return;
+    }
 
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    bounds_min = vertices[0].position;
+    bounds_max = vertices[0].position;
 
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                 &vertices[0], GL_STATIC_DRAW);
+    for (const Vertex& vertex : vertices) {
+      bounds_min = glm::min(bounds_min, vertex.position);
+      bounds_max = glm::max(bounds_max, vertex.position);
+    }
+  }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 &indices[0], GL_STATIC_DRAW);
+  void setup_mesh(const void* vertex_data, std::size_t vertex_count,
+                  const void* index_data, std::size_t index_count) {
+    this->index_count = static_cast<unsigned int>(index_count);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    if (arena) {
+      allocation = arena->allocate(vertex_data, vertex_count, index_data,
+                                   index_type, index_count);
+      VAO = arena->VAO;
+      return;
+    }
 
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, normal));
+    allocation.vertex_count = vertex_count;
+    allocation.index_count = index_count;
+    allocation.index_type = index_type;
 
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, tex_coords));
+    vertex_array = Gl_Vertex_Array::create("mesh VAO");
+    vertex_buffer = Gl_Buffer::create("mesh vertices");
+    index_buffer = Gl_Buffer::create("mesh indices");
+    VAO = vertex_array.get();
 
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, tangent));
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer.get());
 
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, bitangent));
+    glBufferData(GL_ARRAY_BUFFER, vertex_count * vertex_size(format),
+                 vertex_data, GL_STATIC_DRAW);
 
-    glEnableVertexAttribArray(5);
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, m_bone_IDs));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer.get());
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes(), index_data,
+                 GL_STATIC_DRAW);
 
-    glEnableVertexAttribArray(6);
-    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, m_weights));
+    setup_vertex_attributes(format);
 
     glBindVertexArray(0);
   }
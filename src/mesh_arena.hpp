@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <utility>
+
+#include <glad/glad.h>
+
+#include "gl_resource.hpp"
+#include "index_buffer.hpp"
+#include "vertex.hpp"
+
+// First-fit sub-allocator over a range of [0, capacity) elements. Freed
+// blocks are coalesced with their neighbours.
+class Range_Allocator {
+ public:
+  explicit Range_Allocator(std::size_t capacity = 0) : capacity(capacity) {
+    if (capacity > 0) {
+      free_blocks[0] = capacity;
+    }
+  }
+
+  bool allocate(std::size_t size, std::size_t& offset) {
+    if (size == 0) {
+      offset = 0;
+      return true;
+    }
+
+    for (auto it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+      if (it->second < size) {
+        continue;
+      }
+
+      offset = it->first;
+      std::size_t remaining = it->second - size;
+      free_blocks.erase(it);
+
+      if (remaining > 0) {
+        free_blocks[offset + size] = remaining;
+      }
+
+      used += size;
+      return true;
+    }
+
+    return false;
+  }
+
+  void free(std::size_t offset, std::size_t size) {
+    if (size == 0) {
+      return;
+    }
+
+    used -= size;
+    auto next = free_blocks.lower_bound(offset);
+
+    if (next != free_blocks.end() && offset + size == next->first) {
+      size += next->second;
+      next = free_blocks.erase(next);
+    }
+
+    if (next != free_blocks.begin()) {
+      auto prev = std::prev(next);
+
+      if (prev->first + prev->second == offset) {
+        prev->second += size;
+        return;
+      }
+    }
+
+    free_blocks[offset] = size;
+  }
+
+  // Extends the range; the new space is merged into a trailing free block.
+  void grow(std::size_t new_capacity) {
+    if (new_capacity <= capacity) {
+      return;
+    }
+
+    std::size_t old_capacity = capacity;
+    capacity = new_capacity;
+    used += new_capacity - old_capacity;
+    free(old_capacity, new_capacity - old_capacity);
+  }
+
+  std::size_t get_capacity() const { return capacity; }
+  std::size_t get_used() const { return used; }
+
+  std::size_t largest_free_block() const {
+    std::size_t largest = 0;
+
+    for (const auto& block : free_blocks) {
+      largest = std::max(largest, block.second);
+    }
+
+    return largest;
+  }
+
+  std::size_t free_block_count() const { return free_blocks.size(); }
+
+  // 0 when all free space is one contiguous block, approaching 1 as it is
+  // split into many small ones.
+  float fragmentation() const {
+    std::size_t total_free = capacity - used;
+
+    if (total_free == 0) {
+      return 0.0f;
+    }
+
+    return 1.0f - (float)largest_free_block() / (float)total_free;
+  }
+
+ private:
+  std::size_t capacity;
+  std::size_t used = 0;
+  std::map<std::size_t, std::size_t> free_blocks;
+};
+
+struct Arena_Allocation {
+  std::size_t base_vertex = 0;
+  std::size_t vertex_count = 0;
+  // In units of index_type, so the byte offset is first_index *
+  // index_size(index_type).
+  std::size_t first_index = 0;
+  std::size_t index_count = 0;
+  GLenum index_type = GL_UNSIGNED_INT;
+};
+
+struct Arena_Stats {
+  std::size_t allocations = 0;
+  std::size_t vertex_capacity = 0;
+  std::size_t vertex_used = 0;
+  // Index space is in bytes, since it mixes 16- and 32-bit indices.
+  std::size_t index_capacity = 0;
+  std::size_t index_used = 0;
+  std::size_t vertex_free_blocks = 0;
+  std::size_t index_free_blocks = 0;
+  float vertex_occupancy = 0.0f;
+  float index_occupancy = 0.0f;
+  float vertex_fragmentation = 0.0f;
+  float index_fragmentation = 0.0f;
+};
+
+// One VAO, vertex buffer and index buffer shared by many meshes. Each mesh
+// gets a sub-range of both buffers and is drawn with glDrawElementsBaseVertex,
+// so a whole model (or scene) needs a single VAO bind per frame.
+//
+// Both buffers double in size when an allocation does not fit, copying the
+// old contents on the GPU. The index buffer holds 16- and 32-bit index ranges
+// side by side; it is managed in 32-bit words so every range stays aligned
+// for either type.
+class Mesh_Arena {
+ public:
+  unsigned int VAO = 0;
+  const vertex_format format;
+  const std::size_t vertex_stride;
+
+  Mesh_Arena(vertex_format format = VERTEX_FORMAT_FLOAT,
+             std::size_t vertex_capacity = 1 << 18,
+             std::size_t index_capacity = 1 << 20)
+      : format(format),
+        vertex_stride(vertex_size(format)),
+        vertex_ranges(vertex_capacity),
+        index_ranges(index_capacity) {
+    vertex_array = Gl_Vertex_Array::create("arena VAO");
+    vertex_buffer = Gl_Buffer::create("arena vertices");
+    index_buffer = Gl_Buffer::create("arena indices");
+    VAO = vertex_array.get();
+
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer.get());
+    glBufferData(GL_ARRAY_BUFFER, vertex_capacity * vertex_stride, NULL,
+                 GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer.get());
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_capacity * sizeof(unsigned int),
+                 NULL, GL_STATIC_DRAW);
+
+    setup_vertex_attributes(format);
+
+    glBindVertexArray(0);
+  }
+
+  Mesh_Arena(const Mesh_Arena&) = delete;
+  Mesh_Arena& operator=(const Mesh_Arena&) = delete;
+
+  // `vertex_data` must already be encoded in this arena's format and
+  // `index_data` in `index_type`.
+  Arena_Allocation allocate(const void* vertex_data,
+                            std::size_t vertex_count, const void* index_data,
+                            GLenum index_type, std::size_t index_count) {
+    Arena_Allocation allocation;
+    allocation.vertex_count = vertex_count;
+    allocation.index_count = index_count;
+    allocation.index_type = index_type;
+
+    while (!vertex_ranges.allocate(vertex_count, allocation.base_vertex)) {
+      grow_vertices(vertex_ranges.get_capacity() * 2 + vertex_count);
+    }
+
+    std::size_t index_bytes = index_count * index_size(index_type);
+    std::size_t words = index_words(index_bytes);
+    std::size_t first_word = 0;
+
+    while (!index_ranges.allocate(words, first_word)) {
+      grow_indices(index_ranges.get_capacity() * 2 + words);
+    }
+
+    allocation.first_index = first_word * 4 / index_size(index_type);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer.get());
+    glBufferSubData(GL_ARRAY_BUFFER, allocation.base_vertex * vertex_stride,
+                    vertex_count * vertex_stride, vertex_data);
+
+    // The element buffer binding is VAO state, so go through the VAO rather
+    // than clobbering whatever VAO the caller has bound.
+    glBindVertexArray(VAO);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, first_word * 4, index_bytes,
+                    index_data);
+    glBindVertexArray(0);
+
+    allocations++;
+
+    return allocation;
+  }
+
+  // Overwrites an allocation's vertices in place.
+  void update_vertices(const Arena_Allocation& allocation,
+                       const void* vertex_data) {
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer.get());
+    glBufferSubData(GL_ARRAY_BUFFER, allocation.base_vertex * vertex_stride,
+                    allocation.vertex_count * vertex_stride, vertex_data);
+  }
+
+  void free(const Arena_Allocation& allocation) {
+    vertex_ranges.free(allocation.base_vertex, allocation.vertex_count);
+    std::size_t size = index_size(allocation.index_type);
+    index_ranges.free(allocation.first_index * size / 4,
+                      index_words(allocation.index_count * size));
+    allocations--;
+  }
+
+  void bind() const { glBindVertexArray(VAO); }
+
+  Gl_Object_ID vertex_array_id() const { return vertex_array.object_id(); }
+
+  Arena_Stats stats() const {
+    Arena_Stats result;
+    result.allocations = allocations;
+    result.vertex_capacity = vertex_ranges.get_capacity();
+    result.vertex_used = vertex_ranges.get_used();
+    result.index_capacity = index_ranges.get_capacity() * 4;
+    result.index_used = index_ranges.get_used() * 4;
+    result.vertex_free_blocks = vertex_ranges.free_block_count();
+    result.index_free_blocks = index_ranges.free_block_count();
+    result.vertex_occupancy =
+        (float)result.vertex_used / (float)std::max<std::size_t>(
+                                        result.vertex_capacity, 1);
+    result.index_occupancy =
+        (float)result.index_used / (float)std::max<std::size_t>(
+                                       result.index_capacity, 1);
+    result.vertex_fragmentation = vertex_ranges.fragmentation();
+    result.index_fragmentation = index_ranges.fragmentation();
+
+    return result;
+  }
+
+  void print_stats(std::ostream& out = std::cout) const {
+    Arena_Stats current = stats();
+    char line[512];
+
+    std::snprintf(line, sizeof(line),
+                  "mesh arena: %zu allocations\n"
+                  "  vertices    %zu / %zu (%.1f%% occupied, "
+                  "%.1f%% fragmented, %zu free blocks)\n"
+                  "  index bytes %zu / %zu (%.1f%% occupied, "
+                  "%.1f%% fragmented, %zu free blocks)\n",
+                  current.allocations, current.vertex_used,
+                  current.vertex_capacity, current.vertex_occupancy * 100.0f,
+                  current.vertex_fragmentation * 100.0f,
+                  current.vertex_free_blocks, current.index_used,
+                  current.index_capacity, current.index_occupancy * 100.0f,
+                  current.index_fragmentation * 100.0f,
+                  current.index_free_blocks);
+    out << line;
+  }
+
+ private:
+  Gl_Vertex_Array vertex_array;
+  Gl_Buffer vertex_buffer;
+  Gl_Buffer index_buffer;
+  Range_Allocator vertex_ranges;
+  Range_Allocator index_ranges;
+  std::size_t allocations = 0;
+
+  static std::size_t index_words(std::size_t bytes) { return (bytes + 3) / 4; }
+
+  // Replaces `buffer` with a larger copy. The old buffer is only released,
+  // so frames still in flight keep drawing from it until they retire.
+  static void grow_buffer(Gl_Buffer& buffer, const char* label,
+                          std::size_t old_bytes, std::size_t new_bytes) {
+    Gl_Buffer new_buffer = Gl_Buffer::create(label);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, new_buffer.get());
+    glBufferData(GL_COPY_WRITE_BUFFER, new_bytes, NULL, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer.get());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        old_bytes);
+
+    buffer = std::move(new_buffer);
+  }
+
+  void grow_vertices(std::size_t new_capacity) {
+    grow_buffer(vertex_buffer, "arena vertices",
+                vertex_ranges.get_capacity() * vertex_stride,
+                new_capacity * vertex_stride);
+    vertex_ranges.grow(new_capacity);
+
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer.get());
+    setup_vertex_attributes(format);
+    glBindVertexArray(0);
+  }
+
+  void grow_indices(std::size_t new_capacity) {
+    grow_buffer(index_buffer, "arena indices",
+                index_ranges.get_capacity() * sizeof(unsigned int),
+                new_capacity * sizeof(unsigned int));
+    index_ranges.grow(new_capacity);
+
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer.get());
+    glBindVertexArray(0);
+  }
+};
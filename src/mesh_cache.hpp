@@ -0,0 +1,464 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glm/glm.hpp>
+
+#include "hash.hpp"
+#include "mesh.hpp"
+
+// Baked mesh cache layout, all offsets relative to the start of the file:
+//
+//   Mesh_Cache_Header
+//   Mesh_Cache_Mesh[mesh_count]
+//   Mesh_Cache_Texture[texture_count]
+//   char strings[string_bytes]
+//   vertex data               (16-byte aligned, each mesh in its own
+//                              vertex_format, ready for glBufferData)
+//   index data                (4-byte aligned, each mesh in its own
+//                              index_type)
+//   Meshlet meshlets[meshlet_count]
+//   Mesh_LOD lods[lod_count]
+//
+// Bump MESH_CACHE_VERSION whenever any of these records or a vertex layout
+// change.
+const uint32_t MESH_CACHE_MAGIC = 0x4843534d;  // "MSCH"
+const uint32_t MESH_CACHE_VERSION = 7;
+
+struct Mesh_Cache_Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vertex_size;
+  uint32_t import_flags;
+  uint32_t vertex_format;
+  uint32_t optimize_flags;
+  uint64_t source_hash;
+  uint32_t mesh_count;
+  uint32_t texture_count;
+  uint32_t meshlet_count;
+  uint32_t lod_count;
+  uint64_t string_offset;
+  uint64_t string_bytes;
+  uint64_t vertex_offset;
+  uint64_t index_offset;
+  uint64_t meshlet_offset;
+  uint64_t lod_offset;
+  uint64_t file_size;
+};
+
+struct Mesh_Cache_Mesh {
+  uint64_t vertex_byte_offset;
+  uint64_t index_byte_offset;
+  uint32_t vertex_format;
+  uint32_t index_type;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t first_texture;
+  uint32_t texture_count;
+  uint32_t first_meshlet;
+  uint32_t meshlet_count;
+  uint32_t first_lod;
+  uint32_t lod_count;
+  float bounds_min[3];
+  float bounds_max[3];
+};
+
+struct Mesh_Cache_Texture {
+  uint32_t type_offset;
+  uint32_t type_length;
+  uint32_t path_offset;
+  uint32_t path_length;
+};
+
+// The cache key of a model file: its own hash, folded with the hash of
+// every material library it names, since the cache also holds the texture
+// paths those libraries supply. Only .obj files refer to other files the
+// importer reads; each "mtllib" line names one library by the rest of the
+// line, relative to the .obj, as the OBJ importer resolves it. A missing
+// library folds in 0, so creating it also invalidates the cache.
+inline bool hash_model_sources(const std::string& path, uint64_t& hash) {
+  if (!hash_file(path, hash)) {
+    return false;
+  }
+
+  std::string extension = path.substr(path.find_last_of('.') + 1);
+
+  for (char& c : extension) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+
+  if (extension != "obj") {
+    return true;
+  }
+
+  std::string directory = path.substr(0, path.find_last_of('/') + 1);
+  std::ifstream file(path);
+  std::string line;
+
+  while (std::getline(file, line)) {
+    std::size_t begin = line.find_first_not_of(" \t");
+
+    if (begin == std::string::npos || line.compare(begin, 6, "mtllib") != 0 ||
+        line.size() <= begin + 6 ||
+        !std::isspace(static_cast<unsigned char>(line[begin + 6]))) {
+      continue;
+    }
+
+    begin = line.find_first_not_of(" \t", begin + 6);
+    std::size_t end = line.find_last_not_of(" \t\r");
+
+    if (begin == std::string::npos) {
+      continue;
+    }
+
+    uint64_t library_hash = 0;
+    hash_file(directory + line.substr(begin, end - begin + 1), library_hash);
+    hash = fnv1a_64(&library_hash, sizeof(library_hash), hash);
+  }
+
+  return true;
+}
+
+// Read-only memory mapping of a baked mesh cache. Vertex and index arrays are
+// handed to glBufferData directly out of the mapping.
+class Mesh_Cache_File {
+ public:
+  Mesh_Cache_File() = default;
+  Mesh_Cache_File(const Mesh_Cache_File&) = delete;
+  Mesh_Cache_File& operator=(const Mesh_Cache_File&) = delete;
+
+  ~Mesh_Cache_File() { close(); }
+
+  bool open(const std::string& path, uint64_t source_hash,
+            uint32_t import_flags, uint32_t optimize_flags,
+            vertex_format format) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0 ||
+        file_stat.st_size < (off_t)sizeof(Mesh_Cache_Header)) {
+      ::close(fd);
+      return false;
+    }
+
+    size = static_cast<std::size_t>(file_stat.st_size);
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+      data = nullptr;
+      return false;
+    }
+
+    const Mesh_Cache_Header& h = header();
+
+    if (h.magic != MESH_CACHE_MAGIC || h.version != MESH_CACHE_VERSION ||
+        h.vertex_size != sizeof(Vertex) || h.import_flags != import_flags ||
+        h.optimize_flags != optimize_flags ||
+        h.vertex_format != (uint32_t)format || h.source_hash != source_hash ||
+        h.file_size != size || !valid()) {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void close() {
+    if (data) {
+      munmap(data, size);
+    }
+
+    data = nullptr;
+    size = 0;
+  }
+
+  const Mesh_Cache_Header& header() const {
+    return *static_cast<const Mesh_Cache_Header*>(data);
+  }
+
+  const Mesh_Cache_Mesh& mesh(uint32_t i) const {
+    return at<Mesh_Cache_Mesh>(sizeof(Mesh_Cache_Header))[i];
+  }
+
+  const Mesh_Cache_Texture& texture(uint32_t i) const {
+    return at<Mesh_Cache_Texture>(sizeof(Mesh_Cache_Header) +
+                                  header().mesh_count *
+                                      sizeof(Mesh_Cache_Mesh))[i];
+  }
+
+  std::string string(uint32_t offset, uint32_t length) const {
+    return std::string(at<char>(header().string_offset) + offset, length);
+  }
+
+  const void* vertices(const Mesh_Cache_Mesh& mesh) const {
+    return at<char>(header().vertex_offset + mesh.vertex_byte_offset);
+  }
+
+  const void* indices(const Mesh_Cache_Mesh& mesh) const {
+    return at<char>(header().index_offset + mesh.index_byte_offset);
+  }
+
+  std::vector<Meshlet> meshlets(const Mesh_Cache_Mesh& mesh) const {
+    const Meshlet* first =
+        at<Meshlet>(header().meshlet_offset) + mesh.first_meshlet;
+    return std::vector<Meshlet>(first, first + mesh.meshlet_count);
+  }
+
+  std::vector<Mesh_LOD> lods(const Mesh_Cache_Mesh& mesh) const {
+    const Mesh_LOD* first = at<Mesh_LOD>(header().lod_offset) + mesh.first_lod;
+    return std::vector<Mesh_LOD>(first, first + mesh.lod_count);
+  }
+
+ private:
+  void* data = nullptr;
+  std::size_t size = 0;
+
+  // Whether `count` items of `item_size` bytes at `offset` end by `limit`,
+  // without overflowing on hostile values.
+  static bool in_range(uint64_t offset, uint64_t count, uint64_t item_size,
+                       uint64_t limit) {
+    return offset <= limit &&
+           (item_size == 0 || count <= (limit - offset) / item_size);
+  }
+
+  // Every section and every per-mesh range lies inside the file, so at()
+  // never reads past the mapping; run before anything else is read.
+  bool valid() const {
+    const Mesh_Cache_Header& h = header();
+    uint64_t records_end = sizeof(Mesh_Cache_Header);
+
+    if (!in_range(records_end, h.mesh_count, sizeof(Mesh_Cache_Mesh),
+                  size)) {
+      return false;
+    }
+
+    records_end += (uint64_t)h.mesh_count * sizeof(Mesh_Cache_Mesh);
+
+    if (!in_range(records_end, h.texture_count, sizeof(Mesh_Cache_Texture),
+                  size)) {
+      return false;
+    }
+
+    records_end += (uint64_t)h.texture_count * sizeof(Mesh_Cache_Texture);
+
+    if (h.string_offset != records_end ||
+        !in_range(h.string_offset, h.string_bytes, 1, h.vertex_offset) ||
+        h.vertex_offset % 16 != 0 || h.vertex_offset > h.index_offset ||
+        h.index_offset > h.meshlet_offset || h.meshlet_offset % 4 != 0 ||
+        !in_range(h.meshlet_offset, h.meshlet_count, sizeof(Meshlet),
+                  h.lod_offset) ||
+        h.lod_offset % 4 != 0 ||
+        !in_range(h.lod_offset, h.lod_count, sizeof(Mesh_LOD), size)) {
+      return false;
+    }
+
+    uint64_t vertex_bytes = h.index_offset - h.vertex_offset;
+    uint64_t index_bytes = h.meshlet_offset - h.index_offset;
+
+    for (uint32_t i = 0; i < h.texture_count; i++) {
+      const Mesh_Cache_Texture& record = texture(i);
+
+      if (!in_range(record.type_offset, record.type_length, 1,
+                    h.string_bytes) ||
+          !in_range(record.path_offset, record.path_length, 1,
+                    h.string_bytes)) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < h.mesh_count; i++) {
+      const Mesh_Cache_Mesh& record = mesh(i);
+
+      if (record.vertex_format > VERTEX_FORMAT_COMPACT_SKINNED ||
+          (record.index_type != GL_UNSIGNED_SHORT &&
+           record.index_type != GL_UNSIGNED_INT) ||
+          !in_range(record.vertex_byte_offset, record.vertex_count,
+                    vertex_size((vertex_format)record.vertex_format),
+                    vertex_bytes) ||
+          !in_range(record.index_byte_offset, record.index_count,
+                    index_size(record.index_type), index_bytes) ||
+          !in_range(record.first_texture, record.texture_count, 1,
+                    h.texture_count) ||
+          !in_range(record.first_meshlet, record.meshlet_count, 1,
+                    h.meshlet_count) ||
+          !in_range(record.first_lod, record.lod_count, 1, h.lod_count)) {
+        return false;
+      }
+
+      const Meshlet* meshlet =
+          at<Meshlet>(h.meshlet_offset) + record.first_meshlet;
+
+      for (uint32_t j = 0; j < record.meshlet_count; j++, meshlet++) {
+        if (!in_range(meshlet->first_triangle, meshlet->triangle_count, 1,
+                      record.index_count / 3)) {
+          return false;
+        }
+      }
+
+      const Mesh_LOD* lod = at<Mesh_LOD>(h.lod_offset) + record.first_lod;
+
+      for (uint32_t j = 0; j < record.lod_count; j++, lod++) {
+        if (!in_range(lod->first_index, lod->index_count, 1,
+                      record.index_count)) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  template <typename T>
+  const T* at(uint64_t offset) const {
+    return reinterpret_cast<const T*>(static_cast<const char*>(data) + offset);
+  }
+};
+
+// Bakes already encoded meshes, so nothing is converted twice.
+inline bool write_mesh_cache(const std::string& path, uint64_t source_hash,
+                             uint32_t import_flags, uint32_t optimize_flags,
+                             vertex_format format,
+                             const std::vector<const Mesh_Import*>& meshes) {
+  Mesh_Cache_Header header = {};
+  header.magic = MESH_CACHE_MAGIC;
+  header.version = MESH_CACHE_VERSION;
+  header.vertex_size = sizeof(Vertex);
+  header.import_flags = import_flags;
+  header.optimize_flags = optimize_flags;
+  header.vertex_format = format;
+  header.source_hash = source_hash;
+  header.mesh_count = static_cast<uint32_t>(meshes.size());
+
+  std::vector<Mesh_Cache_Mesh> mesh_records;
+  std::vector<Mesh_Cache_Texture> texture_records;
+  std::string strings;
+  uint64_t vertex_bytes = 0;
+  uint64_t index_bytes = 0;
+  std::vector<Meshlet> meshlets;
+  std::vector<Mesh_LOD> lods;
+
+  for (const Mesh_Import* mesh : meshes) {
+    Mesh_Cache_Mesh record = {};
+    record.vertex_byte_offset = vertex_bytes;
+    record.index_byte_offset = index_bytes;
+    record.vertex_format = mesh->format;
+    record.index_type = mesh->index_type;
+    record.vertex_count = static_cast<uint32_t>(mesh->vertex_count);
+    record.index_count = static_cast<uint32_t>(mesh->index_count);
+    record.first_texture = static_cast<uint32_t>(texture_records.size());
+    record.texture_count = static_cast<uint32_t>(mesh->textures.size());
+    record.first_meshlet = static_cast<uint32_t>(meshlets.size());
+    record.meshlet_count = static_cast<uint32_t>(mesh->meshlets.size());
+    meshlets.insert(meshlets.end(), mesh->meshlets.begin(),
+                    mesh->meshlets.end());
+    record.first_lod = static_cast<uint32_t>(lods.size());
+    record.lod_count = static_cast<uint32_t>(mesh->lods.size());
+    lods.insert(lods.end(), mesh->lods.begin(), mesh->lods.end());
+
+    for (int i = 0; i < 3; i++) {
+      record.bounds_min[i] = mesh->bounds_min[i];
+      record.bounds_max[i] = mesh->bounds_max[i];
+    }
+
+    for (const Texture& texture : mesh->textures) {
+      Mesh_Cache_Texture texture_record;
+      texture_record.type_offset = static_cast<uint32_t>(strings.size());
+      texture_record.type_length = static_cast<uint32_t>(texture.type.size());
+      strings += texture.type;
+      texture_record.path_offset = static_cast<uint32_t>(strings.size());
+      texture_record.path_length = static_cast<uint32_t>(texture.path.size());
+      strings += texture.path;
+
+      texture_records.push_back(texture_record);
+    }
+
+    // Keep every mesh's vertices 16-byte aligned within the mapping.
+    vertex_bytes += (mesh->vertex_bytes() + 15) & ~15ull;
+    index_bytes += (mesh->index_bytes() + 3) & ~3ull;
+    mesh_records.push_back(record);
+  }
+
+  header.texture_count = static_cast<uint32_t>(texture_records.size());
+  header.meshlet_count = static_cast<uint32_t>(meshlets.size());
+  header.lod_count = static_cast<uint32_t>(lods.size());
+  header.string_offset = sizeof(Mesh_Cache_Header) +
+                         mesh_records.size() * sizeof(Mesh_Cache_Mesh) +
+                         texture_records.size() * sizeof(Mesh_Cache_Texture);
+  header.string_bytes = strings.size();
+  header.vertex_offset = (header.string_offset + strings.size() + 15) & ~15ull;
+  header.index_offset = header.vertex_offset + vertex_bytes;
+  header.meshlet_offset = header.index_offset + index_bytes;
+  header.lod_offset =
+      header.meshlet_offset + meshlets.size() * sizeof(Meshlet);
+  header.file_size = header.lod_offset + lods.size() * sizeof(Mesh_LOD);
+
+  // Write to a temporary file first so a crash never leaves a truncated cache
+  // that passes the header check.
+  std::string temp_path = path + ".tmp";
+  std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+
+  if (!file) {
+    std::cerr << "ERROR::MESH_CACHE::WRITE_FAILED\n" << temp_path << "\n";
+    return false;
+  }
+
+  std::fwrite(&header, sizeof(header), 1, file);
+  std::fwrite(mesh_records.data(), sizeof(Mesh_Cache_Mesh),
+              mesh_records.size(), file);
+  std::fwrite(texture_records.data(), sizeof(Mesh_Cache_Texture),
+              texture_records.size(), file);
+  std::fwrite(strings.data(), 1, strings.size(), file);
+
+  const char padding[16] = {};
+  std::fwrite(padding, 1,
+              header.vertex_offset - header.string_offset - strings.size(),
+              file);
+
+  for (const Mesh_Import* mesh : meshes) {
+    std::fwrite(mesh->vertex_data, 1, mesh->vertex_bytes(), file);
+    std::fwrite(padding, 1,
+                ((mesh->vertex_bytes() + 15) & ~15ull) - mesh->vertex_bytes(),
+                file);
+  }
+
+  for (const Mesh_Import* mesh : meshes) {
+    std::fwrite(mesh->index_data, 1, mesh->index_bytes(), file);
+    std::fwrite(padding, 1,
+                ((mesh->index_bytes() + 3) & ~3ull) - mesh->index_bytes(),
+                file);
+  }
+
+  std::fwrite(meshlets.data(), sizeof(Meshlet), meshlets.size(), file);
+  std::fwrite(lods.data(), sizeof(Mesh_LOD), lods.size(), file);
+
+  bool ok = std::ferror(file) == 0;
+  ok = std::fclose(file) == 0 && ok;
+
+  if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::cerr << "ERROR::MESH_CACHE::WRITE_FAILED\n" << path << "\n";
+    std::remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
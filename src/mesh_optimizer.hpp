@@ -0,0 +1,448 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Import-time reordering of indexed triangle lists:
+//
+//   1. optimize_vertex_cache  - Tipsify triangle order for the post-transform
+//                               vertex cache.
+//   2. optimize_overdraw      - splits that order into clusters and sorts them
+//                               outside-in, so front faces tend to draw first.
+//   3. optimize_vertex_fetch  - renumbers vertices in first-use order so the
+//                               vertex buffer is read (mostly) sequentially.
+//
+// analyze_vertex_cache measures the result on a FIFO cache simulator, so the
+// numbers do not depend on (or need) a GPU.
+
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// Transformed vertex counts from the FIFO simulator. Counts rather than ratios
+// so stats of several meshes can be summed.
+struct Vertex_Cache_Stats {
+  std::size_t triangles = 0;
+  std::size_t vertices = 0;
+  std::size_t transformed = 0;
+
+  // Average cache miss ratio: transformed vertices per triangle (0.5 is the
+  // ideal for large regular meshes, 3 means no reuse at all).
+  float acmr() const {
+    return triangles ? (float)transformed / (float)triangles : 0.0f;
+  }
+
+  // Average transform to vertex ratio: 1 means every vertex is transformed
+  // exactly once.
+  float atvr() const {
+    return vertices ? (float)transformed / (float)vertices : 0.0f;
+  }
+
+  void merge(const Vertex_Cache_Stats& other) {
+    triangles += other.triangles;
+    vertices += other.vertices;
+    transformed += other.transformed;
+  }
+};
+
+inline Vertex_Cache_Stats analyze_vertex_cache(
+    const std::vector<unsigned int>& indices, std::size_t vertex_count,
+    unsigned int cache_size = VERTEX_CACHE_SIZE) {
+  Vertex_Cache_Stats stats;
+  stats.triangles = indices.size() / 3;
+  stats.vertices = vertex_count;
+
+  // A vertex is in the FIFO iff it was pushed within the last cache_size
+  // misses; the timestamps start past cache_size so everything begins cold.
+  std::vector<std::size_t> cache_time(vertex_count, 0);
+  std::size_t time = cache_size + 1;
+
+  for (unsigned int index : indices) {
+    if (time - cache_time[index] > cache_size) {
+      cache_time[index] = time++;
+      stats.transformed++;
+    }
+  }
+
+  return stats;
+}
+
+// Triangles adjacent to each vertex, in compressed row form.
+struct Triangle_Adjacency {
+  std::vector<unsigned int> offsets;
+  std::vector<unsigned int> counts;
+  std::vector<unsigned int> triangles;
+
+  Triangle_Adjacency(const std::vector<unsigned int>& indices,
+                     std::size_t vertex_count)
+      : offsets(vertex_count + 1, 0),
+        counts(vertex_count, 0),
+        triangles(indices.size()) {
+    for (unsigned int index : indices) {
+      counts[index]++;
+    }
+
+    for (std::size_t i = 0; i < vertex_count; i++) {
+      offsets[i + 1] = offsets[i] + counts[i];
+    }
+
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+
+    for (std::size_t i = 0; i < indices.size(); i++) {
+      triangles[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+    }
+  }
+};
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw", 2007). Fans around one vertex at a time and
+// picks the next fanning vertex among the ones still in cache.
+//
+// When `clusters` is given it receives the first triangle of every run that
+// starts with a cold cache; optimize_overdraw can reorder those freely.
+inline void optimize_vertex_cache(std::vector<unsigned int>& indices,
+                                  std::size_t vertex_count,
+                                  std::vector<unsigned int>* clusters = nullptr,
+                                  unsigned int cache_size = VERTEX_CACHE_SIZE) {
+  std::size_t triangle_count = indices.size() / 3;
+
+  if (triangle_count == 0 || vertex_count == 0) {
+    return;
+  }
+
+  Triangle_Adjacency adjacency(indices, vertex_count);
+  std::vector<unsigned int> live = adjacency.counts;
+  std::vector<std::size_t> cache_time(vertex_count, 0);
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<unsigned int> dead_end;
+  std::vector<unsigned int> candidates;
+  std::vector<unsigned int> result;
+  result.reserve(indices.size());
+
+  if (clusters) {
+    clusters->clear();
+  }
+
+  std::size_t time = cache_size + 1;
+  std::size_t cursor = 0;
+  bool cold = true;
+  long fanning = indices[0];
+
+  while (fanning >= 0) {
+    candidates.clear();
+
+    if (cold && clusters) {
+      clusters->push_back(static_cast<unsigned int>(result.size() / 3));
+    }
+
+    unsigned int begin = adjacency.offsets[fanning];
+    unsigned int end = adjacency.offsets[fanning + 1];
+
+    for (unsigned int t = begin; t < end; t++) {
+      unsigned int triangle = adjacency.triangles[t];
+
+      if (emitted[triangle]) {
+        continue;
+      }
+
+      for (int corner = 0; corner < 3; corner++) {
+        unsigned int vertex = indices[triangle * 3 + corner];
+
+        result.push_back(vertex);
+        dead_end.push_back(vertex);
+        candidates.push_back(vertex);
+        live[vertex]--;
+
+        if (time - cache_time[vertex] > cache_size) {
+          cache_time[vertex] = time++;
+        }
+      }
+
+      emitted[triangle] = true;
+    }
+
+    // Prefer the candidate that entered the cache longest ago but will still
+    // be in it after its remaining triangles are emitted.
+    long best = -1;
+    std::size_t best_priority = 0;
+
+    for (unsigned int vertex : candidates) {
+      if (live[vertex] == 0) {
+        continue;
+      }
+
+      std::size_t age = time - cache_time[vertex];
+      std::size_t priority = 0;
+
+      if (age + 2 * live[vertex] <= cache_size) {
+        priority = age;
+      }
+
+      if (best < 0 || priority > best_priority) {
+        best = vertex;
+        best_priority = priority;
+      }
+    }
+
+    cold = false;
+
+    if (best < 0) {
+      // Dead end: back up through recently emitted vertices, then fall back
+      // to scanning for any vertex with triangles left.
+      cold = true;
+
+      while (!dead_end.empty()) {
+        unsigned int vertex = dead_end.back();
+        dead_end.pop_back();
+
+        if (live[vertex] > 0) {
+          best = vertex;
+          cold = time - cache_time[vertex] > cache_size;
+          break;
+        }
+      }
+
+      while (best < 0 && cursor < vertex_count) {
+        if (live[cursor] > 0) {
+          best = static_cast<long>(cursor);
+        }
+
+        cursor++;
+      }
+    }
+
+    fanning = best;
+  }
+
+  indices.swap(result);
+}
+
+// Splits the Tipsify order into smaller clusters wherever the local miss
+// ratio is already within `threshold` of the cluster's, then sorts clusters
+// so the ones facing away from the mesh centre come first. Drawing outer
+// surfaces first lets early-z reject more of what is behind them.
+//
+// `positions` points at the first vertex position and `stride` is the
+// distance between vertices in bytes.
+inline void optimize_overdraw(std::vector<unsigned int>& indices,
+                              const float* positions, std::size_t stride,
+                              std::size_t vertex_count,
+                              const std::vector<unsigned int>& clusters,
+                              float threshold = 1.05f,
+                              unsigned int cache_size = VERTEX_CACHE_SIZE) {
+  std::size_t triangle_count = indices.size() / 3;
+
+  if (triangle_count == 0 || clusters.empty()) {
+    return;
+  }
+
+  auto position = [&](unsigned int vertex) {
+    const float* p = reinterpret_cast<const float*>(
+        reinterpret_cast<const char*>(positions) + vertex * stride);
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+
+  std::vector<std::size_t> cache_time(vertex_count, 0);
+  std::size_t time = cache_size + 1;
+
+  auto misses = [&](std::size_t triangle) {
+    std::size_t count = 0;
+
+    for (int corner = 0; corner < 3; corner++) {
+      unsigned int vertex = indices[triangle * 3 + corner];
+
+      if (time - cache_time[vertex] > cache_size) {
+        cache_time[vertex] = time++;
+        count++;
+      }
+    }
+
+    return count;
+  };
+
+  auto flush = [&] { time += cache_size + 1; };
+
+  std::vector<std::size_t> soft_clusters;
+
+  for (std::size_t c = 0; c < clusters.size(); c++) {
+    std::size_t begin = clusters[c];
+    std::size_t end =
+        c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+
+    std::size_t cluster_misses = 0;
+    flush();
+
+    for (std::size_t t = begin; t < end; t++) {
+      cluster_misses += misses(t);
+    }
+
+    float cluster_threshold =
+        threshold * (float)cluster_misses / (float)std::max<std::size_t>(
+                                                 end - begin, 1);
+
+    std::size_t start = begin;
+    std::size_t start_misses = 0;
+    soft_clusters.push_back(begin);
+    flush();
+
+    for (std::size_t t = begin; t < end; t++) {
+      start_misses += misses(t);
+
+      if (t + 1 < end &&
+          (float)start_misses / (float)(t + 1 - start) <= cluster_threshold) {
+        soft_clusters.push_back(t + 1);
+        start = t + 1;
+        start_misses = 0;
+        flush();
+      }
+    }
+  }
+
+  // Area-weighted centroid and normal per cluster, and for the whole mesh.
+  std::size_t cluster_count = soft_clusters.size();
+  std::vector<glm::vec3> centroids(cluster_count, glm::vec3(0.0f));
+  std::vector<glm::vec3> normals(cluster_count, glm::vec3(0.0f));
+  glm::vec3 mesh_centroid(0.0f);
+  float mesh_area = 0.0f;
+
+  for (std::size_t c = 0; c < cluster_count; c++) {
+    std::size_t begin = soft_clusters[c];
+    std::size_t end =
+        c + 1 < cluster_count ? soft_clusters[c + 1] : triangle_count;
+    float cluster_area = 0.0f;
+
+    for (std::size_t t = begin; t < end; t++) {
+      glm::vec3 a = position(indices[t * 3 + 0]);
+      glm::vec3 b = position(indices[t * 3 + 1]);
+      glm::vec3 p = position(indices[t * 3 + 2]);
+      glm::vec3 normal = glm::cross(b - a, p - a);
+      float area = glm::length(normal);
+
+      centroids[c] += (a + b + p) * (area / 3.0f);
+      normals[c] += normal;
+      cluster_area += area;
+    }
+
+    mesh_centroid += centroids[c];
+    mesh_area += cluster_area;
+
+    if (cluster_area > 0.0f) {
+      centroids[c] /= cluster_area;
+    }
+
+    float length = glm::length(normals[c]);
+
+    if (length > 0.0f) {
+      normals[c] /= length;
+    }
+  }
+
+  if (mesh_area > 0.0f) {
+    mesh_centroid /= mesh_area;
+  }
+
+  std::vector<float> sort_keys(cluster_count);
+
+  for (std::size_t c = 0; c < cluster_count; c++) {
+    sort_keys[c] = glm::dot(centroids[c] - mesh_centroid, normals[c]);
+  }
+
+  std::vector<unsigned int> order(cluster_count);
+  std::iota(order.begin(), order.end(), 0u);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](unsigned int a, unsigned int b) {
+                     return sort_keys[a] > sort_keys[b];
+                   });
+
+  std::vector<unsigned int> result;
+  result.reserve(indices.size());
+
+  for (unsigned int c : order) {
+    std::size_t begin = soft_clusters[c];
+    std::size_t end =
+        c + 1 < cluster_count ? soft_clusters[c + 1] : triangle_count;
+
+    result.insert(result.end(), indices.begin() + begin * 3,
+                  indices.begin() + end * 3);
+  }
+
+  indices.swap(result);
+}
+
+// Renumbers vertices in the order the index buffer first references them and
+// drops unreferenced ones. Returns the new vertex count.
+template <typename T>
+std::size_t optimize_vertex_fetch(std::vector<T>& vertices,
+                                  std::vector<unsigned int>& indices) {
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(vertices.size(), unused);
+  std::vector<T> result;
+  result.reserve(vertices.size());
+
+  for (unsigned int& index : indices) {
+    if (remap[index] == unused) {
+      remap[index] = static_cast<unsigned int>(result.size());
+      result.push_back(vertices[index]);
+    }
+
+    index = remap[index];
+  }
+
+  vertices.swap(result);
+
+  return vertices.size();
+}
+
+// Before / after numbers for one or more meshes run through optimize_mesh.
+struct Mesh_Optimize_Report {
+  std::size_t meshes = 0;
+  Vertex_Cache_Stats before;
+  Vertex_Cache_Stats after;
+  double milliseconds = 0.0;
+
+  void merge(const Mesh_Optimize_Report& other) {
+    meshes += other.meshes;
+    before.merge(other.before);
+    after.merge(other.after);
+    milliseconds += other.milliseconds;
+  }
+};
+
+// Runs the enabled passes on one mesh in the order above. T needs a
+// glm::vec3 `position` member.
+template <typename T>
+Mesh_Optimize_Report optimize_mesh(std::vector<T>& vertices,
+                                   std::vector<unsigned int>& indices,
+                                   bool vertex_cache, bool overdraw,
+                                   bool vertex_fetch) {
+  Mesh_Optimize_Report report;
+  report.meshes = 1;
+  report.before = analyze_vertex_cache(indices, vertices.size());
+
+  auto start = std::chrono::steady_clock::now();
+
+  if (vertex_cache && !vertices.empty()) {
+    std::vector<unsigned int> clusters;
+    optimize_vertex_cache(indices, vertices.size(),
+                          overdraw ? &clusters : nullptr);
+
+    if (overdraw) {
+      optimize_overdraw(indices, &vertices[0].position.x, sizeof(T),
+                        vertices.size(), clusters);
+    }
+  }
+
+  if (vertex_fetch) {
+    optimize_vertex_fetch(vertices, indices);
+  }
+
+  report.milliseconds = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  report.after = analyze_vertex_cache(indices, vertices.size());
+
+  return report;
+}
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh_optimizer.hpp"
+
+// Quadric error metric simplification (Garland and Heckbert, "Surface
+// Simplification Using Quadric Error Metrics", 1997) by half-edge collapse:
+// a vertex is only ever merged into one of its neighbours, so every level of
+// detail is just another index list over the mesh's original vertex buffer.
+//
+// Vertices on open borders and on attribute seams (several vertices sharing a
+// position, e.g. where UVs or normals split) are never moved, which keeps
+// texture seams and hard edges intact at the cost of some reduction on
+// heavily seamed meshes. Collapses that would flip a triangle are rejected.
+
+// One detail level: a range of the mesh's index buffer and the approximate
+// geometric error (in model units) of replacing level 0 with it.
+struct Mesh_LOD {
+  uint32_t first_index;
+  uint32_t index_count;
+  float error;
+};
+
+// Area-weighted sum of plane quadrics. evaluate() is the weighted mean
+// squared distance from `p` to the accumulated planes.
+struct Quadric {
+  double a2 = 0, ab = 0, ac = 0, ad = 0;
+  double b2 = 0, bc = 0, bd = 0;
+  double c2 = 0, cd = 0;
+  double d2 = 0;
+  double weight = 0;
+
+  void add_plane(glm::vec3 n, float d, float w) {
+    a2 += w * n.x * n.x;
+    ab += w * n.x * n.y;
+    ac += w * n.x * n.z;
+    ad += w * n.x * d;
+    b2 += w * n.y * n.y;
+    bc += w * n.y * n.z;
+    bd += w * n.y * d;
+    c2 += w * n.z * n.z;
+    cd += w * n.z * d;
+    d2 += w * d * d;
+    weight += w;
+  }
+
+  void add(const Quadric& q) {
+    a2 += q.a2;
+    ab += q.ab;
+    ac += q.ac;
+    ad += q.ad;
+    b2 += q.b2;
+    bc += q.bc;
+    bd += q.bd;
+    c2 += q.c2;
+    cd += q.cd;
+    d2 += q.d2;
+    weight += q.weight;
+  }
+
+  double evaluate(glm::vec3 p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double error = a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+                   2 * (ab * x * y + ac * x * z + bc * y * z + ad * x +
+                        bd * y + cd * z);
+
+    return weight > 0 ? std::max(error, 0.0) / weight : 0.0;
+  }
+};
+
+// Reduces the triangle list `indices` towards `target_index_count` without
+// exceeding `max_error` (model units). Returns the new index list and stores
+// the error actually reached in `result_error`.
+inline std::vector<unsigned int> simplify_mesh(
+    const std::vector<unsigned int>& indices, const float* positions,
+    std::size_t stride, std::size_t vertex_count,
+    std::size_t target_index_count, float max_error, float& result_error) {
+  auto position = [&](unsigned int vertex) {
+    const float* p = reinterpret_cast<const float*>(
+        reinterpret_cast<const char*>(positions) + vertex * stride);
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+
+  result_error = 0.0f;
+
+  // Group vertices by exact position.
+  std::vector<unsigned int> order(vertex_count);
+  std::vector<unsigned int> group(vertex_count);
+  std::vector<unsigned int> group_size(vertex_count, 0);
+
+  for (std::size_t i = 0; i < vertex_count; i++) {
+    order[i] = static_cast<unsigned int>(i);
+  }
+
+  auto less = [&](unsigned int a, unsigned int b) {
+    glm::vec3 pa = position(a), pb = position(b);
+
+    if (pa.x != pb.x) return pa.x < pb.x;
+    if (pa.y != pb.y) return pa.y < pb.y;
+    return pa.z < pb.z;
+  };
+
+  std::sort(order.begin(), order.end(), less);
+
+  for (std::size_t i = 0; i < vertex_count; i++) {
+    bool same = i > 0 && position(order[i]) == position(order[i - 1]);
+    group[order[i]] = same ? group[order[i - 1]] : order[i];
+    group_size[group[order[i]]]++;
+  }
+
+  // Lock seams, then open borders: edges whose reverse (in position space)
+  // no triangle uses.
+  std::vector<bool> locked(vertex_count, false);
+
+  for (std::size_t i = 0; i < vertex_count; i++) {
+    locked[i] = group_size[group[i]] > 1;
+  }
+
+  std::unordered_map<uint64_t, unsigned int> edges;
+  edges.reserve(indices.size());
+
+  auto edge_key = [&](unsigned int a, unsigned int b) {
+    return (uint64_t)group[a] << 32 | group[b];
+  };
+
+  for (std::size_t i = 0; i < indices.size(); i += 3) {
+    for (int e = 0; e < 3; e++) {
+      edges[edge_key(indices[i + e], indices[i + (e + 1) % 3])]++;
+    }
+  }
+
+  for (std::size_t i = 0; i < indices.size(); i += 3) {
+    for (int e = 0; e < 3; e++) {
+      unsigned int a = indices[i + e], b = indices[i + (e + 1) % 3];
+
+      if (edges.find(edge_key(b, a)) == edges.end()) {
+        locked[a] = true;
+        locked[b] = true;
+      }
+    }
+  }
+
+  std::vector<Quadric> quadrics(vertex_count);
+
+  for (std::size_t i = 0; i < indices.size(); i += 3) {
+    glm::vec3 a = position(indices[i]);
+    glm::vec3 normal = glm::cross(position(indices[i + 1]) - a,
+                                  position(indices[i + 2]) - a);
+    float area = glm::length(normal);
+
+    if (area == 0.0f) {
+      continue;
+    }
+
+    normal /= area;
+
+    for (int corner = 0; corner < 3; corner++) {
+      quadrics[indices[i + corner]].add_plane(normal, -glm::dot(normal, a),
+                                              area);
+    }
+  }
+
+  struct Collapse {
+    unsigned int from;
+    unsigned int to;
+    double cost;
+  };
+
+  std::vector<unsigned int> result = indices;
+  std::vector<Collapse> collapses;
+  std::vector<Collapse> best(vertex_count);
+  std::vector<unsigned int> target(vertex_count);
+  std::vector<bool> touched(vertex_count);
+  double error_limit = (double)max_error * max_error;
+  double max_cost = 0.0;
+
+  while (result.size() > target_index_count) {
+    Triangle_Adjacency adjacency(result, vertex_count);
+    collapses.clear();
+
+    // Only the cheapest collapse of each vertex is a candidate.
+    std::fill(best.begin(), best.end(), Collapse{0, 0, -1.0});
+
+    for (std::size_t i = 0; i < result.size(); i += 3) {
+      for (int e = 0; e < 3; e++) {
+        unsigned int a = result[i + e], b = result[i + (e + 1) % 3];
+
+        for (int direction = 0; direction < 2; direction++) {
+          if (!locked[a]) {
+            Quadric q = quadrics[a];
+            q.add(quadrics[b]);
+            double cost = q.evaluate(position(b));
+
+            if (best[a].cost < 0.0 || cost < best[a].cost) {
+              best[a] = {a, b, cost};
+            }
+          }
+
+          std::swap(a, b);
+        }
+      }
+    }
+
+    for (const Collapse& collapse : best) {
+      if (collapse.cost >= 0.0) {
+        collapses.push_back(collapse);
+      }
+    }
+
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse& x, const Collapse& y) {
+                return x.cost < y.cost;
+              });
+
+    for (std::size_t i = 0; i < vertex_count; i++) {
+      target[i] = static_cast<unsigned int>(i);
+    }
+
+    std::fill(touched.begin(), touched.end(), false);
+
+    std::size_t triangles_to_remove = (result.size() - target_index_count) / 3;
+    std::size_t removed = 0;
+    std::size_t applied = 0;
+
+    for (const Collapse& collapse : collapses) {
+      if (collapse.cost > error_limit || removed >= triangles_to_remove) {
+        break;
+      }
+
+      unsigned int from = collapse.from, to = collapse.to;
+
+      if (touched[from] || touched[to]) {
+        continue;
+      }
+
+      // Every triangle around `from` that survives must keep its facing.
+      bool flips = false;
+      std::size_t collapsing = 0;
+
+      for (unsigned int t = adjacency.offsets[from];
+           t < adjacency.offsets[from + 1] && !flips; t++) {
+        const unsigned int* triangle = &result[adjacency.triangles[t] * 3];
+        glm::vec3 before[3], after[3];
+        bool has_to = false;
+
+        for (int corner = 0; corner < 3; corner++) {
+          has_to = has_to || triangle[corner] == to;
+          before[corner] = position(triangle[corner]);
+          after[corner] =
+              triangle[corner] == from ? position(to) : before[corner];
+        }
+
+        if (has_to) {
+          collapsing++;
+          continue;
+        }
+
+        glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+        flips = glm::dot(n0, n1) <= 0.0f;
+      }
+
+      if (flips) {
+        continue;
+      }
+
+      // Freeze the whole neighbourhood so this pass's flip checks stay valid.
+      for (unsigned int t = adjacency.offsets[from];
+           t < adjacency.offsets[from + 1]; t++) {
+        for (int corner = 0; corner < 3; corner++) {
+          touched[result[adjacency.triangles[t] * 3 + corner]] = true;
+        }
+      }
+
+      target[from] = to;
+      quadrics[to].add(quadrics[from]);
+      max_cost = std::max(max_cost, collapse.cost);
+      removed += collapsing;
+      applied++;
+    }
+
+    if (applied == 0) {
+      break;
+    }
+
+    std::size_t kept = 0;
+
+    for (std::size_t i = 0; i < result.size(); i += 3) {
+      unsigned int a = target[result[i]];
+      unsigned int b = target[result[i + 1]];
+      unsigned int c = target[result[i + 2]];
+
+      if (a == b || b == c || a == c) {
+        continue;
+      }
+
+      result[kept++] = a;
+      result[kept++] = b;
+      result[kept++] = c;
+    }
+
+    result.resize(kept);
+  }
+
+  result_error = static_cast<float>(std::sqrt(max_cost));
+
+  return result;
+}
+
+// Appends up to `lod_count - 1` coarser levels to `indices`, each simplified
+// from the previous one down to `ratio` times its triangles, and returns the
+// whole chain with level 0 (the incoming indices) first. A level's error is
+// the sum of the steps that led to it, an upper bound on its distance from
+// level 0. Stops early once a level no longer shrinks by at least 10%.
+inline std::vector<Mesh_LOD> generate_lod_chain(
+    std::vector<unsigned int>& indices, const float* positions,
+    std::size_t stride, std::size_t vertex_count, unsigned int lod_count,
+    float ratio, float max_error) {
+  std::vector<Mesh_LOD> lods;
+  lods.push_back({0, static_cast<uint32_t>(indices.size()), 0.0f});
+
+  std::vector<unsigned int> previous(indices);
+  float total_error = 0.0f;
+
+  for (unsigned int level = 1; level < lod_count; level++) {
+    std::size_t target =
+        static_cast<std::size_t>(previous.size() / 3 * ratio) * 3;
+    float error = 0.0f;
+    std::vector<unsigned int> lod =
+        simplify_mesh(previous, positions, stride, vertex_count, target,
+                      max_error - total_error, error);
+
+    if (lod.empty() || lod.size() > previous.size() * 9 / 10) {
+      break;
+    }
+
+    optimize_vertex_cache(lod, vertex_count);
+    total_error += error;
+
+    lods.push_back({static_cast<uint32_t>(indices.size()),
+                    static_cast<uint32_t>(lod.size()), total_error});
+    indices.insert(indices.end(), lod.begin(), lod.end());
+    previous.swap(lod);
+  }
+
+  return lods;
+}
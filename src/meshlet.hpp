@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "frustum_cull.hpp"
+
+// Meshlets are runs of consecutive triangles of a mesh's index buffer with at
+// most MESHLET_MAX_VERTICES unique vertices and MESHLET_MAX_TRIANGLES
+// triangles. Because they are contiguous, a visible meshlet is drawn straight
+// out of the mesh's own index buffer; no extra GPU data is needed.
+//
+// The same reason keeps the index type per mesh: meshlet indices stay
+// global, so a mesh over 65536 vertices keeps 32-bit indices even though
+// each meshlet's own range would fit in 16 (or 8) bits. Rebasing them
+// would need a base vertex per meshlet and would break the whole-mesh,
+// LOD and collision paths that read the same buffer.
+//
+// Nothing in here touches GL, so building and culling can run headless.
+
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// A run of triangles in the mesh's index buffer, whose indices are global
+// to the mesh (see above for why they are not narrowed per meshlet).
+struct Meshlet {
+  uint32_t first_triangle;
+  uint32_t triangle_count;
+  uint32_t vertex_count;
+
+  // Bounding sphere, in model space.
+  glm::vec3 center;
+  float radius;
+
+  // Every triangle faces away from a viewer at `position` when
+  //   dot(center - position, cone_axis) >=
+  //       cone_cutoff * length(center - position) + radius.
+  // cone_cutoff is 1 (never culled) when the normals spread too widely.
+  glm::vec3 cone_axis;
+  float cone_cutoff;
+};
+
+// Splits `indices` (a triangle list) greedily in index order. Run this after
+// optimize_vertex_cache so neighbouring triangles are already close together.
+inline std::vector<Meshlet> build_meshlets(
+    const std::vector<unsigned int>& indices, std::size_t vertex_count,
+    unsigned int max_vertices = MESHLET_MAX_VERTICES,
+    unsigned int max_triangles = MESHLET_MAX_TRIANGLES) {
+  std::vector<Meshlet> meshlets;
+  std::size_t triangle_count = indices.size() / 3;
+
+  // last_seen[v] is the index + 1 of the meshlet that last counted v.
+  std::vector<uint32_t> last_seen(vertex_count, 0);
+  Meshlet current = {};
+
+  for (std::size_t t = 0; t < triangle_count; t++) {
+    unsigned int new_vertices = 0;
+    uint32_t stamp = static_cast<uint32_t>(meshlets.size() + 1);
+
+    for (int corner = 0; corner < 3; corner++) {
+      unsigned int vertex = indices[t * 3 + corner];
+      bool duplicate = false;
+
+      for (int other = 0; other < corner; other++) {
+        duplicate = duplicate || indices[t * 3 + other] == vertex;
+      }
+
+      if (!duplicate && last_seen[vertex] != stamp) {
+        new_vertices++;
+      }
+    }
+
+    if (current.triangle_count > 0 &&
+        (current.vertex_count + new_vertices > max_vertices ||
+         current.triangle_count + 1 > max_triangles)) {
+      meshlets.push_back(current);
+      current = {};
+      current.first_triangle = static_cast<uint32_t>(t);
+      stamp++;
+      new_vertices = 3;
+
+      for (int corner = 1; corner < 3; corner++) {
+        for (int other = 0; other < corner; other++) {
+          if (indices[t * 3 + other] == indices[t * 3 + corner]) {
+            new_vertices--;
+            break;
+          }
+        }
+      }
+    }
+
+    for (int corner = 0; corner < 3; corner++) {
+      last_seen[indices[t * 3 + corner]] = stamp;
+    }
+
+    current.vertex_count += new_vertices;
+    current.triangle_count++;
+  }
+
+  if (current.triangle_count > 0) {
+    meshlets.push_back(current);
+  }
+
+  return meshlets;
+}
+
+// Fills in the bounding sphere and normal cone of every meshlet. `positions`
+// points at the first vertex position and `stride` is the distance between
+// vertices in bytes.
+inline void compute_meshlet_bounds(std::vector<Meshlet>& meshlets,
+                                   const std::vector<unsigned int>& indices,
+                                   const float* positions,
+                                   std::size_t stride) {
+  auto position = [&](unsigned int vertex) {
+    const float* p = reinterpret_cast<const float*>(
+        reinterpret_cast<const char*>(positions) + vertex * stride);
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+
+  std::vector<glm::vec3> normals;
+
+  for (Meshlet& meshlet : meshlets) {
+    std::size_t begin = meshlet.first_triangle * 3;
+    std::size_t end = begin + meshlet.triangle_count * 3;
+
+    glm::vec3 bounds_min = position(indices[begin]);
+    glm::vec3 bounds_max = bounds_min;
+
+    for (std::size_t i = begin; i < end; i++) {
+      bounds_min = glm::min(bounds_min, position(indices[i]));
+      bounds_max = glm::max(bounds_max, position(indices[i]));
+    }
+
+    meshlet.center = (bounds_min + bounds_max) * 0.5f;
+    meshlet.radius = 0.0f;
+
+    for (std::size_t i = begin; i < end; i++) {
+      meshlet.radius = std::max(
+          meshlet.radius, glm::length(position(indices[i]) - meshlet.center));
+    }
+
+    normals.clear();
+    glm::vec3 axis(0.0f);
+
+    for (std::size_t i = begin; i < end; i += 3) {
+      glm::vec3 a = position(indices[i]);
+      glm::vec3 normal = glm::cross(position(indices[i + 1]) - a,
+                                    position(indices[i + 2]) - a);
+      float length = glm::length(normal);
+
+      if (length > 0.0f) {
+        normals.push_back(normal / length);
+        axis += normal / length;
+      }
+    }
+
+    meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.cone_cutoff = 1.0f;
+
+    float axis_length = glm::length(axis);
+
+    if (normals.empty() || axis_length == 0.0f) {
+      continue;
+    }
+
+    axis /= axis_length;
+    float min_dot = 1.0f;
+
+    for (const glm::vec3& normal : normals) {
+      min_dot = std::min(min_dot, glm::dot(normal, axis));
+    }
+
+    // Cones wider than ~84 degrees would hardly ever cull anything.
+    if (min_dot <= 0.1f) {
+      continue;
+    }
+
+    // The sine of the cone's half angle: the view direction has to be within
+    // 90 degrees minus that angle of the axis for all triangles to face away.
+    meshlet.cone_axis = axis;
+    meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+  }
+}
+
+// A view expressed in the meshlets' model space: the frustum planes of
+// projection * view * model, and the camera position transformed back into
+// model space. The cone test assumes the model matrix scales uniformly.
+struct Meshlet_Cull_View {
+  glm::vec4 planes[6];
+  glm::vec3 camera_position;
+
+  Meshlet_Cull_View(const glm::mat4& projection, const glm::mat4& view,
+                    const glm::mat4& model) {
+    extract_frustum_planes(projection * view * model, planes);
+    camera_position = glm::vec3(glm::inverse(view * model) *
+                                glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+  }
+};
+
+struct Meshlet_Cull_Stats {
+  std::size_t meshlets = 0;
+  std::size_t frustum_culled = 0;
+  std::size_t backface_culled = 0;
+  std::size_t triangles = 0;
+  std::size_t triangles_culled = 0;
+
+  std::size_t culled() const { return frustum_culled + backface_culled; }
+
+  float fraction_culled() const {
+    return meshlets ? (float)culled() / (float)meshlets : 0.0f;
+  }
+
+  void merge(const Meshlet_Cull_Stats& other) {
+    meshlets += other.meshlets;
+    frustum_culled += other.frustum_culled;
+    backface_culled += other.backface_culled;
+    triangles += other.triangles;
+    triangles_culled += other.triangles_culled;
+  }
+};
+
+enum meshlet_visibility {
+  MESHLET_VISIBLE,
+  MESHLET_FRUSTUM_CULLED,
+  MESHLET_BACKFACE_CULLED
+};
+
+inline meshlet_visibility test_meshlet(const Meshlet& meshlet,
+                                       const Meshlet_Cull_View& view) {
+  for (const glm::vec4& plane : view.planes) {
+    if (glm::dot(glm::vec3(plane), meshlet.center) + plane.w <
+        -meshlet.radius) {
+      return MESHLET_FRUSTUM_CULLED;
+    }
+  }
+
+  glm::vec3 to_center = meshlet.center - view.camera_position;
+
+  if (glm::dot(to_center, meshlet.cone_axis) >=
+      meshlet.cone_cutoff * glm::length(to_center) + meshlet.radius) {
+    return MESHLET_BACKFACE_CULLED;
+  }
+
+  return MESHLET_VISIBLE;
+}
+
+// Appends the indices of the meshlets that survive to `visible`.
+inline void cull_meshlets(const std::vector<Meshlet>& meshlets,
+                          const Meshlet_Cull_View& view,
+                          std::vector<unsigned int>& visible,
+                          Meshlet_Cull_Stats& stats) {
+  for (std::size_t i = 0; i < meshlets.size(); i++) {
+    meshlet_visibility visibility = test_meshlet(meshlets[i], view);
+
+    stats.meshlets++;
+    stats.triangles += meshlets[i].triangle_count;
+
+    if (visibility == MESHLET_VISIBLE) {
+      visible.push_back(static_cast<unsigned int>(i));
+      continue;
+    }
+
+    if (visibility == MESHLET_FRUSTUM_CULLED) {
+      stats.frustum_culled++;
+    } else {
+      stats.backface_culled++;
+    }
+
+    stats.triangles_culled += meshlets[i].triangle_count;
+  }
+}
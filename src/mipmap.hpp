@@ -0,0 +1,489 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MIPMAP_SSE 1
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#define MIPMAP_AVX 1
+#endif
+
+#include "thread_pool.hpp"
+
+// Mip chains of RGBA8 images built on the CPU, so loading does not depend on
+// glGenerateMipmap (which filters sRGB textures in gamma space on many
+// drivers, darkening every level) and the chain can be baked offline.
+//
+// Every level is filtered from the one above it in linear light: sRGB
+// texels are decoded to linear floats, filtered, and encoded again. The
+// filter is separable: each output row first combines the source rows under
+// the kernel into one row, then each output texel combines texels of that
+// row. An RGBA texel is one 16-byte SIMD register (two with AVX2).
+
+enum mip_filter {
+  // 2x2 average.
+  MIP_FILTER_BOX,
+  // 8x8 Kaiser-windowed sinc: sharper, with less aliasing, at 4x the cost.
+  MIP_FILTER_KAISER
+};
+
+enum mip_math { MIP_MATH_SCALAR, MIP_MATH_SIMD };
+
+struct Mip_Options {
+  mip_filter filter = MIP_FILTER_BOX;
+  // RGB holds sRGB values (alpha is always linear).
+  bool srgb = false;
+  // RGB holds a unit vector as (n + 1) / 2; renormalized on every level.
+  bool normal_map = false;
+  mip_math math = MIP_MATH_SIMD;
+  // Split every level over the shared thread pool. Not from inside a pool
+  // job: the texture loader generates each texture's chain serially.
+  bool parallel = false;
+};
+
+struct Mip_Level {
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> rgba;
+};
+
+// Output texel x covers source texels 2x + offset ... 2x + offset + taps - 1.
+struct Mip_Kernel {
+  int taps = 0;
+  int offset = 0;
+  float weights[8] = {};
+};
+
+inline double bessel_i0(double x) {
+  double sum = 1.0, term = 1.0;
+
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+
+  return sum;
+}
+
+inline const Mip_Kernel& mip_kernel(mip_filter filter) {
+  static const Mip_Kernel box = [] {
+    Mip_Kernel kernel;
+    kernel.taps = 2;
+    kernel.weights[0] = kernel.weights[1] = 0.5f;
+    return kernel;
+  }();
+
+  // Half-band sinc (cutoff at the new Nyquist rate) under a Kaiser window
+  // (alpha 4) four source texels wide on each side.
+  static const Mip_Kernel kaiser = [] {
+    const double pi = 3.14159265358979323846, alpha = 4.0;
+    Mip_Kernel kernel;
+    kernel.taps = 8;
+    kernel.offset = -3;
+    double total = 0.0, weights[8];
+
+    for (int i = 0; i < 8; i++) {
+      // Distance from the output texel's centre, in source texels.
+      double d = i - 3.5;
+      double x = pi * d / 2.0;
+      double sinc = std::sin(x) / x;
+      double t = d / 4.0;
+      weights[i] = sinc * bessel_i0(alpha * std::sqrt(1.0 - t * t)) /
+                   bessel_i0(alpha);
+      total += weights[i];
+    }
+
+    for (int i = 0; i < 8; i++) {
+      kernel.weights[i] = static_cast<float>(weights[i] / total);
+    }
+
+    return kernel;
+  }();
+
+  return filter == MIP_FILTER_KAISER ? kaiser : box;
+}
+
+inline float srgb_to_linear(float value) {
+  return value <= 0.04045f ? value / 12.92f
+                           : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linear_to_srgb(float value) {
+  return value <= 0.0031308f ? value * 12.92f
+                             : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Byte -> float for sRGB and for linear channels.
+inline const float* mip_decode_table(bool srgb) {
+  static const std::vector<float> tables[2] = {
+      [] {
+        std::vector<float> table(256);
+
+        for (int i = 0; i < 256; i++) {
+          table[i] = i / 255.0f;
+        }
+
+        return table;
+      }(),
+      [] {
+        std::vector<float> table(256);
+
+        for (int i = 0; i < 256; i++) {
+          table[i] = srgb_to_linear(i / 255.0f);
+        }
+
+        return table;
+      }()};
+
+  return tables[srgb].data();
+}
+
+// Linear float in [0, 1], in steps of 1 / (MIP_SRGB_STEPS - 1), -> sRGB
+// byte. Fine enough to stay within one byte of the exact encoding even in
+// the steep part of the curve near black.
+const int MIP_SRGB_STEPS = 8192;
+
+inline const unsigned char* mip_srgb_encode_table() {
+  static const std::vector<unsigned char> table = [] {
+    std::vector<unsigned char> result(MIP_SRGB_STEPS);
+
+    for (int i = 0; i < MIP_SRGB_STEPS; i++) {
+      float linear = i / float(MIP_SRGB_STEPS - 1);
+      result[i] = static_cast<unsigned char>(
+          std::lround(linear_to_srgb(linear) * 255.0f));
+    }
+
+    return result;
+  }();
+
+  return table.data();
+}
+
+// out[i] = sum_j weights[j] * rows[j][i] over `count` floats.
+inline void mip_combine_rows_scalar(const float* const* rows,
+                                    const float* weights, int taps,
+                                    std::size_t count, float* out) {
+  for (std::size_t i = 0; i < count; i++) {
+    float sum = 0.0f;
+
+    for (int j = 0; j < taps; j++) {
+      sum += weights[j] * rows[j][i];
+    }
+
+    out[i] = sum;
+  }
+}
+
+// out[x] = sum_i weights[i] * row[2x + i], per RGBA texel.
+inline void mip_combine_texels_scalar(const float* row, const float* weights,
+                                      int taps, int out_width, float* out) {
+  for (int x = 0; x < out_width; x++) {
+    for (int c = 0; c < 4; c++) {
+      float sum = 0.0f;
+
+      for (int i = 0; i < taps; i++) {
+        sum += weights[i] * row[(2 * x + i) * 4 + c];
+      }
+
+      out[x * 4 + c] = sum;
+    }
+  }
+}
+
+#ifdef MIPMAP_SSE
+inline void mip_combine_rows_simd(const float* const* rows,
+                                  const float* weights, int taps,
+                                  std::size_t count, float* out) {
+  std::size_t i = 0;
+#ifdef MIPMAP_AVX
+  for (; i + 8 <= count; i += 8) {
+    __m256 sum = _mm256_setzero_ps();
+
+    for (int j = 0; j < taps; j++) {
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[j]),
+                                             _mm256_loadu_ps(rows[j] + i)));
+    }
+
+    _mm256_storeu_ps(out + i, sum);
+  }
+#endif
+  // Counts are whole RGBA texels, so the rest is a multiple of 4.
+  for (; i < count; i += 4) {
+    __m128 sum = _mm_setzero_ps();
+
+    for (int j = 0; j < taps; j++) {
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[j]),
+                                       _mm_loadu_ps(rows[j] + i)));
+    }
+
+    _mm_storeu_ps(out + i, sum);
+  }
+}
+
+inline void mip_combine_texels_simd(const float* row, const float* weights,
+                                    int taps, int out_width, float* out) {
+  int x = 0;
+#ifdef MIPMAP_AVX
+  // Two output texels, 2x and 2x + 2 source texels apart, per register.
+  for (; x + 2 <= out_width; x += 2) {
+    __m256 sum = _mm256_setzero_ps();
+
+    for (int i = 0; i < taps; i++) {
+      const float* texel = row + (2 * x + i) * 4;
+      __m256 pair = _mm256_insertf128_ps(
+          _mm256_castps128_ps256(_mm_loadu_ps(texel)),
+          _mm_loadu_ps(texel + 8), 1);
+      sum = _mm256_add_ps(sum,
+                          _mm256_mul_ps(_mm256_set1_ps(weights[i]), pair));
+    }
+
+    _mm256_storeu_ps(out + x * 4, sum);
+  }
+#endif
+  for (; x < out_width; x++) {
+    __m128 sum = _mm_setzero_ps();
+
+    for (int i = 0; i < taps; i++) {
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[i]),
+                                       _mm_loadu_ps(row + (2 * x + i) * 4)));
+    }
+
+    _mm_storeu_ps(out + x * 4, sum);
+  }
+}
+#endif
+
+// Linear floats -> RGBA8, renormalizing normal maps first.
+inline void mip_encode_scalar(const float* texels, std::size_t count,
+                              const Mip_Options& options,
+                              unsigned char* out) {
+  const unsigned char* srgb = mip_srgb_encode_table();
+
+  for (std::size_t t = 0; t < count; t++) {
+    float v[4] = {texels[t * 4], texels[t * 4 + 1], texels[t * 4 + 2],
+                  texels[t * 4 + 3]};
+
+    if (options.normal_map) {
+      float n[3], length = 0.0f;
+
+      for (int c = 0; c < 3; c++) {
+        n[c] = v[c] * 2.0f - 1.0f;
+        length += n[c] * n[c];
+      }
+
+      length = length > 0.0f ? std::sqrt(length) : 1.0f;
+
+      for (int c = 0; c < 3; c++) {
+        v[c] = n[c] / length * 0.5f + 0.5f;
+      }
+    }
+
+    for (int c = 0; c < 4; c++) {
+      float value = std::clamp(v[c], 0.0f, 1.0f);
+      out[t * 4 + c] =
+          options.srgb && c < 3
+              ? srgb[static_cast<int>(value * (MIP_SRGB_STEPS - 1) + 0.5f)]
+              : static_cast<unsigned char>(value * 255.0f + 0.5f);
+    }
+  }
+}
+
+#ifdef MIPMAP_SSE
+inline void mip_encode_simd(const float* texels, std::size_t count,
+                            const Mip_Options& options, unsigned char* out) {
+  const unsigned char* srgb = mip_srgb_encode_table();
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f), two = _mm_set1_ps(2.0f);
+  const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+  const float rgb_scale = options.srgb ? MIP_SRGB_STEPS - 1 : 255.0f;
+  const __m128 scale = _mm_setr_ps(rgb_scale, rgb_scale, rgb_scale, 255.0f);
+  alignas(16) int32_t lanes[4];
+
+  for (std::size_t t = 0; t < count; t++) {
+    __m128 v = _mm_loadu_ps(texels + t * 4);
+
+    if (options.normal_map) {
+      __m128 n = _mm_and_ps(_mm_sub_ps(_mm_mul_ps(v, two), one), xyz);
+      __m128 squares = _mm_mul_ps(n, n);
+      __m128 length = _mm_add_ps(
+          squares, _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(2, 3, 0, 1)));
+      length = _mm_sqrt_ps(_mm_add_ps(
+          length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(1, 0, 3, 2))));
+      length = _mm_max_ps(length, _mm_set1_ps(1e-20f));
+      n = _mm_add_ps(_mm_mul_ps(_mm_div_ps(n, length), half), half);
+      v = _mm_or_ps(_mm_and_ps(xyz, n), _mm_andnot_ps(xyz, v));
+    }
+
+    v = _mm_min_ps(_mm_max_ps(v, zero), one);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes),
+                    _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half)));
+
+    for (int c = 0; c < 3; c++) {
+      out[t * 4 + c] = options.srgb ? srgb[lanes[c]]
+                                    : static_cast<unsigned char>(lanes[c]);
+    }
+
+    out[t * 4 + 3] = static_cast<unsigned char>(lanes[3]);
+  }
+}
+#endif
+
+// Filters rows [y_begin, y_end) of the next level from `source`, whose
+// first row is row `source_first_row` of a `width` x `height` level.
+inline void mip_downsample_rows(const float* source, int source_first_row,
+                                int width, int height, int out_width,
+                                int y_begin, int y_end,
+                                const Mip_Kernel& kernel, mip_math math,
+                                float* out) {
+  // Combined row padded with copies of its edge texels, so every tap of
+  // every output texel is in range.
+  int pad_left = -kernel.offset;
+  int last_tap = 2 * (out_width - 1) + kernel.offset + kernel.taps - 1;
+  int pad_right = std::max(0, last_tap - (width - 1));
+  std::vector<float> combined(
+      static_cast<std::size_t>(pad_left + width + pad_right) * 4);
+  const float* rows[8];
+
+  for (int y = y_begin; y < y_end; y++) {
+    for (int j = 0; j < kernel.taps; j++) {
+      int row = std::clamp(2 * y + kernel.offset + j, 0, height - 1);
+      rows[j] = source +
+                static_cast<std::size_t>(row - source_first_row) * width * 4;
+    }
+
+    float* middle = combined.data() + pad_left * 4;
+    float* out_row =
+        out + static_cast<std::size_t>(y - y_begin) * out_width * 4;
+#ifdef MIPMAP_SSE
+    if (math == MIP_MATH_SIMD) {
+      mip_combine_rows_simd(rows, kernel.weights, kernel.taps,
+                            static_cast<std::size_t>(width) * 4, middle);
+    } else
+#endif
+    {
+      mip_combine_rows_scalar(rows, kernel.weights, kernel.taps,
+                              static_cast<std::size_t>(width) * 4, middle);
+    }
+
+    for (int p = 0; p < pad_left; p++) {
+      std::copy(middle, middle + 4, combined.data() + p * 4);
+    }
+
+    for (int p = 0; p < pad_right; p++) {
+      std::copy(middle + (width - 1) * 4, middle + width * 4,
+                middle + (width + p) * 4);
+    }
+
+#ifdef MIPMAP_SSE
+    if (math == MIP_MATH_SIMD) {
+      mip_combine_texels_simd(combined.data(), kernel.weights, kernel.taps,
+                              out_width, out_row);
+      continue;
+    }
+#endif
+    mip_combine_texels_scalar(combined.data(), kernel.weights, kernel.taps,
+                              out_width, out_row);
+  }
+}
+
+inline void mip_encode(const float* texels, std::size_t count,
+                       const Mip_Options& options, unsigned char* out) {
+#ifdef MIPMAP_SSE
+  if (options.math == MIP_MATH_SIMD) {
+    mip_encode_simd(texels, count, options, out);
+    return;
+  }
+#endif
+  mip_encode_scalar(texels, count, options, out);
+}
+
+// Output rows filtered per band of decoded base-level rows.
+const std::size_t MIP_BAND_ROWS = 32;
+
+// Builds every level below the `width` x `height` RGBA8 image `rgba`, down
+// to 1x1 (none for a 1x1 image); odd sizes round down.
+inline void generate_mip_chain(const unsigned char* rgba, int width,
+                               int height, const Mip_Options& options,
+                               std::vector<Mip_Level>& levels) {
+  const Mip_Kernel& kernel = mip_kernel(options.filter);
+  const float* decode_rgb = mip_decode_table(options.srgb);
+  const float* decode_alpha = mip_decode_table(false);
+
+  levels.clear();
+  std::vector<float> source, next;
+
+  while (width > 1 || height > 1) {
+    int out_width = std::max(width / 2, 1);
+    int out_height = std::max(height / 2, 1);
+    bool from_bytes = levels.empty();
+
+    Mip_Level level;
+    level.width = out_width;
+    level.height = out_height;
+    level.rgba.resize(static_cast<std::size_t>(out_width) * out_height * 4);
+    next.resize(level.rgba.size());
+
+    // Rows [y_begin, y_end) of this level. The base level is decoded a band
+    // of source rows at a time rather than into one float copy four times
+    // its size.
+    auto filter_band = [&](int y_begin, int y_end, std::vector<float>& band) {
+      int first_row = 0;
+      const float* rows = source.data();
+
+      if (from_bytes) {
+        first_row = std::clamp(2 * y_begin + kernel.offset, 0, height - 1);
+        int last_row = std::clamp(
+            2 * (y_end - 1) + kernel.offset + kernel.taps - 1, 0, height - 1);
+        band.resize(static_cast<std::size_t>(last_row - first_row + 1) *
+                    width * 4);
+
+        const unsigned char* in =
+            rgba + static_cast<std::size_t>(first_row) * width * 4;
+
+        for (std::size_t i = 0; i < band.size(); i += 4) {
+          band[i] = decode_rgb[in[i]];
+          band[i + 1] = decode_rgb[in[i + 1]];
+          band[i + 2] = decode_rgb[in[i + 2]];
+          band[i + 3] = decode_alpha[in[i + 3]];
+        }
+
+        rows = band.data();
+      }
+
+      std::size_t first = static_cast<std::size_t>(y_begin) * out_width * 4;
+      mip_downsample_rows(rows, first_row, width, height, out_width, y_begin,
+                          y_end, kernel, options.math, next.data() + first);
+      mip_encode(next.data() + first,
+                 static_cast<std::size_t>(y_end - y_begin) * out_width,
+                 options, level.rgba.data() + first);
+    };
+
+    auto run = [&](std::size_t begin, std::size_t end) {
+      std::vector<float> band;
+
+      for (std::size_t y = begin; y < end; y += MIP_BAND_ROWS) {
+        filter_band(static_cast<int>(y),
+                    static_cast<int>(std::min(end, y + MIP_BAND_ROWS)), band);
+      }
+    };
+
+    if (options.parallel) {
+      Thread_Pool::shared().parallel_for(out_height, MIP_BAND_ROWS, run);
+    } else {
+      run(0, out_height);
+    }
+
+    levels.push_back(std::move(level));
+    source.swap(next);
+    width = out_width;
+    height = out_height;
+  }
+}
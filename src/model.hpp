@@ -1,9 +1,23 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <glad/glad.h>
@@ -15,209 +29,1584 @@
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
 
+#include "animation.hpp"
+#include "frustum_cull.hpp"
+#include "instancing.hpp"
 #include "mesh.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "occlusion_cull.hpp"
+#include "render_queue.hpp"
 #include "shader.hpp"
+#include "skinning.hpp"
+#include "texture_cache.hpp"
+#include "texture_loader.hpp"
+#include "thread_pool.hpp"
+#include "vertex_convert.hpp"
+#include "vertex_weld.hpp"
+
+// Changing these invalidates every baked mesh cache, since the flags are
+// stored in (and checked against) the cache header.
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate |
+                                        aiProcess_GenSmoothNormals |
+                                        aiProcess_FlipUVs |
+                                        aiProcess_CalcTangentSpace;
 
 unsigned int load_texture_from_file(const char* path,
                                     const std::string& directory,
                                     bool gamma = false);
 
+struct Model_Options {
+  // Load from / bake to <path>.meshcache.
+  bool use_mesh_cache = true;
+
+  // Return from the constructor right away and import on a background
+  // thread; call update_loading() once per frame until loading() is false.
+  // Meshes become drawable one at a time, with placeholder textures until
+  // the real ones are uploaded.
+  bool async_load = false;
+
+  // What to keep of each mesh's CPU-side vertices and indices after upload.
+  geometry_residency residency = GEOMETRY_RESIDENCY_KEEP;
+
+  // Sub-allocate every mesh from one vertex/index arena with a single VAO.
+  // When `arena` is null the model creates its own; pass a shared arena to
+  // put several models behind the same VAO.
+  bool use_arena = false;
+  Mesh_Arena* arena = nullptr;
+
+  // Upload quantized vertices (20 bytes instead of 88: see Compact_Vertex).
+  // Needs shader/model_loading_compact.vs. Bone attributes are only kept
+  // for meshes that have weights.
+  bool compact_vertices = false;
+
+  // Merge vertices whose attributes match within weld_epsilon before the
+  // optimization passes below.
+  bool weld_vertices = true;
+  Weld_Epsilon weld_epsilon;
+
+  // Import-time index/vertex reordering, see mesh_optimizer.hpp. Overdraw
+  // clustering only runs after the vertex cache pass.
+  bool optimize_vertex_cache = true;
+  bool optimize_overdraw = true;
+  bool optimize_vertex_fetch = true;
+
+  // Split every mesh into meshlets (see meshlet.hpp) for draw_culled().
+  bool build_meshlets = false;
+
+  // Detail levels generated per mesh (1 = just the original). Each level
+  // aims for lod_ratio times the triangles of the previous one, with
+  // lod_max_error bounding the geometric error as a fraction of the mesh's
+  // bounding box diagonal. Opt in: the levels cost import time and index
+  // memory, and only select_lods() draws them.
+  unsigned int lod_count = 1;
+  float lod_ratio = 0.5f;
+  float lod_max_error = 0.02f;
+
+  // Runtime LOD selection (select_lods): the coarsest level whose projected
+  // error stays under lod_pixel_error is used. A level is only coarsened
+  // below (1 - lod_hysteresis) and refined above (1 + lod_hysteresis) times
+  // that threshold, so meshes near a boundary do not flicker between levels.
+  float lod_pixel_error = 1.0f;
+  float lod_hysteresis = 0.25f;
+
+  vertex_format requested_vertex_format() const {
+    return compact_vertices ? VERTEX_FORMAT_COMPACT : VERTEX_FORMAT_FLOAT;
+  }
+
+  // Stored in the mesh cache so changing any import setting re-imports the
+  // model. The low byte holds the passes, the rest a hash of their
+  // parameters.
+  uint32_t optimize_flags() const {
+    uint32_t flags = (optimize_vertex_cache ? 1u : 0u) |
+                     (optimize_overdraw ? 2u : 0u) |
+                     (optimize_vertex_fetch ? 4u : 0u) |
+                     (weld_vertices ? 8u : 0u) | (build_meshlets ? 16u : 0u);
+
+    uint64_t hash = fnv1a_64(&lod_count, sizeof(lod_count));
+    hash = fnv1a_64(&lod_ratio, sizeof(lod_ratio), hash);
+    hash = fnv1a_64(&lod_max_error, sizeof(lod_max_error), hash);
+
+    if (weld_vertices) {
+      hash = fnv1a_64(&weld_epsilon, sizeof(weld_epsilon), hash);
+    }
+
+    return flags | static_cast<uint32_t>(hash) << 8;
+  }
+};
+
+// Where a model load has got to. Times are in milliseconds since the Model
+// was constructed and stay negative until that point is reached.
+struct Model_Load_Progress {
+  // Known once the file has been parsed or its mesh cache opened.
+  bool parsed = false;
+  std::size_t meshes_total = 0;
+  std::size_t meshes_uploaded = 0;
+
+  // Texture bindings of the uploaded meshes, and how many of them show the
+  // real texture rather than a placeholder.
+  std::size_t textures_total = 0;
+  std::size_t textures_ready = 0;
+
+  bool done = false;
+  bool failed = false;
+
+  double parse_ms = -1.0;
+  double first_mesh_ms = -1.0;
+  double meshes_ms = -1.0;
+  double done_ms = -1.0;
+
+  // GL thread time spent in update_loading(), in total and at worst in a
+  // single call.
+  double upload_ms = 0.0;
+  double max_frame_upload_ms = 0.0;
+  std::size_t frames = 0;
+
+  float fraction() const {
+    if (done) {
+      return 1.0f;
+    }
+
+    std::size_t total = meshes_total + textures_total;
+    return total ? (float)(meshes_uploaded + textures_ready) / (float)total
+                 : 0.0f;
+  }
+};
+
+struct Model_Memory_Report {
+  // Parallel to Model::meshes.
+  std::vector<Mesh_Memory> meshes;
+  Mesh_Memory total;
+  std::size_t textures = 0;
+  std::size_t texture_gpu_bytes = 0;
+
+  std::size_t cpu_bytes() const { return total.cpu_bytes(); }
+  std::size_t gpu_bytes() const {
+    return total.gpu_bytes() + texture_gpu_bytes;
+  }
+};
+
 class Model {
  public:
   std::vector<Texture> loaded_textures;
   std::vector<Mesh> meshes;
   std::string directory;
   bool gamma_correction;
+  Model_Options options;
+  bool loaded_from_cache = false;
+  std::vector<Texture_Load_Timing> texture_timings;
+
+  // Error of the compact vertex format against the float original, filled in
+  // when the model is imported (not when it comes from the mesh cache).
+  Quantization_Error quantization_error;
+
+  // Vertex cache behaviour of the imported indices before and after
+  // optimization; empty when the model comes from the mesh cache.
+  Mesh_Optimize_Report optimize_report;
+
+  // Per-mesh welding results, parallel to `meshes`; empty when the model
+  // comes from the mesh cache.
+  std::vector<Weld_Report> weld_reports;
+
+  // Meshlet culling results of the last draw_culled() call.
+  Meshlet_Cull_Stats cull_stats;
+
+  // Whole-mesh frustum culling results of the last draw(shader, projection,
+  // view, model) or draw_culled() call.
+  Frustum_Cull_Stats mesh_cull_stats;
+
+  Model_Load_Progress load_progress;
+
+  // Filled in when the file has bones (models with bones are always
+  // imported, never read from the mesh cache). Bone IDs in the vertices
+  // index skeleton.bone_offsets. Set once loading is complete.
+  Skeleton skeleton;
+  std::vector<Animation_Clip> animations;
+
+  // How skinned meshes are posed. SKINNING_GPU: bind a Bone_Palette_Buffer
+  // before drawing. SKINNING_CPU: call skin_on_cpu() with the palette.
+  skinning_mode skinning = SKINNING_GPU;
 
-  Model(std::string const& path, bool gamma = false) : gamma_correction(gamma) {
-    load_model(path);
+  // Loads the model, or with options.async_load only starts loading it.
+  Model(std::string const& path, bool gamma = false,
+        Model_Options options = Model_Options())
+      : gamma_correction(gamma), options(options) {
+    start_loading(path);
+
+    if (!options.async_load) {
+      finish_loading();
+    }
+  }
+
+  Model(const Model&) = delete;
+  Model& operator=(const Model&) = delete;
+
+  // Drops this model's texture references; the textures themselves stay in
+  // the shared cache until Texture_Cache::evict_unused().
+  ~Model() {
+    load_cancelled = true;
+
+    if (load_thread.joinable()) {
+      load_thread.join();
+    }
+
+    for (const Texture& texture : loaded_textures) {
+      Texture_Cache::shared().release(texture.id);
+    }
+
+    for (const Mesh& mesh : meshes) {
+      if (mesh.arena) {
+        mesh.arena->free(mesh.allocation);
+      }
+    }
   }
 
-  void draw(Shader& shader) {
+  bool loading() const { return !load_progress.done; }
+
+  bool skinned() const { return skeleton.bone_count() > 0; }
+
+  // The CPU skinning fallback: poses every skinned mesh with `palette`
+  // (skeleton.bone_count() matrices, see animate()) and uploads the result
+  // over its vertices. Needs the float vertex format and
+  // GEOMETRY_RESIDENCY_KEEP, which keep the bind pose on the CPU.
+  void skin_on_cpu(const glm::mat4* palette,
+                   animation_math math = ANIMATION_MATH_SIMD) {
+    skinned_vertices.resize(meshes.size());
+
+    for (std::size_t i = 0; i < meshes.size(); i++) {
+      Mesh& mesh = meshes[i];
+
+      if (!mesh.skinned) {
+        continue;
+      }
+
+      if (mesh.format != VERTEX_FORMAT_FLOAT || mesh.vertices.empty()) {
+        if (!cpu_skinning_reported) {
+          std::cerr << "ERROR::MODEL::CPU_SKINNING_UNAVAILABLE\nmesh " << i
+                    << " needs float vertices and GEOMETRY_RESIDENCY_KEEP\n";
+          cpu_skinning_reported = true;
+        }
+
+        continue;
+      }
+
+      skin_mesh(mesh.vertices, palette, skinned_vertices[i], math);
+      mesh.update_vertices(skinned_vertices[i].data());
+    }
+  }
+
+  // Call once per frame on the GL thread while loading(). Uploads the meshes
+  // the loading thread has finished, then decoded textures, until
+  // `budget_ms` is spent; at least one of each gets through per call so a
+  // tiny budget still makes progress. Returns loading().
+  bool update_loading(double budget_ms) {
+    if (!loading()) {
+      return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool drained = false;
+
+    do {
+      Loaded_Mesh loaded;
+
+      {
+        std::lock_guard<std::mutex> lock(load_queue.mutex);
+        load_progress.parsed = load_queue.parsed;
+        load_progress.meshes_total = load_queue.mesh_count;
+        load_progress.parse_ms = load_queue.parse_ms;
+
+        for (Texture_File& file : load_queue.texture_files) {
+          std::string path = file.path;
+          texture_files[path] = std::move(file);
+        }
+
+        load_queue.texture_files.clear();
+
+        if (load_queue.meshes.empty()) {
+          drained = load_queue.finished;
+          break;
+        }
+
+        loaded = std::move(load_queue.meshes.front());
+        load_queue.meshes.pop_front();
+        drained = load_queue.finished && load_queue.meshes.empty();
+      }
+
+      upload_mesh(loaded);
+    } while (elapsed_ms(start) < budget_ms);
+
+    Texture_Cache::shared().upload_ready(
+        std::max(budget_ms - elapsed_ms(start), 0.0));
+    resolve_placeholders();
+
+    double frame_ms = elapsed_ms(start);
+    load_progress.upload_ms += frame_ms;
+    load_progress.max_frame_upload_ms =
+        std::max(load_progress.max_frame_upload_ms, frame_ms);
+    load_progress.frames++;
+    load_progress.meshes_uploaded = meshes.size();
+
+    if (load_progress.first_mesh_ms < 0.0 && !meshes.empty()) {
+      load_progress.first_mesh_ms = elapsed_ms(load_start);
+    }
+
+    if (drained && load_progress.meshes_ms < 0.0) {
+      load_progress.meshes_ms = elapsed_ms(load_start);
+    }
+
+    if (drained && placeholders.empty()) {
+      complete_loading();
+    }
+
+    return loading();
+  }
+
+  // Blocks until everything is uploaded.
+  void finish_loading() {
+    while (update_loading(std::numeric_limits<double>::infinity())) {
+      std::unique_lock<std::mutex> lock(load_queue.mutex);
+
+      if (load_queue.finished && load_queue.meshes.empty()) {
+        lock.unlock();
+        Texture_Cache::shared().finish();
+        continue;
+      }
+
+      load_queue.changed.wait(lock, [this] {
+        return load_queue.finished || !load_queue.meshes.empty();
+      });
+    }
+  }
+
+  void print_load_report(std::ostream& out = std::cout) const {
+    const Model_Load_Progress& p = load_progress;
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "model load: %zu meshes, parsed at %.1f ms, first mesh at "
+                  "%.1f ms, all meshes at %.1f ms, textures at %.1f ms\n"
+                  "  GL uploads %.1f ms over %zu frames (max %.2f ms)\n",
+                  p.meshes_uploaded, p.parse_ms, p.first_mesh_ms,
+                  p.meshes_ms, p.done_ms, p.upload_ms, p.frames,
+                  p.max_frame_upload_ms);
+    out << line;
+  }
+
+  static std::string cache_path(std::string const& path) {
+    return path + ".meshcache";
+  }
+
+  // Binds each VAO only when it changes, so meshes sharing an arena cost a
+  // single VAO bind between them.
+  void draw(Shader& shader) { draw_meshes(shader, nullptr); }
+
+  // Like draw(), but skips the meshes whose bounding boxes are outside the
+  // view, or hidden in `occlusion` once its occluders are rasterized; the
+  // counts go to mesh_cull_stats and occlusion->stats.
+  void draw(Shader& shader, const glm::mat4& projection, const glm::mat4& view,
+            const glm::mat4& model, Occlusion_Buffer* occlusion = nullptr) {
+    cull_meshes(projection, view, model, occlusion);
+    draw_meshes(shader, mesh_visible.data());
+  }
+
+  // Like draw(shader, projection, view, model, occlusion), but queues the
+  // visible meshes in `queue` for a sorted draw later on.
+  void submit(Render_Queue& queue, Shader& shader,
+              const glm::mat4& projection, const glm::mat4& view,
+              const glm::mat4& model, Occlusion_Buffer* occlusion = nullptr) {
+    cull_meshes(projection, view, model, occlusion);
+    glm::mat4 model_view = view * model;
+
+    for (std::size_t i = 0; i < meshes.size(); i++) {
+      if (!mesh_visible[i]) {
+        continue;
+      }
+
+      Draw_Item item;
+      item.shader = &shader;
+      item.mesh = &meshes[i];
+      item.model = model;
+      item.skinned = meshes[i].skinned && skinning == SKINNING_GPU;
+      item.depth =
+          -(model_view * glm::vec4(meshes[i].bounds_center(), 1.0f)).z;
+      queue.submit(item);
+    }
+  }
+
+  // Draws every mesh once per instance in `instances`, uploading the
+  // instances that changed first. The shader takes its model matrix from
+  // the instance attributes while the "instanced" uniform is set.
+  void draw_instanced(Shader& shader, Instance_Buffer& instances) {
+    instances.upload();
+
+    if (instances.size() == 0) {
+      return;
+    }
+
+    unsigned int bound_VAO = 0;
+    shader.set_uniform_bool("instanced", true);
+
+    for (Mesh& mesh : meshes) {
+      if (mesh.VAO != bound_VAO) {
+        instances.attach(mesh.vertex_array_id());
+        glBindVertexArray(mesh.VAO);
+        bound_VAO = mesh.VAO;
+      }
+
+      mesh.bind_textures(shader);
+      mesh.set_vertex_uniforms(shader);
+      set_skinning_uniforms(shader, mesh);
+      mesh.draw_elements_instanced(instances.size());
+    }
+
+    shader.set_uniform_bool("instanced", false);
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // Queues the meshes that make good occluders (see select_occluders) into
+  // `buffer`. Needs CPU positions: float vertices kept after upload, or
+  // Mesh::collision. Skinned meshes are left out.
+  void add_occluders(Occlusion_Buffer& buffer, const glm::mat4& projection,
+                     const glm::mat4& view, const glm::mat4& model,
+                     const Occluder_Options& options = Occluder_Options()) {
+    std::vector<Occluder_Candidate> candidates;
+    std::vector<const Mesh*> sources;
+
+    for (const Mesh& mesh : meshes) {
+      std::size_t index_count =
+          mesh.lods.empty() ? mesh.indices.size() : mesh.lods[0].index_count;
+      bool has_positions =
+          !mesh.collision.indices.empty() ||
+          (mesh.format == VERTEX_FORMAT_FLOAT && !mesh.vertices.empty() &&
+           mesh.indices.size() >= index_count);
+
+      if (mesh.skinned || !has_positions) {
+        continue;
+      }
+
+      if (!mesh.collision.indices.empty()) {
+        index_count = mesh.collision.indices.size();
+      }
+
+      candidates.push_back({mesh.bounds_min, mesh.bounds_max, index_count / 3});
+      sources.push_back(&mesh);
+    }
+
+    glm::mat4 clip = projection * view * model;
+
+    for (std::size_t i : select_occluders(candidates, projection,
+                                          view * model, options)) {
+      const Mesh& mesh = *sources[i];
+
+      if (!mesh.collision.indices.empty()) {
+        buffer.add_occluder(mesh.collision.positions.data(),
+                            mesh.collision.positions.size(),
+                            sizeof(glm::vec3), mesh.collision.indices.data(),
+                            mesh.collision.indices.size(), clip);
+      } else {
+        buffer.add_occluder(&mesh.vertices[0].position, mesh.vertices.size(),
+                            sizeof(Vertex), mesh.indices.data(),
+                            candidates[i].triangle_count * 3, clip);
+      }
+    }
+  }
+
+  // Picks each mesh's detail level from its projected error in pixels, for a
+  // perspective camera with vertical field of view `fov_y` (degrees, e.g.
+  // Camera::zoom) and a viewport `viewport_height` pixels tall.
+  void select_lods(const glm::mat4& view, const glm::mat4& model, float fov_y,
+                   float viewport_height) {
+    glm::mat4 model_view = view * model;
+    float scale = std::max(glm::length(glm::vec3(model[0])),
+                           std::max(glm::length(glm::vec3(model[1])),
+                                    glm::length(glm::vec3(model[2]))));
+    float pixels_per_unit =
+        viewport_height / (2.0f * std::tan(glm::radians(fov_y) * 0.5f));
+    float coarsen = options.lod_pixel_error * (1.0f - options.lod_hysteresis);
+    float refine = options.lod_pixel_error * (1.0f + options.lod_hysteresis);
+
+    for (Mesh& mesh : meshes) {
+      if (mesh.lods.size() < 2) {
+        continue;
+      }
+
+      glm::vec3 center =
+          glm::vec3(model_view * glm::vec4(mesh.bounds_center(), 1.0f));
+      float radius = mesh.bounds_radius() * scale;
+      float distance = std::max(glm::length(center) - radius, 1e-3f);
+
+      auto projected = [&](unsigned int level) {
+        return mesh.lods[level].error * scale * pixels_per_unit / distance;
+      };
+
+      unsigned int level = std::min<unsigned int>(
+          mesh.current_lod, static_cast<unsigned int>(mesh.lods.size() - 1));
+
+      while (level + 1 < mesh.lods.size() && projected(level + 1) <= coarsen) {
+        level++;
+      }
+
+      while (level > 0 && projected(level) > refine) {
+        level--;
+      }
+
+      mesh.current_lod = level;
+    }
+  }
+
+  void print_lod_report(std::ostream& out = std::cout) const {
+    for (std::size_t i = 0; i < meshes.size(); i++) {
+      const Mesh& mesh = meshes[i];
+
+      if (mesh.lods.empty()) {
+        continue;
+      }
+
+      out << "mesh " << i << " LODs:";
+
+      for (const Mesh_LOD& lod : mesh.lods) {
+        out << "  " << lod.index_count / 3 << " tris";
+
+        if (lod.error > 0.0f) {
+          out << " (error " << lod.error << ")";
+        }
+      }
+
+      out << "\n";
+    }
+  }
+
+  // Like draw(), but culls whole meshes and then each visible mesh's
+  // meshlets against the view, and only draws the visible ones. Meshes
+  // without meshlets are drawn whole.
+  void draw_culled(Shader& shader, const glm::mat4& projection,
+                   const glm::mat4& view, const glm::mat4& model,
+                   Occlusion_Buffer* occlusion = nullptr) {
+    Meshlet_Cull_View cull_view(projection, view, model);
+    unsigned int bound_VAO = 0;
+
+    cull_stats = Meshlet_Cull_Stats();
+    cull_meshes(projection, view, model, occlusion);
+
     for (unsigned int i = 0; i < meshes.size(); i++) {
-      meshes[i].draw(shader);
+      Mesh& mesh = meshes[i];
+      visible_meshlets.clear();
+
+      if (!mesh_visible[i]) {
+        continue;
+      }
+
+      // Meshlets only cover level 0.
+      bool use_meshlets = !mesh.meshlets.empty() && mesh.current_lod == 0;
+
+      if (use_meshlets) {
+        cull_meshlets(mesh.meshlets, cull_view, visible_meshlets, cull_stats);
+
+        if (visible_meshlets.empty()) {
+          continue;
+        }
+      }
+
+      if (mesh.VAO != bound_VAO) {
+        glBindVertexArray(mesh.VAO);
+        bound_VAO = mesh.VAO;
+      }
+
+      mesh.bind_textures(shader);
+      mesh.set_vertex_uniforms(shader);
+      set_skinning_uniforms(shader, mesh);
+
+      if (!use_meshlets) {
+        mesh.draw_elements();
+      } else {
+        mesh.draw_meshlets(visible_meshlets);
+      }
+    }
+
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // CPU and estimated GPU bytes, per mesh and in total. Textures are counted
+  // once per model even when several meshes (or models) share them.
+  Model_Memory_Report memory_report() const {
+    Model_Memory_Report report;
+    std::vector<unsigned int> textures;
+
+    for (const Mesh& mesh : meshes) {
+      report.meshes.push_back(mesh.memory());
+      report.total.merge(report.meshes.back());
+    }
+
+    for (const Texture& texture : loaded_textures) {
+      if (std::find(textures.begin(), textures.end(), texture.id) ==
+          textures.end()) {
+        textures.push_back(texture.id);
+        report.texture_gpu_bytes +=
+            Texture_Cache::shared().texture_bytes(texture.id);
+      }
+    }
+
+    report.textures = textures.size();
+
+    return report;
+  }
+
+  void print_memory_report(std::ostream& out = std::cout,
+                           bool per_mesh = false) const {
+    Model_Memory_Report report = memory_report();
+    auto kib = [](std::size_t bytes) { return bytes / 1024.0; };
+    char line[256];
+
+    if (per_mesh) {
+      for (std::size_t i = 0; i < report.meshes.size(); i++) {
+        const Mesh_Memory& mesh = report.meshes[i];
+        std::snprintf(line, sizeof(line),
+                      "  mesh %3zu: CPU %9.1f KiB (vertices %.1f, indices "
+                      "%.1f, collision %.1f), GPU %9.1f KiB\n",
+                      i, kib(mesh.cpu_bytes()), kib(mesh.cpu_vertex_bytes),
+                      kib(mesh.cpu_index_bytes),
+                      kib(mesh.cpu_collision_bytes), kib(mesh.gpu_bytes()));
+        out << line;
+      }
+    }
+
+    const Mesh_Memory& total = report.total;
+    std::snprintf(line, sizeof(line),
+                  "model memory: CPU %.1f KiB (vertices %.1f, indices %.1f, "
+                  "collision %.1f, other %.1f)\n"
+                  "  GPU %.1f KiB (vertices %.1f, indices %.1f, %zu textures "
+                  "%.1f)\n",
+                  kib(report.cpu_bytes()), kib(total.cpu_vertex_bytes),
+                  kib(total.cpu_index_bytes), kib(total.cpu_collision_bytes),
+                  kib(total.cpu_other_bytes), kib(report.gpu_bytes()),
+                  kib(total.gpu_vertex_bytes), kib(total.gpu_index_bytes),
+                  report.textures, kib(report.texture_gpu_bytes));
+    out << line;
+  }
+
+  void print_arena_stats(std::ostream& out = std::cout) const {
+    std::vector<const Mesh_Arena*> arenas;
+
+    for (const Mesh& mesh : meshes) {
+      if (mesh.arena && std::find(arenas.begin(), arenas.end(), mesh.arena) ==
+                            arenas.end()) {
+        arenas.push_back(mesh.arena);
+      }
+    }
+
+    for (const Mesh_Arena* arena : arenas) {
+      arena->print_stats(out);
     }
   }
 
  private:
-  void load_model(std::string const& path) {
+  std::unique_ptr<Mesh_Arena> own_arenas[3];
+  std::vector<unsigned int> visible_meshlets;
+  // Model-space mesh boxes for cull_meshes(), rebuilt as meshes arrive.
+  Cull_Bounds mesh_bounds;
+  std::vector<unsigned char> mesh_visible;
+  // Per mesh, for skin_on_cpu().
+  std::vector<std::vector<Vertex>> skinned_vertices;
+  bool cpu_skinning_reported = false;
+
+  // `visible` is null or holds one byte per mesh.
+  void draw_meshes(Shader& shader, const unsigned char* visible) {
+    unsigned int bound_VAO = 0;
+
+    for (unsigned int i = 0; i < meshes.size(); i++) {
+      if (visible && !visible[i]) {
+        continue;
+      }
+
+      if (meshes[i].VAO != bound_VAO) {
+        glBindVertexArray(meshes[i].VAO);
+        bound_VAO = meshes[i].VAO;
+      }
+
+      meshes[i].bind_textures(shader);
+      meshes[i].set_vertex_uniforms(shader);
+      set_skinning_uniforms(shader, meshes[i]);
+      meshes[i].draw_elements();
+    }
+
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // Fills mesh_visible, testing the boxes against the frustum in model
+  // space and then against `occlusion`. Skinned meshes are always kept:
+  // their boxes are for the bind pose. A model has too few meshes to be
+  // worth the thread pool.
+  void cull_meshes(const glm::mat4& projection, const glm::mat4& view,
+                   const glm::mat4& model, Occlusion_Buffer* occlusion) {
+    if (mesh_bounds.size() != meshes.size()) {
+      mesh_bounds.clear();
+      mesh_bounds.reserve(meshes.size());
+
+      for (const Mesh& mesh : meshes) {
+        mesh_bounds.push_back(mesh.bounds_min, mesh.bounds_max);
+      }
+    }
+
+    glm::mat4 clip = projection * view * model;
+    mesh_cull_stats = Frustum_Cull_Stats();
+    cull_bounds(Frustum(clip), mesh_bounds, mesh_visible, mesh_cull_stats,
+                CULL_MATH_SIMD, false);
+
+    for (std::size_t i = 0; i < meshes.size(); i++) {
+      if (meshes[i].skinned) {
+        mesh_cull_stats.culled -= !mesh_visible[i];
+        // Untested by the occlusion pass below.
+        mesh_visible[i] = 0;
+      }
+    }
+
+    if (occlusion) {
+      occlusion->test_bounds(mesh_bounds, clip, mesh_visible, false);
+    }
+
+    for (std::size_t i = 0; i < meshes.size(); i++) {
+      mesh_visible[i] |= meshes[i].skinned;
+    }
+  }
+
+  // Set for every mesh, as models share their shaders. The sampler always
+  // points at the palette's unit so it never aliases a 2D texture unit.
+  // Meshlet bounds and cones are for the bind pose, so culled draws of
+  // animated meshes may drop meshlets that have moved into view.
+  void set_skinning_uniforms(Shader& shader, const Mesh& mesh) const {
+    shader.set_uniform_bool("skinned",
+                            mesh.skinned && skinning == SKINNING_GPU);
+    shader.set_uniform_int("bone_palette", BONE_PALETTE_TEXTURE_UNIT);
+  }
+
+  // The arena for meshes of `format`, or null when arenas are off. A shared
+  // arena is only used for meshes in its own format.
+  Mesh_Arena* arena_for(vertex_format format) {
+    if (!options.use_arena) {
+      return nullptr;
+    }
+
+    if (options.arena && options.arena->format == format) {
+      return options.arena;
+    }
+
+    if (!own_arenas[format]) {
+      own_arenas[format] = std::make_unique<Mesh_Arena>(format);
+    }
+
+    return own_arenas[format].get();
+  }
+
+  // A texture file read on the loading thread (empty `bytes` if that
+  // failed).
+  struct Texture_File {
+    std::string path;
+    std::vector<unsigned char> bytes;
+    double io_ms = 0.0;
+  };
+
+  // Texture files already read by some loading job, so each is read once.
+  // Texture files claimed by a worker: false while it reads the file, true
+  // once the bytes are queued for the GL thread.
+  struct Texture_Reads {
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::unordered_map<std::string, bool> paths;
+  };
+
+  // A mesh the loading thread has finished, plus what the GL thread needs
+  // to finish it off. The GL thread only reads `mesh` until the load is
+  // complete, since the loading thread may still be baking it.
+  struct Loaded_Mesh {
+    std::shared_ptr<Mesh_Import> mesh;
+    // Position in the scene (or in the cache, which keeps scene order).
+    std::size_t index = 0;
+
+    // Only meaningful for imported (not cached) meshes.
+    bool imported = false;
+    Weld_Report weld_report;
+    Mesh_Optimize_Report optimize_report;
+    Quantization_Error quantization_error;
+  };
+
+  // Shared with the loading thread.
+  struct Load_Queue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Loaded_Mesh> meshes;
+    std::vector<Texture_File> texture_files;
+    std::size_t mesh_count = 0;
+    double parse_ms = -1.0;
+    bool parsed = false;
+    bool from_cache = false;
+    bool finished = false;
+    bool failed = false;
+    Skeleton skeleton;
+    std::vector<Animation_Clip> animations;
+  };
+
+  // A mesh texture slot showing a placeholder until `texture_ID` is ready.
+  struct Placeholder {
+    std::size_t mesh;
+    std::size_t slot;
+    unsigned int texture_ID;
+  };
+
+  Load_Queue load_queue;
+  std::atomic<bool> load_cancelled{false};
+  std::thread load_thread;
+  std::chrono::steady_clock::time_point load_start;
+  std::size_t first_timing = 0;
+  std::unordered_map<std::string, Texture_File> texture_files;
+  std::vector<Placeholder> placeholders;
+  // Parallel to `meshes` while loading; their CPU-side vertices and indices
+  // move into the meshes once the loading thread is done with them.
+  std::vector<std::shared_ptr<Mesh_Import>> mesh_imports;
+  // Parallel to `meshes` while loading: the scene index of each, as they
+  // arrive in whatever order the workers finish them.
+  std::vector<std::size_t> mesh_indices;
+
+  static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  void start_loading(std::string const& path) {
+    directory = path.substr(0, path.find_last_of('/'));
+    load_start = std::chrono::steady_clock::now();
+    first_timing = Texture_Cache::shared().timings().size();
+    load_thread = std::thread(&Model::load_in_background, this, path);
+  }
+
+  void complete_loading() {
+    load_thread.join();
+    sort_meshes();
+
+    for (std::size_t i = 0; i < mesh_imports.size(); i++) {
+      Mesh_Import& import = *mesh_imports[i];
+
+      if (options.residency == GEOMETRY_RESIDENCY_KEEP) {
+        keep_import_geometry(import, meshes[i].vertices, meshes[i].indices);
+      } else if (options.residency == GEOMETRY_RESIDENCY_COLLISION) {
+        meshes[i].collision = build_collision_mesh(import);
+      }
+    }
+
+    mesh_imports.clear();
+
+    {
+      std::lock_guard<std::mutex> lock(load_queue.mutex);
+      loaded_from_cache = load_queue.from_cache;
+      load_progress.failed = load_queue.failed;
+      skeleton = std::move(load_queue.skeleton);
+      animations = std::move(load_queue.animations);
+    }
+
+    // The cache logs every model's uploads; keep the ones of textures this
+    // model asked for.
+    std::unordered_set<unsigned int> requested;
+
+    for (const Texture& texture : loaded_textures) {
+      requested.insert(texture.id);
+    }
+
+    const std::vector<Texture_Load_Timing>& timings =
+        Texture_Cache::shared().timings();
+    texture_timings.clear();
+
+    for (std::size_t i = first_timing; i < timings.size(); i++) {
+      if (requested.count(timings[i].texture_ID)) {
+        texture_timings.push_back(timings[i]);
+      }
+    }
+
+    load_progress.done_ms = elapsed_ms(load_start);
+    load_progress.done = true;
+  }
+
+  // Puts `meshes` and what runs parallel to it into scene order, so
+  // meshes[i] is the same mesh whether it was imported or read from the
+  // cache. Meshes are drawn as they arrive, so until then they stay in
+  // arrival order. Placeholders index `meshes`, but are all resolved here.
+  void sort_meshes() {
+    std::vector<std::size_t> order(meshes.size());
+
+    for (std::size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+      return mesh_indices[a] < mesh_indices[b];
+    });
+
+    std::vector<Mesh> sorted_meshes;
+    std::vector<std::shared_ptr<Mesh_Import>> sorted_imports;
+    std::vector<Weld_Report> sorted_welds;
+    sorted_meshes.reserve(meshes.size());
+    sorted_imports.reserve(meshes.size());
+
+    for (std::size_t i : order) {
+      sorted_meshes.push_back(std::move(meshes[i]));
+      sorted_imports.push_back(std::move(mesh_imports[i]));
+
+      if (weld_reports.size() == meshes.size()) {
+        sorted_welds.push_back(weld_reports[i]);
+      }
+    }
+
+    meshes = std::move(sorted_meshes);
+    mesh_imports = std::move(sorted_imports);
+
+    if (weld_reports.size() == meshes.size()) {
+      weld_reports = std::move(sorted_welds);
+    }
+
+    mesh_indices.clear();
+    mesh_bounds.clear();
+  }
+
+  // Runs on load_thread. Only reads `options` and `directory` and talks to
+  // the GL thread through load_queue.
+  void load_in_background(std::string path) {
+    uint64_t source_hash = 0;
+    bool hashed =
+        options.use_mesh_cache && hash_model_sources(path, source_hash);
+
+    if (hashed && read_mesh_cache(cache_path(path), source_hash)) {
+      finish_queue(false);
+      return;
+    }
+
     Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile(
-        path, aiProcess_Triangulate | aiProcess_GenSmoothNormals |
-                  aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
         !scene->mRootNode) {
       std::cerr << "ERROR::ASSIMP\n" << importer.GetErrorString() << "\n";
+      finish_queue(true);
       return;
     }
 
-    directory = path.substr(0, path.find_last_of('/'));
+    std::vector<const aiMesh*> scene_meshes;
+    collect_meshes(scene->mRootNode, scene, scene_meshes);
+
+    Skeleton skeleton;
+    std::vector<Animation_Clip> clips;
+    import_skeleton(scene, skeleton, clips);
+    mark_parsed(scene_meshes.size(), false);
+
+    // Meshes are independent, so they are imported in parallel on the
+    // shared pool and published in whatever order they finish. They are
+    // kept in scene order until the whole model can be baked.
+    std::vector<std::shared_ptr<Mesh_Import>> imported(scene_meshes.size());
+    Texture_Reads reads;
+
+    Thread_Pool::shared().parallel_for(
+        scene_meshes.size(), 1, [&](std::size_t begin, std::size_t end) {
+          for (std::size_t i = begin; i < end && !load_cancelled; i++) {
+            Loaded_Mesh loaded =
+                process_mesh(scene_meshes[i], scene, skeleton, reads);
+            loaded.index = i;
+            imported[i] = loaded.mesh;
+            publish(std::move(loaded));
+          }
+        });
+
+    if (load_cancelled) {
+      finish_queue(true);
+      return;
+    }
+
+    // The cache has no room for skeletons and clips.
+    if (hashed && skeleton.bone_count() == 0) {
+      std::vector<const Mesh_Import*> bake;
+
+      for (const std::shared_ptr<Mesh_Import>& mesh : imported) {
+        bake.push_back(mesh.get());
+      }
+
+      write_mesh_cache(cache_path(path), source_hash, MODEL_IMPORT_FLAGS,
+                       options.optimize_flags(),
+                       options.requested_vertex_format(), bake);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(load_queue.mutex);
+      load_queue.skeleton = std::move(skeleton);
+      load_queue.animations = std::move(clips);
+    }
+
+    finish_queue(false);
+  }
+
+  void mark_parsed(std::size_t mesh_count, bool from_cache) {
+    std::lock_guard<std::mutex> lock(load_queue.mutex);
+    load_queue.mesh_count = mesh_count;
+    load_queue.parse_ms = elapsed_ms(load_start);
+    load_queue.parsed = true;
+    load_queue.from_cache = from_cache;
+  }
 
-    process_node(scene->mRootNode, scene);
+  void publish(Loaded_Mesh loaded) {
+    std::lock_guard<std::mutex> lock(load_queue.mutex);
+    load_queue.meshes.push_back(std::move(loaded));
+    load_queue.changed.notify_one();
   }
 
-  void process_node(aiNode* node, const aiScene* scene) {
+  void finish_queue(bool failed) {
+    std::lock_guard<std::mutex> lock(load_queue.mutex);
+    load_queue.finished = true;
+    load_queue.failed = failed;
+    load_queue.changed.notify_one();
+  }
+
+  // Hands out the mapped geometry as-is; the mapping stays open until the
+  // last of its meshes has been uploaded.
+  bool read_mesh_cache(std::string const& path, uint64_t source_hash) {
+    auto cache = std::make_shared<Mesh_Cache_File>();
+
+    if (!cache->open(path, source_hash, MODEL_IMPORT_FLAGS,
+                     options.optimize_flags(),
+                     options.requested_vertex_format())) {
+      return false;
+    }
+
+    const Mesh_Cache_Header& header = cache->header();
+    mark_parsed(header.mesh_count, true);
+
+    Texture_Reads reads;
+
+    for (uint32_t i = 0; i < header.mesh_count && !load_cancelled; i++) {
+      const Mesh_Cache_Mesh& record = cache->mesh(i);
+      auto mesh = std::make_shared<Mesh_Import>();
+      Loaded_Mesh loaded;
+
+      for (uint32_t j = 0; j < record.texture_count; j++) {
+        const Mesh_Cache_Texture& texture =
+            cache->texture(record.first_texture + j);
+        std::string texture_path =
+            cache->string(texture.path_offset, texture.path_length);
+
+        mesh->textures.push_back(
+            {0, cache->string(texture.type_offset, texture.type_length),
+             texture_path});
+        read_texture_file(texture_path, reads);
+      }
+
+      mesh->format = (vertex_format)record.vertex_format;
+      mesh->index_type = (GLenum)record.index_type;
+      mesh->vertex_count = record.vertex_count;
+      mesh->index_count = record.index_count;
+      mesh->vertex_data = cache->vertices(record);
+      mesh->index_data = cache->indices(record);
+      mesh->owner = cache;
+      mesh->bounds_min = glm::vec3(record.bounds_min[0],
+                                   record.bounds_min[1],
+                                   record.bounds_min[2]);
+      mesh->bounds_max = glm::vec3(record.bounds_max[0],
+                                   record.bounds_max[1],
+                                   record.bounds_max[2]);
+      mesh->meshlets = cache->meshlets(record);
+      mesh->lods = cache->lods(record);
+
+      loaded.mesh = std::move(mesh);
+      loaded.index = i;
+      publish(std::move(loaded));
+    }
+
+    return true;
+  }
+
+  // Reads each texture file once per model off the GL thread, which then
+  // only has to hash and queue the bytes. The lock is only held to claim
+  // the path, so different files are read in parallel. A worker wanting a
+  // file another one is still reading waits until it is queued, so the
+  // file always reaches the GL thread ahead of any mesh using it.
+  void read_texture_file(std::string const& path, Texture_Reads& reads) {
+    std::string filename = directory + '/' + path;
+
+    {
+      std::unique_lock<std::mutex> read_lock(reads.mutex);
+      auto claimed = reads.paths.find(filename);
+
+      if (claimed != reads.paths.end()) {
+        // Elements, unlike iterators, survive rehashing.
+        const bool& done = claimed->second;
+        reads.queued.wait(read_lock, [&] { return done; });
+        return;
+      }
+
+      reads.paths.emplace(filename, false);
+    }
+
+    Texture_File file;
+    file.path = filename;
+    auto start = std::chrono::steady_clock::now();
+
+    if (!read_file_bytes(filename, file.bytes)) {
+      file.bytes.clear();
+    }
+
+    file.io_ms = elapsed_ms(start);
+
+    {
+      std::lock_guard<std::mutex> lock(load_queue.mutex);
+      load_queue.texture_files.push_back(std::move(file));
+    }
+
+    std::lock_guard<std::mutex> read_lock(reads.mutex);
+    reads.paths[filename] = true;
+    reads.queued.notify_all();
+  }
+
+  void collect_meshes(const aiNode* node, const aiScene* scene,
+                      std::vector<const aiMesh*>& scene_meshes) {
     for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-      aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-      meshes.push_back(process_mesh(mesh, scene));
+      scene_meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+    }
+
+    for (unsigned int i = 0; i < node->mNumChildren; i++) {
+      collect_meshes(node->mChildren[i], scene, scene_meshes);
     }
+  }
+
+  // assimp matrices are row-major.
+  static glm::mat4 to_mat4(const aiMatrix4x4& m) {
+    return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1),
+                     glm::vec4(m.a2, m.b2, m.c2, m.d2),
+                     glm::vec4(m.a3, m.b3, m.c3, m.d3),
+                     glm::vec4(m.a4, m.b4, m.c4, m.d4));
+  }
+
+  static void add_skeleton_nodes(const aiNode* node, int parent,
+                                 Skeleton& skeleton) {
+    int index = skeleton.add_node(node->mName.C_Str(), parent,
+                                  to_mat4(node->mTransformation));
 
     for (unsigned int i = 0; i < node->mNumChildren; i++) {
-      process_node(node->mChildren[i], scene);
+      add_skeleton_nodes(node->mChildren[i], index, skeleton);
     }
   }
 
-  Mesh process_mesh(aiMesh* mesh, const aiScene* scene) {
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
-    std::vector<Texture> textures;
+  // The node hierarchy, every mesh's bones and the animation clips. Left
+  // empty for scenes without bones: meshes are drawn without their node
+  // transforms, so animating rigid nodes would have no effect.
+  static void import_skeleton(const aiScene* scene, Skeleton& skeleton,
+                              std::vector<Animation_Clip>& clips) {
+    bool has_bones = false;
 
-    for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-      Vertex vertex;
-      glm::vec3 vec3_temp;
+    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+      has_bones = has_bones || scene->mMeshes[i]->mNumBones > 0;
+    }
+
+    if (!has_bones) {
+      return;
+    }
 
-      vec3_temp.x = mesh->mVertices[i].x;
-      vec3_temp.y = mesh->mVertices[i].y;
-      vec3_temp.z = mesh->mVertices[i].z;
+    add_skeleton_nodes(scene->mRootNode, -1, skeleton);
+    skeleton.global_inverse = glm::inverse(skeleton.nodes[0].local);
 
-      vertex.position = vec3_temp;
+    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+      const aiMesh* mesh = scene->mMeshes[i];
 
-      if (mesh->HasNormals()) {
-        vec3_temp.x = mesh->mNormals[i].x;
-        vec3_temp.y = mesh->mNormals[i].y;
-        vec3_temp.z = mesh->mNormals[i].z;
+      for (unsigned int j = 0; j < mesh->mNumBones; j++) {
+        const aiBone* bone = mesh->mBones[j];
 
-        vertex.normal = vec3_temp;
+        if (skeleton.add_bone(bone->mName.C_Str(),
+                              to_mat4(bone->mOffsetMatrix)) < 0) {
+          std::cerr << "ERROR::MODEL::BONE_DROPPED\n" << bone->mName.C_Str()
+                    << " (no such node, or more than " << MAX_SKELETON_BONES
+                    << " bones)\n";
+        }
       }
+    }
 
-      if (mesh->mTextureCoords[0]) {
-        glm::vec2 vec2_temp;
+    for (unsigned int i = 0; i < scene->mNumAnimations; i++) {
+      clips.push_back(import_clip(scene->mAnimations[i], skeleton));
+    }
+  }
 
-        vec2_temp.x = mesh->mTextureCoords[0][i].x;
-        vec2_temp.y = mesh->mTextureCoords[0][i].y;
+  static Animation_Clip import_clip(const aiAnimation* animation,
+                                    const Skeleton& skeleton) {
+    double ticks_per_second =
+        animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+    auto seconds = [&](double ticks) {
+      return static_cast<float>(ticks / ticks_per_second);
+    };
 
-        vertex.tex_coords = vec2_temp;
+    Animation_Clip clip;
+    clip.name = animation->mName.C_Str();
+    clip.duration = seconds(animation->mDuration);
 
-        vec3_temp.x = mesh->mTangents[i].x;
-        vec3_temp.y = mesh->mTangents[i].y;
-        vec3_temp.z = mesh->mTangents[i].z;
+    for (unsigned int i = 0; i < animation->mNumChannels; i++) {
+      const aiNodeAnim* source = animation->mChannels[i];
+      Animation_Channel channel;
+      channel.node = skeleton.find_node(source->mNodeName.C_Str());
 
-        vertex.tangent = vec3_temp;
+      if (channel.node < 0) {
+        continue;
+      }
 
-        vec3_temp.x = mesh->mBitangents[i].x;
-        vec3_temp.y = mesh->mBitangents[i].y;
-        vec3_temp.z = mesh->mBitangents[i].z;
+      for (unsigned int k = 0; k < source->mNumPositionKeys; k++) {
+        const aiVectorKey& key = source->mPositionKeys[k];
+        channel.translation_times.push_back(seconds(key.mTime));
+        channel.translations.push_back(
+            glm::vec4(key.mValue.x, key.mValue.y, key.mValue.z, 0.0f));
+      }
 
-        vertex.bitangent = vec3_temp;
-      } else {
-        vertex.tex_coords = glm::vec2(0.0f, 0.0f);
+      for (unsigned int k = 0; k < source->mNumRotationKeys; k++) {
+        const aiQuatKey& key = source->mRotationKeys[k];
+        channel.rotation_times.push_back(seconds(key.mTime));
+        channel.rotations.push_back(glm::vec4(key.mValue.x, key.mValue.y,
+                                              key.mValue.z, key.mValue.w));
       }
 
-      vertices.push_back(vertex);
+      for (unsigned int k = 0; k < source->mNumScalingKeys; k++) {
+        const aiVectorKey& key = source->mScalingKeys[k];
+        channel.scale_times.push_back(seconds(key.mTime));
+        channel.scales.push_back(
+            glm::vec4(key.mValue.x, key.mValue.y, key.mValue.z, 0.0f));
+      }
+
+      clip.channels.push_back(std::move(channel));
     }
 
-    for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-      aiFace face = mesh->mFaces[i];
+    return clip;
+  }
+
+  // Keeps the MAX_BONE_INFLUENCE heaviest influences of every vertex and
+  // normalizes them to sum to 1.
+  static void apply_bone_weights(const aiMesh* mesh, const Skeleton& skeleton,
+                                 std::vector<Vertex>& vertices) {
+    if (mesh->mNumBones == 0) {
+      return;
+    }
 
-      for (unsigned int j = 0; j < face.mNumIndices; j++) {
-        indices.push_back(face.mIndices[j]);
+    for (unsigned int i = 0; i < mesh->mNumBones; i++) {
+      const aiBone* bone = mesh->mBones[i];
+      int bone_ID = skeleton.find_bone(bone->mName.C_Str());
+
+      if (bone_ID < 0) {
+        continue;
+      }
+
+      for (unsigned int j = 0; j < bone->mNumWeights; j++) {
+        const aiVertexWeight& weight = bone->mWeights[j];
+
+        if (weight.mVertexId >= vertices.size()) {
+          continue;
+        }
+
+        Vertex& vertex = vertices[weight.mVertexId];
+        int lightest = 0;
+
+        for (int k = 1; k < MAX_BONE_INFLUENCE; k++) {
+          if (vertex.m_weights[k] < vertex.m_weights[lightest]) {
+            lightest = k;
+          }
+        }
+
+        if (weight.mWeight > vertex.m_weights[lightest]) {
+          vertex.m_bone_IDs[lightest] = bone_ID;
+          vertex.m_weights[lightest] = weight.mWeight;
+        }
       }
     }
 
-    aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+    for (Vertex& vertex : vertices) {
+      float total = 0.0f;
+
+      for (int k = 0; k < MAX_BONE_INFLUENCE; k++) {
+        total += vertex.m_weights[k];
+      }
+
+      for (int k = 0; k < MAX_BONE_INFLUENCE && total > 0.0f; k++) {
+        vertex.m_weights[k] /= total;
+      }
+    }
+  }
 
-    std::vector<Texture> diffuse_maps = load_material_textures(
-        material, aiTextureType_DIFFUSE, "texture_diffuse");
-    textures.insert(textures.end(), diffuse_maps.begin(), diffuse_maps.end());
+  static Vertex_Streams vertex_streams(const aiMesh* mesh) {
+    static_assert(sizeof(aiVector3D) == 3 * sizeof(float),
+                  "assimp must be built with single precision");
 
-    std::vector<Texture> specular_maps = load_material_textures(
-        material, aiTextureType_SPECULAR, "texture_specular");
-    textures.insert(textures.end(), specular_maps.begin(), specular_maps.end());
+    auto stream = [](const aiVector3D* vectors) {
+      return vectors ? &vectors->x : nullptr;
+    };
 
-    std::vector<Texture> normal_maps = load_material_textures(
-        material, aiTextureType_HEIGHT, "texture_normal");
-    textures.insert(textures.end(), normal_maps.begin(), normal_maps.end());
+    Vertex_Streams streams;
+    streams.count = mesh->mNumVertices;
+    streams.stride = sizeof(aiVector3D);
+    streams.position = stream(mesh->mVertices);
+    streams.normal = stream(mesh->mNormals);
 
-    std::vector<Texture> height_maps = load_material_textures(
-        material, aiTextureType_AMBIENT, "texture_height");
-    textures.insert(textures.end(), height_maps.begin(), height_maps.end());
+    // Tangents are only generated for meshes with UVs.
+    if (mesh->mTextureCoords[0]) {
+      streams.tex_coords = stream(mesh->mTextureCoords[0]);
+      streams.tangent = stream(mesh->mTangents);
+      streams.bitangent = stream(mesh->mBitangents);
+    }
 
-    return Mesh(vertices, indices, textures);
+    return streams;
   }
 
-  std::vector<Texture> load_material_textures(aiMaterial* material,
-                                              aiTextureType type,
-                                              std::string type_name) {
-    std::vector<Texture> textures;
+  static void convert_indices(const aiMesh* mesh,
+                              std::vector<unsigned int>& indices) {
+    std::size_t count = 0;
+
+    if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE) {
+      count = static_cast<std::size_t>(mesh->mNumFaces) * 3;
+    } else {
+      for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+        count += mesh->mFaces[i].mNumIndices;
+      }
+    }
+
+    indices.resize(count);
+    unsigned int* out = indices.data();
+
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+      const aiFace& face = mesh->mFaces[i];
+      std::memcpy(out, face.mIndices, face.mNumIndices * sizeof(unsigned int));
+      out += face.mNumIndices;
+    }
+  }
+
+  // Everything up to the GL upload; runs on a loading job.
+  Loaded_Mesh process_mesh(const aiMesh* mesh, const aiScene* scene,
+                           const Skeleton& skeleton, Texture_Reads& reads) {
+    Loaded_Mesh loaded;
+    loaded.imported = true;
+
+    auto result = std::make_shared<Mesh_Import>();
+    std::vector<Vertex>& vertices = result->vertices;
+    std::vector<unsigned int>& indices = result->indices;
+
+    convert_vertices(vertex_streams(mesh), vertices);
+    apply_bone_weights(mesh, skeleton, vertices);
+    convert_indices(mesh, indices);
+
+    // Points and lines survive aiProcess_Triangulate; only weld and reorder
+    // meshes that are pure triangle lists.
+    bool triangles = mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE &&
+                     !vertices.empty();
+    Weld_Report& weld_report = loaded.weld_report;
+    weld_report.vertices_before = vertices.size();
+    weld_report.vertices_after = vertices.size();
+
+    if (triangles && options.weld_vertices) {
+      weld_report = weld_vertices(vertices, indices, options.weld_epsilon);
+    }
+
+    if (triangles) {
+      loaded.optimize_report = optimize_mesh(
+          vertices, indices, options.optimize_vertex_cache,
+          options.optimize_overdraw, options.optimize_vertex_fetch);
+    }
+
+    aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+
+    load_material_textures(material, aiTextureType_DIFFUSE, "texture_diffuse",
+                           result->textures, reads);
+    load_material_textures(material, aiTextureType_SPECULAR,
+                           "texture_specular", result->textures, reads);
+    load_material_textures(material, aiTextureType_HEIGHT, "texture_normal",
+                           result->textures, reads);
+    load_material_textures(material, aiTextureType_AMBIENT, "texture_height",
+                           result->textures, reads);
+
+    vertex_format format =
+        resolve_vertex_format(options.requested_vertex_format(), vertices);
+
+    if (!vertices.empty()) {
+      result->bounds_min = vertices[0].position;
+      result->bounds_max = result->bounds_min;
+
+      for (const Vertex& vertex : vertices) {
+        result->bounds_min = glm::min(result->bounds_min, vertex.position);
+        result->bounds_max = glm::max(result->bounds_max, vertex.position);
+      }
+    }
+
+    if (triangles && options.build_meshlets) {
+      result->meshlets = build_meshlets(indices, vertices.size());
+      compute_meshlet_bounds(result->meshlets, indices,
+                             &vertices[0].position.x, sizeof(Vertex));
+    }
+
+    // Coarser levels are appended to `indices`, after level 0.
+    if (triangles && options.lod_count > 1) {
+      result->lods = generate_lod_chain(
+          indices, &vertices[0].position.x, sizeof(Vertex), vertices.size(),
+          options.lod_count, options.lod_ratio,
+          options.lod_max_error *
+              glm::length(result->bounds_max - result->bounds_min));
+    }
+
+    // Encode for the GPU here too, so the GL thread only copies bytes.
+    result->format = format;
+    result->skinned = has_bone_weights(vertices);
+    result->vertex_count = vertices.size();
+    result->index_count = indices.size();
+    result->index_type = choose_index_type(vertices.size());
+
+    if (format == VERTEX_FORMAT_FLOAT) {
+      result->vertex_data = vertices.data();
+    } else {
+      result->encoded_vertices = encode_vertices(
+          format, vertices, result->bounds_min, result->bounds_max);
+      result->vertex_data = result->encoded_vertices.data();
+    }
+
+    if (result->index_type == GL_UNSIGNED_INT) {
+      result->index_data = indices.data();
+    } else {
+      result->encoded_indices = encode_indices(result->index_type, indices);
+      result->index_data = result->encoded_indices.data();
+    }
+
+    weld_report.vertex_stride = vertex_size(format);
+
+    if (format != VERTEX_FORMAT_FLOAT) {
+      loaded.quantization_error = measure_quantization_error(
+          vertices, result->bounds_min, result->bounds_max);
+    }
+
+    loaded.mesh = std::move(result);
 
+    return loaded;
+  }
+
+  void load_material_textures(aiMaterial* material, aiTextureType type,
+                              std::string type_name,
+                              std::vector<Texture>& textures,
+                              Texture_Reads& reads) {
     for (unsigned int i = 0; i < material->GetTextureCount(type); i++) {
       aiString str;
       material->GetTexture(type, i, &str);
 
-      bool skip = false;
+      textures.push_back({0, type_name, str.C_Str()});
+      read_texture_file(str.C_Str(), reads);
+    }
+  }
 
-      for (unsigned int j = 0; j < loaded_textures.size(); j++) {
-        if (std::strcmp(loaded_textures[j].path.data(), str.C_Str()) == 0) {
-          textures.push_back(loaded_textures[j]);
-          skip = true;
-          break;
-        }
-      }
+  // GL thread: uploads one finished mesh. Textures that are not resident yet
+  // are bound as placeholders until resolve_placeholders() swaps them in.
+  void upload_mesh(Loaded_Mesh& loaded) {
+    const Mesh_Import& import = *loaded.mesh;
+    Texture_Cache& texture_cache = Texture_Cache::shared();
+    std::vector<Texture> textures = import.textures;
 
-      if (!skip) {
-        Texture texture;
-        texture.id = load_texture_from_file(str.C_Str(), this->directory);
-        texture.type = type_name;
-        texture.path = str.C_Str();
-        textures.push_back(texture);
-        loaded_textures.push_back(texture);
+    for (std::size_t i = 0; i < textures.size(); i++) {
+      unsigned int texture_ID = load_texture(textures[i]);
+      load_progress.textures_total++;
+
+      if (texture_cache.ready(texture_ID)) {
+        textures[i].id = texture_ID;
+        load_progress.textures_ready++;
+        continue;
       }
+
+      textures[i].id =
+          texture_cache.placeholder(placeholder_color(textures[i].type));
+      placeholders.push_back({meshes.size(), i, texture_ID});
     }
 
-    return textures;
+    meshes.push_back(Mesh(import.vertex_data, import.format,
+                          import.vertex_count, import.index_data,
+                          import.index_type, import.index_count, textures,
+                          import.bounds_min, import.bounds_max,
+                          arena_for(import.format)));
+
+    Mesh& mesh = meshes.back();
+    mesh.skinned = import.skinned;
+    mesh.meshlets = import.meshlets;
+    mesh.lods = import.lods;
+    mesh_imports.push_back(loaded.mesh);
+    mesh_indices.push_back(loaded.index);
+
+    if (loaded.imported) {
+      weld_reports.push_back(loaded.weld_report);
+      optimize_report.merge(loaded.optimize_report);
+      quantization_error.merge(loaded.quantization_error);
+    }
   }
-};
 
-unsigned int load_texture_from_file(const char* path,
-                                    const std::string& directory, bool gamma) {
-  std::string filename = std::string(path);
-  filename = directory + '/' + filename;
+  void resolve_placeholders() {
+    Texture_Cache& texture_cache = Texture_Cache::shared();
+    std::size_t kept = 0;
 
-  unsigned int texture_ID;
-  glGenTextures(1, &texture_ID);
+    for (const Placeholder& placeholder : placeholders) {
+      if (!texture_cache.ready(placeholder.texture_ID)) {
+        placeholders[kept++] = placeholder;
+        continue;
+      }
 
-  int width, height, n_components;
-  unsigned char* data =
-      stbi_load(filename.c_str(), &width, &height, &n_components, 0);
+      meshes[placeholder.mesh].textures[placeholder.slot].id =
+          placeholder.texture_ID;
+      load_progress.textures_ready++;
+    }
 
-  if (data) {
-    GLenum format;
+    placeholders.resize(kept);
+  }
 
-    if (n_components == 1) {
-      format = GL_RED;
-    } else if (n_components == 3) {
-      format = GL_RGB;
-    } else if (n_components == 4) {
-      format = GL_RGBA;
+  // Mid grey, a flat tangent-space normal, and black for the rest.
+  static uint32_t placeholder_color(std::string const& type_name) {
+    if (type_name == "texture_diffuse") {
+      return 0x808080ff;
     }
 
-    glBindTexture(GL_TEXTURE_2D, texture_ID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    if (type_name == "texture_normal") {
+      return 0x8080ffff;
+    }
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                    GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return 0x000000ff;
+  }
+
+  // Every reference taken here is held in loaded_textures and released by
+  // ~Model(). Uses the bytes the loading thread read, if any.
+  unsigned int load_texture(Texture const& texture) {
+    Texture_Cache& texture_cache = Texture_Cache::shared();
+    std::string filename = directory + '/' + texture.path;
+    auto file = texture_files.find(filename);
+    unsigned int texture_ID;
 
-    stbi_image_free(data);
-  } else {
-    std::cerr << "Texture failed to load at path: " << path << "\n";
-    stbi_image_free(data);
+    texture_kind kind = texture.type == "texture_normal"
+                            ? TEXTURE_KIND_NORMAL
+                            : TEXTURE_KIND_COLOR;
+    // Only colours are stored in sRGB; normal, specular and height maps
+    // are data. Decided here, so the cache key, the bake and the upload
+    // format all agree.
+    bool gamma = gamma_correction && texture.type == "texture_diffuse";
+
+    if (file != texture_files.end()) {
+      texture_ID = texture_cache.acquire(filename, gamma,
+                                         std::move(file->second.bytes),
+                                         file->second.io_ms, kind);
+      texture_files.erase(file);
+    } else {
+      texture_ID = texture_cache.acquire(filename, gamma, kind);
+    }
+
+    loaded_textures.push_back({texture_ID, texture.type, texture.path});
+
+    return texture_ID;
   }
+};
+
+// Synchronous load through the shared cache; the caller owns one reference.
+unsigned int load_texture_from_file(const char* path,
+                                    const std::string& directory, bool gamma) {
+  std::string filename = std::string(path);
+  filename = directory + '/' + filename;
+
+  Texture_Cache& texture_cache = Texture_Cache::shared();
+  unsigned int texture_ID = texture_cache.acquire(filename, gamma);
+  texture_cache.finish();
 
   return texture_ID;
 }
@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <iostream>
 
 #include <glad/glad.h>
@@ -8,18 +9,48 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "animation.hpp"
 #include "camera.hpp"
+#include "gl_resource.hpp"
 #include "shader.hpp"
 #include "model.hpp"
+#include "skinning.hpp"
+#include "uniform_block.hpp"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double x_pos, double y_pos);
 void scroll_callback(GLFWwindow* window, double x_offset, double y_offset);
 void process_input(GLFWwindow* window);
+void run(GLFWwindow* window);
+void release_gl_resources();
+void print_model_report(const Model& model);
 
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
+const bool USE_COMPACT_VERTICES = true;
+const bool USE_MESHLET_CULLING = true;
+
+// Load the model in the background, spending at most this long per frame on
+// GL uploads.
+const bool USE_ASYNC_LOADING = true;
+const double LOAD_BUDGET_MS = 2.0;
+
+// Load textures from block-compressed bakes with precomputed mips, baking
+// them next to the images on the first run.
+const bool USE_TEXTURE_BAKE = true;
+
+// Filter for every mip chain built on the CPU, baked or not.
+const mip_filter MIP_FILTER = MIP_FILTER_KAISER;
+
+// Rasterize the model's large meshes on the CPU as occluders and skip the
+// meshes they hide; keeps collision geometry for the occluders.
+const bool USE_OCCLUSION_CULLING = false;
+
+// How models with bones are posed. SKINNING_CPU needs the float vertex
+// format and GEOMETRY_RESIDENCY_KEEP.
+const skinning_mode SKINNING = SKINNING_GPU;
+
 Camera camera(glm::vec3(0.0f, 0.0f, 6.0f));
 bool first_mouse = true;
 float last_x = SCR_WIDTH / 2.0f;
@@ -62,9 +93,55 @@ int main() {
 
   glEnable(GL_DEPTH_TEST);
 
-  Shader backpack_shader("src/shader/model_loading.vs", "src/shader/model_loading.fs");
+  run(window);
+  release_gl_resources();
+
+  glfwTerminate();
+
+  return 0;
+}
+
+void run(GLFWwindow* window) {
+  Shader backpack_shader(USE_COMPACT_VERTICES
+                             ? "src/shader/model_loading_compact.vs"
+                             : "src/shader/model_loading.vs",
+                         "src/shader/model_loading.fs");
+
+  Texture_Bake_Options bake_options;
+  bake_options.enabled = USE_TEXTURE_BAKE;
+  bake_options.filter = MIP_FILTER;
+  Texture_Cache::shared().set_bake_options(bake_options);
+
+  Model_Options model_options;
+  model_options.use_arena = true;
+  model_options.compact_vertices = USE_COMPACT_VERTICES;
+  model_options.build_meshlets = USE_MESHLET_CULLING;
+  model_options.lod_count = 4;
+  model_options.async_load = USE_ASYNC_LOADING;
+  model_options.residency = USE_OCCLUSION_CULLING
+                                ? GEOMETRY_RESIDENCY_COLLISION
+                                : GEOMETRY_RESIDENCY_DROP;
+
+  Model backpack_model("data/backpack/backpack.obj", false, model_options);
+
+  if (!backpack_model.loading()) {
+    print_model_report(backpack_model);
+  }
+
+  float last_title_time = 0.0f;
 
-  Model backpack_model("data/backpack/backpack.obj");
+  std::vector<Animation_State> animation_states(1);
+  std::vector<glm::mat4> bone_palette;
+  Bone_Palette_Buffer bone_palette_buffer;
+  backpack_model.skinning = SKINNING;
+
+  Occlusion_Buffer occlusion_buffer;
+  Occlusion_Buffer* occlusion = nullptr;
+
+  // Draws the model's meshes grouped by texture when not meshlet culling.
+  Render_Queue render_queue;
+  render_queue.measure_unsorted = true;
+  Uniform_Block<Camera_Block> camera_block(UNIFORM_BLOCK_CAMERA);
 
   while (!glfwWindowShouldClose(window)) {
     float current_frame_time = static_cast<float>(glfwGetTime());
@@ -76,27 +153,148 @@ int main() {
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    if (backpack_model.loading() &&
+        !backpack_model.update_loading(LOAD_BUDGET_MS)) {
+      print_model_report(backpack_model);
+    }
+
     backpack_shader.use();
 
     glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
     glm::mat4 view = camera.get_view_matrix();
-    backpack_shader.set_uniform_mat4("projection", projection);
-    backpack_shader.set_uniform_mat4("view", view);
+    camera_block.set(&Camera_Block::projection, projection);
+    camera_block.set(&Camera_Block::view, view);
+    camera_block.set(&Camera_Block::view_pos, camera.position);
+    camera_block.upload();
 
     glm::mat4 model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(0.0f));
     model = glm::scale(model, glm::vec3(1.0f));
     backpack_shader.set_uniform_mat4("model", model);
 
-    backpack_model.draw(backpack_shader);
+    if (!backpack_model.loading() && backpack_model.skinned()) {
+      animate_instances(backpack_model.skeleton, backpack_model.animations,
+                        animation_states, delta_time, bone_palette);
+
+      if (SKINNING == SKINNING_GPU) {
+        bone_palette_buffer.upload(bone_palette);
+        bone_palette_buffer.bind(backpack_shader);
+      } else {
+        backpack_model.skin_on_cpu(bone_palette.data());
+      }
+    }
+
+    backpack_model.select_lods(view, model, camera.zoom, (float)SCR_HEIGHT);
+
+    if (USE_OCCLUSION_CULLING && !backpack_model.loading()) {
+      occlusion_buffer.clear();
+      backpack_model.add_occluders(occlusion_buffer, projection, view, model);
+      occlusion_buffer.rasterize();
+      occlusion = &occlusion_buffer;
+    }
+
+    if (USE_MESHLET_CULLING) {
+      backpack_model.draw_culled(backpack_shader, projection, view, model,
+                                 occlusion);
+    } else {
+      render_queue.clear();
+      backpack_model.submit(render_queue, backpack_shader, projection, view,
+                            model, occlusion);
+      render_queue.execute();
+    }
+
+    if (current_frame_time - last_title_time > 0.5f) {
+      char title[192];
+
+      if (backpack_model.loading()) {
+        std::snprintf(title, sizeof(title),
+                      "Model Loading - loading %.0f%% (%zu/%zu meshes)",
+                      backpack_model.load_progress.fraction() * 100.0f,
+                      backpack_model.load_progress.meshes_uploaded,
+                      backpack_model.load_progress.meshes_total);
+      } else {
+        std::snprintf(title, sizeof(title),
+                      "Model Loading - LOD %u, %zu/%zu meshes and %.0f%% of "
+                      "%zu meshlets culled, %zu state changes (%zu unsorted)",
+                      backpack_model.meshes.empty()
+                          ? 0u
+                          : backpack_model.meshes[0].current_lod,
+                      backpack_model.mesh_cull_stats.culled,
+                      backpack_model.mesh_cull_stats.tested,
+                      backpack_model.cull_stats.fraction_culled() * 100.0f,
+                      backpack_model.cull_stats.meshlets,
+                      render_queue.stats.state_changes(),
+                      render_queue.unsorted_stats.state_changes());
+      }
+
+      glfwSetWindowTitle(window, title);
+      last_title_time = current_frame_time;
+    }
 
+    Gl_Resources::shared().end_frame();
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
+}
 
-  glfwTerminate();
+// Everything owning GL objects is gone once run() returns; whatever is
+// still alive after the texture cache lets go of its textures leaked.
+void release_gl_resources() {
+  Texture_Cache::shared().evict_unused();
+  Texture_Cache::shared().clear_placeholders();
 
-  return 0;
+  Gl_Resources& resources = Gl_Resources::shared();
+  resources.flush();
+  resources.print_stats();
+  resources.print_leak_report();
+}
+
+void print_model_report(const Model& model) {
+  std::cout << "Loaded backpack in " << model.load_progress.done_ms << " ms"
+            << (model.loaded_from_cache ? " (mesh cache)\n" : "\n");
+  model.print_load_report();
+  print_texture_load_report(model.texture_timings);
+  Texture_Cache::shared().print_stats();
+  model.print_arena_stats();
+  model.print_memory_report();
+  model.print_lod_report();
+
+  std::size_t index_bytes = 0, wide_index_bytes = 0;
+
+  for (const Mesh& mesh : model.meshes) {
+    index_bytes += mesh.index_bytes();
+    wide_index_bytes += mesh.index_count * sizeof(unsigned int);
+  }
+
+  std::cout << "Index buffers: " << index_bytes / 1024 << " KiB ("
+            << wide_index_bytes / 1024 << " KiB as 32-bit)\n";
+
+  for (std::size_t i = 0; i < model.weld_reports.size(); i++) {
+    const Weld_Report& weld = model.weld_reports[i];
+    std::cout << "Mesh " << i << ": welded " << weld.vertices_before
+              << " -> " << weld.vertices_after << " vertices ("
+              << weld.bytes_saved() / 1024 << " KiB saved)\n";
+  }
+
+  const Mesh_Optimize_Report& optimized = model.optimize_report;
+
+  if (optimized.meshes > 0) {
+    std::cout << "Index optimization (" << optimized.milliseconds
+              << " ms): ACMR " << optimized.before.acmr() << " -> "
+              << optimized.after.acmr() << ", ATVR " << optimized.before.atvr()
+              << " -> " << optimized.after.atvr() << "\n";
+  }
+
+  const Quantization_Error& error = model.quantization_error;
+
+  if (error.vertex_count > 0) {
+    std::cout << "Vertex quantization error over " << error.vertex_count
+              << " vertices: position max " << error.max_position_error
+              << " mean " << error.mean_position_error << ", normal max "
+              << error.max_normal_error << " deg, tangent max "
+              << error.max_tangent_error << " deg, uv max "
+              << error.max_tex_coord_error << "\n";
+  }
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -147,39 +345,3 @@ void process_input(GLFWwindow* window) {
     camera.process_keyboard(RIGHT, delta_time);
   }
 }
-
-unsigned int load_texture(char const* path) {
-  unsigned int texture_ID;
-  glGenTextures(1, &texture_ID);
-
-  int width, height, n_components;
-  unsigned char* data = stbi_load(path, &width, &height, &n_components, 0);
-
-  if (data) {
-    GLenum format;
-
-    if (n_components == 1) {
-      format = GL_RED;
-    } else if (n_components == 3) {
-      format = GL_RGB;
-    } else if (n_components == 4) {
-      format = GL_RGBA;
-    }
-
-    glBindTexture(GL_TEXTURE_2D, texture_ID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    stbi_image_free(data);
-  } else {
-    std::cerr << "Texture failed to load at path: " << path << "\n";
-    stbi_image_free(data);
-  }
-
-  return texture_ID;
-}
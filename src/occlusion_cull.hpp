@@ -0,0 +1,635 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_CULL_SSE 1
+#endif
+
+#include <glm/glm.hpp>
+
+#include "frustum_cull.hpp"
+#include "thread_pool.hpp"
+
+// Masked software occlusion culling. A few large occluders are rasterized
+// on the CPU into a small depth buffer, and bounding boxes are tested
+// against it before their objects are submitted.
+//
+// The buffer is split into 8x4-pixel tiles. A tile does not store per-pixel
+// depths: it keeps a reference depth (the farthest depth of anything drawn
+// over the whole tile), plus a working layer of the pixels covered since
+// (a 32-bit coverage mask and their farthest depth). When the working layer
+// covers the whole tile it becomes the new reference. A triangle updates a
+// tile with its coverage mask, computed 4 pixels at a time, and its
+// farthest depth over the tile. Depths go from 0 (near) to 1 (far).
+//
+// A box is occluded when its nearest depth is behind the reference depth
+// of every tile its screen rectangle touches. Everything is conservative:
+// occluders crossing the near plane are skipped, and boxes crossing it are
+// never occluded.
+//
+// Nothing in here touches GL, so it all runs headless.
+
+const int OCCLUSION_TILE_WIDTH = 8;
+const int OCCLUSION_TILE_HEIGHT = 4;
+
+// How occluders are picked from the candidates (see select_occluders).
+struct Occluder_Options {
+  // Smallest projected bounding sphere radius, as a fraction of the
+  // viewport height; smaller occluders hide too little to pay for
+  // rasterizing them.
+  float min_screen_radius = 0.1f;
+  // Denser meshes are skipped: detail does not make a better occluder.
+  std::size_t max_triangles_per_occluder = 4096;
+  // Total triangles rasterized per frame, largest occluders first.
+  std::size_t triangle_budget = 32768;
+  std::size_t max_occluders = 64;
+};
+
+struct Occluder_Candidate {
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  std::size_t triangle_count;
+};
+
+// Per-frame counters; clear() resets them.
+struct Occlusion_Cull_Stats {
+  std::size_t occluders = 0;
+  std::size_t triangles = 0;
+  // Crossing the near plane, back-facing or off screen.
+  std::size_t triangles_rejected = 0;
+  std::size_t tested = 0;
+  std::size_t occluded = 0;
+
+  double setup_ms = 0.0;
+  double raster_ms = 0.0;
+  double test_ms = 0.0;
+
+  float fraction_occluded() const {
+    return tested ? (float)occluded / (float)tested : 0.0f;
+  }
+};
+
+// Ranks the candidates by projected size per triangle and returns the
+// indices of the ones to rasterize this frame. Candidate bounds are in the
+// space `view` expects (i.e. world space, or apply the model matrix first).
+inline std::vector<std::size_t> select_occluders(
+    const std::vector<Occluder_Candidate>& candidates,
+    const glm::mat4& projection, const glm::mat4& view,
+    const Occluder_Options& options = Occluder_Options()) {
+  std::vector<std::pair<float, std::size_t>> ranked;
+
+  for (std::size_t i = 0; i < candidates.size(); i++) {
+    const Occluder_Candidate& candidate = candidates[i];
+
+    if (candidate.triangle_count == 0 ||
+        candidate.triangle_count > options.max_triangles_per_occluder) {
+      continue;
+    }
+
+    glm::vec3 center = glm::vec3(
+        view * glm::vec4((candidate.bounds_min + candidate.bounds_max) * 0.5f,
+                         1.0f));
+    float radius =
+        glm::length(candidate.bounds_max - candidate.bounds_min) * 0.5f;
+    // Distance in front of the camera; an occluder around the camera
+    // covers the whole view.
+    float distance = std::max(-center.z - radius, 1e-3f);
+    float screen_radius = radius * projection[1][1] / distance * 0.5f;
+
+    if (screen_radius < options.min_screen_radius) {
+      continue;
+    }
+
+    ranked.push_back(
+        {screen_radius * screen_radius / candidate.triangle_count, i});
+  }
+
+  std::sort(ranked.begin(), ranked.end(),
+            [](const auto& a, const auto& b) { return a.first > b.first; });
+
+  std::vector<std::size_t> selected;
+  std::size_t triangles = 0;
+
+  for (const auto& [score, i] : ranked) {
+    if (selected.size() == options.max_occluders ||
+        triangles + candidates[i].triangle_count > options.triangle_budget) {
+      continue;
+    }
+
+    selected.push_back(i);
+    triangles += candidates[i].triangle_count;
+  }
+
+  return selected;
+}
+
+class Occlusion_Buffer {
+ public:
+  Occlusion_Cull_Stats stats;
+
+  // Skip back-facing occluder triangles; turn off for open, single-sided
+  // occluders such as wall quads seen from either side.
+  bool cull_backfaces = true;
+
+  cull_math math = CULL_MATH_SIMD;
+
+  // Rounded up to whole tiles; 320x192 is plenty for occlusion.
+  explicit Occlusion_Buffer(int width = 320, int height = 192)
+      : tiles_x((width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH),
+        tiles_y((height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT),
+        width(tiles_x * OCCLUSION_TILE_WIDTH),
+        height(tiles_y * OCCLUSION_TILE_HEIGHT) {
+    std::size_t tiles = static_cast<std::size_t>(tiles_x) * tiles_y;
+    reference_depth.resize(tiles);
+    layer_depth.resize(tiles);
+    layer_mask.resize(tiles);
+    clear();
+  }
+
+  int buffer_width() const { return width; }
+  int buffer_height() const { return height; }
+
+  // Starts a frame: empties the buffer, the queued triangles and the stats.
+  void clear() {
+    std::fill(reference_depth.begin(), reference_depth.end(), 1.0f);
+    std::fill(layer_depth.begin(), layer_depth.end(), 0.0f);
+    std::fill(layer_mask.begin(), layer_mask.end(), 0u);
+    triangles.clear();
+    stats = Occlusion_Cull_Stats();
+  }
+
+  // Queues the triangles of an occluder. `positions` holds `vertex_count`
+  // positions `stride` bytes apart; `clip` is projection * view * model.
+  void add_occluder(const glm::vec3* positions, std::size_t vertex_count,
+                    std::size_t stride, const unsigned int* indices,
+                    std::size_t index_count, const glm::mat4& clip) {
+    auto start = std::chrono::steady_clock::now();
+    const unsigned char* bytes =
+        reinterpret_cast<const unsigned char*>(positions);
+    screen.resize(vertex_count);
+
+    for (std::size_t i = 0; i < vertex_count; i++) {
+      const glm::vec3& position =
+          *reinterpret_cast<const glm::vec3*>(bytes + i * stride);
+      glm::vec4 v = clip * glm::vec4(position, 1.0f);
+
+      // Behind the near plane: marks the vertex unusable.
+      if (v.z < -v.w || v.w <= 1e-6f) {
+        screen[i] = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+        continue;
+      }
+
+      screen[i] = glm::vec4((v.x / v.w * 0.5f + 0.5f) * width,
+                            (v.y / v.w * 0.5f + 0.5f) * height,
+                            v.z / v.w * 0.5f + 0.5f, 1.0f);
+    }
+
+    for (std::size_t i = 0; i + 2 < index_count; i += 3) {
+      stats.triangles++;
+
+      if (!setup_triangle(screen[indices[i]], screen[indices[i + 1]],
+                          screen[indices[i + 2]])) {
+        stats.triangles_rejected++;
+      }
+    }
+
+    stats.occluders++;
+    stats.setup_ms += elapsed_ms(start);
+  }
+
+  // Rasterizes every queued triangle, in bands of tile rows on the shared
+  // thread pool (not from inside a pool job) when `parallel` is set.
+  void rasterize(bool parallel = true) {
+    auto start = std::chrono::steady_clock::now();
+
+    auto run = [&](std::size_t begin, std::size_t end) {
+      for (const Triangle& triangle : triangles) {
+        int row_begin = std::max<int>(triangle.tile_y0, begin);
+        int row_end = std::min<int>(triangle.tile_y1 + 1, end);
+
+        for (int ty = row_begin; ty < row_end; ty++) {
+          for (int tx = triangle.tile_x0; tx <= triangle.tile_x1; tx++) {
+            rasterize_tile(triangle, tx, ty);
+          }
+        }
+      }
+    };
+
+    if (parallel) {
+      Thread_Pool::shared().parallel_for(tiles_y, 4, run);
+    } else {
+      run(0, tiles_y);
+    }
+
+    triangles.clear();
+    stats.raster_ms += elapsed_ms(start);
+  }
+
+  // Whether the box (in the space `clip` maps from) is hidden by what has
+  // been rasterized.
+  bool occluded(const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+                const glm::mat4& clip) const {
+    float min_x = 1e30f, min_y = 1e30f, max_x = -1e30f, max_y = -1e30f;
+    float nearest = 1.0f;
+
+    // Corners as the clip-space centre plus or minus the clip-space axes.
+    glm::vec3 extent = (bounds_max - bounds_min) * 0.5f;
+    glm::vec4 center = clip * glm::vec4((bounds_min + bounds_max) * 0.5f, 1.0f);
+    glm::vec4 axes[3] = {clip[0] * extent.x, clip[1] * extent.y,
+                         clip[2] * extent.z};
+#ifdef OCCLUSION_CULL_SSE
+    if (math == CULL_MATH_SIMD) {
+      if (!screen_rect_simd(center, axes, min_x, min_y, max_x, max_y,
+                            nearest)) {
+        return false;
+      }
+    } else
+#endif
+    {
+      for (int corner = 0; corner < 8; corner++) {
+        glm::vec4 v = center + (corner & 1 ? axes[0] : -axes[0]) +
+                      (corner & 2 ? axes[1] : -axes[1]) +
+                      (corner & 4 ? axes[2] : -axes[2]);
+
+        if (v.z < -v.w || v.w <= 1e-6f) {
+          return false;
+        }
+
+        float inverse_w = 1.0f / v.w;
+        float x = (v.x * inverse_w * 0.5f + 0.5f) * width;
+        float y = (v.y * inverse_w * 0.5f + 0.5f) * height;
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+        nearest = std::min(nearest, v.z * inverse_w * 0.5f + 0.5f);
+      }
+    }
+
+    // Off screen: for frustum culling to decide.
+    if (max_x < 0.0f || max_y < 0.0f || min_x >= width || min_y >= height) {
+      return false;
+    }
+
+    int tx0 = std::max(0, (int)min_x / OCCLUSION_TILE_WIDTH);
+    int tx1 = std::min(tiles_x - 1, (int)max_x / OCCLUSION_TILE_WIDTH);
+    int ty0 = std::max(0, (int)min_y / OCCLUSION_TILE_HEIGHT);
+    int ty1 = std::min(tiles_y - 1, (int)max_y / OCCLUSION_TILE_HEIGHT);
+
+    for (int ty = ty0; ty <= ty1; ty++) {
+      const float* row = reference_depth.data() + ty * tiles_x;
+      int tx = tx0;
+#ifdef OCCLUSION_CULL_SSE
+      if (math == CULL_MATH_SIMD) {
+        __m128 depth = _mm_set1_ps(nearest);
+
+        for (; tx + 4 <= tx1 + 1; tx += 4) {
+          if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + tx), depth))) {
+            return false;
+          }
+        }
+      }
+#endif
+      for (; tx <= tx1; tx++) {
+        if (row[tx] >= nearest) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  // Clears visible[i] for the boxes still visible that are occluded, and
+  // counts them; boxes already culled are not tested.
+  void test_bounds(const Cull_Bounds& bounds, const glm::mat4& clip,
+                   std::vector<unsigned char>& visible,
+                   bool parallel = true) {
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<std::size_t> tested(0), hidden(0);
+    visible.resize(bounds.size(), 1);
+
+    auto run = [&](std::size_t begin, std::size_t end) {
+      std::size_t batch_tested = 0, batch_hidden = 0;
+
+      for (std::size_t i = begin; i < end; i++) {
+        if (!visible[i]) {
+          continue;
+        }
+
+        glm::vec3 center(bounds.center_x[i], bounds.center_y[i],
+                         bounds.center_z[i]);
+        glm::vec3 extent(bounds.extent_x[i], bounds.extent_y[i],
+                         bounds.extent_z[i]);
+        batch_tested++;
+
+        if (occluded(center - extent, center + extent, clip)) {
+          visible[i] = 0;
+          batch_hidden++;
+        }
+      }
+
+      tested += batch_tested;
+      hidden += batch_hidden;
+    };
+
+    if (parallel && bounds.size() > CULL_BATCH) {
+      Thread_Pool::shared().parallel_for(bounds.size(), CULL_BATCH, run);
+    } else {
+      run(0, bounds.size());
+    }
+
+    stats.tested += tested;
+    stats.occluded += hidden;
+    stats.test_ms += elapsed_ms(start);
+  }
+
+  // Reference depth of the tile holding pixel (x, y), for debugging views.
+  float tile_depth(int x, int y) const {
+    return reference_depth[(y / OCCLUSION_TILE_HEIGHT) * tiles_x +
+                           x / OCCLUSION_TILE_WIDTH];
+  }
+
+ private:
+  struct Triangle {
+    // Edge functions a * x + b * y + c, >= 0 inside.
+    float edge_a[3], edge_b[3], edge_c[3];
+    // Depth plane z = a * x + b * y + c, and the farthest vertex depth.
+    float depth_a, depth_b, depth_c, depth_max;
+    float min_x, min_y, max_x, max_y;
+    int tile_x0, tile_y0, tile_x1, tile_y1;
+  };
+
+  int tiles_x, tiles_y;
+  int width, height;
+  std::vector<float> reference_depth;
+  std::vector<float> layer_depth;
+  std::vector<uint32_t> layer_mask;
+  std::vector<Triangle> triangles;
+  std::vector<glm::vec4> screen;
+
+  static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  bool setup_triangle(glm::vec4 v0, glm::vec4 v1, glm::vec4 v2) {
+    if (v0.w < 0.0f || v1.w < 0.0f || v2.w < 0.0f) {
+      return false;
+    }
+
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+
+    if (area == 0.0f || (cull_backfaces && area < 0.0f)) {
+      return false;
+    }
+
+    if (area < 0.0f) {
+      std::swap(v1, v2);
+      area = -area;
+    }
+
+    Triangle triangle;
+    const glm::vec4* v[3] = {&v0, &v1, &v2};
+    triangle.min_x = std::max(0.0f, std::min({v0.x, v1.x, v2.x}));
+    triangle.min_y = std::max(0.0f, std::min({v0.y, v1.y, v2.y}));
+    triangle.max_x = std::min<float>(width, std::max({v0.x, v1.x, v2.x}));
+    triangle.max_y = std::min<float>(height, std::max({v0.y, v1.y, v2.y}));
+
+    if (triangle.min_x >= triangle.max_x || triangle.min_y >= triangle.max_y) {
+      return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+      const glm::vec4& a = *v[i];
+      const glm::vec4& b = *v[(i + 1) % 3];
+      triangle.edge_a[i] = a.y - b.y;
+      triangle.edge_b[i] = b.x - a.x;
+      triangle.edge_c[i] = a.x * b.y - b.x * a.y;
+    }
+
+    triangle.depth_a = ((v1.z - v0.z) * (v2.y - v0.y) -
+                        (v2.z - v0.z) * (v1.y - v0.y)) /
+                       area;
+    triangle.depth_b = ((v2.z - v0.z) * (v1.x - v0.x) -
+                        (v1.z - v0.z) * (v2.x - v0.x)) /
+                       area;
+    triangle.depth_c =
+        v0.z - triangle.depth_a * v0.x - triangle.depth_b * v0.y;
+    triangle.depth_max = std::max({v0.z, v1.z, v2.z});
+
+    triangle.tile_x0 = (int)triangle.min_x / OCCLUSION_TILE_WIDTH;
+    triangle.tile_x1 =
+        std::min(tiles_x - 1, (int)triangle.max_x / OCCLUSION_TILE_WIDTH);
+    triangle.tile_y0 = (int)triangle.min_y / OCCLUSION_TILE_HEIGHT;
+    triangle.tile_y1 =
+        std::min(tiles_y - 1, (int)triangle.max_y / OCCLUSION_TILE_HEIGHT);
+
+    triangles.push_back(triangle);
+    return true;
+  }
+
+  // Bit row * 8 + column is set for the tile's pixel centres inside.
+  static uint32_t coverage_scalar(const Triangle& triangle, float x0,
+                                  float y0) {
+    uint32_t mask = 0;
+
+    for (int row = 0; row < OCCLUSION_TILE_HEIGHT; row++) {
+      for (int column = 0; column < OCCLUSION_TILE_WIDTH; column++) {
+        float x = x0 + column + 0.5f, y = y0 + row + 0.5f;
+        bool inside = true;
+
+        for (int e = 0; e < 3; e++) {
+          inside = inside && triangle.edge_a[e] * x + triangle.edge_b[e] * y +
+                                     triangle.edge_c[e] >=
+                                 0.0f;
+        }
+
+        mask |= static_cast<uint32_t>(inside)
+                << (row * OCCLUSION_TILE_WIDTH + column);
+      }
+    }
+
+    return mask;
+  }
+
+#ifdef OCCLUSION_CULL_SSE
+  static uint32_t coverage_simd(const Triangle& triangle, float x0,
+                                float y0) {
+    const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 left = _mm_add_ps(_mm_set1_ps(x0), offsets);
+    __m128 right = _mm_add_ps(left, _mm_set1_ps(4.0f));
+    __m128 a[3], b[3], c[3];
+
+    for (int e = 0; e < 3; e++) {
+      a[e] = _mm_set1_ps(triangle.edge_a[e]);
+      b[e] = _mm_set1_ps(triangle.edge_b[e]);
+      c[e] = _mm_set1_ps(triangle.edge_c[e]);
+    }
+
+    uint32_t mask = 0;
+
+    for (int row = 0; row < OCCLUSION_TILE_HEIGHT; row++) {
+      __m128 y = _mm_set1_ps(y0 + row + 0.5f);
+      __m128 inside_left = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      __m128 inside_right = inside_left;
+
+      for (int e = 0; e < 3; e++) {
+        __m128 base = _mm_add_ps(_mm_mul_ps(b[e], y), c[e]);
+        inside_left = _mm_and_ps(
+            inside_left,
+            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[e], left), base), zero));
+        inside_right = _mm_and_ps(
+            inside_right,
+            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[e], right), base), zero));
+      }
+
+      uint32_t bits = _mm_movemask_ps(inside_left) |
+                      _mm_movemask_ps(inside_right) << 4;
+      mask |= bits << (row * OCCLUSION_TILE_WIDTH);
+    }
+
+    return mask;
+  }
+#endif
+
+#ifdef OCCLUSION_CULL_SSE
+  static float horizontal_min(__m128 v) {
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(v);
+  }
+
+  static float horizontal_max(__m128 v) {
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(v);
+  }
+
+  // The eight corners four at a time: one register per coordinate. False
+  // when a corner is behind the near plane.
+  bool screen_rect_simd(const glm::vec4& center, const glm::vec4* axes,
+                        float& min_x, float& min_y, float& max_x,
+                        float& max_y, float& nearest) const {
+    const __m128 sign_x = _mm_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f);
+    const __m128 sign_y = _mm_setr_ps(-1.0f, -1.0f, 1.0f, 1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 scale_x = _mm_set1_ps(0.5f * width);
+    const __m128 scale_y = _mm_set1_ps(0.5f * height);
+    __m128 lo_x = _mm_set1_ps(1e30f), lo_y = lo_x, lo_z = _mm_set1_ps(1.0f);
+    __m128 hi_x = _mm_set1_ps(-1e30f), hi_y = hi_x;
+    __m128 clipped = _mm_setzero_ps();
+
+    for (int half_box = 0; half_box < 2; half_box++) {
+      __m128 sign_z = _mm_set1_ps(half_box ? 1.0f : -1.0f);
+      __m128 v[4];
+
+      for (int c = 0; c < 4; c++) {
+        v[c] = _mm_add_ps(
+            _mm_add_ps(_mm_set1_ps(center[c]),
+                       _mm_mul_ps(sign_x, _mm_set1_ps(axes[0][c]))),
+            _mm_add_ps(_mm_mul_ps(sign_y, _mm_set1_ps(axes[1][c])),
+                       _mm_mul_ps(sign_z, _mm_set1_ps(axes[2][c]))));
+      }
+
+      clipped = _mm_or_ps(
+          clipped,
+          _mm_or_ps(_mm_cmplt_ps(v[2], _mm_sub_ps(_mm_setzero_ps(), v[3])),
+                    _mm_cmple_ps(v[3], _mm_set1_ps(1e-6f))));
+
+      __m128 inverse_w = _mm_div_ps(_mm_set1_ps(1.0f), v[3]);
+      __m128 x = _mm_mul_ps(
+          _mm_add_ps(_mm_mul_ps(v[0], inverse_w), _mm_set1_ps(1.0f)), scale_x);
+      __m128 y = _mm_mul_ps(
+          _mm_add_ps(_mm_mul_ps(v[1], inverse_w), _mm_set1_ps(1.0f)), scale_y);
+      __m128 z = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(v[2], inverse_w), half),
+                            half);
+
+      lo_x = _mm_min_ps(lo_x, x);
+      hi_x = _mm_max_ps(hi_x, x);
+      lo_y = _mm_min_ps(lo_y, y);
+      hi_y = _mm_max_ps(hi_y, y);
+      lo_z = _mm_min_ps(lo_z, z);
+    }
+
+    if (_mm_movemask_ps(clipped)) {
+      return false;
+    }
+
+    min_x = horizontal_min(lo_x);
+    max_x = horizontal_max(hi_x);
+    min_y = horizontal_min(lo_y);
+    max_y = horizontal_max(hi_y);
+    nearest = horizontal_min(lo_z);
+    return true;
+  }
+#endif
+
+  void rasterize_tile(const Triangle& triangle, int tx, int ty) {
+    std::size_t tile = static_cast<std::size_t>(ty) * tiles_x + tx;
+    float x0 = static_cast<float>(tx * OCCLUSION_TILE_WIDTH);
+    float y0 = static_cast<float>(ty * OCCLUSION_TILE_HEIGHT);
+
+    // Farthest depth of the triangle over the part of the tile inside its
+    // bounding box; the plane is linear, so it is at a corner.
+    float cx0 = std::max(x0, triangle.min_x);
+    float cy0 = std::max(y0, triangle.min_y);
+    float cx1 = std::min(x0 + OCCLUSION_TILE_WIDTH, triangle.max_x);
+    float cy1 = std::min(y0 + OCCLUSION_TILE_HEIGHT, triangle.max_y);
+    float depth = -1e30f;
+
+    for (float x : {cx0, cx1}) {
+      for (float y : {cy0, cy1}) {
+        depth = std::max(depth, triangle.depth_a * x + triangle.depth_b * y +
+                                    triangle.depth_c);
+      }
+    }
+
+    depth = std::min(depth, triangle.depth_max);
+
+    // Hidden behind the whole tile already: nothing to learn.
+    if (depth >= reference_depth[tile]) {
+      return;
+    }
+
+    uint32_t mask;
+#ifdef OCCLUSION_CULL_SSE
+    if (math == CULL_MATH_SIMD) {
+      mask = coverage_simd(triangle, x0, y0);
+    } else
+#endif
+    {
+      mask = coverage_scalar(triangle, x0, y0);
+    }
+
+    if (!mask) {
+      return;
+    }
+
+    // A triangle much nearer than the working layer starts a new one: the
+    // old layer would only hold the merged depth back.
+    if (layer_depth[tile] - depth > reference_depth[tile] - layer_depth[tile]) {
+      layer_depth[tile] = 0.0f;
+      layer_mask[tile] = 0;
+    }
+
+    layer_depth[tile] = std::max(layer_depth[tile], depth);
+    layer_mask[tile] |= mask;
+
+    if (layer_mask[tile] == 0xffffffffu) {
+      reference_depth[tile] = layer_depth[tile];
+      layer_depth[tile] = 0.0f;
+      layer_mask[tile] = 0;
+    }
+  }
+};
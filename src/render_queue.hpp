@@ -0,0 +1,370 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "instancing.hpp"
+#include "mesh.hpp"
+#include "shader.hpp"
+#include "skinning.hpp"
+
+// Draws submitted in any order, executed sorted by a 64-bit key so that
+// items sharing a program, material and VAO run back to back, and with
+// every bind or uniform that would not change GL state skipped.
+//
+//   opaque:      pass:2 | program:10 | material:14 | VAO:14 | depth:24
+//   transparent: pass:2 | ~depth:24  | program:10 | material:14 | VAO:14
+//
+// Opaque items go front to back inside each state group, which helps early
+// depth rejection; transparent ones strictly back to front, as blending
+// needs, and only group state between items at the same depth. Programs,
+// materials and VAOs get dense ids per frame; ids beyond a field's width
+// wrap, which only costs sort quality, never correctness.
+
+enum render_pass { RENDER_PASS_OPAQUE, RENDER_PASS_TRANSPARENT };
+
+const int SORT_KEY_PROGRAM_BITS = 10;
+const int SORT_KEY_MATERIAL_BITS = 14;
+const int SORT_KEY_VERTEX_ARRAY_BITS = 14;
+const int SORT_KEY_DEPTH_BITS = 24;
+
+// The top bits of a non-negative float order the same way as the float,
+// with finer steps close to the camera.
+inline std::uint64_t quantize_sort_depth(float depth) {
+  depth = depth > 0.0f ? depth : 0.0f;
+  std::uint32_t bits;
+  std::memcpy(&bits, &depth, sizeof(bits));
+
+  return bits >> (32 - SORT_KEY_DEPTH_BITS);
+}
+
+inline std::uint64_t make_sort_key(render_pass pass, std::uint32_t program,
+                                   std::uint32_t material,
+                                   std::uint32_t vertex_array, float depth) {
+  std::uint64_t p = program & ((1u << SORT_KEY_PROGRAM_BITS) - 1);
+  std::uint64_t m = material & ((1u << SORT_KEY_MATERIAL_BITS) - 1);
+  std::uint64_t v = vertex_array & ((1u << SORT_KEY_VERTEX_ARRAY_BITS) - 1);
+  std::uint64_t d = quantize_sort_depth(depth);
+  std::uint64_t key = (std::uint64_t)pass << 62;
+
+  if (pass == RENDER_PASS_TRANSPARENT) {
+    d = ((1u << SORT_KEY_DEPTH_BITS) - 1) - d;
+    return key | d << 38 | p << 28 | m << 14 | v;
+  }
+
+  return key | p << 52 | m << 38 | v << 24 | d;
+}
+
+struct Sort_Entry {
+  std::uint64_t key;
+  std::uint32_t index;
+};
+
+// Stable LSD radix sort of `entries` by key, a byte per pass. Passes where
+// every key has the same byte are skipped, so keys using few distinct
+// programs or materials cost fewer passes. `scratch` is reused storage.
+inline void radix_sort(std::vector<Sort_Entry>& entries,
+                       std::vector<Sort_Entry>& scratch) {
+  std::size_t count = entries.size();
+  std::size_t histograms[8][256] = {};
+  scratch.resize(count);
+
+  for (const Sort_Entry& entry : entries) {
+    for (int byte = 0; byte < 8; byte++) {
+      histograms[byte][(entry.key >> (byte * 8)) & 0xff]++;
+    }
+  }
+
+  for (int byte = 0; byte < 8; byte++) {
+    std::size_t* histogram = histograms[byte];
+    std::uint64_t any_key = count ? entries[0].key : 0;
+
+    if (histogram[(any_key >> (byte * 8)) & 0xff] == count) {
+      continue;
+    }
+
+    std::size_t offset = 0;
+
+    for (int bucket = 0; bucket < 256; bucket++) {
+      std::size_t bucket_count = histogram[bucket];
+      histogram[bucket] = offset;
+      offset += bucket_count;
+    }
+
+    for (const Sort_Entry& entry : entries) {
+      scratch[histogram[(entry.key >> (byte * 8)) & 0xff]++] = entry;
+    }
+
+    entries.swap(scratch);
+  }
+}
+
+// A mesh draw with the state it needs. The "model" uniform is set from
+// `model` unless `instances` is given, in which case the mesh is drawn
+// once per instance with "instanced" set.
+struct Draw_Item {
+  Shader* shader = nullptr;
+  Mesh* mesh = nullptr;
+  glm::mat4 model = glm::mat4(1.0f);
+  Instance_Buffer* instances = nullptr;
+  // Sets the model shaders' "skinned" uniform.
+  bool skinned = false;
+  render_pass pass = RENDER_PASS_OPAQUE;
+  // View-space distance, e.g. to the mesh's bounds centre.
+  float depth = 0.0f;
+};
+
+// Counts for one execute(). Uniforms are those the queue itself sets.
+struct Render_Queue_Stats {
+  std::size_t items = 0;
+  std::size_t program_binds = 0;
+  std::size_t vertex_array_binds = 0;
+  std::size_t texture_binds = 0;
+  std::size_t uniform_updates = 0;
+  double sort_ms = 0.0;
+
+  std::size_t state_changes() const {
+    return program_binds + vertex_array_binds + texture_binds +
+           uniform_updates;
+  }
+};
+
+class Render_Queue {
+ public:
+  // The last execute(), and what the same items would have cost drawn in
+  // submission order (with the same redundant-bind filtering), when
+  // measure_unsorted is set.
+  Render_Queue_Stats stats;
+  Render_Queue_Stats unsorted_stats;
+  bool measure_unsorted = false;
+
+  std::size_t size() const { return items.size(); }
+
+  void clear() {
+    items.clear();
+    materials.clear();
+    entries.clear();
+    program_ids.clear();
+    material_ids.clear();
+    vertex_array_ids.clear();
+  }
+
+  void submit(const Draw_Item& item) {
+    std::uint64_t hash = material_hash(*item.mesh);
+    std::uint32_t program = dense_id(program_ids, item.shader->ID);
+    std::uint32_t material = dense_id(material_ids, hash);
+    std::uint32_t vertex_array = dense_id(vertex_array_ids, item.mesh->VAO);
+
+    entries.push_back({make_sort_key(item.pass, program, material,
+                                     vertex_array, item.depth),
+                       static_cast<std::uint32_t>(items.size())});
+    items.push_back(item);
+    materials.push_back(hash);
+  }
+
+  // Sorts and draws everything submitted since clear(). GL state is
+  // tracked from scratch on every call, so callers may change it freely
+  // between frames; afterwards no VAO is bound and unit 0 is active.
+  void execute() {
+    unsorted_stats = Render_Queue_Stats();
+
+    if (measure_unsorted) {
+      replay(unsorted_stats, false);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    radix_sort(entries, scratch);
+    stats = Render_Queue_Stats();
+    stats.sort_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+    replay(stats, true);
+
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+ private:
+  std::vector<Draw_Item> items;
+  // material_hash() of each item's mesh.
+  std::vector<std::uint64_t> materials;
+  std::vector<Sort_Entry> entries, scratch;
+  std::unordered_map<std::uint64_t, std::uint32_t> program_ids;
+  std::unordered_map<std::uint64_t, std::uint32_t> material_ids;
+  std::unordered_map<std::uint64_t, std::uint32_t> vertex_array_ids;
+
+  static std::uint32_t dense_id(
+      std::unordered_map<std::uint64_t, std::uint32_t>& ids,
+      std::uint64_t value) {
+    return ids.emplace(value, static_cast<std::uint32_t>(ids.size()))
+        .first->second;
+  }
+
+  // FNV-1a over the texture names, in unit order.
+  static std::uint64_t material_hash(const Mesh& mesh) {
+    std::uint64_t hash = 14695981039346656037ull;
+
+    for (const Texture& texture : mesh.textures) {
+      hash = (hash ^ texture.id) * 1099511628211ull;
+    }
+
+    return hash;
+  }
+
+  // Walks the items in `entries` order, counting (and with `issue`, making)
+  // only the GL calls that change state.
+  void replay(Render_Queue_Stats& counts, bool issue) {
+    unsigned int program = 0;
+    unsigned int vertex_array = 0;
+    std::vector<unsigned int> textures;
+    // Per program: reset whenever it changes.
+    bool material_set = false, model_set = false;
+    std::uint64_t material = 0;
+    glm::mat4 model;
+    int skinned = -1;
+    int instanced = -1;
+    // Of the current program; -1 where it lacks the uniform.
+    Uniform_Handle model_uniform, instanced_uniform, skinned_uniform;
+    counts.items = items.size();
+
+    for (const Sort_Entry& entry : entries) {
+      const Draw_Item& item = items[entry.index];
+      Shader& shader = *item.shader;
+      Mesh& mesh = *item.mesh;
+
+      if (shader.ID != program) {
+        program = shader.ID;
+        material_set = model_set = false;
+        skinned = instanced = -1;
+        model_uniform = shader.uniform("model"_uniform);
+        instanced_uniform = shader.uniform("instanced"_uniform);
+        skinned_uniform = shader.uniform("skinned"_uniform);
+        counts.program_binds++;
+
+        if (issue) {
+          shader.use();
+          // Never leave the palette sampler aliasing a 2D texture unit.
+          shader.set_uniform_int(shader.uniform("bone_palette"_uniform),
+                                 BONE_PALETTE_TEXTURE_UNIT);
+        }
+      }
+
+      if (item.instances && issue) {
+        item.instances->upload();
+
+        if (item.instances->attach(mesh.vertex_array_id())) {
+          vertex_array = 0;
+        }
+      }
+
+      if (mesh.VAO != vertex_array) {
+        vertex_array = mesh.VAO;
+        counts.vertex_array_binds++;
+
+        if (issue) {
+          glBindVertexArray(vertex_array);
+        }
+      }
+
+      if (!material_set || materials[entry.index] != material) {
+        material_set = true;
+        material = materials[entry.index];
+        bind_material(shader, mesh, textures, counts, issue);
+      }
+
+      if (!item.instances && model_uniform.location >= 0 &&
+          (!model_set ||
+           std::memcmp(&item.model, &model, sizeof(model)) != 0)) {
+        model_set = true;
+        model = item.model;
+        counts.uniform_updates++;
+
+        if (issue) {
+          shader.set_uniform_mat4(model_uniform, model);
+        }
+      }
+
+      if (instanced_uniform.location >= 0 &&
+          instanced != (item.instances != nullptr)) {
+        instanced = item.instances != nullptr;
+        counts.uniform_updates++;
+
+        if (issue) {
+          shader.set_uniform_bool(instanced_uniform, instanced);
+        }
+      }
+
+      if (skinned_uniform.location >= 0 && skinned != item.skinned) {
+        skinned = item.skinned;
+        counts.uniform_updates++;
+
+        if (issue) {
+          shader.set_uniform_bool(skinned_uniform, skinned);
+        }
+      }
+
+      if (mesh.format != VERTEX_FORMAT_FLOAT) {
+        counts.uniform_updates += 2;
+
+        if (issue) {
+          mesh.set_vertex_uniforms(shader);
+        }
+      }
+
+      if (!issue) {
+        continue;
+      }
+
+      if (item.instances) {
+        mesh.draw_elements_instanced(item.instances->size());
+      } else {
+        mesh.draw_elements();
+      }
+    }
+  }
+
+  // Points the samplers at units 0.. and binds only the units whose
+  // texture differs from the one already there.
+  void bind_material(Shader& shader, const Mesh& mesh,
+                     std::vector<unsigned int>& bound,
+                     Render_Queue_Stats& counts, bool issue) {
+    const std::vector<Uniform_Handle>* samplers = nullptr;
+
+    if (issue) {
+      samplers = &mesh.sampler_uniforms(shader);
+    }
+
+    if (bound.size() < mesh.textures.size()) {
+      bound.resize(mesh.textures.size(), 0);
+    }
+
+    for (unsigned int i = 0; i < mesh.textures.size(); i++) {
+      counts.uniform_updates++;
+
+      if (issue) {
+        shader.set_sampler((*samplers)[i], i);
+      }
+
+      if (bound[i] == mesh.textures[i].id) {
+        continue;
+      }
+
+      bound[i] = mesh.textures[i].id;
+      counts.texture_binds++;
+
+      if (issue) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, bound[i]);
+      }
+    }
+  }
+};
@@ -1,13 +1,69 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "gl_resource.hpp"
+#include "uniform_block.hpp"
+
+// FNV-1a, 32 bits. Shader reflects its active uniforms into a table keyed
+// by this hash, so setting a uniform by name needs no driver lookup.
+constexpr std::uint32_t hash_uniform_name(std::string_view name) {
+  std::uint32_t hash = 2166136261u;
+
+  for (char c : name) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+  }
+
+  return hash;
+}
+
+// A uniform name and its hash. Literals hash at compile time when written
+// as "view"_uniform; plain strings convert implicitly and hash at run time.
+struct Uniform_Name {
+  std::uint32_t hash;
+  std::string_view text;
+
+  constexpr Uniform_Name(std::string_view name)
+      : hash(hash_uniform_name(name)), text(name) {}
+  constexpr Uniform_Name(const char* name)
+      : Uniform_Name(std::string_view(name)) {}
+  Uniform_Name(const std::string& name)
+      : Uniform_Name(std::string_view(name)) {}
+};
+
+consteval Uniform_Name operator""_uniform(const char* name,
+                                          std::size_t length) {
+  return Uniform_Name(std::string_view(name, length));
+}
+
+// A location looked up once with Shader::uniform(); -1 when the program
+// has no such active uniform, which the set_uniform_* calls ignore.
+struct Uniform_Handle {
+  int location = -1;
+};
+
+// One active uniform. Arrays get an entry for the whole array ("bones")
+// and one per element ("bones[3]"). The name tells apart uniforms whose
+// hashes collide.
+struct Uniform_Info {
+  std::uint32_t hash;
+  std::string name;
+  int location;
+  GLenum type;
+  int size;
+};
+
 class Shader {
 public:
   unsigned int ID;
@@ -56,7 +112,9 @@ public:
     glCompileShader(fragment_shader);
     check_error(fragment_shader, "FRAGMENT");
 
-    ID = glCreateProgram();
+    program = Gl_Program::create(std::string(vertex_shader_path) + " + " +
+                                 fragment_shader_path);
+    ID = program.get();
     glAttachShader(ID, vertex_shader);
     glAttachShader(ID, fragment_shader);
     glLinkProgram(ID);
@@ -64,65 +122,221 @@ public:
 
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
+
+    bind_uniform_blocks(ID);
+    reflect_uniforms();
   }
 
   void use() {
     glUseProgram(ID);
   }
 
-  void set_uniform_bool(const std::string& name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+  // Looks `name` up without the debug check below, for uniforms that only
+  // some of the programs sharing a code path have.
+  Uniform_Handle uniform(Uniform_Name name) const {
+    const Uniform_Info* info = find_uniform(name);
+
+    return {info ? info->location : -1};
   }
 
-  void set_uniform_int(const std::string& name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+  bool has_uniform(Uniform_Name name) const {
+    return find_uniform(name) != nullptr;
   }
 
-  void set_uniform_float(const std::string& name, float value) const {
-  glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+  const std::vector<Uniform_Info>& active_uniforms() const {
+    return uniforms;
   }
 
-  void set_uniform_vec2(const std::string& name, const glm::vec2& value) const {
-    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+  // Each setter takes a Uniform_Name (or anything converting to one: a
+  // literal, "name"_uniform, std::string) or a Uniform_Handle.
+  template <typename Key>
+  void set_uniform_bool(const Key& key, bool value) const {
+    glUniform1i(location(key), (int)value);
   }
 
-  void set_uniform_vec2(const std::string& name, float x, float y) const {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+  template <typename Key>
+  void set_uniform_int(const Key& key, int value) const {
+    glUniform1i(location(key), value);
   }
 
-  void set_uniform_vec3(const std::string& name, const glm::vec3& value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+  template <typename Key>
+  void set_uniform_float(const Key& key, float value) const {
+    glUniform1f(location(key), value);
   }
 
-  void set_uniform_vec3(const std::string& name, float x, float y, float z) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+  template <typename Key>
+  void set_uniform_vec2(const Key& key, const glm::vec2& value) const {
+    glUniform2fv(location(key), 1, &value[0]);
   }
 
-  void set_uniform_vec4(const std::string& name, const glm::vec4& value) const {
-    glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+  template <typename Key>
+  void set_uniform_vec2(const Key& key, float x, float y) const {
+    glUniform2f(location(key), x, y);
   }
 
-  void set_uniform_vec4(const std::string& name, float x, float y, float z, float w) const {
-    glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+  template <typename Key>
+  void set_uniform_vec3(const Key& key, const glm::vec3& value) const {
+    glUniform3fv(location(key), 1, &value[0]);
   }
 
-  void set_uniform_mat2(const std::string& name, const glm::mat2& mat) const {
-    glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+  template <typename Key>
+  void set_uniform_vec3(const Key& key, float x, float y, float z) const {
+    glUniform3f(location(key), x, y, z);
   }
 
-  void set_uniform_mat3(const std::string& name, const glm::mat3& mat) const {
-    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+  template <typename Key>
+  void set_uniform_vec4(const Key& key, const glm::vec4& value) const {
+    glUniform4fv(location(key), 1, &value[0]);
   }
 
-  void set_uniform_mat4(const std::string& name, const glm::mat4& mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+  template <typename Key>
+  void set_uniform_vec4(const Key& key, float x, float y, float z,
+                        float w) const {
+    glUniform4f(location(key), x, y, z, w);
+  }
+
+  template <typename Key>
+  void set_uniform_mat2(const Key& key, const glm::mat2& mat) const {
+    glUniformMatrix2fv(location(key), 1, GL_FALSE, &mat[0][0]);
+  }
+
+  template <typename Key>
+  void set_uniform_mat3(const Key& key, const glm::mat3& mat) const {
+    glUniformMatrix3fv(location(key), 1, GL_FALSE, &mat[0][0]);
+  }
+
+  template <typename Key>
+  void set_uniform_mat4(const Key& key, const glm::mat4& mat) const {
+    glUniformMatrix4fv(location(key), 1, GL_FALSE, &mat[0][0]);
+  }
+
+  // Points a sampler at texture `unit`, skipping the call when it already
+  // is. Only valid if that sampler is never set any other way. Returns
+  // whether the uniform was set.
+  bool set_sampler(Uniform_Handle handle, int unit) {
+    if (handle.location < 0) {
+      return false;
+    }
+
+    if ((std::size_t)handle.location >= sampler_units.size()) {
+      sampler_units.resize(handle.location + 1, -1);
+    }
+
+    if (sampler_units[handle.location] == unit) {
+      return false;
+    }
+
+    sampler_units[handle.location] = unit;
+    glUniform1i(handle.location, unit);
+    return true;
   }
 
+  // Stays unique after the program is deleted, unlike ID.
+  Gl_Object_ID object_id() const { return program.object_id(); }
+
+  // The program is otherwise deleted with the Shader.
   void delete_program() {
-    glDeleteProgram(ID);
+    program.reset();
+    ID = 0;
+    uniforms.clear();
+    sampler_units.clear();
   }
 
 private:
+  Gl_Program program;
+  // Sorted by hash; colliding names sit next to each other.
+  std::vector<Uniform_Info> uniforms;
+  // The unit each sampler was last set to by set_sampler(), by location;
+  // -1 if never.
+  std::vector<int> sampler_units;
+#ifndef NDEBUG
+  // Unknown names already reported, so each is reported once.
+  mutable std::vector<std::string> reported_names;
+#endif
+
+  static bool hash_less(const Uniform_Info& info, std::uint32_t hash) {
+    return info.hash < hash;
+  }
+
+  const Uniform_Info* find_uniform(Uniform_Name name) const {
+    auto it = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash,
+                               hash_less);
+
+    for (; it != uniforms.end() && it->hash == name.hash; ++it) {
+      if (it->name == name.text) {
+        return &*it;
+      }
+    }
+
+    return nullptr;
+  }
+
+  int location(Uniform_Name name) const {
+    const Uniform_Info* info = find_uniform(name);
+
+    if (info) {
+      return info->location;
+    }
+
+#ifndef NDEBUG
+    // Most likely misspelled; inactive (optimized out) uniforms land here
+    // too. Use uniform() for names not every program has.
+    if (ID && std::find(reported_names.begin(), reported_names.end(),
+                        name.text) == reported_names.end()) {
+      reported_names.emplace_back(name.text);
+      std::cerr << "ERROR::SHADER::UNKNOWN_UNIFORM\n"
+                << name.text << " is not an active uniform of program " << ID
+                << "\n\n";
+    }
+#endif
+
+    return -1;
+  }
+
+  static int location(Uniform_Handle handle) { return handle.location; }
+
+  void add_uniform(const std::string& name, GLenum type, int size) {
+    int location = glGetUniformLocation(ID, name.c_str());
+    std::uint32_t hash = hash_uniform_name(name);
+
+    if (location < 0 || find_uniform(name)) {
+      return;
+    }
+
+    auto it = std::lower_bound(uniforms.begin(), uniforms.end(), hash,
+                               hash_less);
+    uniforms.insert(it, {hash, name, location, type, size});
+  }
+
+  // Builds the table once after linking. Uniforms in blocks have no
+  // location and are skipped.
+  void reflect_uniforms() {
+    int count = 0, max_length = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<char> buffer(std::max(max_length, 1));
+
+    for (int i = 0; i < count; i++) {
+      GLsizei length = 0;
+      GLint size = 0;
+      GLenum type = 0;
+      glGetActiveUniform(ID, i, (GLsizei)buffer.size(), &length, &size, &type,
+                         buffer.data());
+      std::string name(buffer.data(), length);
+      add_uniform(name, type, size);
+
+      // Arrays are reported as "name[0]".
+      if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+        std::string base = name.substr(0, name.size() - 3);
+        add_uniform(base, type, size);
+
+        for (int element = 1; element < size; element++) {
+          add_uniform(base + "[" + std::to_string(element) + "]", type, 1);
+        }
+      }
+    }
+  }
+
   void check_error(unsigned int shader, std::string type) {
     int success;
     char info_log[1024];
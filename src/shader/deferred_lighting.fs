@@ -0,0 +1,174 @@
+#version 330 core
+
+out vec4 frag_color;
+
+// The same lights as lighting_object.fs, shaded from the G-buffer, see
+// deferred.hpp.
+struct Dir_Light {
+  vec3 direction;
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+};
+
+struct Spot_Light {
+  vec3 position;
+  float constant;
+  vec3 direction;
+  float linear;
+  vec3 ambient;
+  float quadratic;
+  vec3 diffuse;
+  float cut_off;
+  vec3 specular;
+  float outer_cut_off;
+};
+
+layout (std140) uniform Camera {
+  mat4 projection;
+  mat4 view;
+  vec3 view_pos;
+};
+
+layout (std140) uniform Lights {
+  Dir_Light dir_light;
+  Spot_Light spot_light;
+  ivec4 cluster_grid;
+  vec4 cluster_mapping;
+};
+
+uniform sampler2D g_albedo_specular;
+uniform sampler2D g_normal;
+uniform sampler2D g_depth;
+
+uniform mat4 inverse_view_projection;
+uniform float shininess;
+
+uniform samplerBuffer cluster_lights;
+uniform usamplerBuffer cluster_ranges;
+uniform usamplerBuffer cluster_light_indices;
+
+// What the G-buffer holds for one pixel.
+struct Surface {
+  vec3 position;
+  vec3 normal;
+  vec3 albedo;
+  vec3 specular;
+};
+
+vec3 octahedral_decode(vec2 e);
+vec3 calc_dir_light(Dir_Light light, Surface surface, vec3 view_dir);
+vec3 calc_cluster_light(int light, Surface surface, vec3 view_dir);
+vec3 calc_spot_light(Spot_Light light, Surface surface, vec3 view_dir);
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(g_depth, pixel, 0).r;
+
+  // Nothing was drawn here; keep the clear colour.
+  if (depth == 1.0) {
+    discard;
+  }
+
+  vec2 uv = gl_FragCoord.xy / vec2(textureSize(g_depth, 0));
+  vec4 world = inverse_view_projection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+  vec4 albedo_specular = texelFetch(g_albedo_specular, pixel, 0);
+
+  Surface surface;
+  surface.position = world.xyz / world.w;
+  vec2 encoded_normal = texelFetch(g_normal, pixel, 0).xy * 2.0 - 1.0;
+  surface.normal = octahedral_decode(encoded_normal);
+  surface.albedo = albedo_specular.rgb;
+  surface.specular = vec3(albedo_specular.a);
+
+  vec3 view_dir = normalize(view_pos - surface.position);
+  vec3 result = calc_dir_light(dir_light, surface, view_dir);
+
+  float view_depth = -(view * vec4(surface.position, 1.0)).z;
+  int slice = int(log(view_depth) * cluster_mapping.x + cluster_mapping.y);
+  ivec2 tile = ivec2(gl_FragCoord.xy * cluster_mapping.zw);
+  slice = clamp(slice, 0, cluster_grid.z - 1);
+  tile = clamp(tile, ivec2(0), cluster_grid.xy - 1);
+
+  int cluster = (slice * cluster_grid.y + tile.y) * cluster_grid.x + tile.x;
+  uvec2 range = texelFetch(cluster_ranges, cluster).xy;
+
+  for (uint i = 0u; i < range.y; i++) {
+    int light = int(texelFetch(cluster_light_indices, int(range.x + i)).x);
+    result += calc_cluster_light(light, surface, view_dir);
+  }
+
+  result += calc_spot_light(spot_light, surface, view_dir);
+
+  frag_color = vec4(result, 1.0);
+}
+
+vec3 octahedral_decode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+
+  return normalize(n);
+}
+
+vec3 calc_dir_light(Dir_Light light, Surface surface, vec3 view_dir) {
+  vec3 light_dir = normalize(-light.direction);
+
+  float diff = max(dot(surface.normal, light_dir), 0.0);
+
+  vec3 reflect_dir = reflect(-light_dir, surface.normal);
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), shininess);
+
+  return light.ambient * surface.albedo +
+         light.diffuse * diff * surface.albedo +
+         light.specular * spec * surface.specular;
+}
+
+vec3 calc_cluster_light(int light, Surface surface, vec3 view_dir) {
+  vec4 position_range = texelFetch(cluster_lights, light * 3);
+  vec4 color_inner = texelFetch(cluster_lights, light * 3 + 1);
+  vec4 direction_outer = texelFetch(cluster_lights, light * 3 + 2);
+
+  vec3 to_light = position_range.xyz - surface.position;
+  float distance = length(to_light);
+  vec3 light_dir = to_light / max(distance, 1e-4);
+
+  float diff = max(dot(surface.normal, light_dir), 0.0);
+
+  vec3 reflect_dir = reflect(-light_dir, surface.normal);
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), shininess);
+
+  float window = clamp(1.0 - pow(distance / position_range.w, 4.0), 0.0, 1.0);
+  float attenuation = window * window / (distance * distance + 1.0);
+
+  float theta = dot(-light_dir, direction_outer.xyz);
+  float epsilon = max(color_inner.w - direction_outer.w, 1e-4);
+  float intensity = clamp((theta - direction_outer.w) / epsilon, 0.0, 1.0);
+
+  return color_inner.rgb *
+         (diff * surface.albedo + spec * surface.specular) * attenuation *
+         intensity;
+}
+
+vec3 calc_spot_light(Spot_Light light, Surface surface, vec3 view_dir) {
+  vec3 light_dir = normalize(light.position - surface.position);
+
+  float diff = max(dot(surface.normal, light_dir), 0.0);
+
+  vec3 reflect_dir = reflect(-light_dir, surface.normal);
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), shininess);
+
+  float distance = length(light.position - surface.position);
+  float attenuation = 1.0 / (light.constant + light.linear * distance +
+                             light.quadratic * (distance * distance));
+
+  float theta = dot(light_dir, normalize(-light.direction));
+  float epsilon = light.cut_off - light.outer_cut_off;
+  float intensity = clamp((theta - light.outer_cut_off) / epsilon, 0.0, 1.0);
+
+  return (light.ambient * surface.albedo +
+          light.diffuse * diff * surface.albedo +
+          light.specular * spec * surface.specular) *
+         attenuation * intensity;
+}
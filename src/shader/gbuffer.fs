@@ -0,0 +1,36 @@
+#version 330 core
+
+in vec3 normal;
+in vec2 tex_coords;
+
+// See deferred.hpp.
+layout (location = 0) out vec4 albedo_specular;
+layout (location = 1) out vec2 encoded_normal;
+
+struct Material {
+  sampler2D diffuse;
+  sampler2D specular;
+};
+
+uniform Material material;
+
+// Folds the unit sphere onto the [-1, 1] square, the lower hemisphere onto
+// its corners.
+vec2 octahedral_encode(vec3 n) {
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+
+  if (n.z < 0.0) {
+    vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    n.xy = (1.0 - abs(n.yx)) * signs;
+  }
+
+  return n.xy;
+}
+
+void main() {
+  vec3 specular = texture(material.specular, tex_coords).rgb;
+
+  albedo_specular = vec4(texture(material.diffuse, tex_coords).rgb,
+                         dot(specular, vec3(1.0 / 3.0)));
+  encoded_normal = octahedral_encode(normalize(normal)) * 0.5 + 0.5;
+}
@@ -3,6 +3,7 @@
 in vec3 normal;
 in vec3 frag_pos;
 in vec2 tex_coords;
+in float view_depth;
 
 out vec4 frag_color;
 
@@ -12,51 +13,54 @@ struct Material {
   float shininess;
 };
 
+// Member order packs each float into the padding after a vec3; the C++
+// mirrors are in uniform_block.hpp.
 struct Dir_Light {
   vec3 direction;
-
   vec3 ambient;
   vec3 diffuse;
   vec3 specular;
 };
 
-struct Point_Light {
+struct Spot_Light {
   vec3 position;
-
   float constant;
+  vec3 direction;
   float linear;
-  float quadratic;
-
   vec3 ambient;
+  float quadratic;
   vec3 diffuse;
-  vec3 specular;
-};
-
-struct Spot_Light {
-  vec3 position;
-  vec3 direction;
   float cut_off;
+  vec3 specular;
   float outer_cut_off;
+};
 
-  float constant;
-  float linear;
-  float quadratic;
-
-  vec3 ambient;
-  vec3 diffuse;
-  vec3 specular;
+layout (std140) uniform Camera {
+  mat4 projection;
+  mat4 view;
+  vec3 view_pos;
 };
 
-#define N_POINT_LIGHTS 4
+layout (std140) uniform Lights {
+  Dir_Light dir_light;
+  Spot_Light spot_light;
+  ivec4 cluster_grid;
+  vec4 cluster_mapping;
+};
 
-uniform vec3 view_pos;
-uniform Dir_Light dir_light;
-uniform Point_Light point_lights[N_POINT_LIGHTS];
-uniform Spot_Light spot_light;
 uniform Material material;
 
+// Clustered lights, see light_clusters.hpp: three texels per light
+// (position and range, colour and inner cone cosine, direction and outer
+// cone cosine), and per froxel the offset and length of its list of light
+// indices.
+uniform samplerBuffer cluster_lights;
+uniform usamplerBuffer cluster_ranges;
+uniform usamplerBuffer cluster_light_indices;
+
 vec3 calc_dir_light(Dir_Light light, vec3 normal, vec3 view_dir);
-vec3 calc_point_light(Point_Light light, vec3 normal, vec3 frag_pos, vec3 view_dir);
+vec3 calc_cluster_light(int light, vec3 normal, vec3 view_dir,
+                        vec3 diffuse_color, vec3 specular_color);
 vec3 calc_spot_light(Spot_Light light, vec3 normal, vec3 frag_pos, vec3 view_dir);
 
 void main() {
@@ -65,8 +69,22 @@ void main() {
 
   vec3 result = calc_dir_light(dir_light, norm, view_dir);
 
-  for (int i = 0; i < N_POINT_LIGHTS; i++) {
-    result += calc_point_light(point_lights[i], norm, frag_pos, view_dir);
+  // The material is sampled once for all clustered lights.
+  vec3 diffuse_color = vec3(texture(material.diffuse, tex_coords));
+  vec3 specular_color = vec3(texture(material.specular, tex_coords));
+
+  int slice = int(log(view_depth) * cluster_mapping.x + cluster_mapping.y);
+  ivec2 tile = ivec2(gl_FragCoord.xy * cluster_mapping.zw);
+  slice = clamp(slice, 0, cluster_grid.z - 1);
+  tile = clamp(tile, ivec2(0), cluster_grid.xy - 1);
+
+  int cluster = (slice * cluster_grid.y + tile.y) * cluster_grid.x + tile.x;
+  uvec2 range = texelFetch(cluster_ranges, cluster).xy;
+
+  for (uint i = 0u; i < range.y; i++) {
+    int light = int(texelFetch(cluster_light_indices, int(range.x + i)).x);
+    result += calc_cluster_light(light, norm, view_dir, diffuse_color,
+                                 specular_color);
   }
 
   result += calc_spot_light(spot_light, norm, frag_pos, view_dir);
@@ -89,26 +107,33 @@ vec3 calc_dir_light(Dir_Light light, vec3 normal, vec3 view_dir) {
   return (ambient + diffuse + specular);
 }
 
-vec3 calc_point_light(Point_Light light, vec3 normal, vec3 frag_pos, vec3 view_dir) {
-  vec3 light_dir = normalize(light.position - frag_pos);
+vec3 calc_cluster_light(int light, vec3 normal, vec3 view_dir,
+                        vec3 diffuse_color, vec3 specular_color) {
+  vec4 position_range = texelFetch(cluster_lights, light * 3);
+  vec4 color_inner = texelFetch(cluster_lights, light * 3 + 1);
+  vec4 direction_outer = texelFetch(cluster_lights, light * 3 + 2);
+
+  vec3 to_light = position_range.xyz - frag_pos;
+  float distance = length(to_light);
+  vec3 light_dir = to_light / max(distance, 1e-4);
 
   float diff = max(dot(normal, light_dir), 0.0);
 
   vec3 reflect_dir = reflect(-light_dir, normal);
   float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
 
-  vec3 ambient = light.ambient * vec3(texture(material.diffuse, tex_coords));
-  vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, tex_coords));
-  vec3 specular = light.specular * spec * vec3(texture(material.specular, tex_coords));
+  // Inverse square falloff, windowed to reach 0 at the light's range so
+  // lights outside a froxel's list contribute nothing anyway.
+  float window = clamp(1.0 - pow(distance / position_range.w, 4.0), 0.0, 1.0);
+  float attenuation = window * window / (distance * distance + 1.0);
 
-  float distance = length(light.position - frag_pos);
-  float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+  // Point lights have an outer cosine of -2, which every direction passes.
+  float theta = dot(-light_dir, direction_outer.xyz);
+  float epsilon = max(color_inner.w - direction_outer.w, 1e-4);
+  float intensity = clamp((theta - direction_outer.w) / epsilon, 0.0, 1.0);
 
-  ambient *= attenuation;
-  diffuse *= attenuation;
-  specular *= attenuation;
-
-  return (ambient + diffuse + specular);
+  return color_inner.rgb * (diff * diffuse_color + spec * specular_color) *
+         attenuation * intensity;
 }
 
 vec3 calc_spot_light(Spot_Light light, vec3 normal, vec3 frag_pos, vec3 view_dir) {
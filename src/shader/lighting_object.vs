@@ -3,19 +3,29 @@
 layout (location = 0) in vec3 a_pos;
 layout (location = 1) in vec3 a_normal;
 layout (location = 2) in vec2 a_tex_coords;
+// Per instance, see instancing.hpp.
+layout (location = 8) in mat4 i_model;
+layout (location = 12) in mat3 i_normal_matrix;
 
 out vec3 normal;
 out vec3 frag_pos;
 out vec2 tex_coords;
+out float view_depth;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Shared with every program, see uniform_block.hpp.
+layout (std140) uniform Camera {
+  mat4 projection;
+  mat4 view;
+  vec3 view_pos;
+};
 
 void main() {
-  frag_pos = vec3(model * vec4(a_pos, 1.0));
-  normal = mat3(transpose(inverse(model))) * a_normal;
+  frag_pos = vec3(i_model * vec4(a_pos, 1.0));
+  normal = i_normal_matrix * a_normal;
   tex_coords = a_tex_coords;
 
-  gl_Position = projection * view * vec4(frag_pos, 1.0);
+  vec4 view_space = view * vec4(frag_pos, 1.0);
+  view_depth = -view_space.z;
+
+  gl_Position = projection * view_space;
 }
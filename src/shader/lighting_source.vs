@@ -1,11 +1,16 @@
 #version 330 core
 
 layout (location = 0) in vec3 a_pos;
+// Per instance, see instancing.hpp.
+layout (location = 8) in mat4 i_model;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Shared with every program, see uniform_block.hpp.
+layout (std140) uniform Camera {
+  mat4 projection;
+  mat4 view;
+  vec3 view_pos;
+};
 
 void main() {
-  gl_Position = projection * view * model * vec4(a_pos, 1.0);
+  gl_Position = projection * view * i_model * vec4(a_pos, 1.0);
 }
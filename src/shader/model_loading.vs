@@ -3,15 +3,57 @@
 layout (location = 0) in vec3 a_pos;
 layout (location = 1) in vec3 a_normal;
 layout (location = 2) in vec2 a_tex_coords;
+layout (location = 5) in ivec4 a_bone_IDs;
+layout (location = 6) in vec4 a_weights;
+// Per instance (see instancing.hpp), read while `instanced` is set.
+layout (location = 8) in mat4 i_model;
 
 out vec2 tex_coords;
 
+// Shared with every program, see uniform_block.hpp.
+layout (std140) uniform Camera {
+  mat4 projection;
+  mat4 view;
+  vec3 view_pos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform bool instanced;
+
+// Bone palette (see skinning.hpp): four texels per matrix, this instance's
+// bones start at matrix bone_offset.
+uniform bool skinned;
+uniform samplerBuffer bone_palette;
+uniform int bone_offset;
+
+mat4 bone_matrix(int bone) {
+  int texel = (bone_offset + bone) * 4;
+
+  return mat4(texelFetch(bone_palette, texel),
+              texelFetch(bone_palette, texel + 1),
+              texelFetch(bone_palette, texel + 2),
+              texelFetch(bone_palette, texel + 3));
+}
+
+// Weights sum to 1, or to 0 for a vertex that keeps its bind pose.
+mat4 skin_matrix() {
+  if (!skinned) {
+    return mat4(1.0);
+  }
+
+  float total = a_weights.x + a_weights.y + a_weights.z + a_weights.w;
+
+  return bone_matrix(a_bone_IDs.x) * a_weights.x +
+         bone_matrix(a_bone_IDs.y) * a_weights.y +
+         bone_matrix(a_bone_IDs.z) * a_weights.z +
+         bone_matrix(a_bone_IDs.w) * a_weights.w + mat4(1.0 - total);
+}
 
 void main() {
   tex_coords = a_tex_coords;
 
-  gl_Position = projection * view * model * vec4(a_pos, 1.0);
+  mat4 model_matrix = instanced ? i_model : model;
+
+  gl_Position = projection * view * model_matrix * skin_matrix() *
+                vec4(a_pos, 1.0);
 }
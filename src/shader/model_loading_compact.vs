@@ -0,0 +1,103 @@
+#version 330 core
+
+// Compact_Vertex layout: positions are unorm16 relative to the mesh bounds
+// (w holds the bitangent sign), normal and tangent are octahedral snorm16,
+// passed as raw integers. The decoding matches decode_compact_vertex() in
+// vertex.hpp.
+layout (location = 0) in vec4 a_pos;
+layout (location = 1) in vec4 a_normal_tangent;
+layout (location = 2) in vec2 a_tex_coords;
+layout (location = 5) in ivec4 a_bone_IDs;
+layout (location = 6) in vec4 a_weights;
+// Per instance (see instancing.hpp), read while `instanced` is set.
+layout (location = 8) in mat4 i_model;
+layout (location = 12) in mat3 i_normal_matrix;
+
+out vec2 tex_coords;
+// World space, for lit shaders.
+out vec3 frag_pos;
+out vec3 normal;
+out mat3 TBN;
+
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+// Shared with every program, see uniform_block.hpp.
+layout (std140) uniform Camera {
+  mat4 projection;
+  mat4 view;
+  vec3 view_pos;
+};
+
+uniform mat4 model;
+uniform bool instanced;
+
+// Bone palette (see skinning.hpp): four texels per matrix, this instance's
+// bones start at matrix bone_offset.
+uniform bool skinned;
+uniform samplerBuffer bone_palette;
+uniform int bone_offset;
+
+mat4 bone_matrix(int bone) {
+  int texel = (bone_offset + bone) * 4;
+
+  return mat4(texelFetch(bone_palette, texel),
+              texelFetch(bone_palette, texel + 1),
+              texelFetch(bone_palette, texel + 2),
+              texelFetch(bone_palette, texel + 3));
+}
+
+// Weights sum to 1, or to 0 for a vertex that keeps its bind pose.
+mat4 skin_matrix() {
+  if (!skinned) {
+    return mat4(1.0);
+  }
+
+  float total = a_weights.x + a_weights.y + a_weights.z + a_weights.w;
+
+  return bone_matrix(a_bone_IDs.x) * a_weights.x +
+         bone_matrix(a_bone_IDs.y) * a_weights.y +
+         bone_matrix(a_bone_IDs.z) * a_weights.z +
+         bone_matrix(a_bone_IDs.w) * a_weights.w + mat4(1.0 - total);
+}
+
+vec2 snorm16_to_float(vec2 value) {
+  return max(value / 32767.0, -1.0);
+}
+
+vec3 oct_decode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+
+  return normalize(n);
+}
+
+void main() {
+  vec3 position = position_offset + a_pos.xyz * position_scale;
+  vec3 object_normal = oct_decode(snorm16_to_float(a_normal_tangent.xy));
+  vec3 object_tangent = oct_decode(snorm16_to_float(a_normal_tangent.zw));
+  float bitangent_sign = a_pos.w < 0.5 ? -1.0 : 1.0;
+
+  tex_coords = a_tex_coords;
+
+  mat4 skin = skin_matrix();
+  mat4 world = (instanced ? i_model : model) * skin;
+  // Instances bring their normal matrix. `model` and the bones are assumed
+  // rigid or uniformly scaled, so their upper 3x3 transforms normals as
+  // well, without an inverse per vertex.
+  mat3 normal_matrix = (instanced ? i_normal_matrix : mat3(model)) *
+                       mat3(skin);
+
+  normal = normalize(normal_matrix * object_normal);
+  vec3 tangent = normalize(mat3(world) * object_tangent);
+  // Re-orthogonalized, as the quantized pair is only nearly perpendicular.
+  tangent = normalize(tangent - dot(tangent, normal) * normal);
+  TBN = mat3(tangent, cross(normal, tangent) * bitangent_sign, normal);
+
+  vec4 world_position = world * vec4(position, 1.0);
+  frag_pos = vec3(world_position);
+
+  gl_Position = projection * view * world_position;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "animation.hpp"
+#include "gl_resource.hpp"
+#include "shader.hpp"
+#include "thread_pool.hpp"
+#include "vertex.hpp"
+
+// Two ways to pose a skinned mesh with a bone palette (see animation.hpp):
+// on the GPU, where the vertex shader fetches the palette from a texture
+// buffer, or on the CPU, where the vertices are skinned here and uploaded
+// again. Both blend up to MAX_BONE_INFLUENCE matrices per vertex; a vertex
+// without weights keeps its bind pose.
+
+enum skinning_mode { SKINNING_GPU, SKINNING_CPU };
+
+// Texture unit the bone palette is bound to, clear of the material textures.
+const unsigned int BONE_PALETTE_TEXTURE_UNIT = 15;
+
+inline void skin_vertices_scalar(const Vertex* bind, const glm::mat4* palette,
+                                 Vertex* out, std::size_t begin,
+                                 std::size_t end) {
+  for (std::size_t i = begin; i < end; i++) {
+    const Vertex& vertex = bind[i];
+    float total = 0.0f;
+    glm::mat4 m(0.0f);
+
+    for (int k = 0; k < MAX_BONE_INFLUENCE; k++) {
+      const glm::mat4& bone = palette[vertex.m_bone_IDs[k]];
+      float weight = vertex.m_weights[k];
+      total += weight;
+
+      for (int column = 0; column < 4; column++) {
+        m[column] += bone[column] * weight;
+      }
+    }
+
+    // Weights sum to 1 or to 0; the latter keeps the bind pose.
+    for (int column = 0; column < 4; column++) {
+      m[column][column] += 1.0f - total;
+    }
+
+    out[i].position = glm::vec3(m * glm::vec4(vertex.position, 1.0f));
+    out[i].normal =
+        glm::normalize(glm::vec3(m * glm::vec4(vertex.normal, 0.0f)));
+    out[i].tangent = glm::vec3(m * glm::vec4(vertex.tangent, 0.0f));
+    out[i].bitangent = glm::vec3(m * glm::vec4(vertex.bitangent, 0.0f));
+  }
+}
+
+#ifdef ANIMATION_SSE
+inline __m128 skin_transform_sse(const __m128* m, const float* v, __m128 w) {
+  __m128 r = _mm_mul_ps(m[0], _mm_set1_ps(v[0]));
+  r = _mm_add_ps(r, _mm_mul_ps(m[1], _mm_set1_ps(v[1])));
+  r = _mm_add_ps(r, _mm_mul_ps(m[2], _mm_set1_ps(v[2])));
+  return _mm_add_ps(r, _mm_mul_ps(m[3], w));
+}
+
+inline void skin_store3_sse(float* out, __m128 value) {
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, value);
+  std::memcpy(out, lanes, 3 * sizeof(float));
+}
+
+// Each of the four matrix columns is one register; the weighted sum of the
+// bones is 16 multiply-adds per vertex.
+inline void skin_vertices_sse(const Vertex* bind, const glm::mat4* palette,
+                              Vertex* out, std::size_t begin,
+                              std::size_t end) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 identity[4] = {
+      _mm_setr_ps(1.0f, 0.0f, 0.0f, 0.0f), _mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f),
+      _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f), _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f)};
+
+  for (std::size_t i = begin; i < end; i++) {
+    const Vertex& vertex = bind[i];
+    __m128 m[4] = {zero, zero, zero, zero};
+    __m128 total = zero;
+
+    for (int k = 0; k < MAX_BONE_INFLUENCE; k++) {
+      const float* bone = &palette[vertex.m_bone_IDs[k]][0][0];
+      __m128 weight = _mm_set1_ps(vertex.m_weights[k]);
+      total = _mm_add_ps(total, weight);
+
+      for (int column = 0; column < 4; column++) {
+        m[column] = _mm_add_ps(
+            m[column], _mm_mul_ps(_mm_loadu_ps(bone + column * 4), weight));
+      }
+    }
+
+    __m128 rest = _mm_sub_ps(one, total);
+
+    for (int column = 0; column < 4; column++) {
+      m[column] = _mm_add_ps(m[column], _mm_mul_ps(identity[column], rest));
+    }
+
+    // The bones are affine, so the w lane of a transformed direction is 0.
+    __m128 normal = skin_transform_sse(m, &vertex.normal.x, zero);
+    normal = _mm_div_ps(normal, _mm_sqrt_ps(dot4_sse(normal, normal)));
+
+    skin_store3_sse(&out[i].position.x,
+                    skin_transform_sse(m, &vertex.position.x, one));
+    skin_store3_sse(&out[i].normal.x, normal);
+    skin_store3_sse(&out[i].tangent.x,
+                    skin_transform_sse(m, &vertex.tangent.x, zero));
+    skin_store3_sse(&out[i].bitangent.x,
+                    skin_transform_sse(m, &vertex.bitangent.x, zero));
+  }
+}
+#endif
+
+// Writes the posed position, normal, tangent and bitangent of bind[begin,
+// end) into out[begin, end); the other attributes of `out` are left alone.
+// Bone IDs must index into `palette`.
+inline void skin_vertices(const Vertex* bind, const glm::mat4* palette,
+                          Vertex* out, std::size_t begin, std::size_t end,
+                          animation_math math = ANIMATION_MATH_SIMD) {
+#ifdef ANIMATION_SSE
+  if (math == ANIMATION_MATH_SIMD) {
+    skin_vertices_sse(bind, palette, out, begin, end);
+    return;
+  }
+#endif
+  skin_vertices_scalar(bind, palette, out, begin, end);
+}
+
+// Skins a whole mesh in batches on the shared thread pool. `out` starts as
+// a copy of `bind` so its unskinned attributes are right.
+inline void skin_mesh(const std::vector<Vertex>& bind,
+                      const glm::mat4* palette, std::vector<Vertex>& out,
+                      animation_math math = ANIMATION_MATH_SIMD,
+                      bool parallel = true) {
+  if (out.size() != bind.size()) {
+    out = bind;
+  }
+
+  auto run = [&](std::size_t begin, std::size_t end) {
+    skin_vertices(bind.data(), palette, out.data(), begin, end, math);
+  };
+
+  if (parallel) {
+    Thread_Pool::shared().parallel_for(bind.size(), 4096, run);
+  } else {
+    run(0, bind.size());
+  }
+}
+
+// Bone palettes for GPU skinning: mat4s in a buffer texture (four RGBA32F
+// texels each), read with texelFetch by the model vertex shaders. Holding
+// every instance's palette in one buffer, instances differ only in the
+// `bone_offset` uniform. GL 3.3 guarantees 65536 texels, i.e. 16384
+// matrices; desktop drivers allow far more.
+class Bone_Palette_Buffer {
+ public:
+  Bone_Palette_Buffer()
+      : buffer(Gl_Buffer::create("bone palette buffer")),
+        texture(Gl_Texture::create("bone palette texture")) {}
+
+  // Replaces the palette. The old storage is orphaned, so frames still in
+  // flight keep reading their own copy.
+  void upload(const glm::mat4* matrices, std::size_t count) {
+    std::size_t bytes = count * sizeof(glm::mat4);
+    capacity = std::max(capacity, bytes);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer.get());
+    glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, matrices);
+
+    if (!attached) {
+      glBindTexture(GL_TEXTURE_BUFFER, texture.get());
+      glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer.get());
+      glBindTexture(GL_TEXTURE_BUFFER, 0);
+      attached = true;
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    matrix_count = count;
+  }
+
+  void upload(const std::vector<glm::mat4>& matrices) {
+    upload(matrices.data(), matrices.size());
+  }
+
+  // Binds the palette for `shader`, which must be in use; the instance's
+  // bones start at matrix `first_matrix`.
+  void bind(Shader& shader, std::size_t first_matrix = 0) const {
+    glActiveTexture(GL_TEXTURE0 + BONE_PALETTE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, texture.get());
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.set_uniform_int("bone_palette", BONE_PALETTE_TEXTURE_UNIT);
+    shader.set_uniform_int("bone_offset", static_cast<int>(first_matrix));
+  }
+
+  std::size_t size() const { return matrix_count; }
+
+ private:
+  Gl_Buffer buffer;
+  Gl_Texture texture;
+  std::size_t capacity = 0;
+  std::size_t matrix_count = 0;
+  bool attached = false;
+};
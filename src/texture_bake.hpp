@@ -0,0 +1,532 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glad/glad.h>
+
+#include "mipmap.hpp"
+#include "texture_compress.hpp"
+
+// Not part of core GL 3.3; glad only defines them when generated with
+// EXT_texture_compression_s3tc / EXT_texture_sRGB.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// What a texture holds, which decides how it is baked: normal maps keep
+// only X and Y (BC5), so shaders sampling a baked normal map rebuild Z.
+enum texture_kind { TEXTURE_KIND_COLOR, TEXTURE_KIND_NORMAL };
+
+enum texture_bake_format {
+  TEXTURE_BAKE_RGBA8,
+  TEXTURE_BAKE_BC1,
+  TEXTURE_BAKE_BC3,
+  TEXTURE_BAKE_BC5
+};
+
+struct Texture_Bake_Options {
+  // Load textures from <file>.<variant>.texbake instead of decoding them.
+  bool enabled = false;
+  // Block-compress baked textures: BC1 for opaque colour, BC3 with alpha,
+  // BC5 for normal maps.
+  bool compress = true;
+  // Bake on a miss (the first run) and write the result next to the file.
+  bool write = true;
+  // Filter for the levels below the full-size image; the texture loader
+  // also uses it for the chains it builds for unbaked textures.
+  mip_filter filter = MIP_FILTER_BOX;
+
+  // What the context can sample; filled in by query_texture_compression().
+  // Without S3TC, colour textures are baked as RGBA8 (BC5 is core GL).
+  bool s3tc = false;
+  bool s3tc_srgb = false;
+};
+
+// Needs a current context.
+inline void query_texture_compression(Texture_Bake_Options& options) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  options.s3tc = options.s3tc_srgb = false;
+
+  for (GLint i = 0; i < count; i++) {
+    const char* name = reinterpret_cast<const char*>(
+        glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+
+    if (!name) {
+      continue;
+    }
+
+    if (std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0) {
+      options.s3tc = true;
+    } else if (std::strcmp(name, "GL_EXT_texture_sRGB") == 0) {
+      options.s3tc_srgb = true;
+    }
+  }
+
+  options.s3tc_srgb = options.s3tc && options.s3tc_srgb;
+}
+
+// Baked texture layout, all offsets relative to the start of the file:
+//
+//   Texture_Bake_Header
+//   Texture_Bake_Level[level_count]   (level 0 is the full-size image)
+//   level data                        (16-byte aligned, each level ready
+//                                      for glTexImage2D or
+//                                      glCompressedTexImage2D)
+//
+// Bump TEXTURE_BAKE_VERSION whenever the records, the mip filter or an
+// encoder change.
+const uint32_t TEXTURE_BAKE_MAGIC = 0x4b425854;  // "TXBK"
+const uint32_t TEXTURE_BAKE_VERSION = 2;
+
+// Bake variants; stored in (and checked against) the header.
+const uint32_t TEXTURE_BAKE_GAMMA = 1;
+const uint32_t TEXTURE_BAKE_NORMAL = 2;
+const uint32_t TEXTURE_BAKE_COMPRESS = 4;
+const uint32_t TEXTURE_BAKE_KAISER = 8;
+
+struct Texture_Bake_Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t level_count;
+  uint32_t reserved;
+  uint64_t source_hash;
+  uint64_t file_size;
+};
+
+struct Texture_Bake_Level {
+  uint64_t offset;
+  uint64_t bytes;
+  uint32_t width;
+  uint32_t height;
+};
+
+inline uint32_t texture_bake_flags(bool gamma, texture_kind kind,
+                                   const Texture_Bake_Options& options) {
+  return (gamma ? TEXTURE_BAKE_GAMMA : 0) |
+         (kind == TEXTURE_KIND_NORMAL ? TEXTURE_BAKE_NORMAL : 0) |
+         (options.compress ? TEXTURE_BAKE_COMPRESS : 0) |
+         (options.filter == MIP_FILTER_KAISER ? TEXTURE_BAKE_KAISER : 0);
+}
+
+// One file per variant, so linear and sRGB users of an image do not keep
+// rebaking each other's file.
+inline std::string texture_bake_path(const std::string& path,
+                                     uint32_t flags) {
+  std::string variant = flags & TEXTURE_BAKE_NORMAL  ? "normal"
+                        : flags & TEXTURE_BAKE_GAMMA ? "srgb"
+                                                     : "linear";
+
+  if (flags & TEXTURE_BAKE_KAISER) {
+    variant += "-kaiser";
+  }
+
+  if (!(flags & TEXTURE_BAKE_COMPRESS)) {
+    variant += "-rgba8";
+  }
+
+  return path + "." + variant + ".texbake";
+}
+
+inline bool texture_bake_block_format(texture_bake_format format,
+                                      block_format& block) {
+  switch (format) {
+    case TEXTURE_BAKE_BC1:
+      block = BLOCK_FORMAT_BC1;
+      return true;
+    case TEXTURE_BAKE_BC3:
+      block = BLOCK_FORMAT_BC3;
+      return true;
+    case TEXTURE_BAKE_BC5:
+      block = BLOCK_FORMAT_BC5;
+      return true;
+    default:
+      return false;
+  }
+}
+
+inline std::size_t texture_bake_level_bytes(texture_bake_format format,
+                                            int width, int height) {
+  block_format block;
+
+  if (texture_bake_block_format(format, block)) {
+    return compressed_image_bytes(block, width, height);
+  }
+
+  return static_cast<std::size_t>(width) * height * 4;
+}
+
+inline GLenum texture_bake_internal_format(texture_bake_format format,
+                                           bool gamma) {
+  switch (format) {
+    case TEXTURE_BAKE_BC1:
+      return gamma ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+                   : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TEXTURE_BAKE_BC3:
+      return gamma ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+                   : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TEXTURE_BAKE_BC5:
+      return GL_COMPRESSED_RG_RGTC2;
+    default:
+      return gamma ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+  }
+}
+
+// Whether the context can sample `format`; a bake that fails this (e.g.
+// copied from another machine) is baked again.
+inline bool texture_bake_supported(texture_bake_format format, bool gamma,
+                                   const Texture_Bake_Options& options) {
+  if (format == TEXTURE_BAKE_BC1 || format == TEXTURE_BAKE_BC3) {
+    return gamma ? options.s3tc_srgb : options.s3tc;
+  }
+
+  return true;
+}
+
+inline texture_bake_format choose_texture_bake_format(
+    const unsigned char* rgba, int width, int height, uint32_t flags,
+    const Texture_Bake_Options& options) {
+  if (!(flags & TEXTURE_BAKE_COMPRESS)) {
+    return TEXTURE_BAKE_RGBA8;
+  }
+
+  if (flags & TEXTURE_BAKE_NORMAL) {
+    return TEXTURE_BAKE_BC5;
+  }
+
+  bool gamma = flags & TEXTURE_BAKE_GAMMA;
+
+  if (!texture_bake_supported(TEXTURE_BAKE_BC1, gamma, options)) {
+    return TEXTURE_BAKE_RGBA8;
+  }
+
+  std::size_t texels = static_cast<std::size_t>(width) * height;
+
+  for (std::size_t i = 0; i < texels; i++) {
+    if (rgba[i * 4 + 3] != 255) {
+      return TEXTURE_BAKE_BC3;
+    }
+  }
+
+  return TEXTURE_BAKE_BC1;
+}
+
+// Builds the whole file for an RGBA8 image: the mip chain down to 1x1 (see
+// mipmap.hpp; filtered in linear light for sRGB variants and renormalized
+// for normal maps), each level encoded in `format`.
+inline std::vector<unsigned char> bake_texture(const unsigned char* rgba,
+                                               int width, int height,
+                                               uint64_t source_hash,
+                                               uint32_t flags,
+                                               texture_bake_format format) {
+  std::vector<Texture_Bake_Level> levels;
+  int level_width = width, level_height = height;
+
+  while (true) {
+    levels.push_back({0, texture_bake_level_bytes(format, level_width,
+                                                  level_height),
+                      static_cast<uint32_t>(level_width),
+                      static_cast<uint32_t>(level_height)});
+
+    if (level_width == 1 && level_height == 1) {
+      break;
+    }
+
+    level_width = std::max(level_width / 2, 1);
+    level_height = std::max(level_height / 2, 1);
+  }
+
+  uint64_t offset = (sizeof(Texture_Bake_Header) +
+                     levels.size() * sizeof(Texture_Bake_Level) + 15) &
+                    ~15ull;
+
+  for (Texture_Bake_Level& level : levels) {
+    level.offset = offset;
+    offset += (level.bytes + 15) & ~15ull;
+  }
+
+  Texture_Bake_Header header = {};
+  header.magic = TEXTURE_BAKE_MAGIC;
+  header.version = TEXTURE_BAKE_VERSION;
+  header.flags = flags;
+  header.format = format;
+  header.width = static_cast<uint32_t>(width);
+  header.height = static_cast<uint32_t>(height);
+  header.level_count = static_cast<uint32_t>(levels.size());
+  header.source_hash = source_hash;
+  header.file_size = offset;
+
+  std::vector<unsigned char> file(offset, 0);
+  std::memcpy(file.data(), &header, sizeof(header));
+  std::memcpy(file.data() + sizeof(header), levels.data(),
+              levels.size() * sizeof(Texture_Bake_Level));
+
+  Mip_Options mip_options;
+  mip_options.filter =
+      flags & TEXTURE_BAKE_KAISER ? MIP_FILTER_KAISER : MIP_FILTER_BOX;
+  mip_options.normal_map = flags & TEXTURE_BAKE_NORMAL;
+  mip_options.srgb = (flags & TEXTURE_BAKE_GAMMA) && !mip_options.normal_map;
+
+  std::vector<Mip_Level> mips;
+  generate_mip_chain(rgba, width, height, mip_options, mips);
+
+  block_format block;
+  bool compressed = texture_bake_block_format(format, block);
+
+  for (std::size_t i = 0; i < levels.size(); i++) {
+    const Texture_Bake_Level& level = levels[i];
+    const unsigned char* texels = i == 0 ? rgba : mips[i - 1].rgba.data();
+    unsigned char* out = file.data() + level.offset;
+
+    if (compressed) {
+      compress_image(block, texels, level.width, level.height, out);
+    } else {
+      std::memcpy(out, texels, level.bytes);
+    }
+  }
+
+  return file;
+}
+
+inline bool write_texture_bake(const std::string& path,
+                               const std::vector<unsigned char>& file) {
+  // Write to a temporary file first so a crash never leaves a truncated bake
+  // that passes the header check.
+  std::string temp_path = path + ".tmp";
+  std::FILE* out = std::fopen(temp_path.c_str(), "wb");
+
+  if (!out) {
+    std::cerr << "ERROR::TEXTURE_BAKE::WRITE_FAILED\n" << temp_path << "\n";
+    return false;
+  }
+
+  bool ok = std::fwrite(file.data(), 1, file.size(), out) == file.size();
+  ok = std::fclose(out) == 0 && ok;
+
+  if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::cerr << "ERROR::TEXTURE_BAKE::WRITE_FAILED\n" << path << "\n";
+    std::remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+// A baked texture, either memory-mapped from its file or freshly baked and
+// held in memory; either way the levels are uploaded straight out of it.
+class Texture_Bake {
+ public:
+  Texture_Bake() = default;
+  Texture_Bake(const Texture_Bake&) = delete;
+  Texture_Bake& operator=(const Texture_Bake&) = delete;
+
+  ~Texture_Bake() { close(); }
+
+  bool open(const std::string& path, uint64_t source_hash, uint32_t flags) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0 ||
+        file_stat.st_size < (off_t)sizeof(Texture_Bake_Header)) {
+      ::close(fd);
+      return false;
+    }
+
+    size = static_cast<std::size_t>(file_stat.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+      size = 0;
+      return false;
+    }
+
+    data = static_cast<const unsigned char*>(mapping);
+    mapped = true;
+
+    const Texture_Bake_Header& h = header();
+
+    if (h.magic != TEXTURE_BAKE_MAGIC || h.version != TEXTURE_BAKE_VERSION ||
+        h.flags != flags || h.source_hash != source_hash ||
+        h.file_size != size || !valid()) {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  // Takes a file image from bake_texture().
+  void adopt(std::vector<unsigned char> file) {
+    close();
+    owned = std::move(file);
+    data = owned.data();
+    size = owned.size();
+  }
+
+  void close() {
+    if (mapped) {
+      munmap(const_cast<unsigned char*>(data), size);
+    }
+
+    std::vector<unsigned char>().swap(owned);
+    data = nullptr;
+    size = 0;
+    mapped = false;
+  }
+
+  bool is_mapped() const { return mapped; }
+
+  const Texture_Bake_Header& header() const {
+    return *reinterpret_cast<const Texture_Bake_Header*>(data);
+  }
+
+  texture_bake_format format() const {
+    return static_cast<texture_bake_format>(header().format);
+  }
+
+  bool gamma() const { return header().flags & TEXTURE_BAKE_GAMMA; }
+
+  int level_count() const { return static_cast<int>(header().level_count); }
+
+  const Texture_Bake_Level& level(int i) const {
+    return reinterpret_cast<const Texture_Bake_Level*>(
+        data + sizeof(Texture_Bake_Header))[i];
+  }
+
+  const unsigned char* level_data(int i) const {
+    return data + level(i).offset;
+  }
+
+  // GPU bytes of the whole chain.
+  std::size_t texture_bytes() const {
+    std::size_t bytes = 0;
+
+    for (int i = 0; i < level_count(); i++) {
+      bytes += level(i).bytes;
+    }
+
+    return bytes;
+  }
+
+ private:
+  const unsigned char* data = nullptr;
+  std::size_t size = 0;
+  bool mapped = false;
+  std::vector<unsigned char> owned;
+
+  // Larger than any GL implementation's GL_MAX_TEXTURE_SIZE.
+  static const uint32_t MAX_SIZE = 1 << 16;
+
+  // The format is known and the levels form the chain bake_texture()
+  // writes: level 0 at the header's size, each next one halved down to
+  // 1x1, each holding exactly its image's bytes, 16-byte aligned, after the
+  // level table and the previous level and inside the file. Otherwise
+  // level_data() would hand GL pointers past the mapping.
+  bool valid() const {
+    const Texture_Bake_Header& h = header();
+
+    if (h.format > TEXTURE_BAKE_BC5 || h.width == 0 || h.height == 0 ||
+        h.width > MAX_SIZE || h.height > MAX_SIZE || h.level_count == 0 ||
+        h.level_count > 32 ||
+        sizeof(Texture_Bake_Header) +
+                h.level_count * sizeof(Texture_Bake_Level) >
+            size) {
+      return false;
+    }
+
+    uint32_t width = h.width, height = h.height;
+    uint64_t data_start = sizeof(Texture_Bake_Header) +
+                          h.level_count * sizeof(Texture_Bake_Level);
+
+    for (int i = 0; i < level_count(); i++) {
+      const Texture_Bake_Level& l = level(i);
+
+      if (l.width != width || l.height != height || l.offset % 16 != 0 ||
+          l.offset < data_start || l.offset > size ||
+          l.bytes > size - l.offset ||
+          l.bytes != texture_bake_level_bytes(format(), width, height)) {
+        return false;
+      }
+
+      data_start = l.offset + l.bytes;
+
+      width = std::max(width / 2, 1u);
+      height = std::max(height / 2, 1u);
+    }
+
+    const Texture_Bake_Level& last = level(level_count() - 1);
+    return last.width == 1 && last.height == 1;
+  }
+};
+
+// Sets the sampling state of a texture whose levels arrive one at a time
+// through upload_texture_bake_level(), coarsest first.
+inline void begin_texture_bake_upload(unsigned int texture_ID,
+                                      const Texture_Bake& bake) {
+  glBindTexture(GL_TEXTURE_2D, texture_ID);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                  bake.level_count() - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Uploads one level without any decoding and makes it the base level, so
+// the texture is complete after every call.
+inline void upload_texture_bake_level(unsigned int texture_ID,
+                                      const Texture_Bake& bake, int i) {
+  const Texture_Bake_Level& level = bake.level(i);
+  GLenum internal_format =
+      texture_bake_internal_format(bake.format(), bake.gamma());
+
+  glBindTexture(GL_TEXTURE_2D, texture_ID);
+
+  if (bake.format() == TEXTURE_BAKE_RGBA8) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, i, internal_format, level.width,
+                 level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 bake.level_data(i));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  } else {
+    glCompressedTexImage2D(GL_TEXTURE_2D, i, internal_format, level.width,
+                           level.height, 0, static_cast<GLsizei>(level.bytes),
+                           bake.level_data(i));
+  }
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, i);
+}
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "gl_resource.hpp"
+#include "hash.hpp"
+#include "texture_loader.hpp"
+
+struct Texture_Cache_Stats {
+  std::size_t path_hits = 0;
+  std::size_t content_hits = 0;
+  std::size_t misses = 0;
+  std::size_t evictions = 0;
+  std::size_t resident_textures = 0;
+  std::size_t resident_bytes = 0;
+};
+
+// Process-wide texture cache. Textures are looked up first by normalized path
+// and then by a hash of the file contents, so the same image reached through
+// different paths (or copied under another name) is decoded and uploaded once.
+// Every acquire() takes a reference that must be balanced by release();
+// unreferenced textures stay resident until evict_unused() is called.
+//
+// All methods must be called on the GL thread.
+class Texture_Cache {
+ public:
+  static Texture_Cache& shared() {
+    static Texture_Cache cache;
+    return cache;
+  }
+
+  Texture_Cache(const Texture_Cache&) = delete;
+  Texture_Cache& operator=(const Texture_Cache&) = delete;
+
+  static std::string normalize_path(const std::string& path) {
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(path, error);
+
+    if (error) {
+      absolute = path;
+    }
+
+    return absolute.lexically_normal().generic_string();
+  }
+
+  // Returns the texture for `path`, queueing a decode on a miss. The GL name
+  // is valid immediately; its pixels arrive with upload_ready() / finish().
+  unsigned int acquire(const std::string& path, bool gamma = false,
+                       texture_kind kind = TEXTURE_KIND_COLOR) {
+    std::string key = path_key(normalize_path(path), gamma, kind);
+
+    if (unsigned int texture_ID = acquire_by_path(key)) {
+      return texture_ID;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<unsigned char> bytes;
+
+    if (!read_file_bytes(path, bytes)) {
+      bytes.clear();
+    }
+
+    double io_ms = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+    return acquire_contents(path, key, gamma, kind, std::move(bytes), io_ms);
+  }
+
+  // Like acquire(path), for a file another thread has already read (empty
+  // `bytes` if that failed), so the GL thread does no file I/O. The bytes are
+  // dropped on a path hit.
+  unsigned int acquire(const std::string& path, bool gamma,
+                       std::vector<unsigned char> bytes, double io_ms,
+                       texture_kind kind = TEXTURE_KIND_COLOR) {
+    std::string key = path_key(normalize_path(path), gamma, kind);
+
+    if (unsigned int texture_ID = acquire_by_path(key)) {
+      return texture_ID;
+    }
+
+    return acquire_contents(path, key, gamma, kind, std::move(bytes), io_ms);
+  }
+
+  void acquire(unsigned int texture_ID) {
+    auto it = entries.find(texture_ID);
+
+    if (it != entries.end()) {
+      it->second.ref_count++;
+    }
+  }
+
+  void release(unsigned int texture_ID) {
+    auto it = entries.find(texture_ID);
+
+    if (it == entries.end() || it->second.ref_count == 0) {
+      std::cerr << "ERROR::TEXTURE_CACHE::RELEASE_UNREFERENCED\n"
+                << texture_ID << "\n";
+      return;
+    }
+
+    it->second.ref_count--;
+  }
+
+  // Deletes every texture nobody references any more. Returns the number of
+  // textures deleted.
+  std::size_t evict_unused() {
+    finish();
+
+    std::size_t evicted = 0;
+
+    for (auto it = entries.begin(); it != entries.end();) {
+      if (it->second.ref_count > 0) {
+        ++it;
+        continue;
+      }
+
+      for (const std::string& key : it->second.path_keys) {
+        by_path.erase(key);
+      }
+
+      auto content = by_content.find(it->second.content_hash);
+
+      if (content != by_content.end() && content->second == it->first) {
+        by_content.erase(content);
+      }
+
+      stats.resident_bytes -= it->second.bytes;
+
+      // Erasing the entry releases its texture.
+      it = entries.erase(it);
+      evicted++;
+    }
+
+    stats.evictions += evicted;
+
+    return evicted;
+  }
+
+  std::size_t upload_ready(
+      double budget_ms = std::numeric_limits<double>::infinity()) {
+    std::size_t uploaded = loader.upload_ready(budget_ms);
+    account_uploads();
+    return uploaded;
+  }
+
+  void finish() {
+    loader.finish();
+    account_uploads();
+  }
+
+  bool idle() { return loader.idle(); }
+
+  // Switches texture baking (texture_bake.hpp) on or off for textures
+  // requested from now on. Queries the context for the compressed formats
+  // it can sample, so call it on the GL thread.
+  void set_bake_options(const Texture_Bake_Options& options) {
+    loader.bake_options = options;
+    query_texture_compression(loader.bake_options);
+  }
+
+  // Builds the mip chains of unbaked textures on the loader's workers
+  // (mipmap.hpp) instead of with glGenerateMipmap.
+  void set_cpu_mips(bool enabled) { loader.cpu_mips = enabled; }
+
+  const Texture_Bake_Options& bake_options() const {
+    return loader.bake_options;
+  }
+
+  // Estimated GPU bytes of an uploaded texture, mip chain included.
+  std::size_t texture_bytes(unsigned int texture_ID) const {
+    auto it = entries.find(texture_ID);
+    return it == entries.end() ? 0 : it->second.bytes;
+  }
+
+  // Whether the texture's pixels have been uploaded (or its load failed).
+  bool ready(unsigned int texture_ID) const {
+    auto it = entries.find(texture_ID);
+    return it != entries.end() && it->second.uploaded;
+  }
+
+  // A 1x1 texture of `rgba` (0xRRGGBBAA) to bind while real textures are
+  // still loading. Placeholders live as long as the cache.
+  unsigned int placeholder(uint32_t rgba) {
+    auto it = placeholders.find(rgba);
+
+    if (it != placeholders.end()) {
+      return it->second.get();
+    }
+
+    unsigned char pixel[4] = {
+        static_cast<unsigned char>(rgba >> 24),
+        static_cast<unsigned char>(rgba >> 16),
+        static_cast<unsigned char>(rgba >> 8),
+        static_cast<unsigned char>(rgba)};
+
+    Gl_Texture texture = Gl_Texture::create("placeholder");
+    unsigned int texture_ID = texture.get();
+    upload_texture_image(texture_ID, pixel, 1, 1, 4);
+    placeholders[rgba] = std::move(texture);
+
+    return texture_ID;
+  }
+
+  // Releases every placeholder. Only for shutdown, once nothing draws with
+  // them any more.
+  void clear_placeholders() { placeholders.clear(); }
+
+  unsigned int ref_count(unsigned int texture_ID) const {
+    auto it = entries.find(texture_ID);
+    return it == entries.end() ? 0 : it->second.ref_count;
+  }
+
+  // Per-texture I/O / decode / upload timings, in upload order.
+  const std::vector<Texture_Load_Timing>& timings() const {
+    return loader.timings;
+  }
+
+  Texture_Cache_Stats get_stats() const {
+    Texture_Cache_Stats result = stats;
+    result.resident_textures = entries.size();
+    return result;
+  }
+
+  void print_stats(std::ostream& out = std::cout) const {
+    Texture_Cache_Stats current = get_stats();
+
+    out << "texture cache: " << current.resident_textures << " resident ("
+        << current.resident_bytes / (1024 * 1024) << " MiB), "
+        << current.path_hits << " path hits, " << current.content_hits
+        << " content hits, " << current.misses << " misses, "
+        << current.evictions << " evicted\n";
+  }
+
+ private:
+  struct Entry {
+    uint64_t content_hash = 0;
+    unsigned int ref_count = 0;
+    std::size_t bytes = 0;
+    bool uploaded = false;
+    std::vector<std::string> path_keys;
+    Gl_Texture texture;
+  };
+
+  Texture_Loader loader;
+  std::unordered_map<std::string, unsigned int> by_path;
+  std::unordered_map<uint64_t, unsigned int> by_content;
+  std::unordered_map<unsigned int, Entry> entries;
+  std::unordered_map<uint32_t, Gl_Texture> placeholders;
+  std::size_t accounted_uploads = 0;
+  Texture_Cache_Stats stats;
+
+  Texture_Cache() = default;
+
+  static std::string path_key(const std::string& path, bool gamma,
+                              texture_kind kind) {
+    std::string key = gamma ? path + "#srgb" : path;
+    return kind == TEXTURE_KIND_NORMAL ? key + "#normal" : key;
+  }
+
+  // Takes a reference on the texture already known under `key`; 0 if none.
+  unsigned int acquire_by_path(const std::string& key) {
+    auto path_it = by_path.find(key);
+
+    if (path_it == by_path.end()) {
+      return 0;
+    }
+
+    stats.path_hits++;
+    entries[path_it->second].ref_count++;
+    return path_it->second;
+  }
+
+  unsigned int acquire_contents(const std::string& path,
+                                const std::string& key, bool gamma,
+                                texture_kind kind,
+                                std::vector<unsigned char> bytes,
+                                double io_ms) {
+    uint64_t content_hash = fnv1a_64(bytes.data(), bytes.size());
+    content_hash = fnv1a_64(&gamma, sizeof(gamma), content_hash);
+    content_hash = fnv1a_64(&kind, sizeof(kind), content_hash);
+    bool unreadable = bytes.empty();
+    auto content_it =
+        unreadable ? by_content.end() : by_content.find(content_hash);
+
+    if (content_it != by_content.end()) {
+      stats.content_hits++;
+      Entry& entry = entries[content_it->second];
+      entry.ref_count++;
+      entry.path_keys.push_back(key);
+      by_path[key] = content_it->second;
+      return content_it->second;
+    }
+
+    stats.misses++;
+
+    unsigned int texture_ID = loader.request(path, std::move(bytes), io_ms,
+                                             gamma, kind);
+
+    Entry& entry = entries[texture_ID];
+    entry.texture = Gl_Texture(texture_ID, path);
+    entry.content_hash = content_hash;
+    entry.ref_count = 1;
+    entry.path_keys.push_back(key);
+
+    by_path[key] = texture_ID;
+
+    // Unreadable files all hash alike; each gets its own failed entry
+    // rather than aliasing the first one.
+    if (!unreadable) {
+      by_content[content_hash] = texture_ID;
+    }
+
+    return texture_ID;
+  }
+
+  void account_uploads() {
+    for (; accounted_uploads < loader.timings.size(); accounted_uploads++) {
+      const Texture_Load_Timing& timing = loader.timings[accounted_uploads];
+      auto it = entries.find(timing.texture_ID);
+
+      if (it == entries.end()) {
+        continue;
+      }
+
+      it->second.bytes = timing.gpu_bytes;
+      stats.resident_bytes += it->second.bytes;
+      it->second.uploaded = true;
+    }
+  }
+};
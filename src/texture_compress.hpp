@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Block compression into the BCn formats GPUs sample directly. Every 4x4
+// block of texels becomes 8 bytes (BC1) or 16 bytes (BC3, BC5):
+//
+//   BC1  RGB, two RGB565 endpoints and 2-bit indices    (4 bits per texel)
+//   BC3  BC1 colour plus a BC4 alpha block              (8 bits per texel)
+//   BC5  two BC4 blocks, for the X and Y of normal maps (8 bits per texel)
+//
+// The encoders fit each block's endpoints to its bounding box, inset by a
+// sixteenth of the range so the interpolated palette entries land inside the
+// texels' spread, then pick the nearest palette entry for every texel. This
+// is the fast end of BCn encoding; it is meant for a first-run bake, not for
+// offline-quality mastering.
+
+inline uint16_t pack_rgb565(const int* rgb) {
+  return static_cast<uint16_t>(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) |
+                               (rgb[2] >> 3));
+}
+
+inline void unpack_rgb565(uint16_t color, int* rgb) {
+  int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Reads the 4x4 block at (x, y) of an RGBA8 image as 16 RGBA texels,
+// repeating the last row and column for blocks hanging off the edge.
+inline void read_block_rgba8(const unsigned char* rgba, int width, int height,
+                             int x, int y, unsigned char* block) {
+  for (int j = 0; j < 4; j++) {
+    int row = std::min(y + j, height - 1);
+
+    for (int i = 0; i < 4; i++) {
+      int column = std::min(x + i, width - 1);
+      std::memcpy(block + (j * 4 + i) * 4,
+                  rgba + (static_cast<std::size_t>(row) * width + column) * 4,
+                  4);
+    }
+  }
+}
+
+// One colour block of 16 RGBA texels (alpha ignored), always in the
+// four-colour mode that BC3 also assumes.
+inline void encode_bc1_block(const unsigned char* block, unsigned char* out) {
+  int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+
+  for (int t = 0; t < 16; t++) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], (int)block[t * 4 + c]);
+      hi[c] = std::max(hi[c], (int)block[t * 4 + c]);
+    }
+  }
+
+  for (int c = 0; c < 3; c++) {
+    int inset = (hi[c] - lo[c]) >> 4;
+    lo[c] += inset;
+    hi[c] -= inset;
+  }
+
+  uint16_t color0 = pack_rgb565(hi), color1 = pack_rgb565(lo);
+  uint32_t indices = 0;
+
+  if (color0 < color1) {
+    std::swap(color0, color1);
+  }
+
+  // Equal endpoints would switch to the three-colour mode; every index 0
+  // is exact for them anyway.
+  if (color0 != color1) {
+    int palette[4][3];
+    unpack_rgb565(color0, palette[0]);
+    unpack_rgb565(color1, palette[1]);
+
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (int t = 0; t < 16; t++) {
+      int best = 0, best_distance = 1 << 30;
+
+      for (int p = 0; p < 4; p++) {
+        int distance = 0;
+
+        for (int c = 0; c < 3; c++) {
+          int d = block[t * 4 + c] - palette[p][c];
+          distance += d * d;
+        }
+
+        if (distance < best_distance) {
+          best = p;
+          best_distance = distance;
+        }
+      }
+
+      indices |= static_cast<uint32_t>(best) << (t * 2);
+    }
+  }
+
+  std::memcpy(out, &color0, 2);
+  std::memcpy(out + 2, &color1, 2);
+  std::memcpy(out + 4, &indices, 4);
+}
+
+// One single-channel block (BC4) of channel `channel` of 16 RGBA texels, in
+// the eight-value mode (a flat block has equal endpoints and all indices 0).
+inline void encode_bc4_block(const unsigned char* block, int channel,
+                             unsigned char* out) {
+  int lo = 255, hi = 0;
+
+  for (int t = 0; t < 16; t++) {
+    lo = std::min(lo, (int)block[t * 4 + channel]);
+    hi = std::max(hi, (int)block[t * 4 + channel]);
+  }
+
+  int inset = (hi - lo) >> 4;
+  lo += inset;
+  hi -= inset;
+
+  uint64_t indices = 0;
+
+  if (hi > lo) {
+    int palette[8] = {hi, lo};
+
+    for (int p = 2; p < 8; p++) {
+      palette[p] = ((8 - p) * hi + (p - 1) * lo) / 7;
+    }
+
+    for (int t = 0; t < 16; t++) {
+      int value = block[t * 4 + channel];
+      int best = 0, best_distance = 256;
+
+      for (int p = 0; p < 8; p++) {
+        int distance = std::abs(value - palette[p]);
+
+        if (distance < best_distance) {
+          best = p;
+          best_distance = distance;
+        }
+      }
+
+      indices |= static_cast<uint64_t>(best) << (t * 3);
+    }
+  }
+
+  out[0] = static_cast<unsigned char>(hi);
+  out[1] = static_cast<unsigned char>(lo);
+
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = static_cast<unsigned char>(indices >> (i * 8));
+  }
+}
+
+enum block_format { BLOCK_FORMAT_BC1, BLOCK_FORMAT_BC3, BLOCK_FORMAT_BC5 };
+
+inline std::size_t block_bytes(block_format format) {
+  return format == BLOCK_FORMAT_BC1 ? 8 : 16;
+}
+
+inline std::size_t compressed_image_bytes(block_format format, int width,
+                                          int height) {
+  std::size_t blocks_x = (std::max(width, 1) + 3) / 4;
+  std::size_t blocks_y = (std::max(height, 1) + 3) / 4;
+  return blocks_x * blocks_y * block_bytes(format);
+}
+
+// Compresses a whole RGBA8 image into `out`, blocks in row-major order as
+// glCompressedTexImage2D expects them. BC5 takes X from red and Y from
+// green.
+inline void compress_image(block_format format, const unsigned char* rgba,
+                           int width, int height, unsigned char* out) {
+  unsigned char block[64];
+
+  for (int y = 0; y < height; y += 4) {
+    for (int x = 0; x < width; x += 4) {
+      read_block_rgba8(rgba, width, height, x, y, block);
+
+      switch (format) {
+        case BLOCK_FORMAT_BC1:
+          encode_bc1_block(block, out);
+          break;
+        case BLOCK_FORMAT_BC3:
+          encode_bc4_block(block, 3, out);
+          encode_bc1_block(block, out + 8);
+          break;
+        case BLOCK_FORMAT_BC5:
+          encode_bc4_block(block, 0, out);
+          encode_bc4_block(block, 1, out + 8);
+          break;
+      }
+
+      out += block_bytes(format);
+    }
+  }
+}
@@ -0,0 +1,495 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include "hash.hpp"
+#include "texture_bake.hpp"
+#include "thread_pool.hpp"
+
+struct Texture_Load_Timing {
+  std::string path;
+  unsigned int texture_ID = 0;
+  int width = 0;
+  int height = 0;
+  int n_components = 0;
+  double io_ms = 0.0;
+  double decode_ms = 0.0;
+  double upload_ms = 0.0;
+  // Baked textures: time spent baking on a miss (0 when the bake was
+  // mapped), and whether a bake was used at all.
+  double bake_ms = 0.0;
+  bool baked = false;
+  // Building the mip chain on a worker (0 when the driver builds it).
+  double mip_ms = 0.0;
+  // Estimated for driver-built mip chains, exact otherwise.
+  std::size_t gpu_bytes = 0;
+};
+
+inline bool read_file_bytes(const std::string& path,
+                            std::vector<unsigned char>& bytes) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+
+  if (!file) {
+    return false;
+  }
+
+  std::fseek(file, 0, SEEK_END);
+  long size = std::ftell(file);
+  std::fseek(file, 0, SEEK_SET);
+
+  bytes.resize(size > 0 ? static_cast<std::size_t>(size) : 0);
+  bool ok = std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+  std::fclose(file);
+
+  return ok;
+}
+
+inline void print_texture_load_report(
+    const std::vector<Texture_Load_Timing>& timings,
+    std::ostream& out = std::cout) {
+  Texture_Load_Timing total;
+
+  out << "texture load breakdown (ms):\n";
+
+  for (const Texture_Load_Timing& timing : timings) {
+    const char* bake = !timing.baked          ? ""
+                       : timing.bake_ms > 0.0 ? "  (baked now)"
+                                              : "  (bake mapped)";
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "  %-48s %5dx%-5d io %8.2f  decode %8.2f  mips %8.2f  "
+                  "upload %8.2f%s\n",
+                  timing.path.c_str(), timing.width, timing.height,
+                  timing.io_ms, timing.decode_ms, timing.mip_ms,
+                  timing.upload_ms, bake);
+    out << line;
+
+    total.io_ms += timing.io_ms;
+    total.decode_ms += timing.decode_ms;
+    total.mip_ms += timing.mip_ms;
+    total.upload_ms += timing.upload_ms;
+    total.bake_ms += timing.bake_ms;
+    total.gpu_bytes += timing.gpu_bytes;
+  }
+
+  char line[256];
+  std::snprintf(line, sizeof(line),
+                "  total (%zu textures, %u workers): io %.2f  decode %.2f  "
+                "mips %.2f  upload %.2f  bake %.2f, %zu KiB on the GPU\n",
+                timings.size(), Thread_Pool::shared().size(), total.io_ms,
+                total.decode_ms, total.mip_ms, total.upload_ms, total.bake_ms,
+                total.gpu_bytes / 1024);
+  out << line;
+}
+
+// Uploads 8-bit pixels into an already generated texture name and builds the
+// mip chain.
+inline void upload_texture_image(unsigned int texture_ID,
+                                 const unsigned char* data, int width,
+                                 int height, int n_components) {
+  GLenum format = GL_RGBA;
+
+  if (n_components == 1) {
+    format = GL_RED;
+  } else if (n_components == 3) {
+    format = GL_RGB;
+  } else if (n_components == 4) {
+    format = GL_RGBA;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, texture_ID);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
+               GL_UNSIGNED_BYTE, data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glGenerateMipmap(GL_TEXTURE_2D);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Uploads an RGBA8 image and the levels below it from generate_mip_chain(),
+// as sRGB when `gamma` is set so the texture is sampled in linear light.
+inline void upload_texture_mips(unsigned int texture_ID,
+                                const unsigned char* data, int width,
+                                int height,
+                                const std::vector<Mip_Level>& mips,
+                                bool gamma) {
+  GLenum internal_format = gamma ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+
+  glBindTexture(GL_TEXTURE_2D, texture_ID);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                  static_cast<GLint>(mips.size()));
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, data);
+
+  for (std::size_t i = 0; i < mips.size(); i++) {
+    glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i + 1), internal_format,
+                 mips[i].width, mips[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 mips[i].rgba.data());
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Reads and decodes texture files on a worker pool while the GL thread keeps
+// ownership of every GL call. request() hands out the texture name right away
+// so meshes can reference it; the pixels are uploaded into it later by
+// upload_ready() / finish(), which drain the queue of decoded images.
+//
+// Unbaked textures get their mip chains from the workers too (mipmap.hpp),
+// filtered in linear light for gamma textures, unless cpu_mips is off.
+//
+// With bake_options.enabled, workers map the file's bake (texture_bake.hpp)
+// instead of decoding it, or decode and bake it on a miss. Baked textures
+// are uploaded one mip level at a time, coarsest first, so a large texture
+// can spread over several upload_ready() budgets.
+class Texture_Loader {
+ public:
+  std::vector<Texture_Load_Timing> timings;
+
+  // Read when a texture is requested; set before requesting.
+  Texture_Bake_Options bake_options;
+  bool cpu_mips = true;
+
+  explicit Texture_Loader(Thread_Pool& pool = Thread_Pool::shared())
+      : pool(pool) {}
+
+  Texture_Loader(const Texture_Loader&) = delete;
+  Texture_Loader& operator=(const Texture_Loader&) = delete;
+
+  ~Texture_Loader() { finish(); }
+
+  unsigned int request(const std::string& filename, bool gamma = false,
+                       texture_kind kind = TEXTURE_KIND_COLOR) {
+    return queue(filename, gamma, kind, [](Decoded_Image& image) {
+      auto start = std::chrono::steady_clock::now();
+      std::vector<unsigned char> bytes;
+      bool read = read_file_bytes(image.timing.path, bytes);
+      image.timing.io_ms = elapsed_ms(start);
+
+      if (read) {
+        load(image, bytes);
+      }
+    });
+  }
+
+  // Decodes a file the caller has already read, e.g. to hash its contents.
+  // io_ms is carried into the timing report as-is.
+  unsigned int request(const std::string& filename,
+                       std::vector<unsigned char> bytes, double io_ms,
+                       bool gamma = false,
+                       texture_kind kind = TEXTURE_KIND_COLOR) {
+    return queue(filename, gamma, kind,
+                 [bytes = std::move(bytes), io_ms](Decoded_Image& image) {
+                   image.timing.io_ms = io_ms;
+                   load(image, bytes);
+                 });
+  }
+
+  // Uploads the images decoded so far without blocking, stopping once
+  // `budget_ms` has been spent (after at least one upload, or one mip level
+  // of a baked texture). Returns the number of textures completed.
+  std::size_t upload_ready(
+      double budget_ms = std::numeric_limits<double>::infinity()) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t uploaded = 0;
+
+    while (true) {
+      Decoded_Image image;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (ready.empty()) {
+          break;
+        }
+
+        image = ready.front();
+        ready.pop_front();
+      }
+
+      if (!upload(image, start, budget_ms)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.push_front(image);
+        break;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending--;
+      }
+
+      uploaded++;
+
+      if (elapsed_ms(start) >= budget_ms) {
+        break;
+      }
+    }
+
+    return uploaded;
+  }
+
+  // Blocks until every requested texture has been decoded and uploaded.
+  void finish() {
+    while (true) {
+      std::deque<Decoded_Image> batch;
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (pending == 0) {
+          return;
+        }
+
+        image_ready.wait(lock, [this] { return !ready.empty(); });
+        batch.swap(ready);
+        pending -= batch.size();
+      }
+
+      for (Decoded_Image& image : batch) {
+        upload(image, std::chrono::steady_clock::now(),
+               std::numeric_limits<double>::infinity());
+      }
+    }
+  }
+
+  bool idle() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending == 0;
+  }
+
+ private:
+  struct Decoded_Image {
+    unsigned int texture_ID = 0;
+    unsigned char* data = nullptr;
+    bool gamma = false;
+    texture_kind kind = TEXTURE_KIND_COLOR;
+    Texture_Bake_Options bake_options;
+    bool cpu_mips = true;
+    Texture_Load_Timing timing;
+    // Levels below `data` when the worker built the chain.
+    std::shared_ptr<std::vector<Mip_Level>> mips;
+    // Set instead of `data` for baked textures; levels below next_level are
+    // still to be uploaded (-1 until the upload starts).
+    std::shared_ptr<Texture_Bake> bake;
+    int next_level = -1;
+  };
+
+  Thread_Pool& pool;
+  std::mutex mutex;
+  std::condition_variable image_ready;
+  std::deque<Decoded_Image> ready;
+  std::size_t pending = 0;
+
+  static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  static void decode(Decoded_Image& image,
+                     const std::vector<unsigned char>& bytes,
+                     int components = 0) {
+    auto start = std::chrono::steady_clock::now();
+    image.data = stbi_load_from_memory(
+        bytes.data(), static_cast<int>(bytes.size()), &image.timing.width,
+        &image.timing.height, &image.timing.n_components, components);
+    image.timing.decode_ms = elapsed_ms(start);
+
+    if (image.data && components) {
+      image.timing.n_components = components;
+    }
+  }
+
+  static void load(Decoded_Image& image,
+                   const std::vector<unsigned char>& bytes) {
+    if (!image.bake_options.enabled) {
+      decode(image, bytes, image.cpu_mips ? 4 : 0);
+
+      if (image.data && image.cpu_mips) {
+        build_mips(image);
+      }
+
+      return;
+    }
+
+    const Texture_Bake_Options& options = image.bake_options;
+    uint32_t flags = texture_bake_flags(image.gamma, image.kind, options);
+    std::string path = texture_bake_path(image.timing.path, flags);
+    uint64_t source_hash = fnv1a_64(bytes.data(), bytes.size());
+    auto bake = std::make_shared<Texture_Bake>();
+
+    if (bake->open(path, source_hash, flags) &&
+        texture_bake_supported(bake->format(), image.gamma, options)) {
+      use_bake(image, bake);
+      return;
+    }
+
+    decode(image, bytes, 4);
+
+    if (!image.data) {
+      return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int width = image.timing.width, height = image.timing.height;
+    texture_bake_format format =
+        choose_texture_bake_format(image.data, width, height, flags, options);
+    std::vector<unsigned char> file = bake_texture(
+        image.data, width, height, source_hash, flags, format);
+
+    if (options.write) {
+      write_texture_bake(path, file);
+    }
+
+    stbi_image_free(image.data);
+    image.data = nullptr;
+
+    bake->adopt(std::move(file));
+    use_bake(image, bake);
+    image.timing.bake_ms = elapsed_ms(start);
+  }
+
+  // Serial: this runs on a pool worker, which must not wait on the pool.
+  static void build_mips(Decoded_Image& image) {
+    auto start = std::chrono::steady_clock::now();
+    Mip_Options options;
+    options.filter = image.bake_options.filter;
+    options.normal_map = image.kind == TEXTURE_KIND_NORMAL;
+    options.srgb = image.gamma && !options.normal_map;
+
+    image.mips = std::make_shared<std::vector<Mip_Level>>();
+    generate_mip_chain(image.data, image.timing.width, image.timing.height,
+                       options, *image.mips);
+    image.timing.mip_ms = elapsed_ms(start);
+  }
+
+  static void use_bake(Decoded_Image& image,
+                       std::shared_ptr<Texture_Bake> bake) {
+    image.timing.width = static_cast<int>(bake->header().width);
+    image.timing.height = static_cast<int>(bake->header().height);
+    image.timing.n_components = 4;
+    image.timing.baked = true;
+    image.bake = std::move(bake);
+  }
+
+  template <typename Load_Fn>
+  unsigned int queue(const std::string& filename, bool gamma,
+                     texture_kind kind, Load_Fn load) {
+    unsigned int texture_ID;
+    glGenTextures(1, &texture_ID);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending++;
+    }
+
+    pool.submit([this, texture_ID, filename, gamma, kind,
+                 options = bake_options, cpu_mips = cpu_mips,
+                 load = std::move(load)] {
+      Decoded_Image image;
+      image.texture_ID = texture_ID;
+      image.gamma = gamma;
+      image.kind = kind;
+      image.bake_options = options;
+      image.cpu_mips = cpu_mips;
+      image.timing.path = filename;
+      image.timing.texture_ID = texture_ID;
+
+      load(image);
+
+      // Notify under the lock: once the GL thread sees the image it may
+      // destroy the loader.
+      std::lock_guard<std::mutex> lock(mutex);
+      ready.push_back(image);
+      image_ready.notify_one();
+    });
+
+    return texture_ID;
+  }
+
+  // Returns false if a baked texture ran out of budget part way; the image
+  // then goes back to the front of the queue.
+  bool upload(Decoded_Image& image,
+              std::chrono::steady_clock::time_point budget_start,
+              double budget_ms) {
+    if (image.bake) {
+      auto start = std::chrono::steady_clock::now();
+      const Texture_Bake& bake = *image.bake;
+
+      if (image.next_level < 0) {
+        begin_texture_bake_upload(image.texture_ID, bake);
+        image.next_level = bake.level_count();
+      }
+
+      while (image.next_level > 0) {
+        image.next_level--;
+        upload_texture_bake_level(image.texture_ID, bake, image.next_level);
+
+        if (image.next_level > 0 && elapsed_ms(budget_start) >= budget_ms) {
+          image.timing.upload_ms += elapsed_ms(start);
+          return false;
+        }
+      }
+
+      image.timing.upload_ms += elapsed_ms(start);
+      image.timing.gpu_bytes = bake.texture_bytes();
+      image.bake.reset();
+    } else if (image.data) {
+      auto start = std::chrono::steady_clock::now();
+      int width = image.timing.width, height = image.timing.height;
+
+      if (image.mips) {
+        upload_texture_mips(image.texture_ID, image.data, width, height,
+                            *image.mips, image.gamma);
+        image.timing.gpu_bytes = static_cast<std::size_t>(width) * height * 4;
+
+        for (const Mip_Level& level : *image.mips) {
+          image.timing.gpu_bytes += level.rgba.size();
+        }
+
+        image.mips.reset();
+      } else {
+        upload_texture_image(image.texture_ID, image.data, width, height,
+                             image.timing.n_components);
+
+        // Base level plus a full mip chain is 4/3 of the base level.
+        image.timing.gpu_bytes = static_cast<std::size_t>(width) * height *
+                                 image.timing.n_components * 4 / 3;
+      }
+
+      image.timing.upload_ms = elapsed_ms(start);
+      stbi_image_free(image.data);
+    } else {
+      std::cerr << "Texture failed to load at path: " << image.timing.path
+                << "\n";
+    }
+
+    timings.push_back(image.timing);
+    return true;
+  }
+};
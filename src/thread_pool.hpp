@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool. Jobs run in FIFO order; wait() blocks until every
+// submitted job has finished. Jobs must not call wait() on their own pool.
+class Thread_Pool {
+ public:
+  explicit Thread_Pool(unsigned int n_threads = 0) {
+    if (n_threads == 0) {
+      n_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned int i = 0; i < n_threads; i++) {
+      workers.emplace_back([this] { worker_loop(); });
+    }
+  }
+
+  Thread_Pool(const Thread_Pool&) = delete;
+  Thread_Pool& operator=(const Thread_Pool&) = delete;
+
+  ~Thread_Pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+
+    job_available.notify_all();
+
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Process-wide pool sized to the number of hardware threads.
+  static Thread_Pool& shared() {
+    static Thread_Pool pool;
+    return pool;
+  }
+
+  unsigned int size() const {
+    return static_cast<unsigned int>(workers.size());
+  }
+
+  void submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(std::move(job));
+      unfinished++;
+    }
+
+    job_available.notify_one();
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this] { return unfinished == 0; });
+  }
+
+  // Splits [0, count) into chunks of at least `grain` items, runs
+  // fn(begin, end) for each chunk on the pool and waits for all of them.
+  template <typename Fn>
+  void parallel_for(std::size_t count, std::size_t grain, Fn fn) {
+    if (count == 0) {
+      return;
+    }
+
+    std::size_t n_chunks = std::min<std::size_t>(
+        size() * 4, (count + grain - 1) / std::max<std::size_t>(grain, 1));
+    n_chunks = std::max<std::size_t>(n_chunks, 1);
+
+    if (n_chunks == 1) {
+      fn(std::size_t(0), count);
+      return;
+    }
+
+    std::size_t chunk = (count + n_chunks - 1) / n_chunks;
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    std::size_t remaining = 0;
+
+    for (std::size_t begin = 0; begin < count; begin += chunk) {
+      remaining++;
+    }
+
+    for (std::size_t begin = 0; begin < count; begin += chunk) {
+      std::size_t end = std::min(count, begin + chunk);
+
+      submit([&, begin, end] {
+        fn(begin, end);
+
+        std::lock_guard<std::mutex> lock(done_mutex);
+        if (--remaining == 0) {
+          done_cv.notify_one();
+        }
+      });
+    }
+
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait(lock, [&] { return remaining == 0; });
+  }
+
+ private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable job_available;
+  std::condition_variable all_done;
+  std::size_t unfinished = 0;
+  bool stopping = false;
+
+  void worker_loop() {
+    while (true) {
+      std::function<void()> job;
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        job_available.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+        if (stopping && jobs.empty()) {
+          return;
+        }
+
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+
+      job();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--unfinished == 0) {
+          all_done.notify_all();
+        }
+      }
+    }
+  }
+};
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_resource.hpp"
+
+// Uniform blocks shared by every program, mirrored by C++ structs laid out
+// to std140 rules, so a block is uploaded as one memcpy-able struct:
+//
+//   layout (std140) uniform Camera { ... };  Camera_Block, binding 0
+//   layout (std140) uniform Lights { ... };  Lights_Block, binding 1
+//
+// Each struct's offsets are checked at compile time against std140_offset(),
+// which computes them from a list of GLSL member types, so none of the
+// checks need a GL context. GLSL 330 has no layout(binding = n); Shader
+// binds the blocks named in UNIFORM_BLOCK_NAMES to their points instead.
+
+enum uniform_block_binding {
+  UNIFORM_BLOCK_CAMERA,
+  UNIFORM_BLOCK_LIGHTS,
+  UNIFORM_BLOCK_COUNT
+};
+
+const char* const UNIFORM_BLOCK_NAMES[UNIFORM_BLOCK_COUNT] = {"Camera",
+                                                              "Lights"};
+
+// std140 layout (GL 3.3 spec, 2.11.4) of GLSL members, for the checks.
+enum std140_type {
+  STD140_FLOAT,
+  STD140_INT,
+  STD140_VEC2,
+  STD140_VEC3,
+  STD140_VEC4,
+  STD140_IVEC4,
+  STD140_MAT4,
+  STD140_STRUCT
+};
+
+struct Std140_Member {
+  std140_type type;
+  // Elements, or 0 for a single value.
+  std::size_t array_size = 0;
+  // Of a STD140_STRUCT: std140_size() of its own members.
+  std::size_t struct_size = 0;
+};
+
+constexpr std::size_t std140_round_up(std::size_t value,
+                                      std::size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Scalars align to 4 and vec2 to 8; vec3, vec4, matrices (arrays of
+// columns), structs and arrays of anything to 16.
+constexpr std::size_t std140_alignment(const Std140_Member& member) {
+  if (member.array_size) {
+    return 16;
+  }
+
+  switch (member.type) {
+    case STD140_FLOAT:
+    case STD140_INT:
+      return 4;
+    case STD140_VEC2:
+      return 8;
+    default:
+      return 16;
+  }
+}
+
+// A vec3 takes 12 bytes, so a float may follow it inside the same 16.
+constexpr std::size_t std140_element_size(const Std140_Member& member) {
+  switch (member.type) {
+    case STD140_FLOAT:
+    case STD140_INT:
+      return 4;
+    case STD140_VEC2:
+      return 8;
+    case STD140_VEC3:
+      return 12;
+    case STD140_VEC4:
+    case STD140_IVEC4:
+      return 16;
+    case STD140_MAT4:
+      return 64;
+    default:
+      return member.struct_size;
+  }
+}
+
+// Array elements are padded to a multiple of 16.
+constexpr std::size_t std140_member_size(const Std140_Member& member) {
+  std::size_t size = std140_element_size(member);
+
+  return member.array_size ? std140_round_up(size, 16) * member.array_size
+                           : size;
+}
+
+template <std::size_t N>
+constexpr std::size_t std140_offset(const Std140_Member (&members)[N],
+                                    std::size_t index) {
+  std::size_t offset = 0;
+
+  for (std::size_t i = 0; i < index; i++) {
+    offset = std140_round_up(offset, std140_alignment(members[i]));
+    offset += std140_member_size(members[i]);
+  }
+
+  return std140_round_up(offset, std140_alignment(members[index]));
+}
+
+// Rounded up to 16, as for a struct member; the C++ mirrors are padded to
+// match.
+template <std::size_t N>
+constexpr std::size_t std140_size(const Std140_Member (&members)[N]) {
+  return std140_round_up(
+      std140_offset(members, N - 1) + std140_member_size(members[N - 1]), 16);
+}
+
+// layout (std140) uniform Camera {
+//   mat4 projection;
+//   mat4 view;
+//   vec3 view_pos;
+// };
+struct Camera_Block {
+  glm::mat4 projection;
+  glm::mat4 view;
+  glm::vec3 view_pos;
+  float padding;
+};
+
+constexpr Std140_Member CAMERA_BLOCK_LAYOUT[] = {
+    {STD140_MAT4}, {STD140_MAT4}, {STD140_VEC3}};
+
+static_assert(offsetof(Camera_Block, projection) ==
+              std140_offset(CAMERA_BLOCK_LAYOUT, 0));
+static_assert(offsetof(Camera_Block, view) ==
+              std140_offset(CAMERA_BLOCK_LAYOUT, 1));
+static_assert(offsetof(Camera_Block, view_pos) ==
+              std140_offset(CAMERA_BLOCK_LAYOUT, 2));
+static_assert(sizeof(Camera_Block) == std140_size(CAMERA_BLOCK_LAYOUT));
+
+// struct Dir_Light {
+//   vec3 direction;
+//   vec3 ambient;
+//   vec3 diffuse;
+//   vec3 specular;
+// };
+struct Std140_Dir_Light {
+  glm::vec3 direction;
+  float padding0;
+  glm::vec3 ambient;
+  float padding1;
+  glm::vec3 diffuse;
+  float padding2;
+  glm::vec3 specular;
+  float padding3;
+};
+
+constexpr Std140_Member DIR_LIGHT_LAYOUT[] = {
+    {STD140_VEC3}, {STD140_VEC3}, {STD140_VEC3}, {STD140_VEC3}};
+
+static_assert(offsetof(Std140_Dir_Light, ambient) ==
+              std140_offset(DIR_LIGHT_LAYOUT, 1));
+static_assert(offsetof(Std140_Dir_Light, diffuse) ==
+              std140_offset(DIR_LIGHT_LAYOUT, 2));
+static_assert(offsetof(Std140_Dir_Light, specular) ==
+              std140_offset(DIR_LIGHT_LAYOUT, 3));
+static_assert(sizeof(Std140_Dir_Light) == std140_size(DIR_LIGHT_LAYOUT));
+
+// struct Spot_Light {
+//   vec3 position;
+//   float constant;
+//   vec3 direction;
+//   float linear;
+//   vec3 ambient;
+//   float quadratic;
+//   vec3 diffuse;
+//   float cut_off;
+//   vec3 specular;
+//   float outer_cut_off;
+// };
+struct Std140_Spot_Light {
+  glm::vec3 position;
+  float constant;
+  glm::vec3 direction;
+  float linear;
+  glm::vec3 ambient;
+  float quadratic;
+  glm::vec3 diffuse;
+  float cut_off;
+  glm::vec3 specular;
+  float outer_cut_off;
+};
+
+constexpr Std140_Member SPOT_LIGHT_LAYOUT[] = {
+    {STD140_VEC3}, {STD140_FLOAT}, {STD140_VEC3}, {STD140_FLOAT},
+    {STD140_VEC3}, {STD140_FLOAT}, {STD140_VEC3}, {STD140_FLOAT},
+    {STD140_VEC3}, {STD140_FLOAT}};
+
+static_assert(offsetof(Std140_Spot_Light, direction) ==
+              std140_offset(SPOT_LIGHT_LAYOUT, 2));
+static_assert(offsetof(Std140_Spot_Light, ambient) ==
+              std140_offset(SPOT_LIGHT_LAYOUT, 4));
+static_assert(offsetof(Std140_Spot_Light, diffuse) ==
+              std140_offset(SPOT_LIGHT_LAYOUT, 6));
+static_assert(offsetof(Std140_Spot_Light, cut_off) ==
+              std140_offset(SPOT_LIGHT_LAYOUT, 7));
+static_assert(offsetof(Std140_Spot_Light, specular) ==
+              std140_offset(SPOT_LIGHT_LAYOUT, 8));
+static_assert(offsetof(Std140_Spot_Light, outer_cut_off) ==
+              std140_offset(SPOT_LIGHT_LAYOUT, 9));
+static_assert(sizeof(Std140_Spot_Light) == std140_size(SPOT_LIGHT_LAYOUT));
+
+// layout (std140) uniform Lights {
+//   Dir_Light dir_light;
+//   Spot_Light spot_light;
+//   ivec4 cluster_grid;
+//   vec4 cluster_mapping;
+// };
+//
+// The point and spot lights beyond these two are binned into froxels, see
+// light_clusters.hpp: cluster_grid holds the tiles across and up and the
+// slices, cluster_mapping the slice scale and bias and the reciprocal tile
+// size in pixels.
+struct Lights_Block {
+  Std140_Dir_Light dir_light;
+  Std140_Spot_Light spot_light;
+  glm::ivec4 cluster_grid;
+  glm::vec4 cluster_mapping;
+};
+
+constexpr Std140_Member LIGHTS_BLOCK_LAYOUT[] = {
+    {STD140_STRUCT, 0, std140_size(DIR_LIGHT_LAYOUT)},
+    {STD140_STRUCT, 0, std140_size(SPOT_LIGHT_LAYOUT)},
+    {STD140_IVEC4},
+    {STD140_VEC4}};
+
+static_assert(offsetof(Lights_Block, spot_light) ==
+              std140_offset(LIGHTS_BLOCK_LAYOUT, 1));
+static_assert(offsetof(Lights_Block, cluster_grid) ==
+              std140_offset(LIGHTS_BLOCK_LAYOUT, 2));
+static_assert(offsetof(Lights_Block, cluster_mapping) ==
+              std140_offset(LIGHTS_BLOCK_LAYOUT, 3));
+static_assert(sizeof(Lights_Block) == std140_size(LIGHTS_BLOCK_LAYOUT));
+
+const std::size_t UNIFORM_BLOCK_SIZES[UNIFORM_BLOCK_COUNT] = {
+    sizeof(Camera_Block), sizeof(Lights_Block)};
+
+// Points each shared block `program` declares at its binding. A block the
+// GLSL declares larger than its C++ mirror means the two have drifted.
+inline void bind_uniform_blocks(unsigned int program) {
+  for (int binding = 0; binding < UNIFORM_BLOCK_COUNT; binding++) {
+    GLuint index =
+        glGetUniformBlockIndex(program, UNIFORM_BLOCK_NAMES[binding]);
+
+    if (index == GL_INVALID_INDEX) {
+      continue;
+    }
+
+    GLint size = 0;
+    glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE,
+                              &size);
+
+    if ((std::size_t)size > UNIFORM_BLOCK_SIZES[binding]) {
+      std::cerr << "ERROR::UNIFORM_BLOCK::SIZE_MISMATCH: "
+                << UNIFORM_BLOCK_NAMES[binding] << " is " << size
+                << " bytes in GLSL, " << UNIFORM_BLOCK_SIZES[binding]
+                << " in C++\n";
+    }
+
+    glUniformBlockBinding(program, index, binding);
+  }
+}
+
+// A block's CPU copy plus the uniform buffer behind it, bound once to the
+// block's binding point. Writes that change bytes grow a dirty range, and
+// upload() sends just that range, or nothing when no value changed. No GL
+// call happens before the first upload(), so the CPU side runs headless.
+template <typename Block>
+class Uniform_Block {
+ public:
+  // Bytes sent by the last upload().
+  std::size_t uploaded_bytes = 0;
+
+  explicit Uniform_Block(uniform_block_binding binding) : binding(binding) {}
+
+  Uniform_Block(const Uniform_Block&) = delete;
+  Uniform_Block& operator=(const Uniform_Block&) = delete;
+
+  const Block& get() const { return block; }
+
+  template <typename Field>
+  void set(Field Block::*member, const Field& value) {
+    write(member_offset(member), &value, sizeof(Field));
+  }
+
+  // Element `i` of an array member.
+  template <typename Field, std::size_t N>
+  void set(Field (Block::*member)[N], std::size_t i, const Field& value) {
+    write(member_offset(member) + i * sizeof(Field), &value, sizeof(Field));
+  }
+
+  // Copies `size` bytes to `offset` in the block. Only the span from the
+  // first to the last byte that differs becomes dirty, so setting a whole
+  // light where one field moved costs that field.
+  void write(std::size_t offset, const void* bytes, std::size_t size) {
+    char* target = reinterpret_cast<char*>(&block) + offset;
+    const char* source = static_cast<const char*>(bytes);
+    std::size_t first = 0, last = size;
+
+    while (first < size && target[first] == source[first]) {
+      first++;
+    }
+
+    if (first == size) {
+      return;
+    }
+
+    while (target[last - 1] == source[last - 1]) {
+      last--;
+    }
+
+    // Whole 4-byte components; every std140 member is made of them.
+    first &= ~std::size_t(3);
+    last = std::min(size, (last + 3) & ~std::size_t(3));
+
+    std::memcpy(target + first, source + first, last - first);
+    dirty_begin = std::min(dirty_begin, offset + first);
+    dirty_end = std::max(dirty_end, offset + last);
+  }
+
+  std::size_t dirty_bytes() const {
+    return dirty_end > dirty_begin ? dirty_end - dirty_begin : 0;
+  }
+
+  // Hands out the dirty range and marks the block clean; false when it is
+  // already clean. upload() sends what this returns.
+  bool take_dirty_range(std::size_t& offset, std::size_t& size) {
+    size = dirty_bytes();
+    offset = dirty_begin;
+    dirty_begin = sizeof(Block);
+    dirty_end = 0;
+
+    return size > 0;
+  }
+
+  // Creates and binds the buffer on first use. Returns the bytes sent.
+  std::size_t upload() {
+    std::size_t offset, size;
+    uploaded_bytes = 0;
+
+    if (!buffer) {
+      take_dirty_range(offset, size);
+      buffer = Gl_Buffer::create(std::string("uniform block ") +
+                                 UNIFORM_BLOCK_NAMES[binding]);
+      glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+      glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &block, GL_DYNAMIC_DRAW);
+      glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer.get());
+      uploaded_bytes = sizeof(Block);
+    } else if (take_dirty_range(offset, size)) {
+      glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+      glBufferSubData(GL_UNIFORM_BUFFER, offset, size,
+                      reinterpret_cast<const char*>(&block) + offset);
+      uploaded_bytes = size;
+    } else {
+      return 0;
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return uploaded_bytes;
+  }
+
+  // Deletes the GL buffer, for before Gl_Resources::flush(). The next
+  // upload() creates it again.
+  void reset() {
+    buffer.reset();
+    dirty_begin = 0;
+    dirty_end = sizeof(Block);
+  }
+
+ private:
+  uniform_block_binding binding;
+  Block block{};
+  // Byte range [dirty_begin, dirty_end) changed since the last upload.
+  std::size_t dirty_begin = 0, dirty_end = sizeof(Block);
+  Gl_Buffer buffer;
+
+  template <typename Field>
+  std::size_t member_offset(Field Block::*member) const {
+    return reinterpret_cast<const char*>(&(block.*member)) -
+           reinterpret_cast<const char*>(&block);
+  }
+};
@@ -0,0 +1,463 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+const int MAX_BONE_INFLUENCE = 4;
+
+struct Vertex {
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec2 tex_coords;
+  glm::vec3 tangent;
+  glm::vec3 bitangent;
+
+  // Indices into the model's Skeleton bones. The weights sum to 1, or are
+  // all 0 for vertices no bone moves.
+  int m_bone_IDs[MAX_BONE_INFLUENCE];
+  float m_weights[MAX_BONE_INFLUENCE];
+};
+
+// VERTEX_FORMAT_FLOAT uploads Vertex as-is (88 bytes). The compact formats
+// quantize it for the GPU; the CPU side always keeps full-float Vertex data.
+enum vertex_format {
+  VERTEX_FORMAT_FLOAT,
+  VERTEX_FORMAT_COMPACT,
+  VERTEX_FORMAT_COMPACT_SKINNED
+};
+
+// 20 bytes. Decoded by shader/model_loading_compact.vs.
+struct Compact_Vertex {
+  // unorm16 xyz relative to the mesh bounds; w holds the bitangent sign
+  // (0 = -1, 65535 = +1).
+  uint16_t position[4];
+  // snorm16 octahedral normal (xy) and tangent (zw).
+  int16_t normal_tangent[4];
+  // Half floats, so tiling UVs outside [0, 1] survive.
+  uint16_t tex_coords[2];
+};
+
+// 28 bytes. Only used for meshes that actually carry bone weights.
+struct Compact_Skinned_Vertex {
+  Compact_Vertex base;
+  uint8_t bone_IDs[MAX_BONE_INFLUENCE];
+  uint8_t weights[MAX_BONE_INFLUENCE];
+};
+
+static_assert(sizeof(Compact_Vertex) == 20, "Compact_Vertex must be packed");
+static_assert(sizeof(Compact_Skinned_Vertex) == 28,
+              "Compact_Skinned_Vertex must be packed");
+
+inline std::size_t vertex_size(vertex_format format) {
+  switch (format) {
+    case VERTEX_FORMAT_COMPACT:
+      return sizeof(Compact_Vertex);
+    case VERTEX_FORMAT_COMPACT_SKINNED:
+      return sizeof(Compact_Skinned_Vertex);
+    default:
+      return sizeof(Vertex);
+  }
+}
+
+inline uint16_t float_to_half(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (exponent >= 31) {
+    // Overflow and inf map to inf; NaN keeps a mantissa bit.
+    bool nan = ((bits >> 23) & 0xff) == 0xff && mantissa;
+    return static_cast<uint16_t>(sign | 0x7c00 | (nan ? 0x200 : 0));
+  }
+
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+
+    mantissa |= 0x800000;
+    uint32_t shift = static_cast<uint32_t>(14 - exponent);
+    uint32_t half_mantissa = mantissa >> shift;
+    // Round to nearest even.
+    uint32_t remainder = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+
+    if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+      half_mantissa++;
+    }
+
+    return static_cast<uint16_t>(sign | half_mantissa);
+  }
+
+  uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) |
+                  (mantissa >> 13);
+  uint32_t remainder = mantissa & 0x1fff;
+
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+    half++;
+  }
+
+  return static_cast<uint16_t>(half);
+}
+
+inline float half_to_float(uint16_t half) {
+  uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  uint32_t bits;
+
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      bits = sign;
+    } else {
+      exponent = 127 - 15 + 1;
+
+      while (!(mantissa & 0x400)) {
+        mantissa <<= 1;
+        exponent--;
+      }
+
+      bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+
+  return value;
+}
+
+inline int16_t float_to_snorm16(float value) {
+  return static_cast<int16_t>(
+      std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+inline float snorm16_to_float(int16_t value) {
+  return std::max(static_cast<float>(value) / 32767.0f, -1.0f);
+}
+
+inline uint16_t float_to_unorm16(float value) {
+  return static_cast<uint16_t>(
+      std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+// Octahedral mapping of a unit vector onto [-1, 1]^2.
+inline glm::vec2 oct_encode(glm::vec3 n) {
+  float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+
+  if (l1 == 0.0f) {
+    return glm::vec2(0.0f, 0.0f);
+  }
+
+  n /= l1;
+  glm::vec2 result(n.x, n.y);
+
+  if (n.z < 0.0f) {
+    result.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+    result.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+  }
+
+  return result;
+}
+
+inline glm::vec3 oct_decode(glm::vec2 e) {
+  glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+  float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+
+  return glm::normalize(n);
+}
+
+inline glm::vec3 position_scale(glm::vec3 bounds_min, glm::vec3 bounds_max) {
+  return bounds_max - bounds_min;
+}
+
+inline Compact_Vertex encode_compact_vertex(const Vertex& vertex,
+                                            glm::vec3 bounds_min,
+                                            glm::vec3 bounds_max) {
+  Compact_Vertex result;
+  glm::vec3 scale = position_scale(bounds_min, bounds_max);
+
+  for (int i = 0; i < 3; i++) {
+    float t = scale[i] > 0.0f
+                  ? (vertex.position[i] - bounds_min[i]) / scale[i]
+                  : 0.0f;
+    result.position[i] = float_to_unorm16(t);
+  }
+
+  float handedness =
+      glm::dot(glm::cross(vertex.normal, vertex.tangent), vertex.bitangent);
+  result.position[3] = handedness < 0.0f ? 0 : 65535;
+
+  glm::vec2 normal = oct_encode(vertex.normal);
+  glm::vec2 tangent = oct_encode(vertex.tangent);
+  result.normal_tangent[0] = float_to_snorm16(normal.x);
+  result.normal_tangent[1] = float_to_snorm16(normal.y);
+  result.normal_tangent[2] = float_to_snorm16(tangent.x);
+  result.normal_tangent[3] = float_to_snorm16(tangent.y);
+
+  result.tex_coords[0] = float_to_half(vertex.tex_coords.x);
+  result.tex_coords[1] = float_to_half(vertex.tex_coords.y);
+
+  return result;
+}
+
+// CPU mirror of the decoding in model_loading_compact.vs, before its model
+// and bone transforms; used to measure the error.
+inline Vertex decode_compact_vertex(const Compact_Vertex& compact,
+                                    glm::vec3 bounds_min,
+                                    glm::vec3 bounds_max) {
+  Vertex result = {};
+  glm::vec3 scale = position_scale(bounds_min, bounds_max);
+
+  for (int i = 0; i < 3; i++) {
+    result.position[i] =
+        bounds_min[i] + compact.position[i] / 65535.0f * scale[i];
+  }
+
+  const int16_t* nt = compact.normal_tangent;
+  result.normal =
+      oct_decode(glm::vec2(snorm16_to_float(nt[0]), snorm16_to_float(nt[1])));
+  result.tangent =
+      oct_decode(glm::vec2(snorm16_to_float(nt[2]), snorm16_to_float(nt[3])));
+
+  float sign = compact.position[3] == 0 ? -1.0f : 1.0f;
+  result.bitangent = glm::cross(result.normal, result.tangent) * sign;
+
+  result.tex_coords = glm::vec2(half_to_float(compact.tex_coords[0]),
+                                half_to_float(compact.tex_coords[1]));
+
+  return result;
+}
+
+inline bool has_bone_weights(const std::vector<Vertex>& vertices) {
+  for (const Vertex& vertex : vertices) {
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++) {
+      if (vertex.m_weights[i] != 0.0f) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// The compact format a mesh actually gets: skinned only if it has weights.
+inline vertex_format resolve_vertex_format(
+    vertex_format requested, const std::vector<Vertex>& vertices) {
+  if (requested == VERTEX_FORMAT_FLOAT) {
+    return VERTEX_FORMAT_FLOAT;
+  }
+
+  return has_bone_weights(vertices) ? VERTEX_FORMAT_COMPACT_SKINNED
+                                    : VERTEX_FORMAT_COMPACT;
+}
+
+// Encodes `vertices` into the GPU layout of `format`.
+inline std::vector<unsigned char> encode_vertices(
+    vertex_format format, const std::vector<Vertex>& vertices,
+    glm::vec3 bounds_min, glm::vec3 bounds_max) {
+  std::vector<unsigned char> bytes(vertices.size() * vertex_size(format));
+
+  if (format == VERTEX_FORMAT_FLOAT) {
+    if (!vertices.empty()) {
+      std::memcpy(bytes.data(), vertices.data(), bytes.size());
+    }
+
+    return bytes;
+  }
+
+  for (std::size_t i = 0; i < vertices.size(); i++) {
+    Compact_Vertex compact =
+        encode_compact_vertex(vertices[i], bounds_min, bounds_max);
+
+    if (format == VERTEX_FORMAT_COMPACT) {
+      std::memcpy(&bytes[i * sizeof(Compact_Vertex)], &compact,
+                  sizeof(compact));
+      continue;
+    }
+
+    Compact_Skinned_Vertex skinned;
+    skinned.base = compact;
+
+    for (int j = 0; j < MAX_BONE_INFLUENCE; j++) {
+      skinned.bone_IDs[j] = static_cast<uint8_t>(
+          std::clamp(vertices[i].m_bone_IDs[j], 0, 255));
+      skinned.weights[j] = static_cast<uint8_t>(std::lround(
+          std::clamp(vertices[i].m_weights[j], 0.0f, 1.0f) * 255.0f));
+    }
+
+    std::memcpy(&bytes[i * sizeof(Compact_Skinned_Vertex)], &skinned,
+                sizeof(skinned));
+  }
+
+  return bytes;
+}
+
+struct Quantization_Error {
+  std::size_t vertex_count = 0;
+  float max_position_error = 0.0f;
+  float mean_position_error = 0.0f;
+  // Angular errors in degrees.
+  float max_normal_error = 0.0f;
+  float max_tangent_error = 0.0f;
+  float max_bitangent_error = 0.0f;
+  float max_tex_coord_error = 0.0f;
+
+  void merge(const Quantization_Error& other) {
+    std::size_t total = vertex_count + other.vertex_count;
+
+    if (total > 0) {
+      mean_position_error = (mean_position_error * vertex_count +
+                             other.mean_position_error * other.vertex_count) /
+                            total;
+    }
+
+    vertex_count = total;
+    max_position_error = std::max(max_position_error, other.max_position_error);
+    max_normal_error = std::max(max_normal_error, other.max_normal_error);
+    max_tangent_error = std::max(max_tangent_error, other.max_tangent_error);
+    max_bitangent_error =
+        std::max(max_bitangent_error, other.max_bitangent_error);
+    max_tex_coord_error =
+        std::max(max_tex_coord_error, other.max_tex_coord_error);
+  }
+};
+
+inline float angle_between_degrees(glm::vec3 a, glm::vec3 b) {
+  float la = glm::length(a), lb = glm::length(b);
+
+  if (la == 0.0f || lb == 0.0f) {
+    return 0.0f;
+  }
+
+  // atan2 stays accurate for the tiny angles quantization produces, where
+  // acos(dot) rounds to zero.
+  return glm::degrees(
+      std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b)));
+}
+
+// Round-trips every vertex through the compact layout and compares it with
+// the float original.
+inline Quantization_Error measure_quantization_error(
+    const std::vector<Vertex>& vertices, glm::vec3 bounds_min,
+    glm::vec3 bounds_max) {
+  Quantization_Error error;
+  error.vertex_count = vertices.size();
+  double position_error_sum = 0.0;
+
+  for (const Vertex& vertex : vertices) {
+    Vertex decoded = decode_compact_vertex(
+        encode_compact_vertex(vertex, bounds_min, bounds_max), bounds_min,
+        bounds_max);
+
+    float position_error = glm::length(decoded.position - vertex.position);
+    position_error_sum += position_error;
+
+    error.max_position_error =
+        std::max(error.max_position_error, position_error);
+    error.max_normal_error =
+        std::max(error.max_normal_error,
+                 angle_between_degrees(decoded.normal, vertex.normal));
+    error.max_tangent_error =
+        std::max(error.max_tangent_error,
+                 angle_between_degrees(decoded.tangent, vertex.tangent));
+    error.max_bitangent_error =
+        std::max(error.max_bitangent_error,
+                 angle_between_degrees(decoded.bitangent, vertex.bitangent));
+    error.max_tex_coord_error = std::max(
+        error.max_tex_coord_error,
+        std::max(std::abs(decoded.tex_coords.x - vertex.tex_coords.x),
+                 std::abs(decoded.tex_coords.y - vertex.tex_coords.y)));
+  }
+
+  if (!vertices.empty()) {
+    error.mean_position_error =
+        static_cast<float>(position_error_sum / vertices.size());
+  }
+
+  return error;
+}
+
+// Points the vertex attributes at the `format` layout of the currently bound
+// GL_ARRAY_BUFFER. The target VAO must be bound.
+//
+// Float layout: 0 position, 1 normal, 2 tex coords, 3 tangent, 4 bitangent,
+// 5 bone IDs, 6 weights. Compact layout: 0 quantized position + bitangent
+// sign, 1 octahedral normal + tangent, 2 half tex coords, and for skinned
+// meshes 5 bone IDs / 6 weights.
+inline void setup_vertex_attributes(
+    vertex_format format = VERTEX_FORMAT_FLOAT) {
+  if (format != VERTEX_FORMAT_FLOAT) {
+    GLsizei stride = static_cast<GLsizei>(vertex_size(format));
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                          (void*)offsetof(Compact_Vertex, position));
+
+    // Left unnormalized: GL 3.3 maps snorm as (2c + 1) / 65535, so the
+    // shader divides itself to match snorm16_to_float() exactly.
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_SHORT, GL_FALSE, stride,
+                          (void*)offsetof(Compact_Vertex, normal_tangent));
+
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(Compact_Vertex, tex_coords));
+
+    if (format == VERTEX_FORMAT_COMPACT_SKINNED) {
+      glEnableVertexAttribArray(5);
+      glVertexAttribIPointer(5, 4, GL_UNSIGNED_BYTE, stride,
+                             (void*)offsetof(Compact_Skinned_Vertex, bone_IDs));
+
+      glEnableVertexAttribArray(6);
+      glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                            (void*)offsetof(Compact_Skinned_Vertex, weights));
+    }
+
+    return;
+  }
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void*)offsetof(Vertex, normal));
+
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void*)offsetof(Vertex, tex_coords));
+
+  glEnableVertexAttribArray(3);
+  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void*)offsetof(Vertex, tangent));
+
+  glEnableVertexAttribArray(4);
+  glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void*)offsetof(Vertex, bitangent));
+
+  glEnableVertexAttribArray(5);
+  glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex),
+                         (void*)offsetof(Vertex, m_bone_IDs));
+
+  glEnableVertexAttribArray(6);
+  glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        (void*)offsetof(Vertex, m_weights));
+}
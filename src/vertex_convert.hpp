@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VERTEX_CONVERT_SSE2 1
+#endif
+
+#include "vertex.hpp"
+
+// Attribute streams to interleave into Vertex: arrays of three floats (e.g.
+// aiVector3D; tex_coords uses the first two) `stride` bytes apart. A null
+// stream fills its attribute with zeros. Bone IDs and weights are always
+// zeroed.
+struct Vertex_Streams {
+  std::size_t count = 0;
+  std::size_t stride = 3 * sizeof(float);
+  const float* position = nullptr;
+  const float* normal = nullptr;
+  const float* tex_coords = nullptr;
+  const float* tangent = nullptr;
+  const float* bitangent = nullptr;
+};
+
+// The SIMD path writes each attribute with a 16-byte store that spills into
+// the next one, relying on this exact layout and order.
+static_assert(offsetof(Vertex, position) == 0 &&
+                  offsetof(Vertex, normal) == 12 &&
+                  offsetof(Vertex, tex_coords) == 24 &&
+                  offsetof(Vertex, tangent) == 32 &&
+                  offsetof(Vertex, bitangent) == 44 &&
+                  offsetof(Vertex, m_bone_IDs) == 56 &&
+                  offsetof(Vertex, m_weights) == 72 && sizeof(Vertex) == 88,
+              "convert_vertices assumes the Vertex layout");
+
+// Missing streams read this with a stride of 0, so the inner loops never
+// branch on which attributes a mesh has.
+alignas(16) inline const float VERTEX_CONVERT_ZEROS[4] = {};
+
+struct Vertex_Stream {
+  const char* data;
+  std::size_t stride;
+
+  Vertex_Stream(const float* source, std::size_t source_stride)
+      : data(reinterpret_cast<const char*>(source ? source
+                                                  : VERTEX_CONVERT_ZEROS)),
+        stride(source ? source_stride : 0) {}
+
+  const float* at(std::size_t i) const {
+    return reinterpret_cast<const float*>(data + i * stride);
+  }
+};
+
+// Plain copies, one vertex at a time.
+inline void convert_vertices_scalar(const Vertex_Streams& streams,
+                                    Vertex* out, std::size_t begin,
+                                    std::size_t end) {
+  Vertex_Stream position(streams.position, streams.stride);
+  Vertex_Stream normal(streams.normal, streams.stride);
+  Vertex_Stream tex_coords(streams.tex_coords, streams.stride);
+  Vertex_Stream tangent(streams.tangent, streams.stride);
+  Vertex_Stream bitangent(streams.bitangent, streams.stride);
+
+  for (std::size_t i = begin; i < end; i++) {
+    Vertex& vertex = out[i];
+    std::memcpy(&vertex.position.x, position.at(i), sizeof(glm::vec3));
+    std::memcpy(&vertex.normal.x, normal.at(i), sizeof(glm::vec3));
+    std::memcpy(&vertex.tex_coords.x, tex_coords.at(i), sizeof(glm::vec2));
+    std::memcpy(&vertex.tangent.x, tangent.at(i), sizeof(glm::vec3));
+    std::memcpy(&vertex.bitangent.x, bitangent.at(i), sizeof(glm::vec3));
+    std::memset(vertex.m_bone_IDs, 0, sizeof(vertex.m_bone_IDs));
+    std::memset(vertex.m_weights, 0, sizeof(vertex.m_weights));
+  }
+}
+
+// Fills out[begin, end) from the streams. With SSE2 every attribute is one
+// unaligned 16-byte load and store; the store's fourth float lands in the
+// next attribute, which is written right after. A 16-byte load of the last
+// element would read past the end of its stream, so that one goes through
+// the scalar path.
+inline void convert_vertices(const Vertex_Streams& streams, Vertex* out,
+                             std::size_t begin, std::size_t end) {
+#ifdef VERTEX_CONVERT_SSE2
+  Vertex_Stream position(streams.position, streams.stride);
+  Vertex_Stream normal(streams.normal, streams.stride);
+  Vertex_Stream tex_coords(streams.tex_coords, streams.stride);
+  Vertex_Stream tangent(streams.tangent, streams.stride);
+  Vertex_Stream bitangent(streams.bitangent, streams.stride);
+
+  std::size_t last = streams.count > 0 ? streams.count - 1 : 0;
+  std::size_t simd_end = end < last ? end : last;
+  const __m128i zero = _mm_setzero_si128();
+  std::size_t i = begin;
+
+  for (; i < simd_end; i++) {
+    char* vertex = reinterpret_cast<char*>(out + i);
+
+    _mm_storeu_ps(reinterpret_cast<float*>(vertex + 0),
+                  _mm_loadu_ps(position.at(i)));
+    _mm_storeu_ps(reinterpret_cast<float*>(vertex + 12),
+                  _mm_loadu_ps(normal.at(i)));
+    _mm_storel_pi(reinterpret_cast<__m64*>(vertex + 24),
+                  _mm_loadu_ps(tex_coords.at(i)));
+    _mm_storeu_ps(reinterpret_cast<float*>(vertex + 32),
+                  _mm_loadu_ps(tangent.at(i)));
+    _mm_storeu_ps(reinterpret_cast<float*>(vertex + 44),
+                  _mm_loadu_ps(bitangent.at(i)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(vertex + 56), zero);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(vertex + 72), zero);
+  }
+
+  convert_vertices_scalar(streams, out, i, end);
+#else
+  convert_vertices_scalar(streams, out, begin, end);
+#endif
+}
+
+inline void convert_vertices(const Vertex_Streams& streams,
+                             std::vector<Vertex>& vertices) {
+  vertices.resize(streams.count);
+  convert_vertices(streams, vertices.data(), 0, streams.count);
+}
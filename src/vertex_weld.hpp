@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "vertex.hpp"
+
+// Per-attribute tolerances for weld_vertices. Each attribute is snapped to a
+// grid of this spacing before comparison, so vertices closer than epsilon
+// usually (but not always, if they straddle a grid line) merge. 0 compares
+// the exact float values. Bone IDs and weights always compare exactly.
+struct Weld_Epsilon {
+  float position = 1e-6f;
+  float normal = 1e-4f;
+  float tex_coord = 1e-6f;
+  float tangent = 1e-4f;
+};
+
+struct Weld_Report {
+  std::size_t vertices_before = 0;
+  std::size_t vertices_after = 0;
+  // GPU bytes per vertex of the mesh, for bytes_saved().
+  std::size_t vertex_stride = sizeof(Vertex);
+
+  std::size_t vertices_removed() const {
+    return vertices_before - vertices_after;
+  }
+
+  std::size_t bytes_saved() const { return vertices_removed() * vertex_stride; }
+};
+
+const int WELD_KEY_WORDS = 14 + 2 * MAX_BONE_INFLUENCE;
+
+struct Weld_Key {
+  int32_t words[WELD_KEY_WORDS];
+
+  bool operator==(const Weld_Key& other) const {
+    return std::memcmp(words, other.words, sizeof(words)) == 0;
+  }
+};
+
+inline int32_t snap_weld(float value, float epsilon) {
+  if (epsilon > 0.0f) {
+    return static_cast<int32_t>(std::floor(value / epsilon + 0.5f));
+  }
+
+  // +0 and -0 compare equal.
+  if (value == 0.0f) {
+    return 0;
+  }
+
+  int32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline Weld_Key make_weld_key(const Vertex& vertex,
+                              const Weld_Epsilon& epsilon) {
+  Weld_Key key;
+  int n = 0;
+
+  for (int i = 0; i < 3; i++) {
+    key.words[n++] = snap_weld(vertex.position[i], epsilon.position);
+    key.words[n++] = snap_weld(vertex.normal[i], epsilon.normal);
+    key.words[n++] = snap_weld(vertex.tangent[i], epsilon.tangent);
+    key.words[n++] = snap_weld(vertex.bitangent[i], epsilon.tangent);
+  }
+
+  key.words[n++] = snap_weld(vertex.tex_coords.x, epsilon.tex_coord);
+  key.words[n++] = snap_weld(vertex.tex_coords.y, epsilon.tex_coord);
+
+  for (int i = 0; i < MAX_BONE_INFLUENCE; i++) {
+    key.words[n++] = vertex.m_bone_IDs[i];
+    key.words[n++] = snap_weld(vertex.m_weights[i], 0.0f);
+  }
+
+  return key;
+}
+
+// Word-wise multiply/rotate mix (murmur3 style); much cheaper than hashing
+// the key byte by byte.
+inline uint32_t hash_weld_key(const Weld_Key& key) {
+  uint32_t hash = 0x9747b28c;
+
+  for (int i = 0; i < WELD_KEY_WORDS; i++) {
+    uint32_t k = static_cast<uint32_t>(key.words[i]) * 0xcc9e2d51u;
+    k = (k << 15) | (k >> 17);
+    hash ^= k * 0x1b873593u;
+    hash = ((hash << 13) | (hash >> 19)) * 5 + 0xe6546b64u;
+  }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+
+  return hash;
+}
+
+// Merges vertices whose attributes match within `epsilon`, keeping the first
+// of each group, and rewrites the triangle list `indices` to match, dropping
+// triangles that collapse to a line or point. The table is a single
+// linear-probing array of vertex indices (load factor <= 0.5) and keys are
+// recomputed on probe instead of stored, so the only allocations are the
+// table and the remap.
+inline Weld_Report weld_vertices(std::vector<Vertex>& vertices,
+                                 std::vector<unsigned int>& indices,
+                                 const Weld_Epsilon& epsilon = Weld_Epsilon()) {
+  Weld_Report report;
+  report.vertices_before = vertices.size();
+
+  const unsigned int empty = ~0u;
+  std::size_t capacity = 16;
+
+  while (capacity < vertices.size() * 2) {
+    capacity *= 2;
+  }
+
+  std::vector<unsigned int> table(capacity, empty);
+  std::vector<unsigned int> remap(vertices.size());
+  std::size_t mask = capacity - 1;
+  std::size_t unique = 0;
+
+  for (std::size_t i = 0; i < vertices.size(); i++) {
+    Weld_Key key = make_weld_key(vertices[i], epsilon);
+    std::size_t slot = hash_weld_key(key) & mask;
+
+    while (table[slot] != empty &&
+           !(make_weld_key(vertices[table[slot]], epsilon) == key)) {
+      slot = (slot + 1) & mask;
+    }
+
+    if (table[slot] == empty) {
+      // Compact in place: unique vertices keep their relative order.
+      vertices[unique] = vertices[i];
+      table[slot] = static_cast<unsigned int>(unique);
+      unique++;
+    }
+
+    remap[i] = table[slot];
+  }
+
+  vertices.resize(unique);
+
+  std::size_t kept = 0;
+
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    unsigned int a = remap[indices[i]];
+    unsigned int b = remap[indices[i + 1]];
+    unsigned int c = remap[indices[i + 2]];
+
+    if (a == b || b == c || a == c) {
+      continue;
+    }
+
+    indices[kept++] = a;
+    indices[kept++] = b;
+    indices[kept++] = c;
+  }
+
+  indices.resize(kept);
+  report.vertices_after = unique;
+
+  return report;
+}